@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <esp_clk.h>
+#include <xtensa/hal.h>
+
+// CCOUNT is per CPU, so cycles should only be compared
+// when both reads were done from the same core.
+
+inline void hal_cycles_init(void)
+{
+    // CCOUNT always runs, nothing to do
+}
+
+inline uint32_t hal_cycles_now(void)
+{
+    return xthal_get_ccount();
+}
+
+inline uint32_t hal_cycles_per_micro(void)
+{
+    return esp_clk_cpu_freq() / 1000000;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <libopencm3/cm3/dwt.h>
+#include <libopencm3/stm32/rcc.h>
+
+inline void hal_cycles_init(void)
+{
+    dwt_enable_cycle_counter();
+}
+
+inline uint32_t hal_cycles_now(void)
+{
+    return dwt_read_cycle_counter();
+}
+
+inline uint32_t hal_cycles_per_micro(void)
+{
+    return rcc_ahb_frequency / 1000000;
+}
@@ -17,6 +17,11 @@ static const air_addr_t air_addr_invalid = ((air_addr_t){.addr = {0, 0, 0, 0, 0,
 const air_addr_t *AIR_ADDR_INVALID = &air_addr_invalid;
 static const air_addr_t air_addr_broadcast = ((air_addr_t){.addr = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF}});
 const air_addr_t *AIR_ADDR_BROADCAST = &air_addr_broadcast;
+static const air_packet_layout_t air_packet_layout_default = {
+    .uplink_data_bytes = AIR_UPLINK_DEFAULT_DATA_BYTES,
+    .downlink_data_bytes = AIR_DOWNLINK_DEFAULT_DATA_BYTES,
+};
+const air_packet_layout_t *AIR_PACKET_LAYOUT_DEFAULT = &air_packet_layout_default;
 
 typedef enum
 {
@@ -119,6 +124,19 @@ void air_bind_packet_prepare(air_bind_packet_t *packet)
         packet->info.capabilities |= AIR_CAP_FREQUENCY_915MHZ;
     }
     packet->info.capabilities |= AIR_CAP_P2P_2_4GHZ_WIFI;
+#if defined(USE_AIR_STREAM_RELIABLE)
+    packet->info.capabilities |= AIR_CAP_STREAM_RELIABLE;
+#endif
+    packet->info.capabilities |= AIR_CAP_STREAM_PACKED_CHANNELS;
+    packet->info.capabilities |= AIR_CAP_PACKET_LAYOUTS;
+    packet->info.capabilities |= AIR_CAP_STREAM_TELEMETRY_BATCH;
+    packet->info.capabilities |= AIR_CAP_STREAM_COBS;
+    packet->info.capabilities |= AIR_CAP_FEC_REED_SOLOMON;
+    packet->info.capabilities |= AIR_CAP_FEC_INTERLEAVING;
+    packet->info.capabilities |= AIR_CAP_AIRTIME_CYCLES;
+#if defined(USE_AIR_STREAM_TELEMETRY_DELTA)
+    packet->info.capabilities |= AIR_CAP_STREAM_TELEMETRY_DELTA;
+#endif
     if (system_has_flag(SYSTEM_FLAG_BUTTON))
     {
         packet->info.capabilities |= AIR_CAP_BUTTON;
@@ -165,24 +183,34 @@ static uint8_t air_packet_crc(const void *packet, size_t size, air_key_t key)
     return crc8_dvb_s2_bytes_from(crc, packet, size - 1);
 }
 
-void air_tx_packet_prepare(air_tx_packet_t *packet, air_key_t key)
+size_t air_tx_packet_size(const air_packet_layout_t *layout)
 {
-    packet->crc = air_packet_crc(packet, sizeof(*packet), key);
+    return offsetof(air_tx_packet_t, data) + layout->uplink_data_bytes + 1;
 }
 
-bool air_tx_packet_validate(air_tx_packet_t *packet, air_key_t key)
+size_t air_rx_packet_size(const air_packet_layout_t *layout)
 {
-    return packet->crc == air_packet_crc(packet, sizeof(*packet), key);
+    return offsetof(air_rx_packet_t, data) + layout->downlink_data_bytes + 1;
 }
 
-void air_rx_packet_prepare(air_rx_packet_t *packet, air_key_t key)
+void air_tx_packet_prepare(air_tx_packet_t *packet, const air_packet_layout_t *layout, air_key_t key)
 {
-    packet->crc = air_packet_crc(packet, sizeof(*packet), key);
+    packet->data[layout->uplink_data_bytes] = air_packet_crc(packet, air_tx_packet_size(layout), key);
 }
 
-bool air_rx_packet_validate(air_rx_packet_t *packet, air_key_t key)
+bool air_tx_packet_validate(air_tx_packet_t *packet, const air_packet_layout_t *layout, air_key_t key)
 {
-    return packet->crc == air_packet_crc(packet, sizeof(*packet), key);
+    return packet->data[layout->uplink_data_bytes] == air_packet_crc(packet, air_tx_packet_size(layout), key);
+}
+
+void air_rx_packet_prepare(air_rx_packet_t *packet, const air_packet_layout_t *layout, air_key_t key)
+{
+    packet->data[layout->downlink_data_bytes] = air_packet_crc(packet, air_rx_packet_size(layout), key);
+}
+
+bool air_rx_packet_validate(air_rx_packet_t *packet, const air_packet_layout_t *layout, air_key_t key)
+{
+    return packet->data[layout->downlink_data_bytes] == air_packet_crc(packet, air_rx_packet_size(layout), key);
 }
 
 uint8_t air_sync_word(air_key_t key)
@@ -36,10 +36,21 @@ typedef enum
     AIR_CAP_FREQUENCY_868MHZ = 1 << 5,
     AIR_CAP_FREQUENCY_915MHZ = 1 << 6,
 
+    AIR_CAP_STREAM_RELIABLE = 1 << 8,         // Supports the reliable sub-channel for MSP/RMP in air_stream_t
+    AIR_CAP_STREAM_PACKED_CHANNELS = 1 << 9,  // Can decode multiple aux channels packed in a single air_stream_t frame
+    AIR_CAP_PACKET_LAYOUTS = 1 << 10,         // Uses the per mode packet layouts from air_radio_packet_layout()
+    AIR_CAP_STREAM_TELEMETRY_BATCH = 1 << 11, // Can decode multiple telemetry values in a single air_stream_t frame
+    AIR_CAP_STREAM_TELEMETRY_DELTA = 1 << 12, // Can decode delta coded telemetry in air_stream_t
+    AIR_CAP_STREAM_COBS = 1 << 13,            // Supports COBS framing for variable sized commands in air_stream_t
+    AIR_CAP_FEC_REED_SOLOMON = 1 << 14,       // Uses Reed-Solomon FEC in the modes where the radio supports it
+
     AIR_CAP_P2P_2_4GHZ = 1 << 15,      // 2.4ghz unrestricted
     AIR_CAP_P2P_2_4GHZ_WIFI = 1 << 16, // 2.4ghz but restricted to valid raw WiFi packets
     AIR_CAP_P2P_FLARM = 1 << 17,       // flarm support
 
+    AIR_CAP_FEC_INTERLEAVING = 1 << 18, // Interleaves the FEC symbols in the modes where the radio supports it
+    AIR_CAP_AIRTIME_CYCLES = 1 << 19,   // Uses cycle times derived from the packets time on air, see air_radio_set_airtime_cycles()
+
     // Hardware
     AIR_CAP_BATTERY = 1 << 24,           // Node has an on-board battery
     AIR_CAP_SCREEN = 1 << 25,            // Node has a screen
@@ -96,12 +107,23 @@ void air_pairing_format(const air_pairing_t *pairing, char *buf, size_t bufsize)
 #define AIR_SEQ_BITS 4
 #define AIR_SEQ_COUNT (1 << AIR_SEQ_BITS)
 #define AIR_NUM_HOPPING_FREQS AIR_SEQ_COUNT
-#define AIR_UPLINK_DATA_BYTES 2
-#define AIR_DOWNLINK_DATA_BYTES 3
-#define AIR_MAX_DATA_BYTES (AIR_UPLINK_DATA_BYTES > AIR_DOWNLINK_DATA_BYTES ? AIR_UPLINK_DATA_BYTES : AIR_DOWNLINK_DATA_BYTES)
 #define AIR_SEQ_TO_SEND(seq, count, per_packet) ((seq + (count + per_packet - 1) / per_packet) % AIR_SEQ_COUNT)
-#define AIR_SEQ_TO_SEND_UPLINK(seq, count) AIR_SEQ_TO_SEND(seq, count, AIR_UPLINK_DATA_BYTES)
-#define AIR_SEQ_TO_SEND_DOWNLINK(seq, count) AIR_SEQ_TO_SEND(seq, count, AIR_DOWNLINK_DATA_BYTES)
+
+// Stream data bytes in each packet used when the other end doesn't support
+// AIR_CAP_PACKET_LAYOUTS. Faster modes might carry more,
+// see air_radio_packet_layout().
+#define AIR_UPLINK_DEFAULT_DATA_BYTES 2
+#define AIR_DOWNLINK_DEFAULT_DATA_BYTES 3
+#define AIR_UPLINK_MAX_DATA_BYTES 16
+#define AIR_DOWNLINK_MAX_DATA_BYTES 32
+
+typedef struct air_packet_layout_s
+{
+    uint8_t uplink_data_bytes;   // Stream bytes in each air_tx_packet_t
+    uint8_t downlink_data_bytes; // Stream bytes in each air_rx_packet_t
+} air_packet_layout_t;
+
+extern const air_packet_layout_t *AIR_PACKET_LAYOUT_DEFAULT;
 
 typedef struct tx_packet_s
 {
@@ -112,21 +134,24 @@ typedef struct tx_packet_s
     unsigned ch2 : AIR_CHANNEL_BITS;
     unsigned ch3 : AIR_CHANNEL_BITS;
 
-    uint8_t data[AIR_UPLINK_DATA_BYTES]; // Arbitrary data. Can be a channel or a chunk of telemetry data. Now at 7 bytes
-    uint8_t crc;                         // With CRC we're at 8 bytes
+    // Arbitrary data. Can be a channel or a chunk of telemetry data. Only
+    // the first uplink_data_bytes from the layout are sent, followed by
+    // the CRC. Using the default layout we're at 8 bytes.
+    uint8_t data[AIR_UPLINK_MAX_DATA_BYTES + 1];
 } PACKED air_tx_packet_t;
 
-_Static_assert(sizeof(air_tx_packet_t) == 8, "invalid air_tx_packet_t size");
+_Static_assert(sizeof(air_tx_packet_t) == 5 + AIR_UPLINK_MAX_DATA_BYTES + 1, "invalid air_tx_packet_t size");
 
 typedef struct air_rx_packet_s
 {
-    unsigned seq : AIR_SEQ_BITS;           // Seq from the RX
-    unsigned tx_seq : AIR_SEQ_BITS;        // Seq from the TX, just echoed so the TX can know if we received an specific packet
-    uint8_t data[AIR_DOWNLINK_DATA_BYTES]; // Arbitrary data
-    uint8_t crc;                           // With CRC we're at 5 bytes
+    unsigned seq : AIR_SEQ_BITS;    // Seq from the RX
+    unsigned tx_seq : AIR_SEQ_BITS; // Seq from the TX, just echoed so the TX can know if we received an specific packet
+    // Arbitrary data, downlink_data_bytes from the layout followed by
+    // the CRC. Using the default layout we're at 5 bytes.
+    uint8_t data[AIR_DOWNLINK_MAX_DATA_BYTES + 1];
 } PACKED air_rx_packet_t;
 
-_Static_assert(sizeof(air_rx_packet_t) == 5, "invalid air_rx_packet_t size");
+_Static_assert(sizeof(air_rx_packet_t) == 1 + AIR_DOWNLINK_MAX_DATA_BYTES + 1, "invalid air_rx_packet_t size");
 
 void air_addr_format(const air_addr_t *addr, char *buf, size_t bufsize);
 bool air_addr_equals(const air_addr_t *addr1, const air_addr_t *addr2);
@@ -147,9 +172,13 @@ void air_bind_accept(uint64_t uuid, const char *name, uint8_t *buf, size_t *bufs
 bool air_parse_bind_req(uint8_t *buf, size_t bufsize, uint64_t *uuid, char *name_buf, size_t *name_size);
 bool air_parse_bind_accept(uint8_t *buf, size_t bufsize, uint64_t *uuid, char *name_buf, size_t *name_size);
 
-void air_tx_packet_prepare(air_tx_packet_t *packet, air_key_t key);
-bool air_tx_packet_validate(air_tx_packet_t *packet, air_key_t key);
-void air_rx_packet_prepare(air_rx_packet_t *packet, air_key_t key);
-bool air_rx_packet_validate(air_rx_packet_t *packet, air_key_t key);
+// Sizes of the packets as sent over the air, including the CRC
+size_t air_tx_packet_size(const air_packet_layout_t *layout);
+size_t air_rx_packet_size(const air_packet_layout_t *layout);
+
+void air_tx_packet_prepare(air_tx_packet_t *packet, const air_packet_layout_t *layout, air_key_t key);
+bool air_tx_packet_validate(air_tx_packet_t *packet, const air_packet_layout_t *layout, air_key_t key);
+void air_rx_packet_prepare(air_rx_packet_t *packet, const air_packet_layout_t *layout, air_key_t key);
+bool air_rx_packet_validate(air_rx_packet_t *packet, const air_packet_layout_t *layout, air_key_t key);
 
 uint8_t air_sync_word(air_key_t key);
@@ -0,0 +1,136 @@
+#include <math.h>
+
+#include "util/macros.h"
+
+#include "air_clock.h"
+
+// Gains for the phase and period corrections. Since the sender schedules
+// each packet relative to the actual send time of the previous one, its
+// jitter accumulates and the last arrival is the best reference for the
+// next one, so the phase follows the measurements closely while the
+// period averages them over a few dozen packets.
+#define AIR_CLOCK_ALPHA 0.75f
+#define AIR_CLOCK_BETA 0.05f
+// Smoothing for the offset and variance, as 1/N of the new value
+#define AIR_CLOCK_SMOOTHING 16
+// The peak error decays by 1/N on each packet. Delays in the sender are
+// rare but large, so this keeps the window open for them for a while.
+#define AIR_CLOCK_PEAK_DECAY 128
+// Packets needed before using the estimates
+#define AIR_CLOCK_MIN_SAMPLES 8
+// Don't relate packets further apart than this, rounding to whole
+// cycles becomes ambiguous as the period error accumulates.
+#define AIR_CLOCK_MAX_CYCLES 32
+// Errors bigger than this fraction of the period reset the phase
+#define AIR_CLOCK_MAX_ERROR_FACTOR 0.25f
+// Maximum difference between the estimated and nominal periods. Note
+// that this includes the average scheduling delay of the sender.
+#define AIR_CLOCK_MAX_PERIOD_ERROR 0.02f
+// The guard window covers this many standard deviations of the
+// prediction error or its recent peak, whichever is bigger, plus a
+// fixed margin. Packets delayed past the window are lost rather than
+// measured, so the margin is what lets us see (and adapt to) them.
+#define AIR_CLOCK_GUARD_SIGMAS 4
+#define AIR_CLOCK_GUARD_MARGIN_US 500
+
+static void air_clock_reset_phase(air_clock_t *clock, time_micros_t rx_at)
+{
+    clock->last_at = rx_at;
+    clock->offset = 0;
+    clock->variance = 0;
+    clock->peak = 0;
+    clock->samples = 1;
+}
+
+void air_clock_init(air_clock_t *clock, time_micros_t period)
+{
+    clock->nominal_period = period;
+    clock->last_at = 0;
+    clock->period = period;
+    clock->offset = 0;
+    clock->variance = 0;
+    clock->peak = 0;
+    clock->samples = 0;
+}
+
+bool air_clock_update(air_clock_t *clock, time_micros_t rx_at)
+{
+    if (!air_clock_has_reference(clock) || rx_at <= clock->last_at)
+    {
+        air_clock_reset_phase(clock, rx_at);
+        return false;
+    }
+    float elapsed = rx_at - clock->last_at;
+    unsigned cycles = lroundf(elapsed / clock->period);
+    if (cycles == 0 || cycles > AIR_CLOCK_MAX_CYCLES)
+    {
+        air_clock_reset_phase(clock, rx_at);
+        return false;
+    }
+    float error = elapsed - cycles * clock->period;
+    if (fabsf(error) > clock->period * AIR_CLOCK_MAX_ERROR_FACTOR)
+    {
+        air_clock_reset_phase(clock, rx_at);
+        return false;
+    }
+    clock->last_at = rx_at - lroundf((1 - AIR_CLOCK_ALPHA) * error);
+    float period = clock->period + AIR_CLOCK_BETA * error / cycles;
+    float max_period_error = clock->nominal_period * AIR_CLOCK_MAX_PERIOD_ERROR;
+    clock->period = CONSTRAIN(period, clock->nominal_period - max_period_error, clock->nominal_period + max_period_error);
+
+    // Use a plain average until we have enough samples, so the
+    // initial zeroes don't bias the estimates.
+    clock->samples++;
+    float k = 1.0f / MIN(clock->samples - 1, AIR_CLOCK_SMOOTHING);
+    clock->offset += k * (error - clock->offset);
+    clock->variance += k * (error * error - clock->variance);
+    clock->peak = MAX(fabsf(error), clock->peak - clock->peak / AIR_CLOCK_PEAK_DECAY);
+    return true;
+}
+
+bool air_clock_has_reference(const air_clock_t *clock)
+{
+    return clock->samples > 0;
+}
+
+bool air_clock_is_locked(const air_clock_t *clock)
+{
+    return clock->samples >= AIR_CLOCK_MIN_SAMPLES;
+}
+
+time_micros_t air_clock_next_at(const air_clock_t *clock, unsigned cycles)
+{
+    return clock->last_at + lroundf(cycles * clock->period);
+}
+
+time_micros_t air_clock_guard(const air_clock_t *clock, unsigned cycles)
+{
+    if (!air_clock_is_locked(clock))
+    {
+        return TIME_MICROS_MAX;
+    }
+    float guard = MAX(AIR_CLOCK_GUARD_SIGMAS * sqrtf(clock->variance), clock->peak) + AIR_CLOCK_GUARD_MARGIN_US;
+    // Double the window for each lost packet. Senders which schedule
+    // each packet relative to the actual send time of the previous one
+    // shift all the following packets when one is delayed, so we need
+    // to catch up with them.
+    for (unsigned ii = 1; ii < cycles && guard < clock->nominal_period; ii++)
+    {
+        guard *= 2;
+    }
+    return MIN(guard, (float)clock->nominal_period);
+}
+
+float air_clock_drift_ppm(const air_clock_t *clock)
+{
+    if (clock->nominal_period == 0)
+    {
+        return 0;
+    }
+    return (clock->period - clock->nominal_period) * 1e6f / clock->nominal_period;
+}
+
+int air_clock_offset(const air_clock_t *clock)
+{
+    return lroundf(clock->offset);
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "util/time.h"
+
+// Tracks the timing of the packets sent by the other end from the times
+// at which they're received, using an alpha-beta filter (a second order
+// PLL) over the arrival phase and the cycle period. The period absorbs
+// both the crystal drift between both ends and the average delay of the
+// sender's scheduling, while the spread and the recent peak of the
+// prediction errors are used to size the window we wait for a packet
+// before declaring it lost.
+
+typedef struct air_clock_s
+{
+    time_micros_t nominal_period; // Cycle time for the air mode
+    time_micros_t last_at;        // Estimated arrival of the last packet received, 0 if none
+    float period;                 // Estimated cycle time, as measured by our clock (us)
+    float offset;                 // Smoothed prediction error (us)
+    float variance;               // Smoothed squared prediction error (us^2)
+    float peak;                   // Slowly decaying maximum absolute prediction error (us)
+    unsigned samples;             // Packets received since the phase was reset
+} air_clock_t;
+
+void air_clock_init(air_clock_t *clock, time_micros_t period);
+// Feeds a packet received at rx_at. Returns false if it couldn't be
+// related to the previous one (e.g. the sender restarted), in which
+// case the phase is reset to rx_at.
+bool air_clock_update(air_clock_t *clock, time_micros_t rx_at);
+// Returns true if there's a packet to count cycles from
+bool air_clock_has_reference(const air_clock_t *clock);
+// Returns true once there are enough samples to trust the estimates
+bool air_clock_is_locked(const air_clock_t *clock);
+// Returns the predicted arrival of the packet sent cycles after the
+// last one received. Only valid if air_clock_has_reference().
+time_micros_t air_clock_next_at(const air_clock_t *clock, unsigned cycles);
+// Returns how long to wait after air_clock_next_at() for the packet sent
+// cycles after the last one received, or TIME_MICROS_MAX if not locked.
+time_micros_t air_clock_guard(const air_clock_t *clock, unsigned cycles);
+// Difference between the estimated and the nominal period, in ppm
+float air_clock_drift_ppm(const air_clock_t *clock);
+// Smoothed difference between the arrivals and their predictions, in us
+int air_clock_offset(const air_clock_t *clock);
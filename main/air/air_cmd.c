@@ -39,6 +39,19 @@ int air_cmd_size(air_cmd_e cmd)
     case AIR_CMD_MSP:
     case AIR_CMD_RMP:
         return -1;
+    case AIR_CMD_RELIABLE_SEGMENT:
+        return -1;
+    case AIR_CMD_RELIABLE_ACK:
+        return sizeof(air_cmd_reliable_ack_t);
+    case AIR_CMD_RELIABLE_SYN_ACK:
+        return sizeof(air_cmd_reliable_syn_ack_t);
+    case AIR_CMD_TELEMETRY_ACK:
+        return -1;
     }
     return INT_MAX;
 }
+
+bool air_cmd_is_reliable(air_cmd_e cmd)
+{
+    return cmd == AIR_CMD_MSP || cmd == AIR_CMD_RMP;
+}
@@ -21,6 +21,10 @@ typedef enum
     AIR_CMD_REJECT_MODE = 31,
     AIR_CMD_MSP = 32,
     AIR_CMD_RMP = 33,
+    AIR_CMD_RELIABLE_SEGMENT = 34, // Segment of the reliable sub-channel, see air_stream.c
+    AIR_CMD_RELIABLE_ACK = 35,     // Selective ACK for the reliable sub-channel
+    AIR_CMD_TELEMETRY_ACK = 36,    // ACKs for delta coded telemetry, see air_telemetry_delta.h
+    AIR_CMD_RELIABLE_SYN_ACK = 37, // AIR_CMD_RELIABLE_ACK for segments with syn
 } air_cmd_e;
 
 inline air_mode_e air_mode_from_cmd(air_cmd_e cmd)
@@ -51,6 +55,52 @@ typedef struct air_cmd_switch_mode_ack_s
 
 _Static_assert(sizeof(air_cmd_switch_mode_ack_t) == 1, "invalid air_cmd_switch_mode_ack_t size");
 
+#define AIR_CMD_RELIABLE_SEQ_BITS 4
+
+// Followed by the segment data. When syn is set, the sender's uint32_t
+// nonce goes between the header and the data.
+typedef struct air_cmd_reliable_segment_s
+{
+    unsigned seq : AIR_CMD_RELIABLE_SEQ_BITS;
+    unsigned syn : 1; // Sent until the first ACK in a session is received
+    unsigned reserved : 3;
+    uint8_t session;
+} PACKED air_cmd_reliable_segment_t;
+
+_Static_assert(sizeof(air_cmd_reliable_segment_t) == 2, "invalid air_cmd_reliable_segment_t size");
+
+typedef struct air_cmd_reliable_ack_s
+{
+    unsigned next_seq : AIR_CMD_RELIABLE_SEQ_BITS; // Next in-order segment expected by the receiver
+    unsigned reset : 1;                            // Receiver has no state for session, start a new one
+    unsigned reserved : 3;
+    uint8_t session;
+    uint8_t received; // Bit N set means segment next_seq + 1 + N was received
+} PACKED air_cmd_reliable_ack_t;
+
+_Static_assert(sizeof(air_cmd_reliable_ack_t) == 3, "invalid air_cmd_reliable_ack_t size");
+
+typedef struct air_cmd_reliable_syn_ack_s
+{
+    air_cmd_reliable_ack_t ack;
+    uint32_t nonce; // From the syn segments being acknowledged
+} PACKED air_cmd_reliable_syn_ack_t;
+
+_Static_assert(sizeof(air_cmd_reliable_syn_ack_t) == 7, "invalid air_cmd_reliable_syn_ack_t size");
+
+// AIR_CMD_TELEMETRY_ACK carries one or more of these
+typedef struct air_cmd_telemetry_ack_s
+{
+    unsigned idx : 5;  // Telemetry index
+    unsigned nack : 1; // Receiver doesn't have the slot, stop using it
+    unsigned reserved : 2;
+    unsigned gen : 4;
+    unsigned slot : 2;
+    unsigned reserved2 : 2;
+} PACKED air_cmd_telemetry_ack_t;
+
+_Static_assert(sizeof(air_cmd_telemetry_ack_t) == 2, "invalid air_cmd_telemetry_ack_t size");
+
 bool air_cmd_switch_mode_ack_in_progress(air_cmd_switch_mode_ack_t *cmd);
 void air_cmd_switch_mode_ack_reset(air_cmd_switch_mode_ack_t *cmd);
 // Returns true iff the switch should be now performed
@@ -58,4 +108,7 @@ bool air_cmd_switch_mode_ack_proceed(air_cmd_switch_mode_ack_t *cmd, unsigned tx
 void air_cmd_switch_mode_ack_copy(air_cmd_switch_mode_ack_t *dst, const air_cmd_switch_mode_ack_t *src);
 // Command payload size. <0 means explicit length using variable length
 // encoding.
-int air_cmd_size(air_cmd_e cmd);
\ No newline at end of file
+int air_cmd_size(air_cmd_e cmd);
+// Returns true iff the command is sent over the reliable sub-channel
+// when both ends support it.
+bool air_cmd_is_reliable(air_cmd_e cmd);
\ No newline at end of file
@@ -1,6 +1,7 @@
 #include <hal/log.h>
 
 #include "air/air_freq.h"
+#include "air/air_radio.h"
 
 #include "util/macros.h"
 
@@ -27,4 +28,12 @@ void air_freq_table_init(air_freq_table_t *tbl, air_key_t key, unsigned long bas
         tbl->abs_errors[ii] = 0;
         tbl->last_errors[ii] = 0;
     }
+}
+
+void air_freq_table_prepare_hops(const air_freq_table_t *tbl, air_radio_t *radio)
+{
+    for (unsigned ii = 0; ii < ARRAY_COUNT(tbl->freqs); ii++)
+    {
+        air_radio_prepare_hop(radio, ii, tbl->freqs[ii], tbl->abs_errors[ii]);
+    }
 }
\ No newline at end of file
@@ -11,4 +11,9 @@ typedef struct air_freq_table_s
     int last_errors[AIR_NUM_HOPPING_FREQS];
 } air_freq_table_t;
 
+typedef struct air_radio_s air_radio_t;
+
 void air_freq_table_init(air_freq_table_t *tbl, air_key_t key, unsigned long base_freq);
+// Prepares the radio for hopping to all the frequencies in the table
+// with their current errors. See air_radio_prepare_hop().
+void air_freq_table_prepare_hops(const air_freq_table_t *tbl, air_radio_t *radio);
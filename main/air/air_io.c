@@ -1,6 +1,7 @@
 #include <math.h>
 
 #include "air/air_band.h"
+#include "air/air_radio.h"
 
 #include "config/config.h"
 
@@ -130,4 +131,13 @@ unsigned air_io_get_update_frequency(const air_io_t *io)
         return roundf(1 / value);
     }
     return 0;
-}
\ No newline at end of file
+}
+
+const air_packet_layout_t *air_io_get_packet_layout(const air_io_t *io, air_radio_t *radio, air_mode_e mode)
+{
+    if (io->pairing_info.capabilities & AIR_CAP_PACKET_LAYOUTS)
+    {
+        return air_radio_packet_layout(radio, mode);
+    }
+    return AIR_PACKET_LAYOUT_DEFAULT;
+}
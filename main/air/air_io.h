@@ -5,6 +5,7 @@
 #include "air/air.h"
 #include "air/air_band.h"
 #include "air/air_freq.h"
+#include "air/air_mode.h"
 
 #include "util/lpf.h"
 #include "util/time.h"
@@ -19,6 +20,7 @@ typedef struct air_io_bind_s
     void *user_data;
 } air_io_bind_t;
 
+typedef struct air_radio_s air_radio_t;
 typedef struct rmp_air_s rmp_air_t;
 
 typedef struct air_io_s
@@ -47,4 +49,6 @@ void air_io_on_frame(air_io_t *io, time_micros_t now);
 void air_io_update_rssi(air_io_t *io, int rssi, int snr, int lq, time_micros_t now);
 void air_io_reset_rssi(air_io_t *io, int rssi, int snr, int lq, time_micros_t now);
 void air_io_invalidate_rssi(air_io_t *io, time_micros_t now);
-unsigned air_io_get_update_frequency(const air_io_t *io);
\ No newline at end of file
+unsigned air_io_get_update_frequency(const air_io_t *io);
+// Returns the packet layout to use with the bound node in the given mode
+const air_packet_layout_t *air_io_get_packet_layout(const air_io_t *io, air_radio_t *radio, air_mode_e mode);
\ No newline at end of file
@@ -3,11 +3,13 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#include "air/air.h"
 #include "air/air_mode.h"
 
 #include "util/time.h"
 
 typedef struct air_radio_s air_radio_t;
+typedef struct profiler_stats_s profiler_stats_t;
 typedef struct telemetry_s telemetry_t;
 
 typedef enum
@@ -21,11 +23,36 @@ void air_radio_set_tx_power(air_radio_t *radio, int dBm);
 void air_radio_set_frequency(air_radio_t *radio, unsigned long freq, int error);
 void air_radio_calibrate(air_radio_t *radio, unsigned long freq);
 int air_radio_frequency_error(air_radio_t *radio);
+// Precomputes the radio settings for the frequency at idx in the hop
+// table (see air_freq_table_t), so switching to it with air_radio_set_hop()
+// is cheap. Must be called again when freq or error change.
+void air_radio_prepare_hop(air_radio_t *radio, unsigned idx, unsigned long freq, int error);
+// Same as air_radio_set_frequency() with the arguments passed to
+// air_radio_prepare_hop() for idx.
+void air_radio_set_hop(air_radio_t *radio, unsigned idx);
+// Accounts the cycles spent in each air_radio_set_hop() to stats. Pass
+// NULL (the default) to disable it.
+void air_radio_set_hop_stats(air_radio_t *radio, profiler_stats_t *stats);
 
 void air_radio_set_sync_word(air_radio_t *radio, uint8_t word);
 
 void air_radio_start_rx(air_radio_t *radio);
 
+// Enables Reed-Solomon FEC in the modes where the radio supports it. Only
+// used when both ends have AIR_CAP_FEC_REED_SOLOMON. Takes effect on the
+// next call to air_radio_set_mode().
+void air_radio_set_fec_reed_solomon(air_radio_t *radio, bool enabled);
+// Enables interleaving the FEC symbols in the modes where the radio
+// supports it, to survive bursts of interference. Only used when both
+// ends have AIR_CAP_FEC_INTERLEAVING. Takes effect on the next call to
+// air_radio_set_mode().
+void air_radio_set_fec_interleaving(air_radio_t *radio, bool enabled);
+// Enables cycle times derived from the time on air of the packets sent
+// in each mode, rather than the fixed ones. Only used when both ends have
+// AIR_CAP_AIRTIME_CYCLES. Takes effect on the next call to
+// air_radio_set_mode().
+void air_radio_set_airtime_cycles(air_radio_t *radio, bool enabled);
+
 bool air_radio_should_switch_to_faster_mode(air_radio_t *radio, air_mode_e current, air_mode_e faster, int telemetry_id, telemetry_t *t);
 bool air_radio_should_switch_to_longer_mode(air_radio_t *radio, air_mode_e current, air_mode_e longer, int telemetry_id, telemetry_t *t);
 unsigned air_radio_confirmations_required_for_switching_modes(air_radio_t *radio, air_mode_e current, air_mode_e to);
@@ -37,6 +64,22 @@ void air_radio_set_powertest_mode(air_radio_t *radio);
 bool air_radio_is_tx_done(air_radio_t *radio);
 bool air_radio_is_rx_done(air_radio_t *radio);
 bool air_radio_is_rx_in_progress(air_radio_t *radio);
+// Returns the time at which the radio signaled the last received packet,
+// captured as close to the hardware as possible rather than when the
+// packet is processed. Only valid after air_radio_is_rx_done() returns
+// true.
+time_micros_t air_radio_rx_done_at(air_radio_t *radio);
+
+// Channel activity detection, used to find out quickly wether a packet
+// is coming. Returns how long before the end of an uplink packet using
+// the given mode and layout air_radio_start_cad() should be called to
+// catch its preamble, or 0 if the radio doesn't support CAD in that mode.
+time_micros_t air_radio_cad_offset(air_radio_t *radio, air_mode_e mode, const air_packet_layout_t *layout);
+// Interrupts RX. Returns false if CAD is not supported in the current mode.
+bool air_radio_start_cad(air_radio_t *radio);
+// Returns true once the CAD started by air_radio_start_cad() is done,
+// setting detected to wether there's a packet in the air.
+bool air_radio_is_cad_done(air_radio_t *radio, bool *detected);
 
 void air_radio_set_payload_size(air_radio_t *radio, size_t size);
 size_t air_radio_read(air_radio_t *radio, void *buf, size_t size);
@@ -50,6 +93,12 @@ void air_radio_set_callback(air_radio_t *radio, air_radio_callback_t callback, v
 void air_radio_sleep(air_radio_t *radio);
 void air_radio_shutdown(air_radio_t *radio);
 
-time_micros_t air_radio_cycle_time(air_radio_t *radio, air_mode_e mode);
+// Returns the time between uplink packets in the given mode, with packets
+// using the given layout.
+time_micros_t air_radio_cycle_time(air_radio_t *radio, air_mode_e mode, const air_packet_layout_t *layout);
+// Returns the layout of the packets sent in the given mode. Only used
+// when both ends have AIR_CAP_PACKET_LAYOUTS, AIR_PACKET_LAYOUT_DEFAULT
+// is used otherwise.
+const air_packet_layout_t *air_radio_packet_layout(air_radio_t *radio, air_mode_e mode);
 time_micros_t air_radio_tx_failsafe_interval(air_radio_t *radio, air_mode_e mode);
 time_micros_t air_radio_rx_failsafe_interval(air_radio_t *radio, air_mode_e mode);
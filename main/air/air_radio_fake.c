@@ -20,6 +20,18 @@ void air_radio_set_frequency(air_radio_t *radio, unsigned long freq, int error)
 {
 }
 
+void air_radio_prepare_hop(air_radio_t *radio, unsigned idx, unsigned long freq, int error)
+{
+}
+
+void air_radio_set_hop(air_radio_t *radio, unsigned idx)
+{
+}
+
+void air_radio_set_hop_stats(air_radio_t *radio, profiler_stats_t *stats)
+{
+}
+
 void air_radio_calibrate(air_radio_t *radio, unsigned long freq)
 {
 }
@@ -52,6 +64,18 @@ unsigned air_radio_confirmations_required_for_switching_modes(air_radio_t *radio
     return 1;
 }
 
+void air_radio_set_fec_reed_solomon(air_radio_t *radio, bool enabled)
+{
+}
+
+void air_radio_set_fec_interleaving(air_radio_t *radio, bool enabled)
+{
+}
+
+void air_radio_set_airtime_cycles(air_radio_t *radio, bool enabled)
+{
+}
+
 void air_radio_set_mode(air_radio_t *radio, air_mode_e mode)
 {
 }
@@ -74,6 +98,26 @@ bool air_radio_is_rx_done(air_radio_t *radio)
     return true;
 }
 
+time_micros_t air_radio_rx_done_at(air_radio_t *radio)
+{
+    return time_micros_now();
+}
+
+time_micros_t air_radio_cad_offset(air_radio_t *radio, air_mode_e mode, const air_packet_layout_t *layout)
+{
+    return 0;
+}
+
+bool air_radio_start_cad(air_radio_t *radio)
+{
+    return false;
+}
+
+bool air_radio_is_cad_done(air_radio_t *radio, bool *detected)
+{
+    return false;
+}
+
 bool air_radio_is_rx_in_progress(air_radio_t *radio)
 {
     return false;
@@ -109,13 +153,19 @@ void air_radio_shutdown(air_radio_t *radio)
 {
 }
 
-time_micros_t air_radio_cycle_time(air_radio_t *radio, air_mode_e mode)
+time_micros_t air_radio_cycle_time(air_radio_t *radio, air_mode_e mode, const air_packet_layout_t *layout)
 {
     UNUSED(radio);
+    UNUSED(layout);
 
     return MILLIS_TO_MICROS(500);
 }
 
+const air_packet_layout_t *air_radio_packet_layout(air_radio_t *radio, air_mode_e mode)
+{
+    return AIR_PACKET_LAYOUT_DEFAULT;
+}
+
 time_micros_t air_radio_tx_failsafe_interval(air_radio_t *radio, air_mode_e mode)
 {
     return air_radio_rx_failsafe_interval(radio, mode);
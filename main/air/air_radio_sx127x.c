@@ -12,8 +12,78 @@
 
 #if defined(USE_RADIO_SX127X)
 
+#define AIR_RADIO_SX127X_FSK_BITRATE 200000
+#define AIR_RADIO_SX127X_FSK_PREAMBLE_LENGTH 5
+#define AIR_RADIO_SX127X_LORA_SIGNAL_BW SX127X_LORA_SIGNAL_BW_500
+#define AIR_RADIO_SX127X_LORA_PREAMBLE_LENGTH 6
+
+// Before sending, the radio goes from sleep to standby (TS_OSC, 250us),
+// locks the PLL (TS_FS, 60us) and ramps up the PA (TS_TR, 5us + 1.25 *
+// PaRamp, 55us with the default ramp). See the timing specs in the datasheet.
+#define AIR_RADIO_SX127X_TURNAROUND_US (250 + 60 + 55)
+// From the end of a packet until the other end starts its turnaround:
+// DIO0 handling, reading the FIFO, decoding and building the reply.
+#define AIR_RADIO_SX127X_PROCESSING_US 1000
+
+// CAD takes about 2 symbols and then we need enough preamble left for
+// the receiver to lock, so it's only worth it in the slower modes, where
+// the timing is also less tight relative to the symbol time.
+#define AIR_RADIO_SX127X_CAD_MIN_SF 9
+// Start the CAD this many symbols into the preamble, so it still sees
+// it when the packet arrives a bit earlier or later than expected
+#define AIR_RADIO_SX127X_CAD_PREAMBLE_DELAY_SYMBOLS 1
+
+typedef struct air_radio_sx127x_lora_mode_s
+{
+    int sf;
+    sx127x_lora_coding_rate_e coding_rate;
+} air_radio_sx127x_lora_mode_t;
+
+static const air_radio_sx127x_lora_mode_t air_radio_sx127x_lora_modes[] = {
+    [AIR_MODE_2] = {.sf = 7, .coding_rate = SX127X_LORA_CODING_RATE_4_6},
+    [AIR_MODE_3] = {.sf = 8, .coding_rate = SX127X_LORA_CODING_RATE_4_6},
+    [AIR_MODE_4] = {.sf = 9, .coding_rate = SX127X_LORA_CODING_RATE_4_6},
+    [AIR_MODE_5] = {.sf = 10, .coding_rate = SX127X_LORA_CODING_RATE_4_8},
+};
+
+// Uplink and downlink packets get their own parity, sized to keep the
+// overhead between 25% and 50%. With the AIR_MODE_1 layout, 4 parity
+// bytes correct up to 2 wrong bytes in the uplink packets (10 bytes, 40%
+// overhead) and 6 correct up to 3 in the downlink ones (19 bytes, 32%),
+// rather than 100% with FEC_NIBBLE.
+static const fec_t air_radio_sx127x_fec_reed_solomon_uplink = {
+    .type = FEC_TYPE_REED_SOLOMON,
+    .parity_bytes = 4,
+};
+
+static const fec_t air_radio_sx127x_fec_reed_solomon_downlink = {
+    .type = FEC_TYPE_REED_SOLOMON,
+    .parity_bytes = 6,
+};
+
+// Reed-Solomon expands the payload less than FEC_NIBBLE, so AIR_MODE_1
+// has room for 10 more downlink bytes: 4 + 17 bytes give 6.6ms.
+static const air_packet_layout_t air_radio_sx127x_fsk_reed_solomon_layout = {
+    .uplink_data_bytes = 4,
+    .downlink_data_bytes = 17,
+};
+
+// Reed-Solomon already corrects bursts within a few bytes, but the nibble
+// code only corrects one bit per symbol. Interleaving transposes the bits
+// of the encoded packet, so a burst of up to as many bits as the packet
+// has bytes flips at most one bit per symbol: 20 bits for the AIR_MODE_1
+// uplink packets (20 bytes encoded) and 18 for the downlink ones.
+static const fec_t air_radio_sx127x_fec_nibble_interleaved = {
+    .type = FEC_TYPE_NIBBLE,
+    .interleaved = true,
+};
+
 void air_radio_init(air_radio_t *radio)
 {
+    radio->fec_reed_solomon = false;
+    radio->fec_interleaving = false;
+    radio->airtime_cycles = false;
+    radio->airtime.layout = NULL;
     sx127x_init(&radio->sx127x);
 }
 
@@ -27,6 +97,30 @@ void air_radio_set_frequency(air_radio_t *radio, unsigned long freq, int error)
     sx127x_set_frequency(&radio->sx127x, freq, error);
 }
 
+void air_radio_prepare_hop(air_radio_t *radio, unsigned idx, unsigned long freq, int error)
+{
+    assert(idx < ARRAY_COUNT(radio->hops));
+    sx127x_prepare_frequency(&radio->hops[idx], freq, error);
+}
+
+void air_radio_set_hop(air_radio_t *radio, unsigned idx)
+{
+    assert(idx < ARRAY_COUNT(radio->hops));
+    if (radio->hop_stats)
+    {
+        profiler_cycles_t start = profiler_cycles_now();
+        sx127x_set_prepared_frequency(&radio->sx127x, &radio->hops[idx]);
+        profiler_stats_add_since(radio->hop_stats, start);
+        return;
+    }
+    sx127x_set_prepared_frequency(&radio->sx127x, &radio->hops[idx]);
+}
+
+void air_radio_set_hop_stats(air_radio_t *radio, profiler_stats_t *stats)
+{
+    radio->hop_stats = stats;
+}
+
 void air_radio_calibrate(air_radio_t *radio, unsigned long freq)
 {
     sx127x_calibrate(&radio->sx127x, freq);
@@ -50,7 +144,7 @@ void air_radio_start_rx(air_radio_t *radio)
 static void air_radio_sx127x_set_lora_mode_parameters(air_radio_t *radio)
 {
     sx127x_set_op_mode(&radio->sx127x, SX127X_OP_MODE_LORA);
-    sx127x_set_lora_signal_bw(&radio->sx127x, SX127X_LORA_SIGNAL_BW_500);
+    sx127x_set_lora_signal_bw(&radio->sx127x, AIR_RADIO_SX127X_LORA_SIGNAL_BW);
     sx127x_set_lora_header_mode(&radio->sx127x, SX127X_LORA_HEADER_IMPLICIT);
     sx127x_set_lora_crc(&radio->sx127x, false);
 }
@@ -102,9 +196,57 @@ unsigned air_radio_confirmations_required_for_switching_modes(air_radio_t *radio
     return MIN(15, 4 * ((AIR_MODE_LONGEST + 1) - current));
 }
 
+void air_radio_set_fec_reed_solomon(air_radio_t *radio, bool enabled)
+{
+    radio->fec_reed_solomon = enabled;
+}
+
+void air_radio_set_fec_interleaving(air_radio_t *radio, bool enabled)
+{
+    radio->fec_interleaving = enabled;
+}
+
+void air_radio_set_airtime_cycles(air_radio_t *radio, bool enabled)
+{
+    radio->airtime_cycles = enabled;
+}
+
+// The direction is told apart by the packet size, since the uplink and
+// downlink packets of air_radio_sx127x_fsk_reed_solomon_layout differ.
+static const fec_t *air_radio_sx127x_fsk_fec(air_radio_t *radio, size_t size)
+{
+    if (radio->fec_reed_solomon)
+    {
+        if (size == air_tx_packet_size(&air_radio_sx127x_fsk_reed_solomon_layout))
+        {
+            return &air_radio_sx127x_fec_reed_solomon_uplink;
+        }
+        return &air_radio_sx127x_fec_reed_solomon_downlink;
+    }
+    if (radio->fec_interleaving)
+    {
+        return &air_radio_sx127x_fec_nibble_interleaved;
+    }
+    return FEC_NIBBLE;
+}
+
+static time_micros_t air_radio_sx127x_time_on_air(air_radio_t *radio, air_mode_e mode, size_t size)
+{
+    if (mode == AIR_MODE_1)
+    {
+        return sx127x_fsk_time_on_air(AIR_RADIO_SX127X_FSK_BITRATE, AIR_RADIO_SX127X_FSK_PREAMBLE_LENGTH,
+                                      air_radio_sx127x_fsk_fec(radio, size), size);
+    }
+    const air_radio_sx127x_lora_mode_t *lora = &air_radio_sx127x_lora_modes[mode];
+    return sx127x_lora_time_on_air(lora->sf, AIR_RADIO_SX127X_LORA_SIGNAL_BW, lora->coding_rate,
+                                   AIR_RADIO_SX127X_LORA_PREAMBLE_LENGTH, SX127X_LORA_HEADER_IMPLICIT, false, size);
+}
+
 void air_radio_set_mode(air_radio_t *radio, air_mode_e mode)
 {
     sx127x_sleep(&radio->sx127x);
+    // FEC and airtime_cycles might have changed
+    radio->airtime.layout = NULL;
 
     switch (mode)
     {
@@ -121,34 +263,19 @@ void air_radio_set_mode(air_radio_t *radio, air_mode_e mode)
         //  RxBw = Receiver bandwidth in Hz
         sx127x_set_op_mode(&radio->sx127x, SX127X_OP_MODE_FSK);
         sx127x_set_fsk_fdev(&radio->sx127x, 125000);
-        sx127x_set_fsk_bitrate(&radio->sx127x, 200000);
+        sx127x_set_fsk_bitrate(&radio->sx127x, AIR_RADIO_SX127X_FSK_BITRATE);
         sx127x_set_fsk_rx_bandwidth(&radio->sx127x, 250000);
         sx127x_set_fsk_rx_afc_bandwidth(&radio->sx127x, 250000);
-        sx127x_set_fsk_preamble_length(&radio->sx127x, 5);
+        sx127x_set_fsk_preamble_length(&radio->sx127x, AIR_RADIO_SX127X_FSK_PREAMBLE_LENGTH);
         break;
     case AIR_MODE_2:
-        air_radio_sx127x_set_lora_mode_parameters(radio);
-        sx127x_set_lora_preamble_length(&radio->sx127x, 6);
-        sx127x_set_lora_spreading_factor(&radio->sx127x, 7);
-        sx127x_set_lora_coding_rate(&radio->sx127x, SX127X_LORA_CODING_RATE_4_6);
-        break;
     case AIR_MODE_3:
-        air_radio_sx127x_set_lora_mode_parameters(radio);
-        sx127x_set_lora_preamble_length(&radio->sx127x, 6);
-        sx127x_set_lora_spreading_factor(&radio->sx127x, 8);
-        sx127x_set_lora_coding_rate(&radio->sx127x, SX127X_LORA_CODING_RATE_4_6);
-        break;
     case AIR_MODE_4:
-        air_radio_sx127x_set_lora_mode_parameters(radio);
-        sx127x_set_lora_preamble_length(&radio->sx127x, 6);
-        sx127x_set_lora_spreading_factor(&radio->sx127x, 9);
-        sx127x_set_lora_coding_rate(&radio->sx127x, SX127X_LORA_CODING_RATE_4_6);
-        break;
     case AIR_MODE_5:
         air_radio_sx127x_set_lora_mode_parameters(radio);
-        sx127x_set_lora_preamble_length(&radio->sx127x, 6);
-        sx127x_set_lora_spreading_factor(&radio->sx127x, 10);
-        sx127x_set_lora_coding_rate(&radio->sx127x, SX127X_LORA_CODING_RATE_4_8);
+        sx127x_set_lora_preamble_length(&radio->sx127x, AIR_RADIO_SX127X_LORA_PREAMBLE_LENGTH);
+        sx127x_set_lora_spreading_factor(&radio->sx127x, air_radio_sx127x_lora_modes[mode].sf);
+        sx127x_set_lora_coding_rate(&radio->sx127x, air_radio_sx127x_lora_modes[mode].coding_rate);
         break;
     }
 }
@@ -179,6 +306,38 @@ bool air_radio_is_rx_done(air_radio_t *radio)
     return sx127x_is_rx_done(&radio->sx127x);
 }
 
+time_micros_t air_radio_rx_done_at(air_radio_t *radio)
+{
+    return sx127x_rx_done_at(&radio->sx127x);
+}
+
+time_micros_t air_radio_cad_offset(air_radio_t *radio, air_mode_e mode, const air_packet_layout_t *layout)
+{
+    if (mode == AIR_MODE_1)
+    {
+        // FSK
+        return 0;
+    }
+    const air_radio_sx127x_lora_mode_t *lora = &air_radio_sx127x_lora_modes[mode];
+    if (lora->sf < AIR_RADIO_SX127X_CAD_MIN_SF)
+    {
+        return 0;
+    }
+    time_micros_t symbol = sx127x_lora_symbol_time(lora->sf, AIR_RADIO_SX127X_LORA_SIGNAL_BW);
+    time_micros_t uplink = air_radio_sx127x_time_on_air(radio, mode, air_tx_packet_size(layout));
+    return uplink - AIR_RADIO_SX127X_CAD_PREAMBLE_DELAY_SYMBOLS * symbol;
+}
+
+bool air_radio_start_cad(air_radio_t *radio)
+{
+    return sx127x_start_cad(&radio->sx127x);
+}
+
+bool air_radio_is_cad_done(air_radio_t *radio, bool *detected)
+{
+    return sx127x_is_cad_done(&radio->sx127x, detected);
+}
+
 bool air_radio_is_rx_in_progress(air_radio_t *radio)
 {
     return sx127x_is_rx_in_progress(&radio->sx127x);
@@ -186,16 +345,19 @@ bool air_radio_is_rx_in_progress(air_radio_t *radio)
 
 void air_radio_set_payload_size(air_radio_t *radio, size_t size)
 {
+    sx127x_set_fsk_fec(&radio->sx127x, air_radio_sx127x_fsk_fec(radio, size));
     sx127x_set_payload_size(&radio->sx127x, size);
 }
 
 size_t air_radio_read(air_radio_t *radio, void *buf, size_t size)
 {
+    sx127x_set_fsk_fec(&radio->sx127x, air_radio_sx127x_fsk_fec(radio, size));
     return sx127x_read(&radio->sx127x, buf, size);
 }
 
 void air_radio_send(air_radio_t *radio, const void *buf, size_t size)
 {
+    sx127x_set_fsk_fec(&radio->sx127x, air_radio_sx127x_fsk_fec(radio, size));
     sx127x_send(&radio->sx127x, buf, size);
 }
 
@@ -219,10 +381,8 @@ void air_radio_shutdown(air_radio_t *radio)
     sx127x_shutdown(&radio->sx127x);
 }
 
-time_micros_t air_radio_cycle_time(air_radio_t *radio, air_mode_e mode)
+static time_micros_t air_radio_sx127x_fixed_cycle_time(air_mode_e mode)
 {
-    UNUSED(radio);
-
     switch (mode)
     {
     case AIR_MODE_1:
@@ -240,6 +400,59 @@ time_micros_t air_radio_cycle_time(air_radio_t *radio, air_mode_e mode)
     return 0;
 }
 
+time_micros_t air_radio_cycle_time(air_radio_t *radio, air_mode_e mode, const air_packet_layout_t *layout)
+{
+    ASSERT(air_mode_is_valid(mode));
+
+    if (!radio->airtime_cycles)
+    {
+        return air_radio_sx127x_fixed_cycle_time(mode);
+    }
+    if (radio->airtime.layout != layout || radio->airtime.mode != mode)
+    {
+        // Each cycle has an uplink packet and its reply, each one
+        // preceded by the processing on the receiving end and the
+        // turnaround of the sender.
+        radio->airtime.mode = mode;
+        radio->airtime.layout = layout;
+        radio->airtime.uplink = air_radio_sx127x_time_on_air(radio, mode, air_tx_packet_size(layout));
+        radio->airtime.downlink = air_radio_sx127x_time_on_air(radio, mode, air_rx_packet_size(layout));
+        time_micros_t cycle = radio->airtime.uplink + radio->airtime.downlink +
+                              2 * (AIR_RADIO_SX127X_TURNAROUND_US + AIR_RADIO_SX127X_PROCESSING_US);
+        // Round up to 100us. This is the minimum safe cycle, so it's used
+        // even if it's longer than the fixed one. The layouts are sized
+        // to avoid that.
+        radio->airtime.cycle = (cycle + 99) / 100 * 100;
+    }
+    return radio->airtime.cycle;
+}
+
+// In implicit header mode, LoRa packets are sent in blocks of 4 * SF bits
+// (SF = spreading factor), so we can fill the padding of the last block
+// without changing the airtime. For SF7, 8 byte uplink and 5 byte
+// downlink packets leave room for 1 extra byte each. In FSK mode, the
+// layout is the biggest one that still fits both packets, turnarounds
+// and processing in the 6.67ms cycle (see air_radio_cycle_time()), which
+// depends on the FEC expansion. With FEC_NIBBLE, 4 + 7 bytes give 6.5ms.
+static const air_packet_layout_t air_radio_sx127x_layouts[] = {
+    [AIR_MODE_1] = {.uplink_data_bytes = 4, .downlink_data_bytes = 7},
+    [AIR_MODE_2] = {.uplink_data_bytes = 3, .downlink_data_bytes = 4},
+    [AIR_MODE_3] = {.uplink_data_bytes = 5, .downlink_data_bytes = 5},
+    [AIR_MODE_4] = {.uplink_data_bytes = 2, .downlink_data_bytes = 6},
+    [AIR_MODE_5] = {.uplink_data_bytes = 3, .downlink_data_bytes = 7},
+};
+
+const air_packet_layout_t *air_radio_packet_layout(air_radio_t *radio, air_mode_e mode)
+{
+    ASSERT(air_mode_is_valid(mode));
+
+    if (mode == AIR_MODE_1 && radio->fec_reed_solomon)
+    {
+        return &air_radio_sx127x_fsk_reed_solomon_layout;
+    }
+    return &air_radio_sx127x_layouts[mode];
+}
+
 time_micros_t air_radio_tx_failsafe_interval(air_radio_t *radio, air_mode_e mode)
 {
     return air_radio_rx_failsafe_interval(radio, mode);
@@ -2,7 +2,23 @@
 
 #include "io/sx127x.h"
 
+#include "util/profiler.h"
+
 typedef struct air_radio_s
 {
     sx127x_t sx127x;
+    sx127x_freq_t hops[AIR_NUM_HOPPING_FREQS];
+    profiler_stats_t *hop_stats;
+    bool fec_reed_solomon;
+    bool fec_interleaving;
+    bool airtime_cycles;
+    struct
+    {
+        // Cache for air_radio_cycle_time(), invalid when layout is NULL
+        air_mode_e mode;
+        const air_packet_layout_t *layout;
+        time_micros_t uplink;
+        time_micros_t downlink;
+        time_micros_t cycle;
+    } airtime;
 } air_radio_t;
\ No newline at end of file
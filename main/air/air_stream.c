@@ -1,4 +1,7 @@
+#include <string.h>
+
 #include <hal/log.h>
+#include <hal/rand.h>
 
 #include "air/air_cmd.h"
 
@@ -17,6 +20,33 @@ static const char *TAG = "Air.Stream";
 #define AIR_STREAM_FULL_CHANELL_MASK 0
 #define AIR_STREAM_2_BIT_CHANEL_MASK (AIR_STREAM_TELEMETRY_MASK | AIR_STREAM_CMD_MASK)
 #define AIR_STREAM_DATA_TYPE_MASK AIR_STREAM_2_BIT_CHANEL_MASK
+// Full channel frames only use channel numbers < 16, so their type byte
+// never has 0x20 set. We use it for packed channel frames.
+#define AIR_STREAM_PACKED_CHANNELS_MASK 0x20
+#define AIR_STREAM_PACKED_CHANNELS_RESERVED_MASK 0x10
+#define AIR_STREAM_CHANNEL_CODE_FULL 3
+
+// Telemetry ID reserved for batches of telemetry values, which are sent
+// as [type byte][count] followed by count [index][value] pairs.
+#define AIR_STREAM_TELEMETRY_BATCH_ID 0x3f
+#define AIR_STREAM_TELEMETRY_BATCH (AIR_STREAM_TELEMETRY_MASK | AIR_STREAM_TELEMETRY_BATCH_ID)
+_Static_assert(TELEMETRY_UPLINK_COUNT < AIR_STREAM_TELEMETRY_BATCH_ID, "telemetry batch ID overlaps uplink telemetry");
+_Static_assert(TELEMETRY_DOWNLINK_COUNT < AIR_STREAM_TELEMETRY_BATCH_ID, "telemetry batch ID overlaps downlink telemetry");
+// Telemetry IDs >= 32 are not used, so 0x20 in the type byte (or in the
+// index in a batch) marks a delta coded value. See air_telemetry_delta.h.
+#define AIR_STREAM_TELEMETRY_DELTA_MASK 0x20
+#define AIR_STREAM_TELEMETRY_IDX_MASK 0x1f
+_Static_assert(TELEMETRY_DOWNLINK_COUNT <= AIR_STREAM_TELEMETRY_IDX_MASK, "delta coded telemetry overlaps telemetry batch ID");
+
+#define AIR_STREAM_AUX_CHANNELS_NUM (RC_CHANNELS_NUM - 4)
+_Static_assert(AIR_STREAM_AUX_CHANNELS_NUM <= 12, "packed channels mask can't fit all aux channels");
+
+#define AIR_STREAM_FRAME_SIZE_UNKNOWN 0
+#define AIR_STREAM_FRAME_SIZE_INVALID -1
+
+// COBS blocks hold up to 254 bytes. Codes are XOR'ed with
+// AIR_DATA_START_STOP, so they never match the delimiter.
+#define AIR_STREAM_COBS_MAX_CODE 0xFF
 
 static bool air_stream_sends_uplink(air_stream_t *s)
 {
@@ -63,288 +93,1967 @@ static bool air_stream_cmd_decode(air_cmd_e cmd, const void *data, size_t size,
     return true;
 }
 
-static void air_stream_decode(air_stream_t *s, time_micros_t now)
+// Returns the total size of an encoded command (including the
+// command byte) given the cmd and the first size bytes that follow it.
+// See air_stream_input_frame_size() for the return values.
+static int air_stream_cmd_frame_size(uint8_t cmd, const uint8_t *data, size_t size)
 {
-    uint8_t buf[AIR_STREAM_MAX_PAYLOAD_SIZE];
-    unsigned p = 0;
-    uint8_t c;
-    ring_buffer_t *rb = &s->input_buf;
-    while (ring_buffer_pop(rb, &c))
+    int data_size = air_cmd_size(cmd);
+    if (data_size >= AIR_STREAM_MAX_PAYLOAD_SIZE)
     {
-        if (c == AIR_DATA_BYTE_STUFF)
-        {
-            if (!ring_buffer_pop(rb, &c))
-            {
-                // We missed a byte. Ignore this payload.
-                ring_buffer_empty(rb);
-                return;
-            }
-            c ^= AIR_DATA_XOR;
-        }
-        buf[p++] = c;
-        if (p >= sizeof(buf))
-        {
-            // We got more data than expected. Maybe a newer protocol
-            // which we don't understand yet?
-            ring_buffer_empty(rb);
-            return;
-        }
+        // Unknown command
+        return AIR_STREAM_FRAME_SIZE_INVALID;
     }
-    // Now we got some decoding to do
-    if (p > 0)
+    if (data_size >= 0)
     {
-        unsigned chn;
-        switch (buf[0] & AIR_STREAM_DATA_TYPE_MASK)
-        {
-        case AIR_STREAM_2_BIT_CHANEL_MASK:
-            // 2 bit encoded channel. 0 -> min, 1 -> center, 2 -> max, 3 -> invalid
-            chn = ((buf[0] & ~AIR_STREAM_2_BIT_CHANEL_MASK) >> 2) + 4;
-            if (chn < RC_CHANNELS_NUM)
-            {
-                unsigned value;
-                switch (buf[0] & 3)
-                {
-                case 0:
-                    value = RC_CHANNEL_MIN_VALUE;
-                    break;
-                case 1:
-                    value = RC_CHANNEL_CENTER_VALUE;
-                    break;
-                case 2:
-                    value = RC_CHANNEL_MAX_VALUE;
-                    break;
-                default:
-                    return;
-                }
-                s->channel(s->user, chn, value, now);
-            }
-            break;
-        case AIR_STREAM_TELEMETRY_MASK:
+        return 1 + data_size;
+    }
+    uint32_t explicit_size;
+    int uvarint_size = uvarint_decode32(&explicit_size, data, size);
+    if (uvarint_size <= 0)
+    {
+        // uvarint32 needs at most 5 bytes
+        return size > 5 ? AIR_STREAM_FRAME_SIZE_INVALID : AIR_STREAM_FRAME_SIZE_UNKNOWN;
+    }
+    if (explicit_size > AIR_STREAM_MAX_PAYLOAD_SIZE)
+    {
+        return AIR_STREAM_FRAME_SIZE_INVALID;
+    }
+    return 1 + uvarint_size + explicit_size;
+}
+
+// Channels are sent as a 2 bit code, plus AIR_CHANNEL_BITS for the value
+// when the code is AIR_STREAM_CHANNEL_CODE_FULL.
+static unsigned air_stream_channel_code(unsigned val)
+{
+    switch (val)
+    {
+    case RC_CHANNEL_MIN_VALUE:
+        return 0;
+    case RC_CHANNEL_CENTER_VALUE:
+        return 1;
+    case RC_CHANNEL_MAX_VALUE:
+        return 2;
+    }
+    return AIR_STREAM_CHANNEL_CODE_FULL;
+}
+
+static unsigned air_stream_channel_code_value(unsigned code)
+{
+    switch (code)
+    {
+    case 0:
+        return RC_CHANNEL_MIN_VALUE;
+    case 1:
+        return RC_CHANNEL_CENTER_VALUE;
+    case 2:
+        return RC_CHANNEL_MAX_VALUE;
+    }
+    UNREACHABLE();
+    return 0;
+}
+
+// Bits are packed MSB first. buf must be zeroed before writing.
+static void air_stream_put_bits(uint8_t *buf, unsigned *pos, unsigned val, unsigned nbits)
+{
+    for (unsigned ii = nbits; ii > 0; ii--, (*pos)++)
+    {
+        if (val & (1 << (ii - 1)))
         {
-            int telemetry_id = buf[0];
-            // If the stream sends data uplink, it receives downlink telemetry
-            if (air_stream_sends_uplink(s))
-            {
-                // Downlink telemetry IDs don't have the most
-                // significant bit set.
-                telemetry_id &= ~AIR_STREAM_TELEMETRY_MASK;
-            }
-            size_t telemetry_size = telemetry_get_data_size(telemetry_id);
-            if (telemetry_size == 0)
-            {
-                // must zero terminated
-                if (buf[p - 1] != 0)
-                {
-                    // invalid data
-                    LOG_W(TAG, "Discarding variable sized telemetry data, not zero terminated");
-                    break;
-                }
-                telemetry_size = p - 1;
-            }
-            else if (telemetry_size != p - 1)
-            {
-                // invalida data
-                LOG_W(TAG, "Discarding fixed sized telemetry data (id = %d), expected %u != %d actual",
-                      telemetry_id, telemetry_size, p - 1);
-                LOG_BUFFER_W(TAG, &buf[1], p - 1);
-                break;
-            }
-            s->telemetry(s->user, telemetry_id, &buf[1], telemetry_size, now);
-            break;
+            buf[*pos / 8] |= 0x80 >> (*pos % 8);
         }
-        case AIR_STREAM_CMD_MASK:
+    }
+}
+
+static unsigned air_stream_get_bits(const uint8_t *buf, unsigned *pos, unsigned nbits)
+{
+    unsigned val = 0;
+    for (unsigned ii = 0; ii < nbits; ii++, (*pos)++)
+    {
+        val = (val << 1) | ((buf[*pos / 8] >> (7 - *pos % 8)) & 1);
+    }
+    return val;
+}
+
+// Packed channels frame: the type byte carries the 4 most significant
+// bits of the aux channel mask (bit 0 is channel 4), the next byte has
+// the 8 remaining ones. Then comes a 2 bit code (plus the full value if
+// needed) for each channel in the mask, in ascending order.
+static unsigned air_stream_packed_channels_mask(const uint8_t *buf)
+{
+    return (buf[0] & 0x0f) << 8 | buf[1];
+}
+
+// See air_stream_input_frame_size() for the return values.
+static int air_stream_packed_channels_frame_size(const uint8_t *buf, unsigned p)
+{
+    if (buf[0] & AIR_STREAM_PACKED_CHANNELS_RESERVED_MASK)
+    {
+        return AIR_STREAM_FRAME_SIZE_INVALID;
+    }
+    if (p < 2)
+    {
+        return AIR_STREAM_FRAME_SIZE_UNKNOWN;
+    }
+    unsigned mask = air_stream_packed_channels_mask(buf);
+    if (mask == 0 || mask >> AIR_STREAM_AUX_CHANNELS_NUM)
+    {
+        return AIR_STREAM_FRAME_SIZE_INVALID;
+    }
+    unsigned pos = 16;
+    for (unsigned ii = 0; ii < AIR_STREAM_AUX_CHANNELS_NUM; ii++)
+    {
+        if (mask & (1 << ii))
         {
-            uint8_t cmd = buf[0] & ~AIR_STREAM_CMD_MASK;
-            const void *cmd_data;
-            size_t cmd_data_size;
-            if (!air_stream_cmd_decode(cmd, &buf[1], p - 1, &cmd_data, &cmd_data_size))
+            if (pos + 2 > p * 8)
             {
-                LOG_W(TAG, "Discarding CMD %u", cmd);
-                if (p > 1)
-                {
-                    LOG_BUFFER_W(TAG, &buf[1], p - 1);
-                }
-                break;
+                return AIR_STREAM_FRAME_SIZE_UNKNOWN;
             }
-            s->cmd(s->user, cmd, cmd_data, cmd_data_size, now);
-            break;
-        }
-        case AIR_STREAM_FULL_CHANELL_MASK:
-            if (p >= 2)
+            if (air_stream_get_bits(buf, &pos, 2) == AIR_STREAM_CHANNEL_CODE_FULL)
             {
-                // It's a channel. First AIR_CHANNEL_BITS from the right are channel value,
-                // then comes channel (number - 4)
-                chn = (buf[0] >> (AIR_CHANNEL_BITS - 8)) + 4;
-                if (chn < RC_CHANNELS_NUM)
-                {
-                    unsigned air_value = (buf[0] << 8 | buf[1]) & ((1 << AIR_CHANNEL_BITS) - 1);
-                    unsigned value = RC_CHANNEL_DECODE_FROM_BITS(air_value, AIR_CHANNEL_BITS);
-                    s->channel(s->user, chn, value, now);
-                }
+                pos += AIR_CHANNEL_BITS;
             }
-            break;
         }
     }
+    return (pos + 7) / 8;
 }
 
-void air_stream_init(air_stream_t *s, air_stream_channel_f channel, air_stream_telemetry_f telemetry, air_stream_cmd_f cmd, void *user)
+// Returns the telemetry ID for an index received in a batch or
+// in a delta coded value, -1 if it's not valid.
+static int air_stream_telemetry_input_id(air_stream_t *s, uint8_t idx)
 {
-    s->channel = channel;
-    s->telemetry = telemetry;
-    s->cmd = cmd;
-    s->user = user;
-    s->input_in_sync = false;
-    s->input_seq = 0;
-    RING_BUFFER_INIT(&s->input_buf, uint8_t, AIR_STREAM_INPUT_BUFFER_CAPACITY);
-    RING_BUFFER_INIT(&s->output_buf, uint8_t, AIR_STREAM_OUTPUT_BUFFER_CAPACITY);
+    // If the stream sends data uplink, it receives downlink telemetry
+    if (air_stream_sends_uplink(s))
+    {
+        return idx < TELEMETRY_DOWNLINK_COUNT ? TELEMETRY_DOWNLINK_ID(idx) : -1;
+    }
+    return idx < TELEMETRY_UPLINK_COUNT ? TELEMETRY_UPLINK_ID(idx) : -1;
 }
 
-void air_stream_feed_input(air_stream_t *s, unsigned seq, const void *data, size_t size, time_micros_t now)
+#if defined(USE_AIR_STREAM_TELEMETRY_DELTA)
+// Size of the delta coded value at buf, starting with the byte with the
+// index. See air_stream_input_frame_size() for the return values.
+static int air_stream_telemetry_delta_frame_size(air_stream_t *s, const uint8_t *buf, unsigned p)
 {
-    if (++s->input_seq != seq)
+    unsigned idx = buf[0] & AIR_STREAM_TELEMETRY_IDX_MASK;
+    int size = air_telemetry_delta_encoded_size(&s->telemetry_delta.decoder, idx, &buf[1], p - 1);
+    if (size < 0)
     {
-        LOG_D(TAG, "Resetting air stream sequency at %u", seq);
-        s->input_in_sync = false;
-        s->input_seq = seq;
-        ring_buffer_empty(&s->input_buf);
+        return AIR_STREAM_FRAME_SIZE_INVALID;
+    }
+    if (size == 0)
+    {
+        return AIR_STREAM_FRAME_SIZE_UNKNOWN;
     }
+    return 1 + size;
+}
+#endif
 
-    const uint8_t *buf = data;
-    for (size_t ii = 0; ii < size; ii++)
+// See air_stream_input_frame_size() for the return values.
+static int air_stream_telemetry_batch_frame_size(air_stream_t *s, const uint8_t *buf, unsigned p)
+{
+    if (p < 2)
     {
-        uint8_t c = buf[ii];
-        if (!s->input_in_sync)
+        return AIR_STREAM_FRAME_SIZE_UNKNOWN;
+    }
+    unsigned count = buf[1];
+    if (count == 0)
+    {
+        return AIR_STREAM_FRAME_SIZE_INVALID;
+    }
+    unsigned pos = 2;
+    for (unsigned ii = 0; ii < count; ii++)
+    {
+        if (pos >= p)
         {
-            s->input_in_sync = c == AIR_DATA_START_STOP;
-            continue;
+            return AIR_STREAM_FRAME_SIZE_UNKNOWN;
         }
-        if (c == AIR_DATA_START_STOP)
+#if defined(USE_AIR_STREAM_TELEMETRY_DELTA)
+        if (buf[pos] & AIR_STREAM_TELEMETRY_DELTA_MASK)
         {
-            if (ring_buffer_count(&s->input_buf) > 0)
+            int size = air_stream_telemetry_delta_frame_size(s, &buf[pos], p - pos);
+            if (size <= 0)
             {
-                air_stream_decode(s, now);
+                return size;
             }
+            pos += size;
             continue;
         }
-        ring_buffer_push(&s->input_buf, &c);
+#endif
+        int id = air_stream_telemetry_input_id(s, buf[pos]);
+        // Only fixed size values can be batched
+        size_t size = id >= 0 ? telemetry_get_data_size(id) : 0;
+        if (size == 0)
+        {
+            return AIR_STREAM_FRAME_SIZE_INVALID;
+        }
+        pos += 1 + size;
     }
+    return pos;
 }
 
-static size_t air_stream_feed_output(air_stream_t *s, const void *data, size_t size)
+// Variable sized commands (MSP, RMP, reliable segments...) carry arbitrary
+// binary data, which might double in size with byte stuffing. When both
+// ends support it, everything after their type byte is COBS encoded
+// instead, which caps the overhead at 1 byte per 254. Type bytes never
+// need stuffing, so the frame type is known before choosing the framing.
+static bool air_stream_type_uses_cobs(bool cobs, uint8_t type)
 {
-    size_t n = 0;
-    const uint8_t *p = data;
-    for (unsigned ii = 0; ii < size; ii++, p++)
+    return cobs && (type & AIR_STREAM_DATA_TYPE_MASK) == AIR_STREAM_CMD_MASK &&
+           air_cmd_size(type & ~AIR_STREAM_CMD_MASK) < 0;
+}
+
+// Frames are written directly into the free space of the queue for
+// their class, and only committed if the whole frame fits.
+typedef struct air_stream_frame_writer_s
+{
+    air_stream_class_e cls;
+    ring_buffer_span_t spans[RING_BUFFER_MAX_SPANS];
+    size_t spans_count;
+    size_t span;
+    size_t pos;
+    size_t n;
+    bool overflow;
+    bool cobs_enabled;  // Wether the stream uses COBS for variable sized commands
+    bool has_type;      // Wether the type byte has been written
+    bool cobs;          // Wether the rest of the frame is COBS encoded
+    uint8_t *cobs_code; // Code byte for the current block, NULL if there's no block
+    uint8_t cobs_len;   // Bytes in the current block, including its code
+} air_stream_frame_writer_t;
+
+// Returns a pointer to the written byte or NULL if it didn't fit
+static uint8_t *air_stream_frame_put(air_stream_frame_writer_t *w, uint8_t c)
+{
+    if (w->overflow)
     {
-        uint8_t c = *p;
-        if (c == AIR_DATA_START_STOP || c == AIR_DATA_BYTE_STUFF)
+        return NULL;
+    }
+    while (w->pos == w->spans[w->span].count)
+    {
+        if (++w->span >= w->spans_count)
         {
-            n++;
-            c ^= AIR_DATA_XOR;
-            uint8_t bs = AIR_DATA_BYTE_STUFF;
-            ring_buffer_push(&s->output_buf, &bs);
+            w->overflow = true;
+            return NULL;
         }
-        ring_buffer_push(&s->output_buf, &c);
-        n++;
+        w->pos = 0;
     }
-    return n;
+    uint8_t *ptr = &((uint8_t *)w->spans[w->span].ptr)[w->pos++];
+    *ptr = c;
+    w->n++;
+    return ptr;
 }
 
-size_t air_stream_feed_output_channel(air_stream_t *s, unsigned chn, unsigned val)
+static void air_stream_frame_cobs_begin_block(air_stream_frame_writer_t *w)
 {
-    // Maximum channel number is now 20 since we can use
-    // as much as 4 bits for 2-bit channel representation.
-    ASSERT(chn < 20);
+    // Placeholder, the code is known once the block ends
+    w->cobs_code = air_stream_frame_put(w, 0);
+    w->cobs_len = 1;
+}
 
-    uint8_t ss = AIR_DATA_START_STOP;
-    ring_buffer_push(&s->output_buf, &ss);
-    uint8_t buf[2];
-    size_t bs;
-    unsigned n = (chn - 4);
-    unsigned air_value;
-    switch (val)
+static void air_stream_frame_cobs_end_block(air_stream_frame_writer_t *w)
+{
+    if (w->cobs_code)
     {
-    case RC_CHANNEL_MIN_VALUE:
-        buf[0] = AIR_STREAM_2_BIT_CHANEL_MASK | (n << 2);
-        bs = 1;
-        break;
-    case RC_CHANNEL_CENTER_VALUE:
-        buf[0] = AIR_STREAM_2_BIT_CHANEL_MASK | (n << 2) | 1;
-        bs = 1;
-        break;
-    case RC_CHANNEL_MAX_VALUE:
-        buf[0] = AIR_STREAM_2_BIT_CHANEL_MASK | (n << 2) | 2;
-        bs = 1;
-        break;
-    default:
-        air_value = RC_CHANNEL_ENCODE_TO_BITS(val, AIR_CHANNEL_BITS);
-        buf[0] = (n << (AIR_CHANNEL_BITS - 8)) | air_value >> 8;
-        buf[1] = air_value & 0xff;
-        bs = 2;
-        break;
+        *w->cobs_code = w->cobs_len ^ AIR_DATA_START_STOP;
     }
-    return 1 + air_stream_feed_output(s, buf, bs);
+    w->cobs_code = NULL;
 }
 
-static size_t air_stream_feed_output_telemetry(air_stream_t *s, telemetry_t *t, int id, uint8_t tid)
+static void air_stream_frame_cobs_put(air_stream_frame_writer_t *w, uint8_t c)
 {
-    size_t data_size = telemetry_get_data_size(id);
-    if (data_size == 0)
+    if (!w->cobs_code)
     {
-        ASSERT(telemetry_get_type(id) == TELEMETRY_TYPE_STRING);
-        data_size = strlen(t->val.s) + 1;
+        air_stream_frame_cobs_begin_block(w);
+    }
+    if (c == AIR_DATA_START_STOP)
+    {
+        // Implied by the end of the block. The decoder only outputs it
+        // when it sees the next code, so we need a new block right away.
+        air_stream_frame_cobs_end_block(w);
+        air_stream_frame_cobs_begin_block(w);
+        return;
+    }
+    air_stream_frame_put(w, c);
+    if (++w->cobs_len == AIR_STREAM_COBS_MAX_CODE)
+    {
+        // Full block, no implied delimiter after it
+        air_stream_frame_cobs_end_block(w);
     }
-    uint8_t ss = AIR_DATA_START_STOP;
-    ring_buffer_push(&s->output_buf, &ss);
-    size_t n = air_stream_feed_output(s, &tid, sizeof(tid));
-    return 1 + n + air_stream_feed_output(s, &t->val, data_size);
 }
 
-size_t air_stream_feed_output_uplink_telemetry(air_stream_t *s, telemetry_t *t, telemetry_uplink_id_e id)
+static void air_stream_frame_begin(air_stream_t *s, air_stream_class_e cls, air_stream_frame_writer_t *w)
 {
-    ASSERT(air_stream_sends_uplink(s));
-    // Uplink telemetry IDs have MSB (0x80) set, so the ID sent over the air
-    // is exactly its ID from the enum.
-    return air_stream_feed_output_telemetry(s, t, id, id);
+    air_stream_class_t *c = &s->classes[cls];
+    w->cls = cls;
+    w->spans_count = ring_buffer_reserve(c->queue, w->spans);
+    w->span = 0;
+    w->pos = 0;
+    w->n = 0;
+    w->overflow = w->spans_count == 0 || ring_buffer_free(&c->frames) == 0;
+    w->cobs_enabled = s->cobs;
+    w->has_type = false;
+    w->cobs = false;
+    w->cobs_code = NULL;
+    air_stream_frame_put(w, AIR_DATA_START_STOP);
 }
 
-size_t air_stream_feed_output_downlink_telemetry(air_stream_t *s, telemetry_t *t, telemetry_downlink_id_e id)
+static void air_stream_frame_write(air_stream_frame_writer_t *w, const void *data, size_t size)
 {
-    ASSERT(air_stream_sends_downlink(s));
-    // Downlink telemetry has MSB (0x80) unset, so the ID sent over the air
-    // has to be OR'ed with AIR_STREAM_TELEMETRY_MASK.
-    return air_stream_feed_output_telemetry(s, t, id, id | AIR_STREAM_TELEMETRY_MASK);
+    const uint8_t *p = data;
+    for (unsigned ii = 0; ii < size && !w->overflow; ii++, p++)
+    {
+        uint8_t c = *p;
+        if (w->cobs)
+        {
+            air_stream_frame_cobs_put(w, c);
+            continue;
+        }
+        if (c == AIR_DATA_START_STOP || c == AIR_DATA_BYTE_STUFF)
+        {
+            air_stream_frame_put(w, AIR_DATA_BYTE_STUFF);
+            c ^= AIR_DATA_XOR;
+        }
+        air_stream_frame_put(w, c);
+        if (!w->has_type)
+        {
+            w->has_type = true;
+            w->cobs = air_stream_type_uses_cobs(w->cobs_enabled, c);
+        }
+    }
 }
 
-size_t air_stream_feed_output_cmd(air_stream_t *s, uint8_t cmd, const void *data, size_t size)
+// Returns the number of bytes written to the queue,
+// zero if the frame didn't fit.
+static size_t air_stream_frame_end(air_stream_t *s, air_stream_frame_writer_t *w)
 {
-    // We only have 6 bits for CMD encoding
-    ASSERT(cmd < 64);
-    uint8_t ss = AIR_DATA_START_STOP;
-    ring_buffer_push(&s->output_buf, &ss);
+    air_stream_class_t *c = &s->classes[w->cls];
+    air_stream_frame_cobs_end_block(w);
+    if (w->overflow)
+    {
+        LOG_W(TAG, "Output queue %d full, dropping frame", w->cls);
+        c->stats.dropped++;
+        return 0;
+    }
+    ring_buffer_commit(c->queue, w->n);
+    air_stream_queued_frame_t frame = {
+        .size = w->n,
+        .queued_at = time_micros_now(),
+    };
+    ring_buffer_push(&c->frames, &frame);
+    c->stats.depth += w->n;
+    c->stats.max_depth = MAX(c->stats.max_depth, c->stats.depth);
+    return w->n;
+}
+
+static air_stream_class_e air_stream_cmd_class(uint8_t cmd)
+{
+    switch (cmd)
+    {
+    case AIR_CMD_MSP:
+    case AIR_CMD_RELIABLE_SEGMENT:
+        return AIR_STREAM_CLASS_MSP;
+    case AIR_CMD_RMP:
+        return AIR_STREAM_CLASS_RMP;
+    }
+    return AIR_STREAM_CLASS_CONTROL;
+}
+
+static size_t air_stream_write_cmd_frame(air_stream_t *s, uint8_t cmd, const void *data, size_t size)
+{
+    air_stream_frame_writer_t w;
+    air_stream_frame_begin(s, air_stream_cmd_class(cmd), &w);
     uint8_t cid = cmd | AIR_STREAM_CMD_MASK;
-    size_t n = air_stream_feed_output(s, &cid, sizeof(cid));
+    air_stream_frame_write(&w, &cid, sizeof(cid));
     // Check if the command needs explicit size
     if (air_cmd_size(cmd) < 0)
     {
         uint8_t size_buf[9];
         int used = uvarint_encode32(size_buf, sizeof(size_buf), size);
-        n += air_stream_feed_output(s, size_buf, used);
+        air_stream_frame_write(&w, size_buf, used);
     }
-    return 1 + n + air_stream_feed_output(s, data, size);
+    air_stream_frame_write(&w, data, size);
+    return air_stream_frame_end(s, &w);
 }
 
-size_t air_stream_output_count(const air_stream_t *s)
+#if defined(USE_AIR_STREAM_RELIABLE)
+
+// Reliable sub-channel: selective repeat ARQ for MSP and RMP.
+//
+// Commands are serialized as [cmd][uvarint size][data] into tx_buf, which
+// is split into segments of up to AIR_STREAM_RELIABLE_SEGMENT_SIZE bytes
+// (less with small packets) sent as AIR_CMD_RELIABLE_SEGMENT frames in the
+// MSP class. The receiver acknowledges them with AIR_CMD_RELIABLE_ACK, which
+// carries the next segment it expects plus a bitmap of the segments received
+// out of order. Only the segments missing
+// from the ACK are retransmitted, either after a timeout estimated from the
+// RTT or right away when a segment sent after them has been acknowledged.
+//
+// Each end picks a random session when starting. Segments carry the syn
+// flag until the first ACK arrives, which lets the receiver adopt the
+// session. If the receiver gets a segment from a session it doesn't know
+// without syn (e.g. it restarted), it replies with a reset ACK and the
+// sender starts over with a new session. Since sessions are only 8 bits, a
+// restarted sender might pick the session the receiver already has, so
+// syn segments also carry a 32 bit nonce picked by the sender at startup.
+// The receiver starts over when it sees a syn segment with a nonce it
+// doesn't know and acknowledges syn segments with AIR_CMD_RELIABLE_SYN_ACK,
+// which echoes the nonce. Until it gets its first ACK, the sender ignores
+// the ones without its nonce, since they might be for the previous sender.
+
+#define AIR_STREAM_RELIABLE_SESSION_NONE 0x100
+// Timeouts are measured in output packets
+#define AIR_STREAM_RELIABLE_INITIAL_RTO 32
+#define AIR_STREAM_RELIABLE_MIN_RTO 4
+#define AIR_STREAM_RELIABLE_MAX_RTO 255
+// Maximum number of packets per segment
+#define AIR_STREAM_RELIABLE_SEGMENT_PACKETS 6
+// Bytes added to each segment: type, size, header, delimiter and COBS code
+#define AIR_STREAM_RELIABLE_SEGMENT_OVERHEAD 6
+// Packets considered by the loss estimate
+#define AIR_STREAM_RELIABLE_LOSS_WINDOW 512
+
+typedef enum
 {
-    return ring_buffer_count(&s->output_buf);
+    AIR_STREAM_RELIABLE_TX_FREE = 0,
+    AIR_STREAM_RELIABLE_TX_PENDING,   // Needs to be retransmitted
+    AIR_STREAM_RELIABLE_TX_IN_FLIGHT, // Waiting for ACK
+    AIR_STREAM_RELIABLE_TX_ACKED,
+} air_stream_reliable_tx_state_e;
+
+static unsigned air_stream_reliable_seq_distance(unsigned from, unsigned to)
+{
+    return (to - from) & (AIR_STREAM_RELIABLE_SEQ_COUNT - 1);
 }
 
-void air_stream_reset_output(air_stream_t *s)
+static unsigned air_stream_reliable_seq_add(unsigned seq, unsigned n)
+{
+    return (seq + n) & (AIR_STREAM_RELIABLE_SEQ_COUNT - 1);
+}
+
+static air_stream_reliable_tx_slot_t *air_stream_reliable_tx_slot(air_stream_reliable_t *r, unsigned seq)
+{
+    return &r->tx_slots[seq % AIR_STREAM_RELIABLE_WINDOW_SIZE];
+}
+
+static air_stream_reliable_rx_slot_t *air_stream_reliable_rx_slot(air_stream_reliable_t *r, unsigned seq)
+{
+    return &r->rx_slots[seq % AIR_STREAM_RELIABLE_WINDOW_SIZE];
+}
+
+static void air_stream_reliable_tx_reset(air_stream_reliable_t *r, uint8_t session)
+{
+    r->tx_session = session;
+    r->tx_synced = false;
+    r->tx_base_seq = 0;
+    r->tx_next_seq = 0;
+    r->tx_in_flight = 0;
+    r->tx_segmented = 0;
+    memset(r->tx_slots, 0, sizeof(r->tx_slots));
+    ring_buffer_empty(&r->tx_buf);
+}
+
+static void air_stream_reliable_rx_reset(air_stream_reliable_t *r, uint16_t session)
+{
+    r->rx_session = session;
+    r->rx_next_seq = 0;
+    r->rx_syn = false;
+    for (int ii = 0; ii < AIR_STREAM_RELIABLE_WINDOW_SIZE; ii++)
+    {
+        r->rx_slots[ii].received = false;
+    }
+    r->rx_msg_size = 0;
+    r->rx_msg_expected_size = AIR_STREAM_FRAME_SIZE_UNKNOWN;
+}
+
+static void air_stream_reliable_init(air_stream_reliable_t *r)
+{
+    r->enabled = false;
+    r->packets = 0;
+    r->tx_srtt = 0;
+    r->tx_rto = AIR_STREAM_RELIABLE_INITIAL_RTO;
+    r->tx_loss_packets = 0;
+    r->tx_loss_segments = 0;
+    RING_BUFFER_INIT(&r->tx_buf, uint8_t, AIR_STREAM_RELIABLE_TX_BUFFER_CAPACITY);
+    r->tx_nonce = hal_rand_u32();
+    air_stream_reliable_tx_reset(r, r->tx_nonce);
+    air_stream_reliable_rx_reset(r, AIR_STREAM_RELIABLE_SESSION_NONE);
+    r->rx_nonce = 0;
+    r->rx_ack_pending = false;
+    r->rx_reset_pending = false;
+    memset(&r->stats, 0, sizeof(r->stats));
+    r->stats.rto = r->tx_rto;
+}
+
+static size_t air_stream_reliable_feed(air_stream_reliable_t *r, uint8_t cmd, const void *data, size_t size)
+{
+    uint8_t hdr[1 + 5];
+    size_t hdr_size = 1;
+    hdr[0] = cmd;
+    if (air_cmd_size(cmd) < 0)
+    {
+        hdr_size += uvarint_encode32(&hdr[1], sizeof(hdr) - 1, size);
+    }
+    if (ring_buffer_free(&r->tx_buf) < hdr_size + size)
+    {
+        LOG_W(TAG, "Reliable buffer full, dropping CMD %u", cmd);
+        return 0;
+    }
+    ring_buffer_push_n(&r->tx_buf, hdr, hdr_size);
+    if (size > 0)
+    {
+        ring_buffer_push_n(&r->tx_buf, data, size);
+    }
+    return hdr_size + size;
+}
+
+static void air_stream_reliable_update_rto(air_stream_reliable_t *r, uint16_t rtt)
+{
+    // tx_srtt has 3 bits of fraction, so this is srtt = 7/8 * srtt + 1/8 * rtt
+    if (r->tx_srtt == 0)
+    {
+        r->tx_srtt = rtt << 3;
+    }
+    else
+    {
+        r->tx_srtt += rtt - (r->tx_srtt >> 3);
+    }
+    unsigned rto = (r->tx_srtt >> 2) + AIR_STREAM_RELIABLE_MIN_RTO;
+    r->tx_rto = MIN(rto, AIR_STREAM_RELIABLE_MAX_RTO);
+    r->stats.rtt = r->tx_srtt >> 3;
+    r->stats.rto = r->tx_rto;
+}
+
+// Called once we know if the first transmission of a segment arrived
+static void air_stream_reliable_update_loss(air_stream_reliable_t *r, const air_stream_reliable_tx_slot_t *slot, bool lost)
+{
+    if (slot->retransmitted)
+    {
+        return;
+    }
+    r->tx_loss_packets += slot->packets;
+    if (lost)
+    {
+        // Counts as a single lost packet. That underestimates the losses
+        // with long segments, but ACKs are lost too and spurious
+        // timeouts count as losses.
+        r->tx_loss_segments++;
+    }
+    if (r->tx_loss_packets >= AIR_STREAM_RELIABLE_LOSS_WINDOW)
+    {
+        r->tx_loss_packets /= 2;
+        r->tx_loss_segments /= 2;
+    }
+}
+
+// A segment is lost if any of the packets carrying it is lost, so
+// pick the size with the best expected goodput for the estimated
+// packet loss. Without losses that's the biggest one.
+static size_t air_stream_reliable_segment_size(const air_stream_reliable_t *r, size_t packet_size)
 {
-    ring_buffer_empty(&s->output_buf);
+    size_t max_size = MIN(packet_size * AIR_STREAM_RELIABLE_SEGMENT_PACKETS, AIR_STREAM_RELIABLE_SEGMENT_SIZE);
+    if (r->tx_loss_segments == 0)
+    {
+        return max_size;
+    }
+    // Probability of a packet arriving with 16 bits of fraction
+    uint32_t delivered = 65536 - MIN((uint32_t)r->tx_loss_segments * 65536 / r->tx_loss_packets, 65536);
+    uint32_t all_delivered = 65536;
+    uint32_t best_score = 0;
+    size_t best_size = max_size;
+    for (size_t packets = 1;; packets++)
+    {
+        all_delivered = all_delivered * delivered >> 16;
+        size_t span = packets * packet_size;
+        if (span > AIR_STREAM_RELIABLE_SEGMENT_OVERHEAD)
+        {
+            size_t size = MIN(span - AIR_STREAM_RELIABLE_SEGMENT_OVERHEAD, max_size);
+            uint32_t score = size * all_delivered / packets;
+            if (score > best_score)
+            {
+                best_score = score;
+                best_size = size;
+            }
+            if (size == max_size)
+            {
+                break;
+            }
+        }
+    }
+    return best_size;
 }
 
-bool air_stream_pop_output(air_stream_t *s, uint8_t *c)
+static size_t air_stream_reliable_send_segment(air_stream_t *s, unsigned seq, size_t offset, size_t packet_size)
 {
-    return ring_buffer_pop(&s->output_buf, c);
-}
\ No newline at end of file
+    air_stream_reliable_t *r = &s->reliable;
+    air_stream_reliable_tx_slot_t *slot = air_stream_reliable_tx_slot(r, seq);
+    air_cmd_reliable_segment_t hdr = {
+        .seq = seq,
+        // Retransmissions after the first ACK don't need syn either,
+        // the receiver already has our nonce.
+        .syn = !r->tx_synced,
+        .session = r->tx_session,
+    };
+    size_t nonce_size = hdr.syn ? sizeof(r->tx_nonce) : 0;
+    uint8_t prefix[1 + 5];
+    prefix[0] = AIR_CMD_RELIABLE_SEGMENT | AIR_STREAM_CMD_MASK;
+    int used = uvarint_encode32(&prefix[1], sizeof(prefix) - 1, sizeof(hdr) + nonce_size + slot->size);
+    // Segment data starts after the previous segments in the window
+    size_t data_offset = 0;
+    for (unsigned ii = r->tx_base_seq; ii != seq; ii = air_stream_reliable_seq_add(ii, 1))
+    {
+        data_offset += air_stream_reliable_tx_slot(r, ii)->size;
+    }
+    ring_buffer_span_t spans[RING_BUFFER_MAX_SPANS];
+    size_t spans_count = ring_buffer_peek_span(&r->tx_buf, spans);
+
+    air_stream_frame_writer_t w;
+    air_stream_frame_begin(s, AIR_STREAM_CLASS_MSP, &w);
+    air_stream_frame_write(&w, prefix, 1 + used);
+    air_stream_frame_write(&w, &hdr, sizeof(hdr));
+    air_stream_frame_write(&w, &r->tx_nonce, nonce_size);
+    size_t rem = slot->size;
+    for (size_t ii = 0; ii < spans_count && rem > 0; ii++)
+    {
+        if (data_offset >= spans[ii].count)
+        {
+            data_offset -= spans[ii].count;
+            continue;
+        }
+        size_t n = MIN(spans[ii].count - data_offset, rem);
+        air_stream_frame_write(&w, (const uint8_t *)spans[ii].ptr + data_offset, n);
+        data_offset = 0;
+        rem -= n;
+    }
+    size_t n = air_stream_frame_end(s, &w);
+    if (n > 0)
+    {
+        // Segments are pulled right before sending them, starting
+        // at offset in the current packet.
+        size_t packets = (offset + n + packet_size - 1) / packet_size;
+        slot->packets = MIN(packets, UINT8_MAX);
+        slot->sent_at = r->packets + packets - 1;
+        slot->timeout_at = slot->sent_at + r->tx_rto;
+        slot->state = AIR_STREAM_RELIABLE_TX_IN_FLIGHT;
+        r->stats.segments_sent++;
+    }
+    return n;
+}
+
+static void air_stream_reliable_send_ack(air_stream_t *s)
+{
+    air_stream_reliable_t *r = &s->reliable;
+    air_cmd_reliable_syn_ack_t syn_ack = {0};
+    air_cmd_reliable_ack_t *ack = &syn_ack.ack;
+    air_cmd_e cmd = AIR_CMD_RELIABLE_ACK;
+    if (r->rx_reset_pending)
+    {
+        ack->reset = 1;
+        ack->session = r->rx_reset_session;
+    }
+    else
+    {
+        ack->next_seq = r->rx_next_seq;
+        ack->session = r->rx_session;
+        for (int ii = 0; ii < AIR_STREAM_RELIABLE_WINDOW_SIZE - 1; ii++)
+        {
+            if (air_stream_reliable_rx_slot(r, air_stream_reliable_seq_add(r->rx_next_seq, ii + 1))->received)
+            {
+                ack->received |= 1 << ii;
+            }
+        }
+        if (r->rx_syn)
+        {
+            cmd = AIR_CMD_RELIABLE_SYN_ACK;
+            syn_ack.nonce = r->rx_nonce;
+        }
+    }
+    if (air_stream_write_cmd_frame(s, cmd, &syn_ack, air_cmd_size(cmd)) > 0)
+    {
+        if (r->rx_reset_pending)
+        {
+            r->rx_reset_pending = false;
+        }
+        else
+        {
+            r->rx_ack_pending = false;
+        }
+    }
+}
+
+// Called once per output packet
+static void air_stream_reliable_update(air_stream_t *s)
+{
+    air_stream_reliable_t *r = &s->reliable;
+    r->packets++;
+    if (r->rx_ack_pending || r->rx_reset_pending)
+    {
+        air_stream_reliable_send_ack(s);
+    }
+    // No backoff here, since the link is not shared there's no
+    // congestion to avoid. Losses are just noise.
+    for (unsigned ii = 0; ii < r->tx_in_flight; ii++)
+    {
+        air_stream_reliable_tx_slot_t *slot = air_stream_reliable_tx_slot(r, air_stream_reliable_seq_add(r->tx_base_seq, ii));
+        if (slot->state == AIR_STREAM_RELIABLE_TX_IN_FLIGHT && (int16_t)(r->packets - slot->timeout_at) >= 0)
+        {
+            air_stream_reliable_update_loss(r, slot, true);
+            slot->state = AIR_STREAM_RELIABLE_TX_PENDING;
+        }
+    }
+}
+
+// Called when the MSP class is scheduled with nothing queued. Sending
+// segments as late as possible lets us retransmit with the latest ACK.
+static void air_stream_reliable_pull(air_stream_t *s, size_t offset, size_t packet_size)
+{
+    air_stream_reliable_t *r = &s->reliable;
+    if (!r->enabled || packet_size == 0)
+    {
+        return;
+    }
+    // Retransmissions go first, oldest segment first
+    for (unsigned ii = 0; ii < r->tx_in_flight; ii++)
+    {
+        unsigned seq = air_stream_reliable_seq_add(r->tx_base_seq, ii);
+        air_stream_reliable_tx_slot_t *slot = air_stream_reliable_tx_slot(r, seq);
+        if (slot->state == AIR_STREAM_RELIABLE_TX_PENDING)
+        {
+            if (air_stream_reliable_send_segment(s, seq, offset, packet_size) > 0)
+            {
+                slot->retransmitted = true;
+                r->stats.retransmissions++;
+            }
+            return;
+        }
+    }
+    size_t available = ring_buffer_count(&r->tx_buf) - r->tx_segmented;
+    if (available > 0 && r->tx_in_flight < AIR_STREAM_RELIABLE_WINDOW_SIZE)
+    {
+        air_stream_reliable_tx_slot_t *slot = air_stream_reliable_tx_slot(r, r->tx_next_seq);
+        slot->size = MIN(available, air_stream_reliable_segment_size(r, packet_size));
+        slot->retransmitted = false;
+        if (air_stream_reliable_send_segment(s, r->tx_next_seq, offset, packet_size) > 0)
+        {
+            r->tx_segmented += slot->size;
+            r->tx_next_seq++;
+            r->tx_in_flight++;
+        }
+    }
+}
+
+static void air_stream_reliable_handle_ack(air_stream_t *s, const air_cmd_reliable_ack_t *ack, bool syn)
+{
+    air_stream_reliable_t *r = &s->reliable;
+    if (ack->session != r->tx_session)
+    {
+        // Stale
+        return;
+    }
+    if (ack->reset)
+    {
+        LOG_W(TAG, "Reliable session %u reset by receiver", r->tx_session);
+        r->stats.resets++;
+        air_stream_reliable_tx_reset(r, r->tx_session + 1);
+        return;
+    }
+    if (!syn && !r->tx_synced)
+    {
+        // Might be for a previous sender that used the same session
+        return;
+    }
+    unsigned acked = air_stream_reliable_seq_distance(r->tx_base_seq, ack->next_seq);
+    if (acked > r->tx_in_flight)
+    {
+        // Duplicate ACK for segments we already released
+        return;
+    }
+    r->tx_synced = true;
+    bool has_last_sent = false;
+    uint16_t last_sent_at = 0;
+    for (unsigned ii = 0; ii < r->tx_in_flight; ii++)
+    {
+        unsigned seq = air_stream_reliable_seq_add(r->tx_base_seq, ii);
+        air_stream_reliable_tx_slot_t *slot = air_stream_reliable_tx_slot(r, seq);
+        if (slot->state == AIR_STREAM_RELIABLE_TX_ACKED)
+        {
+            continue;
+        }
+        if (ii >= acked)
+        {
+            unsigned bit = air_stream_reliable_seq_distance(ack->next_seq, seq) - 1;
+            if (bit >= 8 || !(ack->received & (1 << bit)))
+            {
+                continue;
+            }
+        }
+        if (slot->state == AIR_STREAM_RELIABLE_TX_IN_FLIGHT && !slot->retransmitted)
+        {
+            // Karn's algorithm: only sample segments sent once
+            air_stream_reliable_update_rto(r, r->packets - slot->sent_at);
+            air_stream_reliable_update_loss(r, slot, false);
+        }
+        if (!has_last_sent || (int16_t)(slot->sent_at - last_sent_at) > 0)
+        {
+            has_last_sent = true;
+            last_sent_at = slot->sent_at;
+        }
+        slot->state = AIR_STREAM_RELIABLE_TX_ACKED;
+    }
+    if (has_last_sent)
+    {
+        // Frames arrive in order, so any segment sent before one that
+        // was acknowledged and still missing was lost.
+        for (unsigned ii = 0; ii < r->tx_in_flight; ii++)
+        {
+            air_stream_reliable_tx_slot_t *slot = air_stream_reliable_tx_slot(r, air_stream_reliable_seq_add(r->tx_base_seq, ii));
+            if (slot->state == AIR_STREAM_RELIABLE_TX_IN_FLIGHT && (int16_t)(slot->sent_at - last_sent_at) < 0)
+            {
+                air_stream_reliable_update_loss(r, slot, true);
+                slot->state = AIR_STREAM_RELIABLE_TX_PENDING;
+            }
+        }
+    }
+    while (r->tx_in_flight > 0)
+    {
+        air_stream_reliable_tx_slot_t *slot = air_stream_reliable_tx_slot(r, r->tx_base_seq);
+        if (slot->state != AIR_STREAM_RELIABLE_TX_ACKED)
+        {
+            break;
+        }
+        ring_buffer_consume(&r->tx_buf, slot->size);
+        r->tx_segmented -= slot->size;
+        r->stats.bytes_acked += slot->size;
+        slot->state = AIR_STREAM_RELIABLE_TX_FREE;
+        r->tx_base_seq++;
+        r->tx_in_flight--;
+    }
+}
+
+static void air_stream_reliable_lost_sync(air_stream_reliable_t *r)
+{
+    // Ask the sender to start over, since we can't tell where
+    // the next command starts.
+    r->rx_reset_pending = true;
+    r->rx_reset_session = r->rx_session;
+    r->rx_ack_pending = false;
+    air_stream_reliable_rx_reset(r, AIR_STREAM_RELIABLE_SESSION_NONE);
+}
+
+// Reassembles the commands sent via the reliable sub-channel
+static void air_stream_reliable_deliver(air_stream_t *s, const uint8_t *data, size_t size, time_micros_t now)
+{
+    air_stream_reliable_t *r = &s->reliable;
+    r->stats.bytes_received += size;
+    for (size_t ii = 0; ii < size; ii++)
+    {
+        if (r->rx_msg_size >= sizeof(r->rx_msg))
+        {
+            LOG_W(TAG, "Reliable command too big");
+            air_stream_reliable_lost_sync(r);
+            return;
+        }
+        r->rx_msg[r->rx_msg_size++] = data[ii];
+        if (r->rx_msg_expected_size == AIR_STREAM_FRAME_SIZE_UNKNOWN)
+        {
+            int expected_size = air_stream_cmd_frame_size(r->rx_msg[0], &r->rx_msg[1], r->rx_msg_size - 1);
+            if (expected_size == AIR_STREAM_FRAME_SIZE_INVALID || !air_cmd_is_reliable(r->rx_msg[0]))
+            {
+                LOG_W(TAG, "Invalid reliable CMD %u", r->rx_msg[0]);
+                air_stream_reliable_lost_sync(r);
+                return;
+            }
+            r->rx_msg_expected_size = expected_size;
+        }
+        if (r->rx_msg_expected_size == (int)r->rx_msg_size)
+        {
+            const void *cmd_data;
+            size_t cmd_data_size;
+            if (air_stream_cmd_decode(r->rx_msg[0], &r->rx_msg[1], r->rx_msg_size - 1, &cmd_data, &cmd_data_size))
+            {
+                s->cmd(s->user, r->rx_msg[0], cmd_data, cmd_data_size, now);
+            }
+            r->rx_msg_size = 0;
+            r->rx_msg_expected_size = AIR_STREAM_FRAME_SIZE_UNKNOWN;
+        }
+    }
+}
+
+static void air_stream_reliable_handle_segment(air_stream_t *s, const uint8_t *data, size_t size, time_micros_t now)
+{
+    air_stream_reliable_t *r = &s->reliable;
+    const air_cmd_reliable_segment_t *hdr = (const air_cmd_reliable_segment_t *)data;
+    size_t hdr_size = sizeof(*hdr);
+    uint32_t nonce = 0;
+    if (size >= sizeof(*hdr) && hdr->syn)
+    {
+        hdr_size += sizeof(nonce);
+    }
+    if (size < hdr_size || size - hdr_size > AIR_STREAM_RELIABLE_SEGMENT_SIZE)
+    {
+        LOG_W(TAG, "Invalid reliable segment size %u", (unsigned)size);
+        return;
+    }
+    const uint8_t *payload = data + hdr_size;
+    size_t payload_size = size - hdr_size;
+    if (hdr->syn)
+    {
+        memcpy(&nonce, data + sizeof(*hdr), sizeof(nonce));
+    }
+    if (hdr->session != r->rx_session || (hdr->syn && nonce != r->rx_nonce))
+    {
+        if (!hdr->syn)
+        {
+            r->rx_reset_pending = true;
+            r->rx_reset_session = hdr->session;
+            return;
+        }
+        // Either a new session or a restarted sender that picked
+        // the same one.
+        LOG_D(TAG, "Starting reliable session %u", hdr->session);
+        air_stream_reliable_rx_reset(r, hdr->session);
+        r->rx_nonce = nonce;
+        r->rx_reset_pending = false;
+    }
+    r->rx_syn = hdr->syn;
+    r->rx_ack_pending = true;
+    unsigned distance = air_stream_reliable_seq_distance(r->rx_next_seq, hdr->seq);
+    if (distance >= AIR_STREAM_RELIABLE_WINDOW_SIZE)
+    {
+        // Already delivered, our ACK was lost. Just ACK it again.
+        return;
+    }
+    if (distance > 0)
+    {
+        air_stream_reliable_rx_slot_t *slot = air_stream_reliable_rx_slot(r, hdr->seq);
+        if (!slot->received)
+        {
+            memcpy(slot->data, payload, payload_size);
+            slot->size = payload_size;
+            slot->received = true;
+        }
+        return;
+    }
+    air_stream_reliable_deliver(s, payload, payload_size, now);
+    r->rx_next_seq++;
+    air_stream_reliable_rx_slot_t *slot;
+    while ((slot = air_stream_reliable_rx_slot(r, r->rx_next_seq))->received)
+    {
+        slot->received = false;
+        air_stream_reliable_deliver(s, slot->data, slot->size, now);
+        r->rx_next_seq++;
+    }
+}
+
+// Returns true iff the command belongs to the reliable sub-channel
+static bool air_stream_reliable_handle_cmd(air_stream_t *s, air_cmd_e cmd, const void *data, size_t size, time_micros_t now)
+{
+    switch (cmd)
+    {
+    case AIR_CMD_RELIABLE_SEGMENT:
+        air_stream_reliable_handle_segment(s, data, size, now);
+        return true;
+    case AIR_CMD_RELIABLE_ACK:
+        air_stream_reliable_handle_ack(s, data, false);
+        return true;
+    case AIR_CMD_RELIABLE_SYN_ACK:
+    {
+        const air_cmd_reliable_syn_ack_t *syn_ack = data;
+        if (syn_ack->nonce == s->reliable.tx_nonce)
+        {
+            air_stream_reliable_handle_ack(s, &syn_ack->ack, true);
+        }
+        return true;
+    }
+    default:
+        break;
+    }
+    return false;
+}
+
+#endif
+
+#if defined(USE_AIR_STREAM_TELEMETRY_DELTA)
+
+static void air_stream_telemetry_delta_init(air_stream_telemetry_delta_t *td, bool uplink)
+{
+    td->enabled = false;
+    td->packets = 0;
+    // The encoder is for the telemetry we send, the decoder
+    // for the one we receive.
+    air_telemetry_delta_init(&td->encoder, uplink);
+    air_telemetry_delta_init(&td->decoder, !uplink);
+    td->acks_pending = 0;
+}
+
+static void air_stream_telemetry_delta_dispatch(air_stream_t *s, const uint8_t *buf, size_t size, time_micros_t now)
+{
+    air_stream_telemetry_delta_t *td = &s->telemetry_delta;
+    unsigned idx = buf[0] & AIR_STREAM_TELEMETRY_IDX_MASK;
+    telemetry_val_t val;
+    size_t val_size;
+    air_cmd_telemetry_ack_t ack;
+    switch (air_telemetry_delta_decode(&td->decoder, idx, &buf[1], size - 1, &val, &val_size, &ack))
+    {
+    case AIR_TELEMETRY_DELTA_DECODED_ACK:
+        td->acks[idx] = ack;
+        td->acks_pending |= 1u << idx;
+        // Fallthrough
+    case AIR_TELEMETRY_DELTA_DECODED:
+        s->telemetry(s->user, air_stream_telemetry_input_id(s, idx), &val, val_size, now);
+        break;
+    case AIR_TELEMETRY_DELTA_NACK:
+        LOG_D(TAG, "Missing delta coded telemetry slot (idx = %u, slot = %u)", idx, ack.slot);
+        td->acks[idx] = ack;
+        td->acks_pending |= 1u << idx;
+        break;
+    case AIR_TELEMETRY_DELTA_INVALID:
+        LOG_W(TAG, "Discarding invalid delta coded telemetry (idx = %u)", idx);
+        break;
+    }
+}
+
+// Called once per output packet. Sends the ACKs for the delta coded
+// telemetry received, if any. They're only sent when there are no other
+// control frames, so they don't delay more urgent ones and can't overflow
+// the queue.
+static void air_stream_telemetry_delta_update(air_stream_t *s)
+{
+    air_stream_telemetry_delta_t *td = &s->telemetry_delta;
+    td->packets++;
+    if (td->acks_pending == 0 || ring_buffer_count(&s->control_queue) > 0)
+    {
+        return;
+    }
+    air_cmd_telemetry_ack_t acks[AIR_STREAM_TELEMETRY_ACKS_PER_FRAME];
+    size_t count = 0;
+    uint32_t sent = 0;
+    for (unsigned ii = 0; ii < AIR_TELEMETRY_DELTA_MAX_IDS && count < ARRAY_COUNT(acks); ii++)
+    {
+        if (td->acks_pending & (1u << ii))
+        {
+            acks[count++] = td->acks[ii];
+            sent |= 1u << ii;
+        }
+    }
+    if (air_stream_write_cmd_frame(s, AIR_CMD_TELEMETRY_ACK, acks, count * sizeof(acks[0])) > 0)
+    {
+        td->acks_pending &= ~sent;
+    }
+}
+
+// Returns true iff the command belongs to the telemetry delta coding
+static bool air_stream_telemetry_delta_handle_cmd(air_stream_t *s, air_cmd_e cmd, const void *data, size_t size)
+{
+    if (cmd != AIR_CMD_TELEMETRY_ACK)
+    {
+        return false;
+    }
+    const air_cmd_telemetry_ack_t *acks = data;
+    for (size_t ii = 0; ii < size / sizeof(*acks); ii++)
+    {
+        air_telemetry_delta_handle_ack(&s->telemetry_delta.encoder, &acks[ii]);
+    }
+    return true;
+}
+
+// Encodes the value for idx into buf, returning the number of bytes used.
+// Returns zero if the value should be sent as is.
+static size_t air_stream_telemetry_delta_encode(air_stream_t *s, unsigned idx, telemetry_t *t, uint8_t *buf)
+{
+    if (!s->telemetry_delta.enabled)
+    {
+        return 0;
+    }
+    return air_telemetry_delta_encode(&s->telemetry_delta.encoder, idx, &t->val, buf, s->telemetry_delta.packets);
+}
+
+#endif
+
+static void air_stream_dispatch_packed_channels(air_stream_t *s, const uint8_t *buf, unsigned p, time_micros_t now)
+{
+    if (air_stream_packed_channels_frame_size(buf, p) != (int)p)
+    {
+        LOG_W(TAG, "Discarding invalid packed channels frame");
+        return;
+    }
+    unsigned mask = air_stream_packed_channels_mask(buf);
+    unsigned pos = 16;
+    for (unsigned ii = 0; ii < AIR_STREAM_AUX_CHANNELS_NUM; ii++)
+    {
+        if (mask & (1 << ii))
+        {
+            unsigned value;
+            unsigned code = air_stream_get_bits(buf, &pos, 2);
+            if (code == AIR_STREAM_CHANNEL_CODE_FULL)
+            {
+                unsigned air_value = air_stream_get_bits(buf, &pos, AIR_CHANNEL_BITS);
+                value = RC_CHANNEL_DECODE_FROM_BITS(air_value, AIR_CHANNEL_BITS);
+            }
+            else
+            {
+                value = air_stream_channel_code_value(code);
+            }
+            s->channel(s->user, ii + 4, value, now);
+        }
+    }
+}
+
+static void air_stream_dispatch_telemetry_batch(air_stream_t *s, const uint8_t *buf, unsigned p, time_micros_t now)
+{
+    if (air_stream_telemetry_batch_frame_size(s, buf, p) != (int)p)
+    {
+        LOG_W(TAG, "Discarding invalid telemetry batch");
+        return;
+    }
+    unsigned pos = 2;
+    for (unsigned ii = 0; ii < buf[1]; ii++)
+    {
+#if defined(USE_AIR_STREAM_TELEMETRY_DELTA)
+        if (buf[pos] & AIR_STREAM_TELEMETRY_DELTA_MASK)
+        {
+            int size = air_stream_telemetry_delta_frame_size(s, &buf[pos], p - pos);
+            air_stream_telemetry_delta_dispatch(s, &buf[pos], size, now);
+            pos += size;
+            continue;
+        }
+#endif
+        int id = air_stream_telemetry_input_id(s, buf[pos]);
+        size_t size = telemetry_get_data_size(id);
+        s->telemetry(s->user, id, &buf[pos + 1], size, now);
+        pos += 1 + size;
+    }
+}
+
+static void air_stream_dispatch_frame(air_stream_t *s, const uint8_t *buf, unsigned p, time_micros_t now)
+{
+    unsigned chn;
+    switch (buf[0] & AIR_STREAM_DATA_TYPE_MASK)
+    {
+    case AIR_STREAM_2_BIT_CHANEL_MASK:
+        // 2 bit encoded channel. 0 -> min, 1 -> center, 2 -> max, 3 -> invalid
+        chn = ((buf[0] & ~AIR_STREAM_2_BIT_CHANEL_MASK) >> 2) + 4;
+        if (chn < RC_CHANNELS_NUM && (buf[0] & 3) != AIR_STREAM_CHANNEL_CODE_FULL)
+        {
+            s->channel(s->user, chn, air_stream_channel_code_value(buf[0] & 3), now);
+        }
+        break;
+    case AIR_STREAM_TELEMETRY_MASK:
+    {
+        if (buf[0] == AIR_STREAM_TELEMETRY_BATCH)
+        {
+            air_stream_dispatch_telemetry_batch(s, buf, p, now);
+            break;
+        }
+#if defined(USE_AIR_STREAM_TELEMETRY_DELTA)
+        if (buf[0] & AIR_STREAM_TELEMETRY_DELTA_MASK)
+        {
+            if (air_stream_telemetry_delta_frame_size(s, buf, p) != (int)p)
+            {
+                LOG_W(TAG, "Discarding truncated delta coded telemetry");
+                break;
+            }
+            air_stream_telemetry_delta_dispatch(s, buf, p, now);
+            break;
+        }
+#endif
+        int telemetry_id = buf[0];
+        // If the stream sends data uplink, it receives downlink telemetry
+        if (air_stream_sends_uplink(s))
+        {
+            // Downlink telemetry IDs don't have the most
+            // significant bit set.
+            telemetry_id &= ~AIR_STREAM_TELEMETRY_MASK;
+        }
+        size_t telemetry_size = telemetry_get_data_size(telemetry_id);
+        if (telemetry_size == 0)
+        {
+            // must zero terminated
+            if (buf[p - 1] != 0)
+            {
+                // invalid data
+                LOG_W(TAG, "Discarding variable sized telemetry data, not zero terminated");
+                break;
+            }
+            telemetry_size = p - 1;
+        }
+        else if (telemetry_size != p - 1)
+        {
+            // invalida data
+            LOG_W(TAG, "Discarding fixed sized telemetry data (id = %d), expected %u != %d actual",
+                  telemetry_id, telemetry_size, p - 1);
+            LOG_BUFFER_W(TAG, &buf[1], p - 1);
+            break;
+        }
+        s->telemetry(s->user, telemetry_id, &buf[1], telemetry_size, now);
+        break;
+    }
+    case AIR_STREAM_CMD_MASK:
+    {
+        uint8_t cmd = buf[0] & ~AIR_STREAM_CMD_MASK;
+        const void *cmd_data;
+        size_t cmd_data_size;
+        if (!air_stream_cmd_decode(cmd, &buf[1], p - 1, &cmd_data, &cmd_data_size))
+        {
+            LOG_W(TAG, "Discarding CMD %u", cmd);
+            if (p > 1)
+            {
+                LOG_BUFFER_W(TAG, &buf[1], p - 1);
+            }
+            break;
+        }
+#if defined(USE_AIR_STREAM_RELIABLE)
+        if (air_stream_reliable_handle_cmd(s, cmd, cmd_data, cmd_data_size, now))
+        {
+            break;
+        }
+#endif
+#if defined(USE_AIR_STREAM_TELEMETRY_DELTA)
+        if (air_stream_telemetry_delta_handle_cmd(s, cmd, cmd_data, cmd_data_size))
+        {
+            break;
+        }
+#endif
+        s->cmd(s->user, cmd, cmd_data, cmd_data_size, now);
+        break;
+    }
+    case AIR_STREAM_FULL_CHANELL_MASK:
+        if (buf[0] & AIR_STREAM_PACKED_CHANNELS_MASK)
+        {
+            air_stream_dispatch_packed_channels(s, buf, p, now);
+        }
+        else if (p >= 2)
+        {
+            // It's a channel. First AIR_CHANNEL_BITS from the right are channel value,
+            // then comes channel (number - 4)
+            chn = (buf[0] >> (AIR_CHANNEL_BITS - 8)) + 4;
+            if (chn < RC_CHANNELS_NUM)
+            {
+                unsigned air_value = (buf[0] << 8 | buf[1]) & ((1 << AIR_CHANNEL_BITS) - 1);
+                unsigned value = RC_CHANNEL_DECODE_FROM_BITS(air_value, AIR_CHANNEL_BITS);
+                s->channel(s->user, chn, value, now);
+            }
+        }
+        break;
+    }
+}
+
+// Returns the total size of the frame being decoded (starting with the
+// type byte), AIR_STREAM_FRAME_SIZE_UNKNOWN if it can't be determined yet
+// from the data we have or AIR_STREAM_FRAME_SIZE_INVALID if the frame
+// can't be decoded.
+static int air_stream_input_frame_size(air_stream_t *s)
+{
+    const uint8_t *buf = s->input_frame;
+    unsigned p = s->input_frame_size;
+    switch (buf[0] & AIR_STREAM_DATA_TYPE_MASK)
+    {
+    case AIR_STREAM_2_BIT_CHANEL_MASK:
+        return 1;
+    case AIR_STREAM_TELEMETRY_MASK:
+    {
+        if (buf[0] == AIR_STREAM_TELEMETRY_BATCH)
+        {
+            return air_stream_telemetry_batch_frame_size(s, buf, p);
+        }
+#if defined(USE_AIR_STREAM_TELEMETRY_DELTA)
+        if (buf[0] & AIR_STREAM_TELEMETRY_DELTA_MASK)
+        {
+            return air_stream_telemetry_delta_frame_size(s, buf, p);
+        }
+#endif
+        int telemetry_id = buf[0];
+        if (air_stream_sends_uplink(s))
+        {
+            telemetry_id &= ~AIR_STREAM_TELEMETRY_MASK;
+            if (TELEMETRY_DOWNLINK_GET_IDX(telemetry_id) >= TELEMETRY_DOWNLINK_COUNT)
+            {
+                return AIR_STREAM_FRAME_SIZE_INVALID;
+            }
+        }
+        else if (TELEMETRY_UPLINK_GET_IDX(telemetry_id) >= TELEMETRY_UPLINK_COUNT)
+        {
+            return AIR_STREAM_FRAME_SIZE_INVALID;
+        }
+        size_t telemetry_size = telemetry_get_data_size(telemetry_id);
+        if (telemetry_size == 0)
+        {
+            // Zero terminated, the frame ends at the first zero
+            if (p > 1 && buf[p - 1] == 0)
+            {
+                return p;
+            }
+            return AIR_STREAM_FRAME_SIZE_UNKNOWN;
+        }
+        return 1 + telemetry_size;
+    }
+    case AIR_STREAM_CMD_MASK:
+        return air_stream_cmd_frame_size(buf[0] & ~AIR_STREAM_CMD_MASK, &buf[1], p - 1);
+    case AIR_STREAM_FULL_CHANELL_MASK:
+        if (buf[0] & AIR_STREAM_PACKED_CHANNELS_MASK)
+        {
+            return air_stream_packed_channels_frame_size(buf, p);
+        }
+        return 2;
+    }
+    UNREACHABLE();
+    return AIR_STREAM_FRAME_SIZE_INVALID;
+}
+
+static void air_stream_input_reset_frame(air_stream_t *s)
+{
+    s->input_frame_size = 0;
+    s->input_frame_expected_size = AIR_STREAM_FRAME_SIZE_UNKNOWN;
+    s->input_stuffed = false;
+    s->input_cobs = false;
+    s->input_cobs_remaining = 0;
+    s->input_cobs_delimiter = false;
+}
+
+// Adds a decoded byte to the frame, dispatching it once it's complete
+static void air_stream_input_frame_byte(air_stream_t *s, uint8_t c, time_micros_t now)
+{
+    if (s->input_frame_size >= sizeof(s->input_frame))
+    {
+        // We got more data than expected. Maybe a newer protocol
+        // which we don't understand yet?
+        s->input_in_sync = false;
+        return;
+    }
+    s->input_frame[s->input_frame_size++] = c;
+    if (s->input_frame_expected_size == AIR_STREAM_FRAME_SIZE_UNKNOWN)
+    {
+        int size = air_stream_input_frame_size(s);
+        if (size == AIR_STREAM_FRAME_SIZE_INVALID || size > (int)sizeof(s->input_frame))
+        {
+            LOG_W(TAG, "Discarding invalid frame with type byte 0x%02x", s->input_frame[0]);
+            s->input_in_sync = false;
+            return;
+        }
+        s->input_frame_expected_size = size;
+    }
+    if (s->input_frame_expected_size == (int)s->input_frame_size)
+    {
+        // Frame is complete, dispatch it right away. If the packet with
+        // the next delimiter is lost, we won't lose this frame.
+        air_stream_dispatch_frame(s, s->input_frame, s->input_frame_size, now);
+        // Ignore anything else until the next delimiter
+        s->input_in_sync = false;
+    }
+}
+
+// Decodes a byte after the type byte in a COBS encoded frame
+static void air_stream_input_cobs_byte(air_stream_t *s, uint8_t c, time_micros_t now)
+{
+    if (s->input_cobs_remaining > 0)
+    {
+        s->input_cobs_remaining--;
+        air_stream_input_frame_byte(s, c, now);
+        return;
+    }
+    // Code byte. The delimiter implied by the previous block is only
+    // part of the data when another block follows it.
+    if (s->input_cobs_delimiter)
+    {
+        air_stream_input_frame_byte(s, AIR_DATA_START_STOP, now);
+        if (!s->input_in_sync)
+        {
+            return;
+        }
+    }
+    // Never zero, since c can't be AIR_DATA_START_STOP here
+    unsigned code = c ^ AIR_DATA_START_STOP;
+    s->input_cobs_remaining = code - 1;
+    s->input_cobs_delimiter = code < AIR_STREAM_COBS_MAX_CODE;
+}
+
+static void air_stream_input_byte(air_stream_t *s, uint8_t c, time_micros_t now)
+{
+    if (c == AIR_DATA_START_STOP)
+    {
+        if (s->input_in_sync && s->input_frame_size > 0)
+        {
+            // Frame whose size we couldn't determine from its contents
+            // (or which was truncated). Let the dispatcher validate it.
+            air_stream_dispatch_frame(s, s->input_frame, s->input_frame_size, now);
+        }
+        s->input_in_sync = true;
+        air_stream_input_reset_frame(s);
+        return;
+    }
+    if (!s->input_in_sync)
+    {
+        // Waiting for the next delimiter
+        return;
+    }
+    if (s->input_cobs)
+    {
+        air_stream_input_cobs_byte(s, c, now);
+        return;
+    }
+    if (c == AIR_DATA_BYTE_STUFF)
+    {
+        s->input_stuffed = true;
+        return;
+    }
+    if (s->input_stuffed)
+    {
+        c ^= AIR_DATA_XOR;
+        s->input_stuffed = false;
+    }
+    air_stream_input_frame_byte(s, c, now);
+    if (s->input_in_sync && s->input_frame_size == 1)
+    {
+        s->input_cobs = air_stream_type_uses_cobs(s->cobs, c);
+    }
+}
+
+static void air_stream_class_init(air_stream_class_t *c, ring_buffer_t *queue, unsigned quantum)
+{
+    c->queue = queue;
+    RING_BUFFER_INIT(&c->frames, air_stream_queued_frame_t, AIR_STREAM_QUEUE_MAX_FRAMES);
+    c->quantum = quantum;
+    c->deficit = 0;
+    memset(&c->stats, 0, sizeof(c->stats));
+}
+
+void air_stream_init(air_stream_t *s, air_stream_channel_f channel, air_stream_telemetry_f telemetry, air_stream_cmd_f cmd, air_stream_pull_f pull, void *user)
+{
+    s->channel = channel;
+    s->telemetry = telemetry;
+    s->cmd = cmd;
+    s->pull = pull;
+    s->user = user;
+    s->input_in_sync = false;
+    s->input_seq = 0;
+    s->cobs = false;
+    air_stream_input_reset_frame(s);
+    RING_BUFFER_INIT(&s->control_queue, uint8_t, AIR_STREAM_CONTROL_QUEUE_CAPACITY);
+    RING_BUFFER_INIT(&s->channels_queue, uint8_t, AIR_STREAM_CHANNELS_QUEUE_CAPACITY);
+    RING_BUFFER_INIT(&s->telemetry_queue, uint8_t, AIR_STREAM_TELEMETRY_QUEUE_CAPACITY);
+    RING_BUFFER_INIT(&s->msp_queue, uint8_t, AIR_STREAM_MSP_QUEUE_CAPACITY);
+    RING_BUFFER_INIT(&s->rmp_queue, uint8_t, AIR_STREAM_RMP_QUEUE_CAPACITY);
+    air_stream_class_init(&s->classes[AIR_STREAM_CLASS_CONTROL], &s->control_queue, 0);
+    air_stream_class_init(&s->classes[AIR_STREAM_CLASS_CHANNELS], &s->channels_queue, AIR_STREAM_CHANNELS_QUANTUM);
+    air_stream_class_init(&s->classes[AIR_STREAM_CLASS_TELEMETRY], &s->telemetry_queue, AIR_STREAM_TELEMETRY_QUANTUM);
+    air_stream_class_init(&s->classes[AIR_STREAM_CLASS_MSP], &s->msp_queue, AIR_STREAM_MSP_QUANTUM);
+    air_stream_class_init(&s->classes[AIR_STREAM_CLASS_RMP], &s->rmp_queue, AIR_STREAM_RMP_QUANTUM);
+    s->output_class = AIR_STREAM_CLASS_CONTROL;
+    s->output_remaining = 0;
+    s->drr_class = AIR_STREAM_CLASS_CHANNELS;
+    s->drr_visited = false;
+#if defined(USE_AIR_STREAM_RELIABLE)
+    air_stream_reliable_init(&s->reliable);
+#endif
+#if defined(USE_AIR_STREAM_TELEMETRY_DELTA)
+    air_stream_telemetry_delta_init(&s->telemetry_delta, air_stream_sends_uplink(s));
+#endif
+}
+
+#if defined(USE_AIR_STREAM_RELIABLE)
+void air_stream_set_reliable(air_stream_t *s, bool enabled)
+{
+    if (s->reliable.enabled != enabled)
+    {
+        s->reliable.enabled = enabled;
+        // Anything queued is dropped, start over with a new session
+        air_stream_reliable_tx_reset(&s->reliable, s->reliable.tx_session + 1);
+    }
+}
+
+const air_stream_reliable_stats_t *air_stream_get_reliable_stats(const air_stream_t *s)
+{
+    return &s->reliable.stats;
+}
+#endif
+
+#if defined(USE_AIR_STREAM_TELEMETRY_DELTA)
+void air_stream_set_telemetry_delta(air_stream_t *s, bool enabled)
+{
+    s->telemetry_delta.enabled = enabled;
+}
+#endif
+
+void air_stream_feed_input(air_stream_t *s, unsigned seq, const void *data, size_t size, time_micros_t now)
+{
+    if (++s->input_seq != seq)
+    {
+        // We lost at least one packet. Complete frames have already been
+        // dispatched, so we only need to drop the frame in progress (if any)
+        // and resynchronize on the next delimiter.
+        if (s->input_in_sync && s->input_frame_size > 0)
+        {
+            LOG_D(TAG, "Dropping partial frame at seq %u", seq);
+        }
+        s->input_in_sync = false;
+        s->input_seq = seq;
+    }
+
+    const uint8_t *ptr = data;
+    for (size_t ii = 0; ii < size; ii++)
+    {
+        air_stream_input_byte(s, ptr[ii], now);
+    }
+}
+
+void air_stream_set_cobs(air_stream_t *s, bool enabled)
+{
+    s->cobs = enabled;
+}
+
+size_t air_stream_feed_output_channel(air_stream_t *s, unsigned chn, unsigned val)
+{
+    // Maximum channel number is now 20 since we can use
+    // as much as 4 bits for 2-bit channel representation.
+    ASSERT(chn < 20);
+
+    uint8_t buf[2];
+    size_t bs;
+    unsigned n = (chn - 4);
+    unsigned code = air_stream_channel_code(val);
+    if (code != AIR_STREAM_CHANNEL_CODE_FULL)
+    {
+        buf[0] = AIR_STREAM_2_BIT_CHANEL_MASK | (n << 2) | code;
+        bs = 1;
+    }
+    else
+    {
+        unsigned air_value = RC_CHANNEL_ENCODE_TO_BITS(val, AIR_CHANNEL_BITS);
+        buf[0] = (n << (AIR_CHANNEL_BITS - 8)) | air_value >> 8;
+        buf[1] = air_value & 0xff;
+        bs = 2;
+    }
+    air_stream_frame_writer_t w;
+    air_stream_frame_begin(s, AIR_STREAM_CLASS_CHANNELS, &w);
+    air_stream_frame_write(&w, buf, bs);
+    return air_stream_frame_end(s, &w);
+}
+
+size_t air_stream_feed_output_channels(air_stream_t *s, uint32_t mask, const control_channel_t *channels)
+{
+    ASSERT(mask != 0);
+    ASSERT((mask & 0x0f) == 0);
+    ASSERT((mask >> RC_CHANNELS_NUM) == 0);
+
+    if ((mask & (mask - 1)) == 0)
+    {
+        // Just one channel, the single channel frame is smaller
+        unsigned chn = __builtin_ctz(mask);
+        return air_stream_feed_output_channel(s, chn, channels[chn].value);
+    }
+    uint8_t buf[AIR_STREAM_PACKED_CHANNELS_MAX_SIZE];
+    memset(buf, 0, sizeof(buf));
+    unsigned aux_mask = mask >> 4;
+    buf[0] = AIR_STREAM_PACKED_CHANNELS_MASK | aux_mask >> 8;
+    buf[1] = aux_mask & 0xff;
+    unsigned pos = 16;
+    for (unsigned ii = 4; ii < RC_CHANNELS_NUM; ii++)
+    {
+        if (mask & (1 << ii))
+        {
+            unsigned val = channels[ii].value;
+            unsigned code = air_stream_channel_code(val);
+            air_stream_put_bits(buf, &pos, code, 2);
+            if (code == AIR_STREAM_CHANNEL_CODE_FULL)
+            {
+                air_stream_put_bits(buf, &pos, RC_CHANNEL_ENCODE_TO_BITS(val, AIR_CHANNEL_BITS), AIR_CHANNEL_BITS);
+            }
+        }
+    }
+    air_stream_frame_writer_t w;
+    air_stream_frame_begin(s, AIR_STREAM_CLASS_CHANNELS, &w);
+    air_stream_frame_write(&w, buf, (pos + 7) / 8);
+    return air_stream_frame_end(s, &w);
+}
+
+size_t air_stream_feed_output_unacked_channels(air_stream_t *s, control_channel_t *channels, unsigned count, bool packed, uint32_t *sent, time_micros_t now)
+{
+    uint32_t mask = 0;
+    uint32_t max_score = 0;
+    for (unsigned ii = 4; ii < count; ii++)
+    {
+        if (data_state_is_ack_received(&channels[ii].data_state))
+        {
+            continue;
+        }
+        if (packed)
+        {
+            mask |= 1 << ii;
+            continue;
+        }
+        uint32_t score = data_state_score(&channels[ii].data_state, now);
+        if (score > max_score)
+        {
+            mask = 1 << ii;
+            max_score = score;
+        }
+    }
+    *sent = 0;
+    if (mask == 0)
+    {
+        return 0;
+    }
+    size_t n = air_stream_feed_output_channels(s, mask, channels);
+    if (n > 0)
+    {
+        *sent = mask;
+    }
+    return n;
+}
+
+static size_t air_stream_feed_output_telemetry(air_stream_t *s, telemetry_t *t, int id, uint8_t tid)
+{
+#if defined(USE_AIR_STREAM_TELEMETRY_DELTA)
+    uint8_t encoded[AIR_TELEMETRY_DELTA_MAX_SIZE];
+    size_t encoded_size = air_stream_telemetry_delta_encode(s, tid & AIR_STREAM_TELEMETRY_IDX_MASK, t, encoded);
+    if (encoded_size > 0)
+    {
+        tid |= AIR_STREAM_TELEMETRY_DELTA_MASK;
+        air_stream_frame_writer_t w;
+        air_stream_frame_begin(s, AIR_STREAM_CLASS_TELEMETRY, &w);
+        air_stream_frame_write(&w, &tid, sizeof(tid));
+        air_stream_frame_write(&w, encoded, encoded_size);
+        return air_stream_frame_end(s, &w);
+    }
+#endif
+    size_t data_size = telemetry_get_data_size(id);
+    if (data_size == 0)
+    {
+        ASSERT(telemetry_get_type(id) == TELEMETRY_TYPE_STRING);
+        data_size = strlen(t->val.s) + 1;
+    }
+    air_stream_frame_writer_t w;
+    air_stream_frame_begin(s, AIR_STREAM_CLASS_TELEMETRY, &w);
+    air_stream_frame_write(&w, &tid, sizeof(tid));
+    air_stream_frame_write(&w, &t->val, data_size);
+    return air_stream_frame_end(s, &w);
+}
+
+size_t air_stream_feed_output_uplink_telemetry(air_stream_t *s, telemetry_t *t, telemetry_uplink_id_e id)
+{
+    ASSERT(air_stream_sends_uplink(s));
+    // Uplink telemetry IDs have MSB (0x80) set, so the ID sent over the air
+    // is exactly its ID from the enum.
+    return air_stream_feed_output_telemetry(s, t, id, id);
+}
+
+size_t air_stream_feed_output_downlink_telemetry(air_stream_t *s, telemetry_t *t, telemetry_downlink_id_e id)
+{
+    ASSERT(air_stream_sends_downlink(s));
+    // Downlink telemetry has MSB (0x80) unset, so the ID sent over the air
+    // has to be OR'ed with AIR_STREAM_TELEMETRY_MASK.
+    return air_stream_feed_output_telemetry(s, t, id, id | AIR_STREAM_TELEMETRY_MASK);
+}
+
+size_t air_stream_feed_output_telemetry_batch(air_stream_t *s, telemetry_t *const *ts, const int *ids, size_t count)
+{
+    ASSERT(count > 0 && count <= UINT8_MAX);
+
+    if (count == 1)
+    {
+        // The single value frame is smaller
+        if (air_stream_sends_uplink(s))
+        {
+            return air_stream_feed_output_uplink_telemetry(s, ts[0], ids[0]);
+        }
+        return air_stream_feed_output_downlink_telemetry(s, ts[0], ids[0]);
+    }
+
+    uint8_t header[2] = {AIR_STREAM_TELEMETRY_BATCH, count};
+    size_t size = 0;
+    air_stream_frame_writer_t w;
+    air_stream_frame_begin(s, AIR_STREAM_CLASS_TELEMETRY, &w);
+    air_stream_frame_write(&w, header, sizeof(header));
+    for (size_t ii = 0; ii < count; ii++)
+    {
+        int id = ids[ii];
+        ASSERT(air_stream_sends_uplink(s) ? TELEMETRY_IS_UPLINK(id) : TELEMETRY_IS_DOWNLINK(id));
+        size_t data_size = telemetry_get_data_size(id);
+        ASSERT(data_size > 0);
+        uint8_t idx = air_stream_sends_uplink(s) ? TELEMETRY_UPLINK_GET_IDX(id) : TELEMETRY_DOWNLINK_GET_IDX(id);
+#if defined(USE_AIR_STREAM_TELEMETRY_DELTA)
+        uint8_t encoded[AIR_TELEMETRY_DELTA_MAX_SIZE];
+        size_t encoded_size = air_stream_telemetry_delta_encode(s, idx, ts[ii], encoded);
+        if (encoded_size > 0)
+        {
+            idx |= AIR_STREAM_TELEMETRY_DELTA_MASK;
+            air_stream_frame_write(&w, &idx, sizeof(idx));
+            air_stream_frame_write(&w, encoded, encoded_size);
+            size += 1 + encoded_size;
+            continue;
+        }
+#endif
+        air_stream_frame_write(&w, &idx, sizeof(idx));
+        air_stream_frame_write(&w, &ts[ii]->val, data_size);
+        size += 1 + data_size;
+    }
+    ASSERT(size <= AIR_STREAM_TELEMETRY_BATCH_MAX_SIZE);
+    return air_stream_frame_end(s, &w);
+}
+
+size_t air_stream_telemetry_batch_value_size(air_stream_t *s, telemetry_t *t, int id)
+{
+#if defined(USE_AIR_STREAM_TELEMETRY_DELTA)
+    if (s->telemetry_delta.enabled)
+    {
+        unsigned idx = TELEMETRY_IS_UPLINK(id) ? TELEMETRY_UPLINK_GET_IDX(id) : TELEMETRY_DOWNLINK_GET_IDX(id);
+        size_t size = air_telemetry_delta_encoded_size_for(&s->telemetry_delta.encoder, idx, &t->val, s->telemetry_delta.packets);
+        if (size > 0)
+        {
+            return 1 + size;
+        }
+    }
+#endif
+    return 1 + telemetry_get_data_size(id);
+}
+
+// Feeds the fixed size value at first_idx, plus all the other fixed size
+// values that changed since they were last sent (or have a score of at
+// least AIR_STREAM_TELEMETRY_BATCH_MIN_SCORE) that fit in the same frame.
+static size_t air_stream_feed_output_downlink_telemetry_batch(air_stream_t *s, telemetry_t *telemetry, int first_idx, time_micros_t now)
+{
+    telemetry_t *ts[TELEMETRY_DOWNLINK_COUNT];
+    int ids[TELEMETRY_DOWNLINK_COUNT];
+    size_t count = 0;
+    size_t size = 0;
+    for (int ii = first_idx; ii < first_idx + TELEMETRY_DOWNLINK_COUNT; ii++)
+    {
+        int idx = ii % TELEMETRY_DOWNLINK_COUNT;
+        telemetry_t *t = &telemetry[idx];
+        int id = TELEMETRY_DOWNLINK_ID(idx);
+        size_t data_size = telemetry_get_data_size(id);
+        if (data_size == 0 || !telemetry_has_value(t))
+        {
+            continue;
+        }
+        if (idx != first_idx && !data_state_is_dirty(&t->data_state) &&
+            data_state_score(&t->data_state, now) < AIR_STREAM_TELEMETRY_BATCH_MIN_SCORE)
+        {
+            continue;
+        }
+        size_t value_size = air_stream_telemetry_batch_value_size(s, t, id);
+        if (size + value_size > AIR_STREAM_TELEMETRY_BATCH_MAX_SIZE)
+        {
+            continue;
+        }
+        ts[count] = t;
+        ids[count] = id;
+        count++;
+        size += value_size;
+    }
+    size_t n = air_stream_feed_output_telemetry_batch(s, ts, ids, count);
+    if (n > 0)
+    {
+        for (size_t ii = 0; ii < count; ii++)
+        {
+            data_state_sent(&ts[ii]->data_state, -1, now);
+        }
+    }
+    return n;
+}
+
+size_t air_stream_feed_output_scored_downlink_telemetry(air_stream_t *s, telemetry_t *telemetry, bool batch, time_micros_t now)
+{
+    telemetry_t *dt = NULL;
+    int dtidx = -1;
+    uint32_t max_score = 0;
+    for (int ii = 0; ii < TELEMETRY_DOWNLINK_COUNT; ii++)
+    {
+        telemetry_t *t = &telemetry[ii];
+        if (!telemetry_has_value(t))
+        {
+            continue;
+        }
+        uint32_t score = data_state_score(&t->data_state, now);
+        if (score > max_score)
+        {
+            dt = t;
+            dtidx = ii;
+            max_score = score;
+        }
+    }
+    if (!dt)
+    {
+        // No telemetry data to send
+        return 0;
+    }
+    if (batch && telemetry_get_data_size(TELEMETRY_DOWNLINK_ID(dtidx)) > 0)
+    {
+        return air_stream_feed_output_downlink_telemetry_batch(s, telemetry, dtidx, now);
+    }
+    data_state_sent(&dt->data_state, -1, now);
+    return air_stream_feed_output_downlink_telemetry(s, dt, TELEMETRY_DOWNLINK_ID(dtidx));
+}
+
+size_t air_stream_feed_output_cmd(air_stream_t *s, uint8_t cmd, const void *data, size_t size)
+{
+    // We only have 6 bits for CMD encoding
+    ASSERT(cmd < 64);
+#if defined(USE_AIR_STREAM_RELIABLE)
+    if (s->reliable.enabled && air_cmd_is_reliable(cmd))
+    {
+        return air_stream_reliable_feed(&s->reliable, cmd, data, size);
+    }
+#endif
+    return air_stream_write_cmd_frame(s, cmd, data, size);
+}
+
+size_t air_stream_output_count(const air_stream_t *s)
+{
+    size_t count = 0;
+    for (int ii = 0; ii < AIR_STREAM_CLASS_COUNT; ii++)
+    {
+        count += ring_buffer_count(s->classes[ii].queue);
+    }
+    return count;
+}
+
+void air_stream_reset_output(air_stream_t *s)
+{
+    if (s->output_remaining > 0)
+    {
+        air_stream_class_t *c = &s->classes[s->output_class];
+        ring_buffer_consume(c->queue, s->output_remaining);
+        c->stats.depth -= s->output_remaining;
+        s->output_remaining = 0;
+    }
+}
+
+static bool air_stream_class_has_frame(air_stream_t *s, air_stream_class_e cls)
+{
+    return ring_buffer_count(&s->classes[cls].frames) > 0;
+}
+
+static void air_stream_class_pull(air_stream_t *s, air_stream_class_e cls, size_t offset, size_t packet_size, time_micros_t now)
+{
+#if defined(USE_AIR_STREAM_RELIABLE)
+    if (cls == AIR_STREAM_CLASS_MSP)
+    {
+        air_stream_reliable_pull(s, offset, packet_size);
+    }
+#endif
+    if (s->pull && !air_stream_class_has_frame(s, cls))
+    {
+        s->pull(s->user, cls, offset, now);
+    }
+}
+
+static void air_stream_start_frame(air_stream_t *s, air_stream_class_e cls, time_micros_t now)
+{
+    air_stream_class_t *c = &s->classes[cls];
+    air_stream_queued_frame_t frame;
+    ring_buffer_pop(&c->frames, &frame);
+    s->output_class = cls;
+    s->output_remaining = frame.size;
+    c->stats.frames++;
+    c->stats.last_wait = (uint32_t)now - frame.queued_at;
+    c->stats.max_wait = MAX(c->stats.max_wait, c->stats.last_wait);
+    c->stats.total_wait += c->stats.last_wait;
+}
+
+static void air_stream_drr_next(air_stream_t *s)
+{
+    if (++s->drr_class == AIR_STREAM_CLASS_COUNT)
+    {
+        // AIR_STREAM_CLASS_CONTROL is not part of the round
+        s->drr_class = AIR_STREAM_CLASS_CONTROL + 1;
+    }
+    s->drr_visited = false;
+}
+
+// Picks the next frame to send. Returns false if there's nothing to send.
+static bool air_stream_schedule_frame(air_stream_t *s, size_t offset, size_t packet_size, time_micros_t now)
+{
+    if (air_stream_class_has_frame(s, AIR_STREAM_CLASS_CONTROL))
+    {
+        air_stream_start_frame(s, AIR_STREAM_CLASS_CONTROL, now);
+        return true;
+    }
+    // Deficit round robin. Each class gets its quantum when visited and
+    // sends frames while it has enough credit, then we move to the next one.
+    // Note that frames bigger than the quantum are sent after accumulating
+    // enough credit in several rounds.
+    unsigned pulled = 0;
+    unsigned idle = 0;
+    while (idle < AIR_STREAM_CLASS_COUNT - 1)
+    {
+        air_stream_class_e cls = s->drr_class;
+        air_stream_class_t *c = &s->classes[cls];
+        if (!air_stream_class_has_frame(s, cls) && !(pulled & (1 << cls)))
+        {
+            pulled |= 1 << cls;
+            air_stream_class_pull(s, cls, offset, packet_size, now);
+        }
+        if (!air_stream_class_has_frame(s, cls))
+        {
+            // Idle classes don't accumulate credit
+            c->deficit = 0;
+            air_stream_drr_next(s);
+            idle++;
+            continue;
+        }
+        idle = 0;
+        if (!s->drr_visited)
+        {
+            c->deficit += c->quantum;
+            s->drr_visited = true;
+        }
+        air_stream_queued_frame_t frame;
+        ring_buffer_peek(&c->frames, &frame);
+        if (frame.size <= c->deficit)
+        {
+            c->deficit -= frame.size;
+            air_stream_start_frame(s, cls, now);
+            return true;
+        }
+        air_stream_drr_next(s);
+    }
+    return false;
+}
+
+size_t air_stream_pop_output_n(air_stream_t *s, void *buf, size_t size, time_micros_t now)
+{
+#if defined(USE_AIR_STREAM_RELIABLE)
+    air_stream_reliable_update(s);
+#endif
+#if defined(USE_AIR_STREAM_TELEMETRY_DELTA)
+    air_stream_telemetry_delta_update(s);
+#endif
+    uint8_t *ptr = buf;
+    size_t pos = 0;
+    while (pos < size)
+    {
+        if (s->output_remaining == 0 && !air_stream_schedule_frame(s, pos, size, now))
+        {
+            break;
+        }
+        air_stream_class_t *c = &s->classes[s->output_class];
+        size_t n = ring_buffer_pop_n(c->queue, ptr + pos, MIN(size - pos, s->output_remaining));
+        pos += n;
+        s->output_remaining -= n;
+        c->stats.bytes += n;
+        c->stats.depth -= n;
+    }
+    return pos;
+}
+
+const air_stream_class_stats_t *air_stream_get_class_stats(const air_stream_t *s, air_stream_class_e cls)
+{
+    return &s->classes[cls].stats;
+}
+
+const char *air_stream_class_name(air_stream_class_e cls)
+{
+    static const char *names[] = {
+        [AIR_STREAM_CLASS_CONTROL] = "Ctrl",
+        [AIR_STREAM_CLASS_CHANNELS] = "Chn",
+        [AIR_STREAM_CLASS_TELEMETRY] = "Tlm",
+        [AIR_STREAM_CLASS_MSP] = "MSP",
+        [AIR_STREAM_CLASS_RMP] = "RMP",
+    };
+    _Static_assert(ARRAY_COUNT(names) == AIR_STREAM_CLASS_COUNT, "missing air_stream_class_e names");
+    if (cls < AIR_STREAM_CLASS_COUNT)
+    {
+        return names[cls];
+    }
+    return NULL;
+}
@@ -4,54 +4,294 @@
 
 #include "air/air.h"
 #include "air/air_cmd.h"
+#include "air/air_telemetry_delta.h"
 
 #include "msp/msp.h"
 
+#include "rc/rc_data.h"
 #include "rc/telemetry.h"
 
 #include "util/ringbuffer.h"
 #include "util/time.h"
 
+#include "target.h"
+
 // MSP_MAX_PAYLOAD_SIZE, 1 byte for direction, 3 bytes for variable sized cmd and
 // 3 bytes for the variable sized cmd size
 #define AIR_STREAM_BUFFER_CAPACITY (MSP_MAX_PAYLOAD_SIZE + 1 + 3 + 3)
-// Worst case scenario: All bytes stuffed since we don't put start-stop here
-#define AIR_STREAM_INPUT_BUFFER_CAPACITY (AIR_STREAM_BUFFER_CAPACITY * 2)
 // Worst case scenario: All bytes stuffed plus start-stop starting with just one byte left in the packet
 #define AIR_STREAM_OUTPUT_BUFFER_CAPACITY (AIR_STREAM_BUFFER_CAPACITY * 2 + 1 + 1)
 #define AIR_STREAM_MAX_PAYLOAD_SIZE AIR_STREAM_BUFFER_CAPACITY
 
+// Output queues, in bytes of encoded frames. Queues for bulk data must
+// fit a whole frame.
+#define AIR_STREAM_CONTROL_QUEUE_CAPACITY 32
+// Type byte and mask, then up to 2 + AIR_CHANNEL_BITS per aux channel
+#define AIR_STREAM_PACKED_CHANNELS_MAX_SIZE (2 + ((RC_CHANNELS_NUM - 4) * (2 + AIR_CHANNEL_BITS) + 7) / 8)
+#define AIR_STREAM_CHANNELS_QUEUE_CAPACITY (AIR_STREAM_PACKED_CHANNELS_MAX_SIZE * 2 + 1)
+// String telemetry with all bytes stuffed, plus the op byte used
+// by delta coded values
+#define AIR_STREAM_TELEMETRY_QUEUE_CAPACITY ((1 + 1 + TELEMETRY_STRING_MAX_SIZE + 1) * 2 + 1)
+// Maximum size of the id/value pairs in a telemetry batch. Sized so a
+// fully stuffed batch still fits in the telemetry queue.
+#define AIR_STREAM_TELEMETRY_BATCH_MAX_SIZE TELEMETRY_STRING_MAX_SIZE
+// Values that haven't changed are only batched together with the one
+// with the highest score once they haven't been sent for this long
+#define AIR_STREAM_TELEMETRY_BATCH_MIN_SCORE MILLIS_TO_MICROS(500)
+// A lost packet drops the whole batch, which spans several packets. Below
+// this downlink link quality, sending one value per frame delivers more
+// updates. See test/air_stream_telemetry_batch_test.c.
+#define AIR_STREAM_TELEMETRY_BATCH_MIN_LQ 97
+#define AIR_STREAM_MSP_QUEUE_CAPACITY AIR_STREAM_OUTPUT_BUFFER_CAPACITY
+#define AIR_STREAM_RMP_QUEUE_CAPACITY AIR_STREAM_OUTPUT_BUFFER_CAPACITY
+#define AIR_STREAM_QUEUE_MAX_FRAMES 8
+// Must fit in the control queue with all bytes stuffed
+#define AIR_STREAM_TELEMETRY_ACKS_PER_FRAME 4
+
+// Bytes each class can send per round of the deficit round robin
+// scheduler. Classes with queued data get bandwidth proportional
+// to their quantum.
+#define AIR_STREAM_CHANNELS_QUANTUM 8
+#define AIR_STREAM_TELEMETRY_QUANTUM 4
+#define AIR_STREAM_MSP_QUANTUM 8
+#define AIR_STREAM_RMP_QUANTUM 4
+
+// Output traffic classes. Each one has its own queue.
+typedef enum
+{
+    AIR_STREAM_CLASS_CONTROL = 0, // Mode switches and ACKs. Strict priority over the rest.
+    AIR_STREAM_CLASS_CHANNELS,    // Aux channels
+    AIR_STREAM_CLASS_TELEMETRY,
+    AIR_STREAM_CLASS_MSP,         // Also used by the reliable sub-channel
+    AIR_STREAM_CLASS_RMP,
+} air_stream_class_e;
+
+#define AIR_STREAM_CLASS_COUNT (AIR_STREAM_CLASS_RMP + 1)
+
+typedef struct air_stream_class_stats_s
+{
+    uint32_t frames;     // Frames sent
+    uint32_t bytes;      // Bytes sent, including framing
+    uint32_t dropped;    // Frames dropped because the queue was full
+    uint16_t depth;      // Bytes queued right now
+    uint16_t max_depth;  // Maximum value seen for depth
+    uint32_t last_wait;  // Time the last frame sent waited in the queue, in us
+    uint32_t max_wait;   // Maximum value seen for last_wait
+    uint64_t total_wait; // Sum of last_wait for all frames sent
+} air_stream_class_stats_t;
+
+typedef struct air_stream_queued_frame_s
+{
+    uint16_t size;
+    uint32_t queued_at; // Lower 32 bits of the time_micros_t
+} air_stream_queued_frame_t;
+
+typedef struct air_stream_class_s
+{
+    ring_buffer_t *queue; // Encoded frames
+    RING_BUFFER_DECLARE(frames, air_stream_queued_frame_t, AIR_STREAM_QUEUE_MAX_FRAMES);
+    uint16_t quantum;
+    uint16_t deficit;
+    air_stream_class_stats_t stats;
+} air_stream_class_t;
+
+#if defined(USE_AIR_STREAM_RELIABLE)
+#define AIR_STREAM_RELIABLE_SEQ_COUNT (1 << AIR_CMD_RELIABLE_SEQ_BITS)
+// Selective repeat needs the window to be at most half the sequence space
+#define AIR_STREAM_RELIABLE_WINDOW_SIZE (AIR_STREAM_RELIABLE_SEQ_COUNT / 2)
+#define AIR_STREAM_RELIABLE_SEGMENT_SIZE 32
+// Enough for a full MSP command plus a full window of segments waiting for ACK
+#define AIR_STREAM_RELIABLE_TX_BUFFER_CAPACITY (AIR_STREAM_BUFFER_CAPACITY + AIR_STREAM_RELIABLE_WINDOW_SIZE * AIR_STREAM_RELIABLE_SEGMENT_SIZE)
+
+typedef struct air_stream_reliable_stats_s
+{
+    uint32_t segments_sent;   // Including retransmissions
+    uint32_t retransmissions; // Segments sent more than once
+    uint32_t bytes_acked;     // Bytes acknowledged by the other end
+    uint32_t bytes_received;  // Bytes received in order
+    uint32_t resets;          // Sessions restarted because the other end lost its state
+    uint16_t rtt;             // Smoothed RTT in output packets
+    uint16_t rto;             // Retransmission timeout in output packets
+} air_stream_reliable_stats_t;
+
+typedef struct air_stream_reliable_tx_slot_s
+{
+    uint8_t size;
+    uint8_t state; // from air_stream_reliable_tx_state_e in air_stream.c
+    bool retransmitted;
+    uint8_t packets;  // Output packets the segment was sent in
+    uint16_t sent_at; // Output packet in which the last byte of the segment was sent
+    uint16_t timeout_at;
+} air_stream_reliable_tx_slot_t;
+
+typedef struct air_stream_reliable_rx_slot_s
+{
+    bool received;
+    uint8_t size;
+    uint8_t data[AIR_STREAM_RELIABLE_SEGMENT_SIZE];
+} air_stream_reliable_rx_slot_t;
+
+// Selective repeat ARQ used for MSP and RMP, which can't tolerate losing
+// frames. Commands are serialized into tx_buf and sent in segments as
+// AIR_CMD_RELIABLE_SEGMENT, which the other end acknowledges with
+// AIR_CMD_RELIABLE_ACK.
+typedef struct air_stream_reliable_s
+{
+    bool enabled;                                     // Wether MSP/RMP are sent via the reliable sub-channel
+    uint16_t packets;                                 // Output packets sent, used as clock for timeouts
+    uint32_t tx_nonce;                                // Random, identifies this sender in syn segments
+    uint8_t tx_session;                               // Changed when the receiver asks for a reset
+    bool tx_synced;                                   // Wether we got an ACK in this session
+    unsigned tx_base_seq : AIR_CMD_RELIABLE_SEQ_BITS; // Oldest segment not acknowledged yet
+    unsigned tx_next_seq : AIR_CMD_RELIABLE_SEQ_BITS; // Sequence number for the next new segment
+    uint8_t tx_in_flight;                             // Segments from tx_base_seq to tx_next_seq
+    uint16_t tx_segmented;                            // Bytes in tx_buf already assigned to segments
+    uint16_t tx_srtt;                                 // Smoothed RTT in packets, with 3 bits of fraction
+    uint16_t tx_rto;                                  // Retransmission timeout in packets
+    uint16_t tx_loss_packets;                         // Packets carrying segments sent once, halved periodically
+    uint16_t tx_loss_segments;                        // How many of those segments were lost
+    air_stream_reliable_tx_slot_t tx_slots[AIR_STREAM_RELIABLE_WINDOW_SIZE];
+    RING_BUFFER_DECLARE(tx_buf, uint8_t, AIR_STREAM_RELIABLE_TX_BUFFER_CAPACITY);
+    uint16_t rx_session;                              // AIR_STREAM_RELIABLE_SESSION_NONE when we have no session
+    unsigned rx_next_seq : AIR_CMD_RELIABLE_SEQ_BITS; // Next segment to deliver
+    uint32_t rx_nonce;                                // Nonce of the sender that started rx_session
+    bool rx_syn;                                      // Wether the last segment had syn
+    bool rx_ack_pending;
+    bool rx_reset_pending;
+    uint8_t rx_reset_session; // Session the reset is sent for
+    air_stream_reliable_rx_slot_t rx_slots[AIR_STREAM_RELIABLE_WINDOW_SIZE];
+    uint16_t rx_msg_size;
+    int rx_msg_expected_size;
+    uint8_t rx_msg[AIR_STREAM_MAX_PAYLOAD_SIZE];
+    air_stream_reliable_stats_t stats;
+} air_stream_reliable_t;
+#endif
+
+#if defined(USE_AIR_STREAM_TELEMETRY_DELTA)
+typedef struct air_stream_telemetry_delta_s
+{
+    bool enabled;                  // Wether the telemetry we send is delta coded
+    uint16_t packets;              // Output packets sent, used as clock by the encoder
+    air_telemetry_delta_t encoder; // For the telemetry we send
+    air_telemetry_delta_t decoder; // For the telemetry we receive
+    uint32_t acks_pending;         // Bit N set means acks[N] needs to be sent
+    air_cmd_telemetry_ack_t acks[AIR_TELEMETRY_DELTA_MAX_IDS];
+} air_stream_telemetry_delta_t;
+#endif
+
 // Value is already converted to rc_data_t units
 typedef void (*air_stream_channel_f)(void *user, unsigned chn, unsigned value, time_micros_t now);
 typedef void (*air_stream_telemetry_f)(void *user, int telemetry_id, const void *data, size_t size, time_micros_t now);
 typedef void (*air_stream_cmd_f)(void *user, air_cmd_e cmd_id, const void *data, size_t size, time_micros_t now);
+// Called when cls is scheduled but has no queued frames, so the most recent
+// data can be fed just before sending it. offset is the number of bytes in
+// the packet being filled before the frame fed by the callback.
+typedef void (*air_stream_pull_f)(void *user, air_stream_class_e cls, size_t offset, time_micros_t now);
 
 typedef struct air_stream_s
 {
     air_stream_channel_f channel;
     air_stream_telemetry_f telemetry;
     air_stream_cmd_f cmd;
+    air_stream_pull_f pull;
     void *user;
-    bool input_in_sync;                // Wether the input data stream is synchronized
+    bool input_in_sync;                // Wether we're decoding a frame. Otherwise we wait for the next delimiter.
+    bool input_stuffed;                // Wether the previous input byte was AIR_DATA_BYTE_STUFF
+    bool cobs;                         // Wether variable sized commands use COBS instead of byte stuffing
+    bool input_cobs;                   // Wether the rest of the input frame is COBS encoded
+    bool input_cobs_delimiter;         // Wether the current COBS block ends with an implied delimiter
+    uint8_t input_cobs_remaining;      // Bytes left in the current COBS block
     unsigned input_seq : AIR_SEQ_BITS; // Input sequence number
-    RING_BUFFER_DECLARE(input_buf, uint8_t, AIR_STREAM_INPUT_BUFFER_CAPACITY);
-    RING_BUFFER_DECLARE(output_buf, uint8_t, AIR_STREAM_OUTPUT_BUFFER_CAPACITY);
+    uint16_t input_frame_size;         // Decoded bytes in input_frame
+    int input_frame_expected_size;     // Total size of the frame being decoded, 0 if not known yet
+    uint8_t input_frame[AIR_STREAM_MAX_PAYLOAD_SIZE];
+    RING_BUFFER_DECLARE(control_queue, uint8_t, AIR_STREAM_CONTROL_QUEUE_CAPACITY);
+    RING_BUFFER_DECLARE(channels_queue, uint8_t, AIR_STREAM_CHANNELS_QUEUE_CAPACITY);
+    RING_BUFFER_DECLARE(telemetry_queue, uint8_t, AIR_STREAM_TELEMETRY_QUEUE_CAPACITY);
+    RING_BUFFER_DECLARE(msp_queue, uint8_t, AIR_STREAM_MSP_QUEUE_CAPACITY);
+    RING_BUFFER_DECLARE(rmp_queue, uint8_t, AIR_STREAM_RMP_QUEUE_CAPACITY);
+    air_stream_class_t classes[AIR_STREAM_CLASS_COUNT];
+    uint8_t output_class;      // Class of the frame being sent
+    uint16_t output_remaining; // Bytes left of the frame being sent
+    uint8_t drr_class;         // Class visited by the deficit round robin scheduler
+    bool drr_visited;          // Wether drr_class already got its quantum in this visit
+#if defined(USE_AIR_STREAM_RELIABLE)
+    air_stream_reliable_t reliable;
+#endif
+#if defined(USE_AIR_STREAM_TELEMETRY_DELTA)
+    air_stream_telemetry_delta_t telemetry_delta;
+#endif
 } air_stream_t;
 
-void air_stream_init(air_stream_t *s, air_stream_channel_f channel, air_stream_telemetry_f telemetry, air_stream_cmd_f cmd, void *user);
+void air_stream_init(air_stream_t *s, air_stream_channel_f channel, air_stream_telemetry_f telemetry, air_stream_cmd_f cmd, air_stream_pull_f pull, void *user);
+#if defined(USE_AIR_STREAM_RELIABLE)
+// Enables or disables sending MSP and RMP via the reliable sub-channel. This
+// should only be enabled when the other end has AIR_CAP_STREAM_RELIABLE.
+// Reliable data from the other end is always accepted.
+void air_stream_set_reliable(air_stream_t *s, bool enabled);
+const air_stream_reliable_stats_t *air_stream_get_reliable_stats(const air_stream_t *s);
+#endif
+#if defined(USE_AIR_STREAM_TELEMETRY_DELTA)
+// Enables or disables delta coding for the telemetry we send. This should
+// only be enabled when the other end has AIR_CAP_STREAM_TELEMETRY_DELTA.
+// Delta coded telemetry from the other end is always accepted.
+void air_stream_set_telemetry_delta(air_stream_t *s, bool enabled);
+#endif
+
+// Enables or disables COBS for the payload of variable sized commands
+// in both directions. Must be called right after air_stream_init() and
+// only when both ends have AIR_CAP_STREAM_COBS.
+void air_stream_set_cobs(air_stream_t *s, bool enabled);
 
-// Add data received from the air. Returns true iff the data didn't cause a reset
-// in the stream.
+// Add data received from the air. Data is decoded as it arrives and frames
+// are dispatched as soon as they're complete. If seq indicates that packets
+// were lost, only the frame in progress is dropped and the decoder resyncs
+// on the next delimiter.
 void air_stream_feed_input(air_stream_t *s, unsigned seq, const void *data, size_t size, time_micros_t now);
 
-// Add data to be stream to the air
+// Add data to be stream to the air. Each function writes a whole frame
+// to the queue for its class and returns the number of bytes added, zero
+// if the frame didn't fit.
 size_t air_stream_feed_output_channel(air_stream_t *s, unsigned ch, unsigned val);
+// Writes all the channels in mask (bit n for channel n, only aux channels
+// are allowed) in a single frame, with their values taken from channels.
+// Requires AIR_CAP_STREAM_PACKED_CHANNELS on the other end.
+size_t air_stream_feed_output_channels(air_stream_t *s, uint32_t mask, const control_channel_t *channels);
+// Feeds the aux channels in channels[4:count] that are waiting for an ACK.
+// With packed set, which requires AIR_CAP_STREAM_PACKED_CHANNELS on the
+// other end, all of them go in the same frame. Otherwise, just the one
+// with the highest data_state_score(). Returns the number of bytes fed
+// and sets sent to the mask of the channels in the frame.
+size_t air_stream_feed_output_unacked_channels(air_stream_t *s, control_channel_t *channels, unsigned count, bool packed, uint32_t *sent, time_micros_t now);
 size_t air_stream_feed_output_uplink_telemetry(air_stream_t *s, telemetry_t *t, telemetry_uplink_id_e id);
 size_t air_stream_feed_output_downlink_telemetry(air_stream_t *s, telemetry_t *t, telemetry_downlink_id_e id);
+// Writes count fixed size telemetry values in a single frame. ids must
+// be all uplink or all downlink, depending on the stream direction, and
+// the values must add up to AIR_STREAM_TELEMETRY_BATCH_MAX_SIZE at most,
+// as returned by air_stream_telemetry_batch_value_size(). Requires
+// AIR_CAP_STREAM_TELEMETRY_BATCH on the other end.
+size_t air_stream_feed_output_telemetry_batch(air_stream_t *s, telemetry_t *const *ts, const int *ids, size_t count);
+// Returns the number of bytes the fixed size value in t for id would use
+// in a batch fed right now, including its index.
+size_t air_stream_telemetry_batch_value_size(air_stream_t *s, telemetry_t *t, int id);
+// Feeds the downlink value in telemetry[TELEMETRY_DOWNLINK_COUNT] with the
+// highest data_state_score(). With batch set, which requires
+// AIR_CAP_STREAM_TELEMETRY_BATCH on the other end, fixed size values that
+// changed (or haven't been sent for AIR_STREAM_TELEMETRY_BATCH_MIN_SCORE)
+// go in the same frame. Marks the values in the frame as sent.
+size_t air_stream_feed_output_scored_downlink_telemetry(air_stream_t *s, telemetry_t *telemetry, bool batch, time_micros_t now);
 size_t air_stream_feed_output_cmd(air_stream_t *s, uint8_t cmd, const void *data, size_t size);
-// Returns number of bytes ready for output
+// Returns number of bytes ready for output in all queues
 size_t air_stream_output_count(const air_stream_t *s);
-// Removes all output data from the air stream. Used for
-// sending urgent data.
+// Drops the rest of the frame being sent, so the next packet starts
+// with a new frame. Used for sending urgent data.
 void air_stream_reset_output(air_stream_t *s);
-bool air_stream_pop_output(air_stream_t *s, uint8_t *c);
+// Pops up to size bytes into buf, returns the number of bytes popped.
+// Must be called once per outgoing packet, with size set to the packet
+// data size. Control frames are sent first, then the rest of the classes
+// share the bandwidth using deficit round robin.
+size_t air_stream_pop_output_n(air_stream_t *s, void *buf, size_t size, time_micros_t now);
+
+const air_stream_class_stats_t *air_stream_get_class_stats(const air_stream_t *s, air_stream_class_e cls);
+// Returns a short name for cls, for debugging
+const char *air_stream_class_name(air_stream_class_e cls);
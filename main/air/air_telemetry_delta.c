@@ -0,0 +1,456 @@
+#include <string.h>
+
+#include <hal/rand.h>
+
+#include "util/macros.h"
+#include "util/uvarint.h"
+
+#include "air_telemetry_delta.h"
+
+#define AIR_TELEMETRY_DELTA_OP_SET 0
+#define AIR_TELEMETRY_DELTA_OP_DELTA 1
+#define AIR_TELEMETRY_DELTA_OP_REF 2
+
+#define AIR_TELEMETRY_DELTA_HEADER(op, slot, gen) ((op) << 6 | (slot) << 4 | (gen))
+#define AIR_TELEMETRY_DELTA_HEADER_OP(h) ((h) >> 6)
+#define AIR_TELEMETRY_DELTA_HEADER_SLOT(h) (((h) >> 4) & 3)
+#define AIR_TELEMETRY_DELTA_HEADER_GEN(h) ((h)&0x0f)
+
+#define AIR_TELEMETRY_DELTA_SLOT_VALID 0x10
+#define AIR_TELEMETRY_DELTA_SLOT_GEN(s) ((s)&0x0f)
+
+// Output packets to wait for the ACK of a SET before sending another
+// one for the same index. ACKs are sent in the next packet in the other
+// direction, so this leaves room for a few lost ones.
+#define AIR_TELEMETRY_DELTA_SET_RETRY_PACKETS 8
+// Output packets after which we assume an ACK can't arrive anymore. The
+// generation of a SET that was retried isn't reused before this, so a
+// late ACK for it can't validate a newer SET that the decoder missed.
+#define AIR_TELEMETRY_DELTA_ACK_MAX_PACKETS 128
+
+_Static_assert(AIR_TELEMETRY_DELTA_MAX_IDS >= TELEMETRY_UPLINK_COUNT, "AIR_TELEMETRY_DELTA_MAX_IDS can't hold uplink telemetry");
+_Static_assert(AIR_TELEMETRY_DELTA_MAX_IDS <= 32, "telemetry index doesn't fit in air_cmd_telemetry_ack_t");
+_Static_assert(AIR_TELEMETRY_DELTA_INT_SLOTS <= AIR_TELEMETRY_DELTA_STRING_SLOTS, "slot flags can't hold all integer slots");
+_Static_assert(AIR_TELEMETRY_DELTA_STRING_SLOTS <= 4, "slot number doesn't fit in the header");
+
+static int air_telemetry_delta_id(const air_telemetry_delta_t *d, unsigned idx)
+{
+    return d->uplink ? TELEMETRY_UPLINK_ID(idx) : TELEMETRY_DOWNLINK_ID(idx);
+}
+
+static unsigned air_telemetry_delta_slot_count(const air_telemetry_delta_entry_t *e)
+{
+    return e->string >= 0 ? AIR_TELEMETRY_DELTA_STRING_SLOTS : AIR_TELEMETRY_DELTA_INT_SLOTS;
+}
+
+static bool air_telemetry_delta_slot_matches(const air_telemetry_delta_entry_t *e, unsigned slot, unsigned gen)
+{
+    return slot < air_telemetry_delta_slot_count(e) &&
+           e->slots[slot] == (AIR_TELEMETRY_DELTA_SLOT_VALID | gen);
+}
+
+static uint32_t air_telemetry_delta_int_mask(size_t size)
+{
+    return size == sizeof(uint32_t) ? UINT32_MAX : UINT16_MAX;
+}
+
+static uint32_t air_telemetry_delta_int_value(const telemetry_val_t *val, size_t size)
+{
+    return size == sizeof(uint32_t) ? val->u32 : val->u16;
+}
+
+static uint32_t air_telemetry_delta_zigzag(uint32_t value, uint32_t prev, size_t size)
+{
+    int32_t delta;
+    if (size == sizeof(uint32_t))
+    {
+        delta = (int32_t)(value - prev);
+    }
+    else
+    {
+        delta = (int16_t)(value - prev);
+    }
+    return ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+}
+
+static size_t air_telemetry_delta_uvarint_size(uint32_t v)
+{
+    size_t size = 1;
+    while (v >= 0x80)
+    {
+        v >>= 7;
+        size++;
+    }
+    return size;
+}
+
+// Returns the slot to store a new value, avoiding keep
+static unsigned air_telemetry_delta_free_slot(air_telemetry_delta_entry_t *e, int keep)
+{
+    unsigned count = air_telemetry_delta_slot_count(e);
+    for (unsigned ii = 0; ii < count; ii++)
+    {
+        if ((int)ii != keep && !(e->slots[ii] & AIR_TELEMETRY_DELTA_SLOT_VALID))
+        {
+            return ii;
+        }
+    }
+    unsigned slot = e->next_slot++ % count;
+    if ((int)slot == keep)
+    {
+        slot = e->next_slot++ % count;
+    }
+    return slot;
+}
+
+// Returns the generations that can't be used by a new SET, because a
+// late ACK for a previous SET with the same one might still arrive.
+// Includes the pending SET, which the new one would replace.
+static uint16_t air_telemetry_delta_unacked_gens(const air_telemetry_delta_entry_t *e, uint16_t packet)
+{
+    uint16_t gens = 0;
+    if ((uint16_t)(packet - e->unacked_at) < AIR_TELEMETRY_DELTA_ACK_MAX_PACKETS)
+    {
+        gens = e->unacked_gens;
+    }
+    if (e->pending_slot >= 0)
+    {
+        gens |= 1 << AIR_TELEMETRY_DELTA_SLOT_GEN(e->slots[e->pending_slot]);
+    }
+    return gens;
+}
+
+static bool air_telemetry_delta_can_set(const air_telemetry_delta_entry_t *e, uint16_t packet)
+{
+    if (e->pending_slot < 0)
+    {
+        return true;
+    }
+    return (uint16_t)(packet - e->set_at) >= AIR_TELEMETRY_DELTA_SET_RETRY_PACKETS &&
+           air_telemetry_delta_unacked_gens(e, packet) != 0xffff;
+}
+
+// Marks slot as waiting for the ACK of a SET and returns the header for it
+static uint8_t air_telemetry_delta_begin_set(air_telemetry_delta_entry_t *e, unsigned slot, uint16_t packet)
+{
+    uint16_t unacked = air_telemetry_delta_unacked_gens(e, packet);
+    if (e->pending_slot >= 0)
+    {
+        e->unacked_at = packet;
+    }
+    e->unacked_gens = unacked;
+    while (unacked & (1 << e->gen))
+    {
+        e->gen = (e->gen + 1) & 0x0f;
+    }
+    unsigned gen = e->gen;
+    e->gen = (e->gen + 1) & 0x0f;
+    e->slots[slot] = gen;
+    e->pending_slot = slot;
+    e->set_at = packet;
+    return AIR_TELEMETRY_DELTA_HEADER(AIR_TELEMETRY_DELTA_OP_SET, slot, gen);
+}
+
+void air_telemetry_delta_init(air_telemetry_delta_t *d, bool uplink)
+{
+    d->uplink = uplink;
+    d->count = uplink ? TELEMETRY_UPLINK_COUNT : TELEMETRY_DOWNLINK_COUNT;
+    unsigned strings = 0;
+    for (unsigned ii = 0; ii < d->count; ii++)
+    {
+        air_telemetry_delta_entry_t *e = &d->entries[ii];
+        memset(e, 0, sizeof(*e));
+        e->pending_slot = -1;
+        e->string = -1;
+        // Random starting generation, so ACKs for a previous instance
+        // of the encoder are unlikely to match.
+        e->gen = hal_rand_u32() & 0x0f;
+        if (telemetry_get_type(air_telemetry_delta_id(d, ii)) == TELEMETRY_TYPE_STRING)
+        {
+            ASSERT(strings < AIR_TELEMETRY_DELTA_MAX_STRING_IDS);
+            e->string = strings++;
+        }
+    }
+}
+
+bool air_telemetry_delta_is_supported(const air_telemetry_delta_t *d, unsigned idx)
+{
+    return idx < d->count && (d->entries[idx].string >= 0 ||
+                              telemetry_get_data_size(air_telemetry_delta_id(d, idx)) > 1);
+}
+
+// If buf is NULL, the encoded size is calculated without changing d
+static size_t air_telemetry_delta_encode_string(air_telemetry_delta_t *d, air_telemetry_delta_entry_t *e, const char *s, uint8_t *buf, uint16_t packet)
+{
+    char(*values)[TELEMETRY_STRING_MAX_SIZE + 1] = d->strings[e->string];
+    for (unsigned ii = 0; ii < AIR_TELEMETRY_DELTA_STRING_SLOTS; ii++)
+    {
+        if ((e->slots[ii] & AIR_TELEMETRY_DELTA_SLOT_VALID) && strcmp(values[ii], s) == 0)
+        {
+            if (buf)
+            {
+                buf[0] = AIR_TELEMETRY_DELTA_HEADER(AIR_TELEMETRY_DELTA_OP_REF, ii, AIR_TELEMETRY_DELTA_SLOT_GEN(e->slots[ii]));
+            }
+            return 1;
+        }
+    }
+    if (!air_telemetry_delta_can_set(e, packet))
+    {
+        return 0;
+    }
+    size_t size = strlen(s) + 1;
+    if (buf)
+    {
+        unsigned slot = air_telemetry_delta_free_slot(e, -1);
+        memcpy(values[slot], s, size);
+        buf[0] = air_telemetry_delta_begin_set(e, slot, packet);
+        memcpy(&buf[1], s, size);
+    }
+    return 1 + size;
+}
+
+static size_t air_telemetry_delta_encode_value(air_telemetry_delta_t *d, unsigned idx, const telemetry_val_t *val, uint8_t *buf, uint16_t packet)
+{
+    if (!air_telemetry_delta_is_supported(d, idx))
+    {
+        return 0;
+    }
+    air_telemetry_delta_entry_t *e = &d->entries[idx];
+    if (e->string >= 0)
+    {
+        return air_telemetry_delta_encode_string(d, e, val->s, buf, packet);
+    }
+    size_t data_size = telemetry_get_data_size(air_telemetry_delta_id(d, idx));
+    uint32_t value = air_telemetry_delta_int_value(val, data_size);
+    bool repeated = value == e->last;
+    if (buf)
+    {
+        e->last = value;
+    }
+    // Find the acknowledged value with the smallest delta
+    int best = -1;
+    uint32_t best_zigzag = 0;
+    for (unsigned ii = 0; ii < AIR_TELEMETRY_DELTA_INT_SLOTS; ii++)
+    {
+        if (e->slots[ii] & AIR_TELEMETRY_DELTA_SLOT_VALID)
+        {
+            uint32_t zigzag = air_telemetry_delta_zigzag(value, e->values[ii], data_size);
+            if (best < 0 || zigzag < best_zigzag)
+            {
+                best = ii;
+                best_zigzag = zigzag;
+            }
+        }
+    }
+    size_t delta_size = air_telemetry_delta_uvarint_size(best_zigzag);
+    if (best >= 0)
+    {
+        unsigned gen = AIR_TELEMETRY_DELTA_SLOT_GEN(e->slots[best]);
+        if (best_zigzag == 0)
+        {
+            if (buf)
+            {
+                buf[0] = AIR_TELEMETRY_DELTA_HEADER(AIR_TELEMETRY_DELTA_OP_REF, best, gen);
+            }
+            return 1;
+        }
+        // Deltas that fit in a single byte are as small as it gets, while
+        // larger ones mean the reference is getting stale. In that case
+        // store the current value in the other slot when we can, so the
+        // next deltas are small again.
+        if (1 + delta_size < data_size && (delta_size == 1 || !air_telemetry_delta_can_set(e, packet)))
+        {
+            if (buf)
+            {
+                buf[0] = AIR_TELEMETRY_DELTA_HEADER(AIR_TELEMETRY_DELTA_OP_DELTA, best, gen);
+                uvarint_encode32(&buf[1], delta_size, best_zigzag);
+            }
+            return 1 + delta_size;
+        }
+    }
+    // Values too small for deltas are only worth storing if they repeat
+    if (!air_telemetry_delta_can_set(e, packet) || (data_size <= 2 && !repeated))
+    {
+        return 0;
+    }
+    if (buf)
+    {
+        unsigned slot = air_telemetry_delta_free_slot(e, best);
+        e->values[slot] = value;
+        buf[0] = air_telemetry_delta_begin_set(e, slot, packet);
+        memcpy(&buf[1], val, data_size);
+    }
+    return 1 + data_size;
+}
+
+size_t air_telemetry_delta_encode(air_telemetry_delta_t *d, unsigned idx, const telemetry_val_t *val, void *buf, uint16_t packet)
+{
+    return air_telemetry_delta_encode_value(d, idx, val, buf, packet);
+}
+
+size_t air_telemetry_delta_encoded_size_for(air_telemetry_delta_t *d, unsigned idx, const telemetry_val_t *val, uint16_t packet)
+{
+    return air_telemetry_delta_encode_value(d, idx, val, NULL, packet);
+}
+
+void air_telemetry_delta_handle_ack(air_telemetry_delta_t *d, const air_cmd_telemetry_ack_t *ack)
+{
+    if (ack->idx >= d->count)
+    {
+        return;
+    }
+    air_telemetry_delta_entry_t *e = &d->entries[ack->idx];
+    if (!ack->nack && (e->unacked_gens & (1 << ack->gen)))
+    {
+        // Late ACK for a SET that has been replaced, the generation can
+        // be used again
+        e->unacked_gens &= ~(1 << ack->gen);
+        return;
+    }
+    if (ack->slot >= air_telemetry_delta_slot_count(e) || AIR_TELEMETRY_DELTA_SLOT_GEN(e->slots[ack->slot]) != ack->gen)
+    {
+        // Stale, the slot has been reused since
+        return;
+    }
+    if (ack->nack)
+    {
+        e->slots[ack->slot] &= ~AIR_TELEMETRY_DELTA_SLOT_VALID;
+    }
+    else if (e->pending_slot == ack->slot)
+    {
+        e->slots[ack->slot] |= AIR_TELEMETRY_DELTA_SLOT_VALID;
+        e->pending_slot = -1;
+    }
+}
+
+int air_telemetry_delta_encoded_size(const air_telemetry_delta_t *d, unsigned idx, const void *data, size_t size)
+{
+    if (!air_telemetry_delta_is_supported(d, idx))
+    {
+        return -1;
+    }
+    if (size == 0)
+    {
+        return 0;
+    }
+    const air_telemetry_delta_entry_t *e = &d->entries[idx];
+    const uint8_t *ptr = data;
+    if (AIR_TELEMETRY_DELTA_HEADER_SLOT(ptr[0]) >= air_telemetry_delta_slot_count(e))
+    {
+        return -1;
+    }
+    size_t data_size = telemetry_get_data_size(air_telemetry_delta_id(d, idx));
+    switch (AIR_TELEMETRY_DELTA_HEADER_OP(ptr[0]))
+    {
+    case AIR_TELEMETRY_DELTA_OP_SET:
+        if (data_size > 0)
+        {
+            return 1 + data_size;
+        }
+        // Zero terminated
+        for (size_t ii = 1; ii < size && ii < AIR_TELEMETRY_DELTA_MAX_SIZE; ii++)
+        {
+            if (ptr[ii] == 0)
+            {
+                return ii + 1;
+            }
+        }
+        return size < AIR_TELEMETRY_DELTA_MAX_SIZE ? 0 : -1;
+    case AIR_TELEMETRY_DELTA_OP_DELTA:
+        if (data_size == 0)
+        {
+            return -1;
+        }
+        // A delta of N bytes needs at most N+1 bytes
+        for (size_t ii = 1; ii < size && ii <= data_size + 1; ii++)
+        {
+            if (ptr[ii] < 0x80)
+            {
+                return ii + 1;
+            }
+        }
+        return size <= data_size + 1 ? 0 : -1;
+    case AIR_TELEMETRY_DELTA_OP_REF:
+        return 1;
+    }
+    return -1;
+}
+
+air_telemetry_delta_result_e air_telemetry_delta_decode(air_telemetry_delta_t *d, unsigned idx, const void *data, size_t size,
+                                                        telemetry_val_t *val, size_t *val_size, air_cmd_telemetry_ack_t *ack)
+{
+    if (air_telemetry_delta_encoded_size(d, idx, data, size) != (int)size)
+    {
+        return AIR_TELEMETRY_DELTA_INVALID;
+    }
+    air_telemetry_delta_entry_t *e = &d->entries[idx];
+    const uint8_t *ptr = data;
+    unsigned op = AIR_TELEMETRY_DELTA_HEADER_OP(ptr[0]);
+    unsigned slot = AIR_TELEMETRY_DELTA_HEADER_SLOT(ptr[0]);
+    unsigned gen = AIR_TELEMETRY_DELTA_HEADER_GEN(ptr[0]);
+    size_t data_size = telemetry_get_data_size(air_telemetry_delta_id(d, idx));
+    char *s = e->string >= 0 ? d->strings[e->string][slot] : NULL;
+
+    memset(ack, 0, sizeof(*ack));
+    ack->idx = idx;
+    ack->slot = slot;
+    ack->gen = gen;
+
+    if (op == AIR_TELEMETRY_DELTA_OP_SET)
+    {
+        e->slots[slot] = AIR_TELEMETRY_DELTA_SLOT_VALID | gen;
+        if (s)
+        {
+            memcpy(s, &ptr[1], size - 1);
+        }
+        else
+        {
+            memcpy(val, &ptr[1], data_size);
+            e->values[slot] = air_telemetry_delta_int_value(val, data_size);
+        }
+    }
+    else if (!air_telemetry_delta_slot_matches(e, slot, gen))
+    {
+        // We missed the SET for this slot or it has been overwritten
+        // since, ask the encoder to stop using it.
+        ack->nack = 1;
+        return AIR_TELEMETRY_DELTA_NACK;
+    }
+    else if (op == AIR_TELEMETRY_DELTA_OP_DELTA)
+    {
+        uint32_t zigzag;
+        if (uvarint_decode32(&zigzag, &ptr[1], size - 1) < 0)
+        {
+            return AIR_TELEMETRY_DELTA_INVALID;
+        }
+        int32_t delta = (int32_t)(zigzag >> 1) ^ -(int32_t)(zigzag & 1);
+        uint32_t value = (e->values[slot] + (uint32_t)delta) & air_telemetry_delta_int_mask(data_size);
+        if (data_size == sizeof(uint32_t))
+        {
+            val->u32 = value;
+        }
+        else
+        {
+            val->u16 = value;
+        }
+    }
+    else if (!s)
+    {
+        // REF to an integer
+        if (data_size == sizeof(uint32_t))
+        {
+            val->u32 = e->values[slot];
+        }
+        else
+        {
+            val->u16 = e->values[slot];
+        }
+    }
+    if (s)
+    {
+        data_size = strlen(s) + 1;
+        memcpy(val->s, s, data_size);
+    }
+    *val_size = data_size;
+    return op == AIR_TELEMETRY_DELTA_OP_SET ? AIR_TELEMETRY_DELTA_DECODED_ACK : AIR_TELEMETRY_DELTA_DECODED;
+}
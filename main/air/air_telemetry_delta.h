@@ -0,0 +1,92 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "air/air_cmd.h"
+
+#include "rc/telemetry.h"
+
+// Delta and dictionary coding for the telemetry values sent via air_stream_t.
+//
+// Each telemetry index has a few slots with values that the other end has
+// acknowledged. Integers can then be sent as a zigzag uvarint delta against
+// one of them, and values equal to a slot (e.g. a flight mode seen before)
+// as just a reference to it. New values are stored into a slot with a SET,
+// which the decoder acknowledges with AIR_CMD_TELEMETRY_ACK. Deltas and
+// references carry the generation of the slot they use, so a decoder which
+// missed a SET (or restarted) replies with a NACK instead of applying them
+// and the encoder falls back to absolute values.
+// SETs that get no ACK are retried with a new generation, and the old one
+// isn't reused while its ACK might still arrive, so a late ACK can't
+// validate a slot the decoder doesn't have.
+//
+// Encoded values start with a byte with the op in bits 7-6, the slot in
+// bits 5-4 and the generation in bits 3-0, followed by:
+//  - SET: the absolute value, zero terminated for strings.
+//  - DELTA: the zigzag encoded difference as uvarint. Integers only.
+//  - REF: nothing.
+
+#define AIR_TELEMETRY_DELTA_INT_SLOTS 2
+#define AIR_TELEMETRY_DELTA_STRING_SLOTS 4
+#define AIR_TELEMETRY_DELTA_MAX_STRING_IDS 2
+#define AIR_TELEMETRY_DELTA_MAX_IDS TELEMETRY_DOWNLINK_COUNT
+// Op byte plus a zero terminated string
+#define AIR_TELEMETRY_DELTA_MAX_SIZE (1 + TELEMETRY_STRING_MAX_SIZE + 1)
+
+typedef enum
+{
+    AIR_TELEMETRY_DELTA_DECODED,     // Value decoded, nothing to send back
+    AIR_TELEMETRY_DELTA_DECODED_ACK, // Value decoded, send the ACK back
+    AIR_TELEMETRY_DELTA_NACK,        // Slot not available, send the ACK (a NACK) back
+    AIR_TELEMETRY_DELTA_INVALID,
+} air_telemetry_delta_result_e;
+
+typedef struct air_telemetry_delta_entry_s
+{
+    uint32_t values[AIR_TELEMETRY_DELTA_INT_SLOTS]; // Raw integer values
+    uint32_t last;                                   // Last integer value encoded
+    uint8_t slots[AIR_TELEMETRY_DELTA_STRING_SLOTS]; // Generation plus valid flag for each slot
+    uint16_t set_at;                                 // Output packet in which the pending SET was sent
+    uint16_t unacked_gens;                           // Generations of SETs replaced before their ACK arrived
+    uint16_t unacked_at;                             // Output packet in which the last one was added
+    int8_t pending_slot;                             // Slot with a SET waiting for ACK, -1 if none
+    int8_t string;                                   // Index in air_telemetry_delta_t.strings, -1 for integers
+    uint8_t gen;                                     // Generation for the next SET
+    uint8_t next_slot;                               // Round robin for replacing slots when all are valid
+} air_telemetry_delta_entry_t;
+
+// Used for both encoding and decoding. For the encoder a valid slot
+// has been acknowledged, while for the decoder it has been received.
+typedef struct air_telemetry_delta_s
+{
+    bool uplink; // Wether the indexes are uplink telemetry
+    uint8_t count;
+    air_telemetry_delta_entry_t entries[AIR_TELEMETRY_DELTA_MAX_IDS];
+    char strings[AIR_TELEMETRY_DELTA_MAX_STRING_IDS][AIR_TELEMETRY_DELTA_STRING_SLOTS][TELEMETRY_STRING_MAX_SIZE + 1];
+} air_telemetry_delta_t;
+
+void air_telemetry_delta_init(air_telemetry_delta_t *d, bool uplink);
+// Returns true iff values for idx can be encoded. 8 bit values are
+// never smaller when encoded, so they're always sent as is.
+bool air_telemetry_delta_is_supported(const air_telemetry_delta_t *d, unsigned idx);
+// Encodes the value for idx into buf, which must have room for
+// AIR_TELEMETRY_DELTA_MAX_SIZE bytes. Returns the encoded size or zero
+// if the value should be sent as is. packet is the number of the output
+// packet being sent, used for retrying SETs that weren't acknowledged.
+size_t air_telemetry_delta_encode(air_telemetry_delta_t *d, unsigned idx, const telemetry_val_t *val, void *buf, uint16_t packet);
+// Returns the size air_telemetry_delta_encode() would return with the
+// same arguments, without changing d.
+size_t air_telemetry_delta_encoded_size_for(air_telemetry_delta_t *d, unsigned idx, const telemetry_val_t *val, uint16_t packet);
+void air_telemetry_delta_handle_ack(air_telemetry_delta_t *d, const air_cmd_telemetry_ack_t *ack);
+// Returns the size of the encoded value for idx starting at data, 0 if
+// it can't be determined from the available size bytes yet or -1 if the
+// data is not valid.
+int air_telemetry_delta_encoded_size(const air_telemetry_delta_t *d, unsigned idx, const void *data, size_t size);
+// Decodes the size bytes at data, which must be a whole encoded value for
+// idx. val and val_size are only set for the AIR_TELEMETRY_DELTA_DECODED*
+// results, while ack is set for AIR_TELEMETRY_DELTA_DECODED_ACK and
+// AIR_TELEMETRY_DELTA_NACK.
+air_telemetry_delta_result_e air_telemetry_delta_decode(air_telemetry_delta_t *d, unsigned idx, const void *data, size_t size,
+                                                        telemetry_val_t *val, size_t *val_size, air_cmd_telemetry_ack_t *ack);
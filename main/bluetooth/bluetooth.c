@@ -149,14 +149,7 @@ static hm_serial_data_t hm_serial_data;
 static int hm_serial_msp_io_read(void *data, void *buf, size_t size, time_ticks_t timeout)
 {
     hm_serial_data_t *serial_data = data;
-    uint8_t *ptr = buf;
-    uint8_t c;
-    int n = 0;
-    while (n < size && ring_buffer_pop(&serial_data->rb, &c))
-    {
-        ptr[n++] = c;
-    }
-    return n;
+    return ring_buffer_pop_n(&serial_data->rb, buf, size);
 }
 
 static int hm_serial_msp_io_write(void *data, const void *buf, size_t size)
@@ -179,10 +172,9 @@ static esp_gatt_status_t hm_serial_read(gatt_server_t *server, gatt_server_char_
 static esp_gatt_status_t hm_serial_write(gatt_server_t *server, gatt_server_char_t *chr, gatt_server_write_info_t *write_info, void *user_data)
 {
     hm_serial_data_t *serial_data = user_data;
-    for (int ii = 0; ii < write_info->data_len; ii++)
-    {
-        ring_buffer_push(&serial_data->rb, &write_info->data[ii]);
-    }
+    // Push as much as fits, the MSP parser will resync on the next frame
+    size_t n = MIN(write_info->data_len, ring_buffer_free(&serial_data->rb));
+    ring_buffer_push_n(&serial_data->rb, write_info->data, n);
     msp_conn_update(&serial_data->msp);
     return ESP_GATT_OK;
 }
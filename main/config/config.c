@@ -45,6 +45,7 @@ typedef struct config_air_info_blob_s
 typedef struct common_config_s
 {
     air_addr_t addr;
+    uint32_t pairing_generation; // See config_get_pairing_generation()
 #if defined(USE_TX_SUPPORT) && defined(USE_RX_SUPPORT)
     const setting_t *rc_mode;
 #endif
@@ -324,6 +325,7 @@ void config_add_paired_rx(const air_pairing_t *pairing)
     ckey = CONFIG_RX_SEQ_KEY;
     storage_set_u8(&storage, &ckey, sizeof(ckey), tx_config.rx_seq);
     storage_commit(&storage);
+    config.pairing_generation++;
 #else
     UNUSED(pairing);
 #endif
@@ -369,6 +371,7 @@ bool config_remove_paired_rx_at(int idx)
         storage_set_blob(&storage, key, ks, NULL, 0);
 
         storage_commit(&storage);
+        config.pairing_generation++;
     }
 #else
     UNUSED(idx);
@@ -480,6 +483,7 @@ void config_set_paired_tx(const air_pairing_t *pairing)
     ckey = CONFIG_PAIRED_TX_KEY;
     storage_set_blob(&storage, &ckey, sizeof(ckey), &rx_config.paired_tx, sizeof(rx_config.paired_tx));
     storage_commit(&storage);
+    config.pairing_generation++;
 #else
     UNUSED(pairing);
 #endif
@@ -512,6 +516,11 @@ bool config_get_pairing(air_pairing_t *pairing, const air_addr_t *addr)
     return false;
 }
 
+uint32_t config_get_pairing_generation(void)
+{
+    return config.pairing_generation;
+}
+
 tx_input_type_e config_get_input_type(void)
 {
     return setting_get_u8(settings_get_key(SETTING_KEY_TX_INPUT));
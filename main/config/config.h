@@ -172,6 +172,9 @@ bool config_set_air_info(const air_addr_t *addr, const air_info_t *info, air_ban
 // Used for storing keys for talking to other devices, including TX/RX/GS
 // and other RC chains using p2p.
 bool config_get_pairing(air_pairing_t *pairing, const air_addr_t *addr);
+// Changes every time a pairing is added, removed or updated. Used for
+// invalidating keys cached from config_get_pairing().
+uint32_t config_get_pairing_generation(void);
 
 tx_input_type_e config_get_input_type(void);
 rx_output_type_e config_get_output_type(void);
@@ -474,6 +474,7 @@ static const setting_t settings[] = {
     BOOL_YN_SETTING(SETTING_KEY_RX_SPORT_INVERTED, "S.Port Inverted", 0, FOLDER_ID_RX, true),
     U8_MAP_SETTING(SETTING_KEY_RX_MSP_BAUDRATE, "MSP Baudrate", 0, FOLDER_ID_RX, msp_baudrate_table, MSP_SERIAL_BAUDRATE_FIRST),
     BOOL_YN_SETTING(SETTING_KEY_RX_FPORT_INVERTED, "FPort Inverted", 0, FOLDER_ID_RX, false),
+    BOOL_YN_SETTING(SETTING_KEY_RX_EARLY_LOSS_DETECTION, "Early Loss Detect", 0, FOLDER_ID_RX, false),
 #endif
 
 #if defined(CONFIG_RAVEN_USE_PWM_OUTPUTS)
@@ -28,11 +28,11 @@ typedef uint16_t setting_key_t;
 #endif
 #if defined(USE_RX_SUPPORT)
 #if defined(USE_GPIO_REMAP) && defined(CONFIG_RAVEN_USE_PWM_OUTPUTS)
-#define SETTING_RX_FOLDER_COUNT 14
+#define SETTING_RX_FOLDER_COUNT 15
 #elif defined(USE_GPIO_REMAP)
-#define SETTING_RX_FOLDER_COUNT 12
+#define SETTING_RX_FOLDER_COUNT 13
 #else
-#define SETTING_RX_FOLDER_COUNT 10
+#define SETTING_RX_FOLDER_COUNT 11
 #endif
 #else
 #define SETTING_RX_FOLDER_COUNT 0
@@ -115,6 +115,7 @@ typedef enum
 #define SETTING_KEY_RX_SPORT_INVERTED _SKE(FOLDER_ID_RX, 9)
 #define SETTING_KEY_RX_MSP_BAUDRATE _SKE(FOLDER_ID_RX, 10)
 #define SETTING_KEY_RX_FPORT_INVERTED _SKE(FOLDER_ID_RX, 11)
+#define SETTING_KEY_RX_EARLY_LOSS_DETECTION _SKE(FOLDER_ID_RX, 12)
 
 #define SETTING_KEY_RX_CHANNEL_OUTPUTS _SK_FOLDER(FOLDER_ID_RX_CHANNEL_OUTPUTS)
 
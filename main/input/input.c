@@ -1,5 +1,7 @@
 #include "rc/rc_data.h"
 
+#include "util/macros.h"
+
 #include "input.h"
 
 bool input_open(rc_data_t *data, input_t *input, void *config)
@@ -23,8 +25,13 @@ bool input_update(input_t *input, time_micros_t now)
     bool updated = false;
     if (input && input->is_open && input->vtable.update)
     {
+        input->next_update_at = 0;
         updated = input->vtable.update(input, input->rc_data, now);
         failsafe_update(&input->failsafe, now);
+        if (input->next_update_at > 0)
+        {
+            input->next_update_at = MIN(input->next_update_at, failsafe_next_update_at(&input->failsafe));
+        }
         // Input to this msp_io is redirected to the output's msp_io
         // (if any) by rc_t
         msp_io_update(&input->msp);
@@ -32,6 +39,15 @@ bool input_update(input_t *input, time_micros_t now)
     return updated;
 }
 
+time_micros_t input_next_update_at(const input_t *input)
+{
+    if (input && input->is_open)
+    {
+        return input->next_update_at;
+    }
+    return 0;
+}
+
 void input_close(input_t *input, void *config)
 {
     if (input && input->is_open && input->vtable.close)
@@ -30,10 +30,18 @@ typedef struct input_s
     failsafe_t failsafe;
     rc_data_t *rc_data;
     msp_io_t msp;
+    // Set by update() to the latest time at which it needs to be called
+    // again if no events (e.g. radio or serial interrupts, see
+    // util/wakeup.h) happen. 0 means the input needs to be polled
+    // continuously, which is the default.
+    time_micros_t next_update_at;
     input_vtable_t vtable;
 } input_t;
 
 bool input_open(rc_data_t *data, input_t *input, void *config);
 // Returns true iff new data was acquired
 bool input_update(input_t *input, time_micros_t now);
+// Returns the latest time at which input_update() needs to be called
+// again, 0 if it needs to be polled.
+time_micros_t input_next_update_at(const input_t *input);
 void input_close(input_t *input, void *config);
\ No newline at end of file
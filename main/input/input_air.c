@@ -1,3 +1,5 @@
+#include <string.h>
+
 #include <hal/log.h>
 
 #include "air/air_mode.h"
@@ -10,33 +12,32 @@
 #include "input_air.h"
 
 #define AIR_TO_CHANNEL_INPUT(val) RC_CHANNEL_DECODE_FROM_BITS(val, AIR_CHANNEL_BITS)
-#define CYCLE_TIME_WAIT_FACTOR 0.10f // Wait an extra 10% of the cycle time to decide we've lost a packet
+// Wait at most an extra 10% of the cycle time to decide we've lost a packet.
+// Once the clock locks, the window shrinks to the timing error we measure.
+#define CYCLE_TIME_WAIT_FACTOR 0.10f
 // Maximum number of lost packets to continue jumping forward
 #define MAX_LOST_PACKETS_JUMPING_FORWARD (AIR_SEQ_COUNT / 2)
-
-// Telemetry values fed to the output before an MSP reply, to avoid filling
-// all the stream with big MSP responses.
-static telemetry_downlink_id_e telemetry_fed_before_msp[] = {
-    TELEMETRY_ID_RX_RSSI_ANT1,
-    TELEMETRY_ID_RX_RSSI_ANT2,
-    TELEMETRY_ID_RX_LINK_QUALITY,
-    TELEMETRY_ID_RX_SNR,
-};
+// Maximum number of lost packets to keep using CAD. While jumping forward
+// we still know the TX timing, since crystal drift is way below a symbol.
+// Once we start scanning backwards we listen continuously instead.
+#define MAX_LOST_PACKETS_USING_CAD MAX_LOST_PACKETS_JUMPING_FORWARD
+// Keep listening after one in this many CAD misses, to count false negatives
+#define CAD_AUDIT_INTERVAL 16
 
 static const char *TAG = "Input.Air";
 
 typedef enum
 {
-    AIR_INPUT_STATE_RX, // Listening
-    AIR_INPUT_STATE_TX, // Transmitting
+    AIR_INPUT_STATE_RX,  // Listening
+    AIR_INPUT_STATE_TX,  // Transmitting
+    AIR_INPUT_STATE_CAD, // Waiting for the expected preamble time to start CAD
 } air_input_state_e;
 
 static void input_air_update_air_frequency(input_air_t *input_air, unsigned freq_index)
 {
     input_air->freq_index = freq_index;
     air_radio_t *radio = input_air->air_config.radio;
-    air_freq_table_t *freqs = &input_air->air.freq_table;
-    air_radio_set_frequency(radio, freqs->freqs[freq_index], freqs->abs_errors[freq_index]);
+    air_radio_set_hop(radio, freq_index);
     air_radio_start_rx(radio);
 }
 
@@ -45,7 +46,11 @@ static void input_air_update_air_mode(input_air_t *input_air)
     air_radio_t *radio = input_air->air_config.radio;
     air_radio_set_mode(radio, input_air->air_mode);
     air_cmd_switch_mode_ack_reset(&input_air->switch_air_mode);
-    input_air->cycle_time = air_radio_cycle_time(radio, input_air->air_mode);
+    input_air->packet_layout = air_io_get_packet_layout(&input_air->air, radio, input_air->air_mode);
+    input_air->cycle_time = air_radio_cycle_time(radio, input_air->air_mode, input_air->packet_layout);
+    air_clock_init(&input_air->clock, input_air->cycle_time);
+    input_air->cad_offset = air_radio_cad_offset(radio, input_air->air_mode, input_air->packet_layout);
+    air_radio_set_payload_size(radio, air_tx_packet_size(input_air->packet_layout));
     failsafe_set_max_interval(&input_air->input.failsafe, air_radio_rx_failsafe_interval(radio, input_air->air_mode));
     input_air->reset_rssi = true;
 }
@@ -57,11 +62,11 @@ static void input_air_start(input_air_t *input_air)
     air_radio_calibrate(radio, center_freq);
     air_radio_set_sync_word(radio, air_sync_word(input_air->air.pairing.key));
     air_freq_table_init(&input_air->air.freq_table, input_air->air.pairing.key, center_freq);
+    air_freq_table_prepare_hops(&input_air->air.freq_table, radio);
     // TODO: RX used 17dBm fixed power
     air_radio_set_tx_power(radio, 17);
     input_air_update_air_mode(input_air);
     air_radio_sleep(radio);
-    air_radio_set_payload_size(radio, sizeof(air_tx_packet_t));
     input_air_update_air_frequency(input_air, 0);
     input_air->rx_errors = 0;
     input_air->rx_success = 0;
@@ -69,6 +74,9 @@ static void input_air_start(input_air_t *input_air)
     input_air->tx_seq = 0;
     input_air->next_packet_deadline = TIME_MICROS_MAX;
     input_air->next_packet_deadline_extended = false;
+    input_air->cad_audit = false;
+    input_air->cad_misses_until_audit = CAD_AUDIT_INTERVAL;
+    memset(&input_air->cad_stats, 0, sizeof(input_air->cad_stats));
 }
 
 static void input_air_stream_channel_decoded(void *user, unsigned chn, unsigned value, time_micros_t now)
@@ -139,6 +147,12 @@ static void input_air_stream_cmd_decoded(void *user, air_cmd_e cmd, const void *
     case AIR_CMD_RMP:
         rmp_air_decode(&input_air->rmp_air, data, size);
         break;
+    case AIR_CMD_RELIABLE_SEGMENT:
+    case AIR_CMD_RELIABLE_ACK:
+    case AIR_CMD_RELIABLE_SYN_ACK:
+    case AIR_CMD_TELEMETRY_ACK:
+        // Handled by air_stream_t
+        break;
     }
 }
 
@@ -146,10 +160,10 @@ static size_t input_air_feed_stream_ack(input_air_t *input_air)
 {
     if (air_cmd_switch_mode_ack_in_progress(&input_air->switch_air_mode))
     {
-        // Empty the output buffer so we can guarantee the ACK
-        // is gonna fit in the next packet.
+        // Drop the frame being sent so we can guarantee the ACK
+        // is gonna fit in the next packet. Control frames have
+        // priority over anything else.
         air_stream_reset_output(&input_air->air_stream);
-        // This has priority over anything else.
         return air_stream_feed_output_cmd(&input_air->air_stream,
                                           AIR_CMD_SWITCH_MODE_ACK, &input_air->switch_air_mode,
                                           sizeof(input_air->switch_air_mode));
@@ -157,86 +171,47 @@ static size_t input_air_feed_stream_ack(input_air_t *input_air)
     return 0;
 }
 
-static void input_air_msp_before_feed(msp_air_t *msp_air, size_t size, void *user_data)
+static size_t input_air_feed_stream(input_air_t *input_air, rc_data_t *data, time_micros_t now)
 {
-    // Feed some telemetry before sending an MSP response, to update the TX with the
-    // RSSI/LQ/SNR status from the RX since it might need the information. If we need
-    // to send an ACK for a mode change, it takes priority over the telemetry.
-    input_air_t *input_air = user_data;
-    telemetry_downlink_id_e id = telemetry_fed_before_msp[input_air->telemetry_fed_index++];
-    telemetry_t *telemetry = rc_data_get_downlink_telemetry(input_air->input.rc_data, id);
-    air_stream_feed_output_downlink_telemetry(&input_air->air_stream, telemetry, id);
-    if (input_air->telemetry_fed_index == ARRAY_COUNT(telemetry_fed_before_msp))
-    {
-        input_air->telemetry_fed_index = 0;
-    }
+    // TX_LINK_QUALITY is the downlink LQ, as seen by the TX
+    bool batch = (input_air->air.pairing_info.capabilities & AIR_CAP_STREAM_TELEMETRY_BATCH) &&
+                 telemetry_has_value(rc_data_get_uplink_telemetry(data, TELEMETRY_ID_TX_LINK_QUALITY)) &&
+                 TELEMETRY_GET_I8(data, TELEMETRY_ID_TX_LINK_QUALITY) >= AIR_STREAM_TELEMETRY_BATCH_MIN_LQ;
+    return air_stream_feed_output_scored_downlink_telemetry(&input_air->air_stream, data->telemetry_downlink, batch, now);
 }
 
-static size_t input_air_feed_stream(input_air_t *input_air, rc_data_t *data, time_micros_t now)
+static void input_air_stream_pull(void *user, air_stream_class_e cls, size_t offset, time_micros_t now)
 {
-    telemetry_t *dt = NULL;
-    int dtidx = -1;
-    uint32_t max_score = 0;
-    for (int ii = 0; ii < TELEMETRY_DOWNLINK_COUNT; ii++)
-    {
-        telemetry_t *t = &data->telemetry_downlink[ii];
-        if (!telemetry_has_value(t))
-        {
-            continue;
-        }
-        uint32_t score = data_state_score(&t->data_state, now);
-        if (score > max_score)
-        {
-            dt = t;
-            dtidx = ii;
-            max_score = score;
-        }
-    }
-    if (dt)
+    input_air_t *input_air = user;
+    if (cls == AIR_STREAM_CLASS_TELEMETRY)
     {
-        data_state_sent(&dt->data_state, -1, now);
-        return air_stream_feed_output_downlink_telemetry(&input_air->air_stream, dt, TELEMETRY_DOWNLINK_ID(dtidx));
+        input_air_feed_stream(input_air, input_air->input.rc_data, now);
     }
-    // No telemetry data to send
-    return 0;
 }
 
 static void input_air_send_response(input_air_t *input_air, rc_data_t *data, time_micros_t now)
 {
+    const air_packet_layout_t *layout = input_air->packet_layout;
     air_rx_packet_t out_pkt = {
         .seq = input_air->seq++,
         .tx_seq = input_air->tx_seq,
-        .data = {AIR_DATA_START_STOP, AIR_DATA_START_STOP, AIR_DATA_START_STOP},
     };
-
-    if (input_air_feed_stream_ack(input_air) == 0)
-    {
-        // Only send non-ACK data if we have no ACK to send
-        size_t count = air_stream_output_count(&input_air->air_stream);
-        while (count < sizeof(out_pkt.data))
-        {
-            size_t n = input_air_feed_stream(input_air, data, now);
-            if (n == 0)
-            {
-                break;
-            }
-            count += n;
-        }
-    }
-    size_t p = 0;
-    uint8_t c;
-    // Check if we have buffered data to send
-    while (p < sizeof(out_pkt.data) && air_stream_pop_output(&input_air->air_stream, &c))
-    {
-        out_pkt.data[p++] = c;
-    }
+    // We might have no data to send. This leaves the data
+    // stream ready to accept data.
+    memset(out_pkt.data, AIR_DATA_START_STOP, layout->downlink_data_bytes);
+
+    input_air_feed_stream_ack(input_air);
+    // Telemetry is pulled by the stream when it's scheduled,
+    // see input_air_stream_pull()
+    air_stream_pop_output_n(&input_air->air_stream, out_pkt.data, layout->downlink_data_bytes, now);
     // XXX: Reset the LoRa modem before sending. Otherwise sometimes we don't
     // get the TX done interrupt.
     air_radio_sleep(input_air->air_config.radio);
-    air_rx_packet_prepare(&out_pkt, input_air->air.pairing.key);
-    //LOG_BUFFER_I("RADIO-OUT", &out_pkt, sizeof(out_pkt));
+    air_rx_packet_prepare(&out_pkt, layout, input_air->air.pairing.key);
+    size_t out_size = air_rx_packet_size(layout);
+    //LOG_BUFFER_I("RADIO-OUT", &out_pkt, out_size);
     input_air->air_state = AIR_INPUT_STATE_TX;
-    air_radio_send(input_air->air_config.radio, &out_pkt, sizeof(out_pkt));
+    air_radio_send(input_air->air_config.radio, &out_pkt, out_size);
 }
 
 static unsigned input_air_next_expected_tx_seq(input_air_t *input_air)
@@ -286,9 +261,10 @@ static inline bool input_air_receive(input_air_t *input_air, air_tx_packet_t *pk
     air_radio_t *radio = input_air->air_config.radio;
     if (air_radio_is_rx_done(radio))
     {
-        size_t read_size = air_radio_read(radio, pkt, sizeof(*pkt));
+        size_t size = air_tx_packet_size(input_air->packet_layout);
+        size_t read_size = air_radio_read(radio, pkt, size);
         //LOG_BUFFER_I("RADIO-IN", pkt, read_size);
-        if (read_size != sizeof(*pkt) || !air_tx_packet_validate(pkt, input_air->air.pairing.key))
+        if (read_size != size || !air_tx_packet_validate(pkt, input_air->packet_layout, input_air->air.pairing.key))
         {
             LOG_W(TAG, "Got invalid frame");
             // Reading the FIFO puts the module in IDLE state because we need
@@ -302,6 +278,129 @@ static inline bool input_air_receive(input_air_t *input_air, air_tx_packet_t *pk
     return false;
 }
 
+// Returns how long to wait after next_packet_expected_at before
+// declaring the packet lost
+static time_micros_t input_air_guard_window(input_air_t *input_air)
+{
+    time_micros_t max_guard = input_air->cycle_time * CYCLE_TIME_WAIT_FACTOR;
+    time_micros_t guard = air_clock_guard(&input_air->clock, input_air->consecutive_lost_packets + 1);
+    return MIN(guard, max_guard);
+}
+
+static void input_air_packet_lost(input_air_t *input_air, time_micros_t now)
+{
+    air_radio_t *radio = input_air->air_config.radio;
+    input_air->rx_errors++;
+    input_air->consecutive_lost_packets++;
+    if (input_air->consecutive_lost_packets < MAX_LOST_PACKETS_JUMPING_FORWARD &&
+        air_clock_has_reference(&input_air->clock))
+    {
+        // Keep the TX timing while jumping forward, so the next
+        // windows (and CADs) stay aligned with its packets.
+        input_air->next_packet_expected_at = air_clock_next_at(&input_air->clock, input_air->consecutive_lost_packets + 1);
+    }
+    else
+    {
+        input_air->next_packet_expected_at = now + input_air->cycle_time;
+    }
+    input_air->next_packet_deadline = input_air->next_packet_expected_at + input_air_guard_window(input_air);
+    input_air->next_packet_deadline_extended = false;
+    input_air->cad_audit = false;
+    LOG_W(TAG, "invalid or lost frame, %u consecutive, %f%% error rate",
+          input_air->consecutive_lost_packets,
+          (input_air->rx_errors * 100.0) / (input_air->rx_errors + input_air->rx_success));
+
+    // Don't send downlink telemetry for now. Don't sleep nor interrupt the RX here
+    // if the frequency doesn't change, since we might be in the middle of receiving
+    // a packet. First priority now is recovering the control link.
+    if (input_air_prepare_next_receive(input_air))
+    {
+        air_radio_sleep(radio);
+        air_radio_start_rx(radio);
+    }
+}
+
+// Returns wether we should wait for the next packet using CAD. Only
+// possible while we still know when the TX will send it.
+static bool input_air_should_use_cad(input_air_t *input_air)
+{
+    return input_air->cad_enabled && input_air->cad_offset > 0 &&
+           air_clock_has_reference(&input_air->clock) &&
+           input_air->next_packet_expected_at > input_air->cad_offset &&
+           input_air->consecutive_lost_packets < MAX_LOST_PACKETS_USING_CAD;
+}
+
+// Must be called with the radio listening on the frequency for the
+// next packet. It keeps listening until it's time to start the CAD.
+static void input_air_wait_for_cad(input_air_t *input_air)
+{
+    input_air->cad_at = input_air->next_packet_expected_at - input_air->cad_offset;
+    input_air->cad_started = false;
+    input_air->air_state = AIR_INPUT_STATE_CAD;
+}
+
+static void input_air_update_cad(input_air_t *input_air, time_micros_t now)
+{
+    air_radio_t *radio = input_air->air_config.radio;
+    bool detected;
+
+    if (!input_air->cad_started)
+    {
+        if (air_radio_is_rx_done(radio))
+        {
+            // Packet came earlier than expected
+            input_air->air_state = AIR_INPUT_STATE_RX;
+        }
+        else if (now >= input_air->cad_at)
+        {
+            input_air->cad_started = air_radio_start_cad(radio);
+            if (!input_air->cad_started)
+            {
+                input_air->air_state = AIR_INPUT_STATE_RX;
+            }
+        }
+        return;
+    }
+    if (!air_radio_is_cad_done(radio, &detected))
+    {
+        if (now > input_air->next_packet_deadline)
+        {
+            // CAD got stuck, let the RX state handle the timeout
+            air_radio_start_rx(radio);
+            input_air->air_state = AIR_INPUT_STATE_RX;
+        }
+        return;
+    }
+    if (detected)
+    {
+        input_air->cad_stats.hits++;
+        air_radio_start_rx(radio);
+        input_air->air_state = AIR_INPUT_STATE_RX;
+        return;
+    }
+    input_air->cad_stats.misses++;
+    if (--input_air->cad_misses_until_audit == 0)
+    {
+        // Keep listening until the deadline. If the packet arrives
+        // anyway, the CAD was wrong.
+        input_air->cad_misses_until_audit = CAD_AUDIT_INTERVAL;
+        input_air->cad_stats.audits++;
+        input_air->cad_audit = true;
+        air_radio_start_rx(radio);
+        input_air->air_state = AIR_INPUT_STATE_RX;
+        return;
+    }
+    // Declare the packet lost now rather than at the deadline
+    input_air_packet_lost(input_air, now);
+    // The radio goes to standby after CAD
+    air_radio_start_rx(radio);
+    input_air->air_state = AIR_INPUT_STATE_RX;
+    if (input_air_should_use_cad(input_air))
+    {
+        input_air_wait_for_cad(input_air);
+    }
+}
+
 static bool input_air_open(void *input, void *config)
 {
     input_air_t *input_air = input;
@@ -323,14 +422,24 @@ static bool input_air_open(void *input, void *config)
     }
     input_air->air_mode = input_air->air_mode_longest;
 
+    air_radio_set_fec_reed_solomon(input_air->air_config.radio, input_air->air.pairing_info.capabilities & AIR_CAP_FEC_REED_SOLOMON);
+    air_radio_set_fec_interleaving(input_air->air_config.radio, input_air->air.pairing_info.capabilities & AIR_CAP_FEC_INTERLEAVING);
+    air_radio_set_airtime_cycles(input_air->air_config.radio, input_air->air.pairing_info.capabilities & AIR_CAP_AIRTIME_CYCLES);
     input_air_start(input_air);
     input_air->seq = 0;
     input_air->consecutive_lost_packets = 0;
-    input_air->telemetry_fed_index = 0;
     input_air->reset_rssi = true;
     air_stream_init(&input_air->air_stream, input_air_stream_channel_decoded,
-                    input_air_stream_telemetry_decoded, input_air_stream_cmd_decoded, input);
-    msp_air_init(&input_air->msp_air, &input_air->air_stream, input_air_msp_before_feed, input_air);
+                    input_air_stream_telemetry_decoded, input_air_stream_cmd_decoded,
+                    input_air_stream_pull, input);
+    air_stream_set_cobs(&input_air->air_stream, input_air->air.pairing_info.capabilities & AIR_CAP_STREAM_COBS);
+#if defined(USE_AIR_STREAM_RELIABLE)
+    air_stream_set_reliable(&input_air->air_stream, input_air->air.pairing_info.capabilities & AIR_CAP_STREAM_RELIABLE);
+#endif
+#if defined(USE_AIR_STREAM_TELEMETRY_DELTA)
+    air_stream_set_telemetry_delta(&input_air->air_stream, input_air->air.pairing_info.capabilities & AIR_CAP_STREAM_TELEMETRY_DELTA);
+#endif
+    msp_air_init(&input_air->msp_air, &input_air->air_stream);
     INPUT_SET_MSP_TRANSPORT(input_air, MSP_TRANSPORT(&input_air->msp_air));
     return true;
 }
@@ -343,34 +452,60 @@ static bool input_air_update(void *input, rc_data_t *data, time_micros_t now)
     bool updated = false;
     air_radio_t *radio = input_air->air_config.radio;
 
-    switch ((air_input_state_e)input_air->air_state)
+    if (input_air->air_state != AIR_INPUT_STATE_TX && failsafe_is_active(data->failsafe.input))
     {
-    case AIR_INPUT_STATE_RX:
-        if (failsafe_is_active(data->failsafe.input))
+        air_cmd_switch_mode_ack_reset(&input_air->switch_air_mode);
+        if (input_air->air_mode != input_air->air_mode_longest)
         {
-            air_cmd_switch_mode_ack_reset(&input_air->switch_air_mode);
-            if (input_air->air_mode != input_air->air_mode_longest)
+            input_air->air_mode = input_air->air_mode_longest;
+            input_air_update_air_mode(input_air);
+            if (input_air->air_state == AIR_INPUT_STATE_CAD)
             {
-                input_air->air_mode = input_air->air_mode_longest;
-                input_air_update_air_mode(input_air);
+                // The CAD timing was for the previous mode
+                air_radio_start_rx(radio);
+                input_air->air_state = AIR_INPUT_STATE_RX;
             }
-            air_io_invalidate_rssi(&input_air->air, now);
         }
+        air_io_invalidate_rssi(&input_air->air, now);
+    }
+
+    if (input_air->air_state == AIR_INPUT_STATE_CAD)
+    {
+        // Might switch to AIR_INPUT_STATE_RX
+        input_air_update_cad(input_air, now);
+    }
+
+    switch ((air_input_state_e)input_air->air_state)
+    {
+    case AIR_INPUT_STATE_CAD:
+        break;
+    case AIR_INPUT_STATE_RX:
 
         if (input_air_receive(input_air, &in_pkt))
         {
-            input_air->last_packet_at = now;
-            input_air->next_packet_expected_at = now + input_air->cycle_time;
-            input_air->next_packet_deadline = input_air->next_packet_expected_at + input_air->cycle_time * CYCLE_TIME_WAIT_FACTOR;
-            input_air->next_packet_deadline_extended = false;
+            // Sync to the time the radio got the packet, since the delay
+            // until we process it varies.
+            time_micros_t rx_at = air_radio_rx_done_at(radio);
+            input_air->last_packet_at = rx_at;
+            air_clock_update(&input_air->clock, rx_at);
             input_air->consecutive_lost_packets = 0;
+            input_air->next_packet_expected_at = air_clock_next_at(&input_air->clock, 1);
+            input_air->next_packet_deadline = input_air->next_packet_expected_at + input_air_guard_window(input_air);
+            input_air->next_packet_deadline_extended = false;
             input_air->rx_success++;
             input_air->tx_seq = in_pkt.seq;
+            if (input_air->cad_audit)
+            {
+                input_air->cad_stats.false_negatives++;
+                input_air->cad_audit = false;
+            }
 
             rssi = air_radio_rssi(radio, &snr, &lq);
             int last_error = air_radio_frequency_error(radio);
-            input_air->air.freq_table.abs_errors[input_air->tx_seq] += last_error;
-            input_air->air.freq_table.last_errors[input_air->tx_seq] = last_error;
+            air_freq_table_t *freqs = &input_air->air.freq_table;
+            freqs->abs_errors[input_air->tx_seq] += last_error;
+            freqs->last_errors[input_air->tx_seq] = last_error;
+            air_radio_prepare_hop(radio, input_air->tx_seq, freqs->freqs[input_air->tx_seq], freqs->abs_errors[input_air->tx_seq]);
 
             input_air_send_response(input_air, data, now);
 
@@ -392,8 +527,10 @@ static bool input_air_update(void *input, rc_data_t *data, time_micros_t now)
             rc_data_update_channel(data, 1, AIR_TO_CHANNEL_INPUT(in_pkt.ch1), now);
             rc_data_update_channel(data, 2, AIR_TO_CHANNEL_INPUT(in_pkt.ch2), now);
             rc_data_update_channel(data, 3, AIR_TO_CHANNEL_INPUT(in_pkt.ch3), now);
+            const uint16_t air_values[RC_TRACE_CHANNELS] = {in_pkt.ch0, in_pkt.ch1, in_pkt.ch2, in_pkt.ch3};
+            rc_trace_air_rx(&data->trace, in_pkt.seq, input_air->air_mode, air_values, rx_at);
 
-            air_stream_feed_input(&input_air->air_stream, in_pkt.seq, in_pkt.data, sizeof(in_pkt.data), now);
+            air_stream_feed_input(&input_air->air_stream, in_pkt.seq, in_pkt.data, input_air->packet_layout->uplink_data_bytes, now);
             break;
         }
         if (now > input_air->next_packet_deadline)
@@ -405,22 +542,10 @@ static bool input_air_update(void *input, rc_data_t *data, time_micros_t now)
                 break;
             }
             // Packet was lost
-            input_air->rx_errors++;
-            input_air->consecutive_lost_packets++;
-            input_air->next_packet_expected_at = now + input_air->cycle_time;
-            input_air->next_packet_deadline = input_air->next_packet_expected_at + input_air->cycle_time * CYCLE_TIME_WAIT_FACTOR;
-            input_air->next_packet_deadline_extended = false;
-            LOG_W(TAG, "invalid or lost frame, %u consecutive, %f%% error rate",
-                  input_air->consecutive_lost_packets,
-                  (input_air->rx_errors * 100.0) / (input_air->rx_errors + input_air->rx_success));
-
-            // Don't send downlink telemetry for now. Don't sleep nor interrupt the RX here
-            // if the frequency doesn't change, since we might be in the middle of receiving
-            // a packet. First priority now is recovering the control link.
-            if (input_air_prepare_next_receive(input_air))
+            input_air_packet_lost(input_air, now);
+            if (input_air_should_use_cad(input_air))
             {
-                air_radio_sleep(radio);
-                air_radio_start_rx(radio);
+                input_air_wait_for_cad(input_air);
             }
             break;
         }
@@ -428,12 +553,27 @@ static bool input_air_update(void *input, rc_data_t *data, time_micros_t now)
     case AIR_INPUT_STATE_TX:
         if (air_radio_is_tx_done(radio))
         {
-            air_radio_set_payload_size(radio, sizeof(air_tx_packet_t));
+            air_radio_set_payload_size(radio, air_tx_packet_size(input_air->packet_layout));
             input_air_prepare_next_receive(input_air);
             input_air->air_state = AIR_INPUT_STATE_RX;
+            if (input_air_should_use_cad(input_air))
+            {
+                input_air_wait_for_cad(input_air);
+            }
         }
         break;
     }
+    // Received and sent packets wake up the RC task via the radio
+    // interrupt, so we only need to run again for the RX deadline.
+    input_air->input.next_update_at = input_air->next_packet_deadline;
+    if (input_air->next_packet_deadline != TIME_MICROS_MAX)
+    {
+        input_air->input.next_update_at++;
+    }
+    if (input_air->air_state == AIR_INPUT_STATE_CAD && !input_air->cad_started)
+    {
+        input_air->input.next_update_at = MIN(input_air->input.next_update_at, input_air->cad_at);
+    }
     return updated;
 }
 
@@ -447,6 +587,7 @@ static void input_air_close(void *input, void *config)
 void input_air_init(input_air_t *input, air_addr_t addr, air_config_t *air_config, rmp_t *rmp)
 {
     input->air_config = *air_config;
+    input->cad_enabled = false;
     input->input.vtable = (input_vtable_t){
         .open = input_air_open,
         .update = input_air_update,
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "air/air_clock.h"
 #include "air/air_cmd.h"
 #include "air/air_config.h"
 #include "air/air_io.h"
@@ -13,6 +14,14 @@
 
 #include "util/time.h"
 
+typedef struct input_air_cad_stats_s
+{
+    unsigned hits;            // Preamble detected
+    unsigned misses;          // No preamble, packet declared lost early
+    unsigned audits;          // Misses where we kept listening to verify them
+    unsigned false_negatives; // Audited misses where a packet arrived anyway
+} input_air_cad_stats_t;
+
 typedef struct input_air_s
 {
     input_t input;
@@ -29,8 +38,9 @@ typedef struct input_air_s
     air_cmd_switch_mode_ack_t switch_air_mode;
     unsigned air_state;
     unsigned consecutive_lost_packets;
-    unsigned telemetry_fed_index;
     time_micros_t cycle_time;
+    const air_packet_layout_t *packet_layout;
+    air_clock_t clock; // Estimates when the TX sends each packet
     time_micros_t last_packet_at;
     time_micros_t next_packet_expected_at;
     time_micros_t next_packet_deadline;
@@ -38,6 +48,16 @@ typedef struct input_air_s
     bool reset_rssi;
     unsigned freq_index;
 
+    // Channel activity detection at the expected preamble time, to
+    // detect lost packets early. See air_radio_cad_offset().
+    bool cad_enabled;
+    time_micros_t cad_offset; // 0 if not supported in air_mode
+    time_micros_t cad_at;
+    bool cad_started;
+    bool cad_audit;
+    unsigned cad_misses_until_audit;
+    input_air_cad_stats_t cad_stats;
+
     msp_air_t msp_air;
     rmp_air_t rmp_air;
 } input_air_t;
@@ -6,6 +6,8 @@
 
 #include "ui/led.h"
 
+#include "util/macros.h"
+
 #include "input_air_bind.h"
 
 static const char *TAG = "Input.Air.Bind";
@@ -88,6 +90,22 @@ static void input_air_bind_send_response(void *data, time_micros_t now)
     air_radio_send(input->air_config.radio, &bind_packet, sizeof(bind_packet));
 }
 
+static time_micros_t input_air_bind_next_update_at(const input_air_bind_t *input, time_micros_t now)
+{
+    if (input->state != AIR_INPUT_BIND_STATE_RX)
+    {
+        // Waiting for TX done, which wakes us up
+        return TIME_MICROS_MAX;
+    }
+    time_micros_t next = MIN(input->send_response_at, input->switch_band_at);
+    if (input->bind_packet_expires > now)
+    {
+        next = MIN(next, input->bind_packet_expires);
+    }
+    // Timers fire once we're past them
+    return next == TIME_MICROS_MAX ? next : next + 1;
+}
+
 static bool input_air_bind_update(void *data, rc_data_t *rc_data, time_micros_t now)
 {
     input_air_bind_t *input = data;
@@ -152,6 +170,7 @@ static bool input_air_bind_update(void *data, rc_data_t *rc_data, time_micros_t
         }
         break;
     }
+    input->input.next_update_at = input_air_bind_next_update_at(input, now);
     // Never updates rc_data
     return false;
 }
@@ -1,3 +1,4 @@
+#include <math.h>
 #include <stdio.h>
 
 #include <hal/log.h>
@@ -19,6 +20,7 @@ static const char *TAG = "CRSF.Input";
 #define BPS_DETECT_SWITCH_INTERVAL_US MILLIS_TO_MICROS(1000)
 #define BPS_FALLBACK_INTERVAL SECS_TO_MICROS(1)
 #define RESPONSE_WAIT_INTERVAL_US (500)
+#define SYNC_FRAME_INTERVAL_US MILLIS_TO_MICROS(200)
 
 #define CRSF_INPUT_SETTINGS_VIEW ((settings_rmp_view_t){.id = SETTINGS_VIEW_CRSF_INPUT, .folder_id = FOLDER_ID_ROOT, .recursive = true})
 
@@ -139,6 +141,7 @@ static void input_crsf_frame_callback(void *data, crsf_frame_t *frame)
     {
     case CRSF_FRAMETYPE_RC_CHANNELS_PACKED:
     {
+        rc_sync_input_frame(&input_crsf->input.rc_data->sync, input_crsf->last_byte_at);
         crsf_channels_t *channels = &frame->channels;
         rc_data_update_channel(input_crsf->input.rc_data, 0, channels->ch0, now);
         rc_data_update_channel(input_crsf->input.rc_data, 1, channels->ch1, now);
@@ -220,6 +223,10 @@ static void input_crsf_frame_callback(void *data, crsf_frame_t *frame)
     // the radio (e.g. an MSP request), it will replace control frames.
     unsigned frame_interval = input_crsf_frame_interval_us(input_crsf);
     if (frame_interval > 0)
+    {
+        frame_interval = MAX(frame_interval, input_crsf->sync_interval);
+    }
+    if (frame_interval > 0)
     {
         if (input_crsf->last_frame_recv > 0 && now - input_crsf->last_frame_recv > frame_interval * 1.5f)
         {
@@ -369,17 +376,47 @@ static bool input_crsf_send_scheduled_frame(input_crsf_t *input)
     return false;
 }
 
-static bool input_crsf_send_pending_resp_frame(input_crsf_t *input)
+// Tells OpenTX the frame interval to use and how long its last frame
+// waited before being sent over the air, so it can shift its frames
+// to arrive right before we need them.
+static bool input_crsf_send_sync_frame(input_crsf_t *input, time_micros_t now)
+{
+    if (now < input->next_sync_frame)
+    {
+        return false;
+    }
+    input->next_sync_frame = now + SYNC_FRAME_INTERVAL_US;
+    float interval;
+    int32_t lag;
+    if (!rc_sync_get_input_timing(&input->input.rc_data->sync, input_crsf_frame_interval_us(input), now, &interval, &lag))
+    {
+        return false;
+    }
+    input->sync_interval = lroundf(interval);
+    crsf_ext_frame_t frame;
+    frame.header.device_addr = CRSF_ADDRESS_RADIO_TRANSMITTER;
+    frame.header.type = CRSF_FRAMETYPE_RADIO_ID;
+    frame.header.frame_size = CRSF_EXT_FRAME_SIZE(sizeof(crsf_opentx_sync_t));
+    frame.header.dest_addr = CRSF_ADDRESS_RADIO_TRANSMITTER;
+    frame.header.orig_addr = CRSF_ADDRESS_CRSF_TRANSMITTER;
+    frame.opentx_sync.subcommand = CRSF_SUBCOMMAND_OPENTX_SYNC;
+    frame.opentx_sync.rate = CRSF_ENC_U32(lroundf(interval * 10));
+    frame.opentx_sync.offset = CRSF_ENC_I32(lag * 10);
+    crsf_port_write(&input->crsf, crsf_ext_frame_to_frame(&frame));
+    return true;
+}
+
+static bool input_crsf_send_pending_resp_frame(input_crsf_t *input, time_micros_t now)
 {
-    return input_crsf_send_scheduled_frame(input) || input_crsf_send_msp(input);
+    return input_crsf_send_sync_frame(input, now) || input_crsf_send_scheduled_frame(input) || input_crsf_send_msp(input);
 }
 
-static void input_crsf_send_response(input_crsf_t *input)
+static void input_crsf_send_response(input_crsf_t *input, time_micros_t now)
 {
     crsf_frame_type_e frame_type = radio_telemetry_frames[input->telemetry_pos];
     serial_port_begin_write(input->serial_port);
     // If we're not sending the link stats, check if we have a pending response data to send
-    if (frame_type == CRSF_FRAMETYPE_LINK_STATISTICS || !input_crsf_send_pending_resp_frame(input))
+    if (frame_type == CRSF_FRAMETYPE_LINK_STATISTICS || !input_crsf_send_pending_resp_frame(input, now))
     {
         // Write one telemetry frame
         input_crsf_send_telemetry_frame(input, frame_type);
@@ -805,6 +842,8 @@ static bool input_crsf_open(void *input, void *config)
     input_crsf->next_resp_frame = TIME_MICROS_MAX;
     input_crsf->enable_rx_deadline = TIME_MICROS_MAX;
     input_crsf->bps_detect_switched = now;
+    input_crsf->next_sync_frame = now;
+    input_crsf->sync_interval = 0;
     input_crsf->gpio = config_crsf->gpio;
 
     // 100ms should be low enough to be detected fast and high enough that
@@ -822,6 +861,27 @@ static bool input_crsf_open(void *input, void *config)
     return true;
 }
 
+// Returns the latest time at which input_crsf_update() needs to run
+// again. Received bytes wake up the RC task on their own.
+static time_micros_t input_crsf_next_update_at(input_crsf_t *input_crsf)
+{
+    time_micros_t at = MIN(input_crsf->next_resp_frame, input_crsf->enable_rx_deadline);
+    if (input_crsf->last_byte_at > 0)
+    {
+        at = MIN(at, input_crsf->last_byte_at + input_crsf_tx_done_timeout_us(input_crsf));
+    }
+    if (input_crsf->bps == CRSF_INPUT_BPS_DETECT)
+    {
+        at = MIN(at, input_crsf->bps_detect_switched + BPS_DETECT_SWITCH_INTERVAL_US);
+    }
+    else
+    {
+        at = MIN(at, input_crsf->last_frame_recv + BPS_FALLBACK_INTERVAL);
+    }
+    // All deadlines are checked with now > deadline
+    return at + 1;
+}
+
 static bool input_crsf_update(void *input, rc_data_t *data, time_micros_t now)
 {
     input_crsf_t *input_crsf = input;
@@ -873,12 +933,13 @@ static bool input_crsf_update(void *input, rc_data_t *data, time_micros_t now)
         input_crsf->next_resp_frame = TIME_MICROS_MAX;
         input_crsf->bps = CRSF_INPUT_BPS_DETECT;
         input_crsf->bps_detect_switched = now;
+        input_crsf->sync_interval = 0;
     }
     if (now > input_crsf->next_resp_frame)
     {
         input_crsf->enable_rx_deadline = now + input_crsf_max_tx_time_us(input_crsf);
         input_crsf->next_resp_frame = TIME_MICROS_MAX;
-        input_crsf_send_response(input_crsf);
+        input_crsf_send_response(input_crsf, now);
     }
     // The TX_DONE interrupt won't fire on ESP32 if there's a collision, so we use a timer
     // as a fallback to avoid leaving the pin in the TX state.
@@ -907,6 +968,7 @@ static bool input_crsf_update(void *input, rc_data_t *data, time_micros_t now)
         crsf_port_reset(&input_crsf->crsf);
         input_crsf->bps_detect_switched = now;
     }
+    input_crsf->input.next_update_at = input_crsf_next_update_at(input_crsf);
     return updated;
 }
 
@@ -52,6 +52,8 @@ typedef struct input_crsf_s
     time_micros_t next_resp_frame;
     time_micros_t enable_rx_deadline;
     time_micros_t bps_detect_switched;
+    time_micros_t next_sync_frame;
+    time_micros_t sync_interval; // Frame interval requested to the radio, 0 if none
     unsigned baud_rate;
     crsf_port_t crsf;
     hal_gpio_t gpio;
@@ -64,6 +64,7 @@ static void input_ibus_frame_callback(void *data, ibus_frame_t *frame)
             rc_data_update_channel(input_ibus->input.rc_data, i,
                                    input_ibus_channel_value_mapping(frame->payload.ch[i]), now);
         }
+        rc_sync_input_frame(&input_ibus->input.rc_data->sync, now);
         break;
     }
     default:
@@ -115,6 +115,7 @@ static bool input_ppm_update(void *input, rc_data_t *data, time_micros_t now)
                                            PPM_RCVR_TIMEOUT, now);
                 }
                 failsafe_reset_interval(&input_ppm->input.failsafe, now);
+                rc_sync_input_frame(&input_ppm->input.rc_data->sync, now);
 
                 updated = true;
             }
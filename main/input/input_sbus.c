@@ -148,6 +148,7 @@ static bool input_sbus_update(void *input, rc_data_t *data, time_micros_t now)
                 rc_data_update_channel(data, 17, input_sbus->frame.payload.data.flags & SBUS_FLAG_CHANNEL_17 ? RC_CHANNEL_MAX_VALUE : RC_CHANNEL_MIN_VALUE, now);
 
                 failsafe_reset_interval(&input_sbus->input.failsafe, now);
+                rc_sync_input_frame(&data->sync, now);
 
                 return true;
             }
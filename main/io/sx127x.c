@@ -10,6 +10,7 @@
 #include "util/fec.h"
 #include "util/macros.h"
 #include "util/time.h"
+#include "util/wakeup.h"
 
 #include "sx127x.h"
 
@@ -20,6 +21,7 @@
 // constants
 #define SX127X_FXOSC 32000000            // 32Mhz
 #define SX127X_FSK_FREQ_STEP 61.03515625 // 61khz
+#define SX127X_FSK_SYNC_SIZE 4
 
 // Common registers
 #define REG_FIFO 0x00
@@ -96,6 +98,7 @@
 #define MODE_TX 0x03
 #define MODE_RX_CONTINUOUS 0x05
 // #define MODE_RX_SINGLE 0x06 // Unused, only valid in LoRa mode
+#define MODE_CAD 0x07 // Only valid in LoRa mode
 
 // PA config
 #define PA_BOOST 0x80
@@ -111,6 +114,8 @@
 #define IRQ_LORA_TX_DONE_MASK (1 << 3)
 #define IRQ_LORA_RX_DONE_MASK (1 << 6)
 #define IRQ_LORA_VALID_HEADER (1 << 6)
+#define IRQ_LORA_CAD_DONE_MASK (1 << 2)
+#define IRQ_LORA_CAD_DETECTED_MASK (1 << 0)
 
 // Page 46, table 18 indicates the DIO0 values,
 // page 92 indicates that DIO0 is in the most
@@ -118,6 +123,7 @@
 #define DIO0_BIT_OFFSET 6
 #define DIO0_LORA_RX_DONE (0 << DIO0_BIT_OFFSET)
 #define DIO0_LORA_TX_DONE (1 << DIO0_BIT_OFFSET)
+#define DIO0_LORA_CAD_DONE (2 << DIO0_BIT_OFFSET)
 #define DIO0_LORA_NONE (3 << DIO0_BIT_OFFSET)
 
 // Page 69, Table 30 (packet mode, we don't use continous mode)
@@ -137,10 +143,20 @@
 #define SX127X_IMAGE_CAL_START (1 << 6)
 #define SX127X_IMAGE_CAL_RUNNING (1 << 5)
 
+// Registers in this range have different meanings in FSK and LoRa modes
+#define SX127X_REG_MODEM_FIRST 0x0d
+#define SX127X_REG_MODEM_LAST 0x3f
+
+// Runs of changed registers separated by up to this many unchanged ones
+// are written in a single burst, since sending the unchanged values is
+// cheaper than starting another SPI transaction.
+#define SX127X_REG_BURST_MAX_GAP 2
+
 enum
 {
     DIO0_TRIGGER_RX_DONE = 1,
     DIO0_TRIGGER_TX_DONE,
+    DIO0_TRIGGER_CAD_DONE,
 };
 
 enum
@@ -153,7 +169,7 @@ enum
 static const char *TAG = "SX127X";
 
 static void sx127x_set_lora_parameters(sx127x_t *sx127x);
-static float sx127x_get_lora_signal_bw_khz(sx127x_t *sx127x, sx127x_lora_signal_bw_e sbw);
+static float sx127x_get_lora_signal_bw_khz(sx127x_lora_signal_bw_e sbw);
 static void sx127x_apply_bw500_sensitivity_workaround(sx127x_t *sx127x);
 static void sx127x_set_lora_sync_word(sx127x_t *sx127x);
 static void sx127x_set_fsk_parameters(sx127x_t *sx127x);
@@ -167,7 +183,9 @@ static bool sx127x_mode_is_tx(uint8_t mode)
 
 static bool sx127x_mode_is_rx(uint8_t mode)
 {
-    return (mode | MODE_LORA) == (MODE_LORA | MODE_RX_CONTINUOUS);
+    // CAD listens too, so it needs the RX path enabled
+    return (mode | MODE_LORA) == (MODE_LORA | MODE_RX_CONTINUOUS) ||
+           (mode | MODE_LORA) == (MODE_LORA | MODE_CAD);
 }
 
 static uint8_t sx127x_read_reg(sx127x_t *sx127x, uint8_t addr)
@@ -223,6 +241,103 @@ static void sx127x_prepare_write(sx127x_t *sx127x)
     }
 }
 
+static bool sx127x_reg_flag(const uint8_t *flags, uint8_t addr)
+{
+    return flags[addr / 8] & (1 << (addr % 8));
+}
+
+static void sx127x_reg_set_flag(uint8_t *flags, uint8_t addr)
+{
+    flags[addr / 8] |= 1 << (addr % 8);
+}
+
+static void sx127x_reg_clear_flag(uint8_t *flags, uint8_t addr)
+{
+    flags[addr / 8] &= ~(1 << (addr % 8));
+}
+
+// Returns the value of a configuration register, reading it from the
+// chip only if it's not in the shadow copy yet.
+static uint8_t sx127x_get_reg(sx127x_t *sx127x, uint8_t addr)
+{
+    assert(addr < SX127X_NUM_REGS);
+    if (!sx127x_reg_flag(sx127x->state.regs.valid, addr))
+    {
+        sx127x->state.regs.values[addr] = sx127x_read_reg(sx127x, addr);
+        sx127x_reg_set_flag(sx127x->state.regs.valid, addr);
+    }
+    return sx127x->state.regs.values[addr];
+}
+
+// Stores the value for a configuration register in the shadow copy. It
+// will be written to the chip by the next sx127x_flush_regs() only if it
+// changed. Registers which the chip updates by itself (FIFO, IRQ flags,
+// OpMode...) must be written with sx127x_write_reg() instead.
+static void sx127x_set_reg(sx127x_t *sx127x, uint8_t addr, uint8_t value)
+{
+    assert(addr < SX127X_NUM_REGS);
+    if (!sx127x_reg_flag(sx127x->state.regs.valid, addr) || sx127x->state.regs.values[addr] != value)
+    {
+        sx127x->state.regs.values[addr] = value;
+        sx127x_reg_set_flag(sx127x->state.regs.valid, addr);
+        sx127x_reg_set_flag(sx127x->state.regs.dirty, addr);
+    }
+}
+
+// Forgets the registers that depend on the modem type. Must be
+// called after switching between FSK and LoRa.
+static void sx127x_invalidate_modem_regs(sx127x_t *sx127x)
+{
+    for (int ii = SX127X_REG_MODEM_FIRST; ii <= SX127X_REG_MODEM_LAST; ii++)
+    {
+        sx127x_reg_clear_flag(sx127x->state.regs.valid, ii);
+        sx127x_reg_clear_flag(sx127x->state.regs.dirty, ii);
+    }
+}
+
+// Writes the registers changed by sx127x_set_reg(), merging nearby ones
+// into burst writes. If prepare_write is true and there's something to
+// write, the chip is put into a mode which accepts writes first. Returns
+// true iff any register was written.
+static bool sx127x_flush_regs(sx127x_t *sx127x, bool prepare_write)
+{
+    bool written = false;
+    int addr = 0;
+    while (addr < SX127X_NUM_REGS)
+    {
+        if (!sx127x_reg_flag(sx127x->state.regs.dirty, addr))
+        {
+            addr++;
+            continue;
+        }
+        // end is one past the last register in the burst. Unchanged
+        // registers are only included if they're between changed ones.
+        int end = addr + 1;
+        for (int next = end; next < SX127X_NUM_REGS; next++)
+        {
+            if (sx127x_reg_flag(sx127x->state.regs.dirty, next))
+            {
+                end = next + 1;
+            }
+            else if (!sx127x_reg_flag(sx127x->state.regs.valid, next) || next - end >= SX127X_REG_BURST_MAX_GAP)
+            {
+                break;
+            }
+        }
+        if (!written && prepare_write)
+        {
+            sx127x_prepare_write(sx127x);
+        }
+        HAL_ERR_ASSERT_OK(hal_spi_device_transmit(&sx127x->state.spi, 1, addr, &sx127x->state.regs.values[addr], end - addr, NULL, 0));
+        for (; addr < end; addr++)
+        {
+            sx127x_reg_clear_flag(sx127x->state.regs.dirty, addr);
+        }
+        written = true;
+    }
+    return written;
+}
+
 static int link_quality(int min_dbm, int max_dbm, int dbm)
 {
     return (100 * (max_dbm - min_dbm) * (max_dbm - min_dbm) - (max_dbm - dbm) * (25 * (max_dbm - min_dbm) + 75 * (max_dbm - dbm))) / ((max_dbm - min_dbm) * (max_dbm - min_dbm));
@@ -242,34 +357,16 @@ static TaskHandle_t callback_task_handle = NULL;
 static void sx127x_callback_task(void *arg)
 {
     sx127x_t *sx127x = arg;
-    air_radio_callback_t callback;
     for (;;)
     {
-        ulTaskNotifyTake(pdFALSE, portMAX_DELAY);
-        switch (sx127x->state.dio0_trigger)
-        {
-        case DIO0_TRIGGER_RX_DONE:
-            sx127x->state.rx_done = true;
-            if (sx127x->state.callback)
-            {
-                callback = sx127x->state.callback;
-                callback((air_radio_t *)sx127x, AIR_RADIO_CALLBACK_REASON_RX_DONE, sx127x->state.callback_data);
-            }
-            break;
-        case DIO0_TRIGGER_TX_DONE:
-            sx127x->state.tx_done = true;
-            if (sx127x->state.callback)
-            {
-                callback = sx127x->state.callback;
-                callback((air_radio_t *)sx127x, AIR_RADIO_CALLBACK_REASON_TX_DONE, sx127x->state.callback_data);
-            }
-            break;
-        }
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        sx127x_process_events(sx127x);
     }
 }
 
 static void IRAM_ATTR lora_handle_isr(void *arg)
 {
+    sx127x_queue_event(arg, time_micros_now());
     BaseType_t xHigherPriorityTaskWoken = pdFALSE;
     vTaskNotifyGiveFromISR(callback_task_handle, &xHigherPriorityTaskWoken);
     portYIELD_FROM_ISR_IF(xHigherPriorityTaskWoken);
@@ -288,7 +385,8 @@ static void sx127x_disable_dio0(sx127x_t *sx127x)
         reg = DIO0_LORA_NONE;
         break;
     }
-    sx127x_write_reg(sx127x, REG_DIO_MAPPING_1, reg);
+    sx127x_set_reg(sx127x, REG_DIO_MAPPING_1, reg);
+    sx127x_flush_regs(sx127x, false);
 }
 
 static void sx127x_reset(sx127x_t *sx127x)
@@ -338,9 +436,19 @@ void sx127x_init(sx127x_t *sx127x)
 
     sx127x->state.tx_done = false;
     sx127x->state.rx_done = false;
+    sx127x->state.cad_done = false;
+    sx127x->state.rx_done_at = 0;
+    sx127x->state.tx_done_at = 0;
+    sx127x->state.events.head = 0;
+    sx127x->state.events.tail = 0;
+    sx127x->state.events.dropped = 0;
+    histogram_init(&sx127x->state.events.latency);
     sx127x->state.fsk.freq = 0;
+    sx127x->state.fsk.fec = FEC_NIBBLE;
     sx127x->state.lora.freq = 0;
     sx127x->state.lora.ppm_correction = 0;
+    // Registers are at their reset values, which we don't track
+    memset(&sx127x->state.regs, 0, sizeof(sx127x->state.regs));
 
     CREATE_TASK(sx127x_callback_task, "SX127X", configMINIMAL_STACK_SIZE, sx127x, configMAX_PRIORITIES - 1, &callback_task_handle, 1);
 
@@ -385,7 +493,8 @@ void sx127x_init(sx127x_t *sx127x)
 
     // LNA boost HF
     // TODO: Should we adjust LnaGain here?
-    sx127x_write_reg(sx127x, REG_LNA, sx127x_read_reg(sx127x, REG_LNA) | 0x03);
+    sx127x_set_reg(sx127x, REG_LNA, sx127x_get_reg(sx127x, REG_LNA) | 0x03);
+    sx127x_flush_regs(sx127x, false);
 
     // set output power to 17 dBm
     sx127x_set_tx_power(sx127x, 17);
@@ -402,52 +511,68 @@ void sx127x_init(sx127x_t *sx127x)
 
 // freq is in Hz
 void sx127x_set_frequency(sx127x_t *sx127x, unsigned long freq, int error)
+{
+    sx127x_freq_t f;
+    sx127x_prepare_frequency(&f, freq, error);
+    sx127x_set_prepared_frequency(sx127x, &f);
+}
+
+void sx127x_prepare_frequency(sx127x_freq_t *f, unsigned long freq, int error)
 {
     freq -= error;
+    f->freq = freq;
+    // Frf = freq / Fstep, with Fstep = Fxosc / 2^19 (61.03515625Hz).
+    // Both modems use the same register, so it's valid for both.
+    f->frf = ((uint64_t)freq << 19) / SX127X_FXOSC;
+    // TODO: Should ppm_correction be applied in FSK mode?
+    f->ppm_correction = CONSTRAIN_TO_I8(lrintf(0.95f * (error / ((float)freq / 1000000))));
+}
 
-    uint64_t frf = 0;
+void sx127x_set_prepared_frequency(sx127x_t *sx127x, const sx127x_freq_t *f)
+{
+    bool changed = false;
     switch (sx127x->state.op_mode)
     {
     case SX127X_OP_MODE_FSK:
-        if (freq != sx127x->state.fsk.freq)
+        if (f->freq != sx127x->state.fsk.freq)
         {
-            sx127x->state.fsk.freq = freq;
-            frf = (uint32_t)(freq / SX127X_FSK_FREQ_STEP);
+            sx127x->state.fsk.freq = f->freq;
+            changed = true;
         }
         break;
     case SX127X_OP_MODE_LORA:
-        if (freq != sx127x->state.lora.freq)
+        if (f->freq != sx127x->state.lora.freq)
         {
-            sx127x->state.lora.freq = freq;
-            frf = ((uint64_t)freq << 19) / SX127X_FXOSC;
+            sx127x->state.lora.freq = f->freq;
+            changed = true;
         }
         break;
     }
 
-    if (frf > 0)
+    if (changed)
     {
-        sx127x_prepare_write(sx127x);
-        sx127x_write_reg(sx127x, REG_FRF_MSB, (uint8_t)(frf >> 16));
-        sx127x_write_reg(sx127x, REG_FRF_MID, (uint8_t)(frf >> 8));
-        sx127x_write_reg(sx127x, REG_FRF_LSB, (uint8_t)(frf >> 0));
-        // Wait up to 50us for PLL lock (page 15, table 7)
-        time_micros_t now = time_micros_now();
-        do
+        sx127x_set_reg(sx127x, REG_FRF_MSB, (uint8_t)(f->frf >> 16));
+        sx127x_set_reg(sx127x, REG_FRF_MID, (uint8_t)(f->frf >> 8));
+        sx127x_set_reg(sx127x, REG_FRF_LSB, (uint8_t)(f->frf >> 0));
+        if (sx127x_flush_regs(sx127x, true))
         {
-        } while (time_micros_now() < now + 50);
+            // Wait up to 50us for PLL lock (page 15, table 7)
+            time_micros_t now = time_micros_now();
+            do
+            {
+            } while (time_micros_now() < now + 50);
+        }
     }
 
     if (sx127x->state.op_mode == SX127X_OP_MODE_LORA)
     {
-        // TODO: Should ppm_correction be applied in FSK mode?
-        int8_t ppm_correction = CONSTRAIN_TO_I8(lrintf(0.95f * (error / ((float)freq / 1000000))));
-        if (ppm_correction != sx127x->state.lora.ppm_correction)
+        if (f->ppm_correction != sx127x->state.lora.ppm_correction)
         {
-            sx127x_prepare_write(sx127x);
-            sx127x_write_reg(sx127x, REG_LORA_PPM_CORRECTION, (uint8_t)ppm_correction);
-            sx127x->state.lora.ppm_correction = ppm_correction;
+            sx127x_set_reg(sx127x, REG_LORA_PPM_CORRECTION, (uint8_t)f->ppm_correction);
+            sx127x->state.lora.ppm_correction = f->ppm_correction;
         }
         sx127x_apply_bw500_sensitivity_workaround(sx127x);
+        sx127x_flush_regs(sx127x, true);
     }
 }
 
@@ -472,19 +597,19 @@ void sx127x_set_payload_size(sx127x_t *sx127x, uint8_t size)
     switch (sx127x->state.op_mode)
     {
     case SX127X_OP_MODE_FSK:
-        size = FEC_ENCODED_SIZE(size);
+        size = fec_encoded_size(sx127x->state.fsk.fec, size);
         if (sx127x->state.fsk.payload_length != size)
         {
-            sx127x_prepare_write(sx127x);
-            sx127x_write_reg(sx127x, REG_FSK_PAYLOAD_LENGTH, size);
+            sx127x_set_reg(sx127x, REG_FSK_PAYLOAD_LENGTH, size);
+            sx127x_flush_regs(sx127x, true);
             sx127x->state.fsk.payload_length = size;
         }
         break;
     case SX127X_OP_MODE_LORA:
         if (sx127x->state.lora.payload_length != size)
         {
-            sx127x_prepare_write(sx127x);
-            sx127x_write_reg(sx127x, REG_LORA_PAYLOAD_LENGTH, size);
+            sx127x_set_reg(sx127x, REG_LORA_PAYLOAD_LENGTH, size);
+            sx127x_flush_regs(sx127x, true);
             sx127x->state.lora.payload_length = size;
         }
         break;
@@ -505,6 +630,7 @@ void sx127x_set_sync_word(sx127x_t *sx127x, int16_t sw)
             sx127x_set_lora_sync_word(sx127x);
             break;
         }
+        sx127x_flush_regs(sx127x, false);
     }
 }
 
@@ -530,10 +656,12 @@ void sx127x_set_op_mode(sx127x_t *sx127x, sx127x_op_mode_e op_mode)
         {
         case SX127X_OP_MODE_FSK:
             sx127x_set_mode(sx127x, (prev_mode & ~MODE_LORA) | MODE_SLEEP);
+            sx127x_invalidate_modem_regs(sx127x);
             sx127x_set_fsk_parameters(sx127x);
             break;
         case SX127X_OP_MODE_LORA:
             sx127x_set_mode(sx127x, (prev_mode | MODE_LORA) | MODE_SLEEP);
+            sx127x_invalidate_modem_regs(sx127x);
             sx127x_set_lora_parameters(sx127x);
             break;
         }
@@ -543,8 +671,6 @@ void sx127x_set_op_mode(sx127x_t *sx127x, sx127x_op_mode_e op_mode)
 
 void sx127x_set_tx_power(sx127x_t *sx127x, int level)
 {
-    sx127x_prepare_write(sx127x);
-
     uint8_t pa_config = 0;
     uint8_t pa_dac = 0x84; // default for +17dbm
     switch (sx127x->output_type)
@@ -575,20 +701,21 @@ void sx127x_set_tx_power(sx127x_t *sx127x, int level)
     default:
         UNREACHABLE();
     }
-    sx127x_write_reg(sx127x, REG_PA_CONFIG, pa_config);
-    sx127x_write_reg(sx127x, REG_PA_DAC, pa_dac);
+    sx127x_set_reg(sx127x, REG_PA_CONFIG, pa_config);
+    sx127x_set_reg(sx127x, REG_PA_DAC, pa_dac);
+    sx127x_flush_regs(sx127x, true);
 }
 
 void sx127x_send(sx127x_t *sx127x, const void *buf, size_t size)
 {
-    uint8_t data[FEC_ENCODED_SIZE(size)];
+    uint8_t data[fec_encoded_size(sx127x->state.fsk.fec, size)];
     const void *ptr = NULL;
     size_t ptr_size = 0;
     switch (sx127x->state.op_mode)
     {
     case SX127X_OP_MODE_FSK:
         sx127x_sleep(sx127x);
-        ptr_size = fec_encode(buf, size, data, sizeof(data));
+        ptr_size = fec_encode(sx127x->state.fsk.fec, buf, size, data, sizeof(data));
         ptr = data;
         // We need to wait here, otherwise we might write to
         // the FIFO before the modem is in sleep mode and the
@@ -621,7 +748,8 @@ void sx127x_send(sx127x_t *sx127x, const void *buf, size_t size)
     case SX127X_OP_MODE_FSK:
         // No need to clear the IRQ in FSK mode, it's automatically cleared
         // when exiting TX mode.
-        sx127x_write_reg(sx127x, REG_DIO_MAPPING_1, DIO0_FSK_PACKET_SENT);
+        sx127x_set_reg(sx127x, REG_DIO_MAPPING_1, DIO0_FSK_PACKET_SENT);
+        sx127x_flush_regs(sx127x, false);
         // Start transmitting as soon as the FIFO is not empty. We actually make
         // it wait until we fill the FIFO because up until this point, the radio
         // has been in standby mode.
@@ -633,7 +761,8 @@ void sx127x_send(sx127x_t *sx127x, const void *buf, size_t size)
         break;
     case SX127X_OP_MODE_LORA:
         sx127x_write_reg(sx127x, REG_LORA_IRQ_FLAGS, IRQ_LORA_TX_DONE_MASK);
-        sx127x_write_reg(sx127x, REG_DIO_MAPPING_1, DIO0_LORA_TX_DONE);
+        sx127x_set_reg(sx127x, REG_DIO_MAPPING_1, DIO0_LORA_TX_DONE);
+        sx127x_flush_regs(sx127x, false);
         sx127x_set_mode(sx127x, MODE_LORA | MODE_TX);
         break;
     }
@@ -641,7 +770,7 @@ void sx127x_send(sx127x_t *sx127x, const void *buf, size_t size)
 
 size_t sx127x_read(sx127x_t *sx127x, void *buf, size_t size)
 {
-    uint8_t data[FEC_ENCODED_SIZE(size)];
+    uint8_t data[fec_encoded_size(sx127x->state.fsk.fec, size)];
     void *ptr;
     size_t ptr_size;
     if (sx127x->state.op_mode == SX127X_OP_MODE_LORA)
@@ -655,7 +784,7 @@ size_t sx127x_read(sx127x_t *sx127x, void *buf, size_t size)
     else
     {
         ptr = data;
-        ptr_size = FEC_ENCODED_SIZE(size);
+        ptr_size = sizeof(data);
     }
     HAL_ERR_ASSERT_OK(hal_spi_device_transmit(&sx127x->state.spi, 0, REG_FIFO, NULL, ptr_size, ptr, 0));
     sx127x->state.rx_done = false;
@@ -665,7 +794,9 @@ size_t sx127x_read(sx127x_t *sx127x, void *buf, size_t size)
     case SX127X_OP_MODE_FSK:
         // No need to clear the IRQs here, both PayloadReady and SyncAddressMatch are
         // automatically cleared when the FIFO is emptied of when exiting RX mode.
-        fec_decode(data, ptr_size, buf, size);
+        // The radio doesn't provide any per byte reliability information,
+        // so there are no erasure hints. Failures are caught by the CRC.
+        fec_decode(sx127x->state.fsk.fec, data, ptr_size, buf, size, NULL, 0);
         break;
     case SX127X_OP_MODE_LORA:
         sx127x_write_reg(sx127x, REG_LORA_IRQ_FLAGS, IRQ_LORA_RX_DONE_MASK | IRQ_LORA_VALID_HEADER);
@@ -685,7 +816,8 @@ void sx127x_enable_continous_rx(sx127x_t *sx127x)
     case SX127X_OP_MODE_FSK:
         sx127x_idle(sx127x);
         sx127x_fsk_wait_for_mode_ready(sx127x);
-        sx127x_write_reg(sx127x, REG_DIO_MAPPING_1, DIO0_FSK_PAYLOAD_READY);
+        sx127x_set_reg(sx127x, REG_DIO_MAPPING_1, DIO0_FSK_PAYLOAD_READY);
+        sx127x_flush_regs(sx127x, false);
         // Enable RX in packet mode
         sx127x_set_mode(sx127x, MODE_RX_CONTINUOUS);
         //sx127x_write_reg(sx127x, REG_FSK_RX_CONFIG, 1 << 7 | 1 << 4 | 1 << 3 | 6);
@@ -693,13 +825,46 @@ void sx127x_enable_continous_rx(sx127x_t *sx127x)
         break;
     case SX127X_OP_MODE_LORA:
         sx127x_prepare_write(sx127x);
-        sx127x_write_reg(sx127x, REG_DIO_MAPPING_1, DIO0_LORA_RX_DONE);
+        sx127x_set_reg(sx127x, REG_DIO_MAPPING_1, DIO0_LORA_RX_DONE);
+        sx127x_flush_regs(sx127x, false);
         // Enter continous rx mode
         sx127x_set_mode(sx127x, MODE_LORA | MODE_RX_CONTINUOUS);
         break;
     }
 }
 
+bool sx127x_start_cad(sx127x_t *sx127x)
+{
+    if (sx127x->state.op_mode != SX127X_OP_MODE_LORA)
+    {
+        return false;
+    }
+    sx127x->state.cad_done = false;
+    sx127x->state.dio0_trigger = DIO0_TRIGGER_CAD_DONE;
+    sx127x_prepare_write(sx127x);
+    sx127x_write_reg(sx127x, REG_LORA_IRQ_FLAGS, IRQ_LORA_CAD_DONE_MASK | IRQ_LORA_CAD_DETECTED_MASK);
+    sx127x_set_reg(sx127x, REG_DIO_MAPPING_1, DIO0_LORA_CAD_DONE);
+    sx127x_flush_regs(sx127x, false);
+    // The radio goes back to standby once CAD is done
+    sx127x_set_mode(sx127x, MODE_LORA | MODE_CAD);
+    return true;
+}
+
+bool sx127x_is_cad_done(sx127x_t *sx127x, bool *detected)
+{
+    if (!sx127x->state.cad_done)
+    {
+        return false;
+    }
+    if (detected)
+    {
+        // Read here rather than from the callback task, so we don't
+        // race with the RC task for the SPI bus.
+        *detected = sx127x_read_reg(sx127x, REG_LORA_IRQ_FLAGS) & IRQ_LORA_CAD_DETECTED_MASK;
+    }
+    return true;
+}
+
 bool sx127x_is_tx_done(sx127x_t *sx127x)
 {
     return sx127x->state.tx_done;
@@ -710,6 +875,86 @@ bool sx127x_is_rx_done(sx127x_t *sx127x)
     return sx127x->state.rx_done;
 }
 
+time_micros_t sx127x_rx_done_at(sx127x_t *sx127x)
+{
+    return sx127x->state.rx_done_at;
+}
+
+time_micros_t sx127x_tx_done_at(sx127x_t *sx127x)
+{
+    return sx127x->state.tx_done_at;
+}
+
+void IRAM_ATTR sx127x_queue_event(sx127x_t *sx127x, time_micros_t at)
+{
+    // Single producer, single consumer. The release store of head
+    // publishes the event, while the acquire load of tail makes sure
+    // the consumer is done with the slot before we overwrite it.
+    uint8_t head = sx127x->state.events.head;
+    uint8_t next = (head + 1) & (SX127X_EVENT_RING_SIZE - 1);
+    if (next == __atomic_load_n(&sx127x->state.events.tail, __ATOMIC_ACQUIRE))
+    {
+        sx127x->state.events.dropped++;
+        return;
+    }
+    sx127x->state.events.ring[head].at = at;
+    sx127x->state.events.ring[head].trigger = sx127x->state.dio0_trigger;
+    __atomic_store_n(&sx127x->state.events.head, next, __ATOMIC_RELEASE);
+}
+
+void sx127x_process_events(sx127x_t *sx127x)
+{
+    air_radio_callback_t callback;
+    uint8_t tail = sx127x->state.events.tail;
+    if (tail == __atomic_load_n(&sx127x->state.events.head, __ATOMIC_ACQUIRE))
+    {
+        return;
+    }
+    do
+    {
+        sx127x_event_t ev = sx127x->state.events.ring[tail];
+        tail = (tail + 1) & (SX127X_EVENT_RING_SIZE - 1);
+        __atomic_store_n(&sx127x->state.events.tail, tail, __ATOMIC_RELEASE);
+        histogram_add(&sx127x->state.events.latency, (uint32_t)(time_micros_now() - ev.at));
+        switch (ev.trigger)
+        {
+        case DIO0_TRIGGER_RX_DONE:
+            sx127x->state.rx_done_at = ev.at;
+            sx127x->state.rx_done = true;
+            if (sx127x->state.callback)
+            {
+                callback = sx127x->state.callback;
+                callback((air_radio_t *)sx127x, AIR_RADIO_CALLBACK_REASON_RX_DONE, sx127x->state.callback_data);
+            }
+            break;
+        case DIO0_TRIGGER_TX_DONE:
+            sx127x->state.tx_done_at = ev.at;
+            sx127x->state.tx_done = true;
+            if (sx127x->state.callback)
+            {
+                callback = sx127x->state.callback;
+                callback((air_radio_t *)sx127x, AIR_RADIO_CALLBACK_REASON_TX_DONE, sx127x->state.callback_data);
+            }
+            break;
+        case DIO0_TRIGGER_CAD_DONE:
+            sx127x->state.cad_done = true;
+            break;
+        }
+    } while (tail != __atomic_load_n(&sx127x->state.events.head, __ATOMIC_ACQUIRE));
+    // Let the RC task know the radio state changed
+    wakeup_signal();
+}
+
+const histogram_t *sx127x_event_latency(sx127x_t *sx127x)
+{
+    return &sx127x->state.events.latency;
+}
+
+unsigned sx127x_dropped_events(sx127x_t *sx127x)
+{
+    return sx127x->state.events.dropped;
+}
+
 bool sx127x_is_rx_in_progress(sx127x_t *sx127x)
 {
     switch (sx127x->state.op_mode)
@@ -758,7 +1003,7 @@ int sx127x_frequency_error(sx127x_t *sx127x)
             err |= 0xfff00000;
         }
 
-        float bw = sx127x_get_lora_signal_bw_khz(sx127x, sx127x->state.lora.signal_bw);
+        float bw = sx127x_get_lora_signal_bw_khz(sx127x->state.lora.signal_bw);
         return err * bw * ((float)(1L << 24) / (float)SX127X_FXOSC / 500.0);
     }
     }
@@ -932,18 +1177,21 @@ static void sx127x_set_fsk_parameters(sx127x_t *sx127x)
     // sx127x_write_reg(sx127x, REG_PA_RAMP, 0x20);
 
     //sx127x_write_reg(sx127x, REG_FSK_RX_CONFIG, 0x10 | 0x08 | 0x06);
-    sx127x_write_reg(sx127x, REG_FSK_RX_CONFIG, /*1 << 4 |*/ 0x08 | 0x06);
+    sx127x_set_reg(sx127x, REG_FSK_RX_CONFIG, /*1 << 4 |*/ 0x08 | 0x06);
     // detector on | detector size 01 | tolerance 10
-    sx127x_write_reg(sx127x, REG_FSK_PREAMBLE_DETECT, 1 << 7 | 1 << 5 | 10);
+    sx127x_set_reg(sx127x, REG_FSK_PREAMBLE_DETECT, 1 << 7 | 1 << 5 | 10);
 
-    sx127x_write_reg(sx127x, REG_FSK_RSSI_THRES, 0xFF);
+    sx127x_set_reg(sx127x, REG_FSK_RSSI_THRES, 0xFF);
 
     // autorestart = on, wait for pll, polarity = AA, sync = ON, syncsize = 3 + 1 = 4
-    sx127x_write_reg(sx127x, REG_FSK_SYNC_CONFIG, 2 << 5 | 0 << 5 | 1 << 4 | 0x03);
+    sx127x_set_reg(sx127x, REG_FSK_SYNC_CONFIG, 2 << 5 | 0 << 5 | 1 << 4 | (SX127X_FSK_SYNC_SIZE - 1));
 
     sx127x_set_fsk_sync_word(sx127x);
 
-    sx127x_write_reg(sx127x, REG_FSK_PACKET_CONFIG_1, 1 << 5);
+    // fixed length, manchester encoding, no crc
+    sx127x_set_reg(sx127x, REG_FSK_PACKET_CONFIG_1, 1 << 5);
+
+    sx127x_flush_regs(sx127x, false);
 }
 
 static void sx127x_fsk_wait_for_mode_ready(sx127x_t *sx127x)
@@ -956,47 +1204,64 @@ static void sx127x_fsk_wait_for_mode_ready(sx127x_t *sx127x)
 static void sx127x_set_fsk_sync_word(sx127x_t *sx127x)
 {
     uint8_t mask = sx127x->state.sync_word != SX127X_SYNC_WORD_DEFAULT ? sx127x->state.sync_word : 0;
-    sx127x_write_reg(sx127x, REG_FSK_SYNC_VALUE_1, 0x69 ^ mask);
-    sx127x_write_reg(sx127x, REG_FSK_SYNC_VALUE_2, 0x81 ^ mask);
-    sx127x_write_reg(sx127x, REG_FSK_SYNC_VALUE_3, 0x7E ^ mask);
-    sx127x_write_reg(sx127x, REG_FSK_SYNC_VALUE_4, 0x96 ^ mask);
+    sx127x_set_reg(sx127x, REG_FSK_SYNC_VALUE_1, 0x69 ^ mask);
+    sx127x_set_reg(sx127x, REG_FSK_SYNC_VALUE_2, 0x81 ^ mask);
+    sx127x_set_reg(sx127x, REG_FSK_SYNC_VALUE_3, 0x7E ^ mask);
+    sx127x_set_reg(sx127x, REG_FSK_SYNC_VALUE_4, 0x96 ^ mask);
 }
 
 void sx127x_set_fsk_fdev(sx127x_t *sx127x, unsigned hz)
 {
-    sx127x_prepare_write(sx127x);
     uint16_t dev = lrintf(hz / SX127X_FSK_FREQ_STEP);
-    sx127x_write_reg(sx127x, REG_FSK_FDEV_MSB, dev >> 8);
-    sx127x_write_reg(sx127x, REG_FSK_FDEV_LSB, dev & 0xff);
+    sx127x_set_reg(sx127x, REG_FSK_FDEV_MSB, dev >> 8);
+    sx127x_set_reg(sx127x, REG_FSK_FDEV_LSB, dev & 0xff);
+    sx127x_flush_regs(sx127x, true);
 }
 
 void sx127x_set_fsk_bitrate(sx127x_t *sx127x, unsigned long bps)
 {
-    sx127x_prepare_write(sx127x);
     uint16_t br = lrintf((float)SX127X_FXOSC / bps);
-    sx127x_write_reg(sx127x, REG_FSK_BITRATE_MSB, br >> 8);
-    sx127x_write_reg(sx127x, REG_FSK_BITRATE_LSB, br & 0xff);
+    sx127x_set_reg(sx127x, REG_FSK_BITRATE_MSB, br >> 8);
+    sx127x_set_reg(sx127x, REG_FSK_BITRATE_LSB, br & 0xff);
+    sx127x_flush_regs(sx127x, true);
 }
 
 void sx127x_set_fsk_rx_bandwidth(sx127x_t *sx127x, unsigned hz)
 {
-    sx127x_prepare_write(sx127x);
-    sx127x_write_reg(sx127x, REG_FSK_RX_BW, sx127x_get_fsk_bandwidth_reg_value(hz));
+    sx127x_set_reg(sx127x, REG_FSK_RX_BW, sx127x_get_fsk_bandwidth_reg_value(hz));
+    sx127x_flush_regs(sx127x, true);
     sx127x->state.fsk.rx_bandwidth = hz;
 }
 
 void sx127x_set_fsk_rx_afc_bandwidth(sx127x_t *sx127x, unsigned hz)
 {
-    sx127x_prepare_write(sx127x);
-    sx127x_write_reg(sx127x, REG_FSK_RX_AFC_BW, sx127x_get_fsk_bandwidth_reg_value(hz));
+    sx127x_set_reg(sx127x, REG_FSK_RX_AFC_BW, sx127x_get_fsk_bandwidth_reg_value(hz));
+    sx127x_flush_regs(sx127x, true);
 }
 
 void sx127x_set_fsk_preamble_length(sx127x_t *sx127x, unsigned length)
 {
-    sx127x_prepare_write(sx127x);
     uint16_t len = length;
-    sx127x_write_reg(sx127x, REG_FSK_PREAMBLE_MSB, len >> 8);
-    sx127x_write_reg(sx127x, REG_FSK_PREAMBLE_LSB, len & 0xff);
+    sx127x_set_reg(sx127x, REG_FSK_PREAMBLE_MSB, len >> 8);
+    sx127x_set_reg(sx127x, REG_FSK_PREAMBLE_LSB, len & 0xff);
+    sx127x_flush_regs(sx127x, true);
+}
+
+void sx127x_set_fsk_fec(sx127x_t *sx127x, const fec_t *fec)
+{
+    // The payload length register holds the encoded size, it will
+    // be updated by the next call to sx127x_set_payload_size()
+    sx127x->state.fsk.fec = fec;
+}
+
+time_micros_t sx127x_fsk_time_on_air(unsigned long bps, unsigned preamble_length, const fec_t *fec, size_t size)
+{
+    // Datasheet page 75, 4.2.13. Preamble and sync word are sent as is,
+    // while the payload is manchester encoded. The bitrate registers set
+    // the chip rate, so each payload bit takes 2 chips.
+    unsigned long chips = (preamble_length + SX127X_FSK_SYNC_SIZE) * 8;
+    chips += fec_encoded_size(fec, size) * 8 * 2;
+    return (chips * 1000000ULL + bps - 1) / bps;
 }
 
 // #pragma endregion
@@ -1005,22 +1270,24 @@ void sx127x_set_fsk_preamble_length(sx127x_t *sx127x, unsigned length)
 
 static void sx127x_set_lora_parameters(sx127x_t *sx127x)
 {
-    sx127x_write_reg(sx127x, REG_LORA_FIFO_TX_BASE_ADDR, TX_FIFO_ADDR);
-    sx127x_write_reg(sx127x, REG_LORA_FIFO_RX_BASE_ADDR, RX_FIFO_ADDR);
+    sx127x_set_reg(sx127x, REG_LORA_FIFO_TX_BASE_ADDR, TX_FIFO_ADDR);
+    sx127x_set_reg(sx127x, REG_LORA_FIFO_RX_BASE_ADDR, RX_FIFO_ADDR);
 
     // set auto AGC
-    sx127x_write_reg(sx127x, REG_LORA_MODEM_CONFIG_3, 0x04);
+    sx127x_set_reg(sx127x, REG_LORA_MODEM_CONFIG_3, 0x04);
 
 #if defined(CONFIG_RAVEN_DIO5_CLK_OUTPUT)
     // Enable DIO5 as ClkOut
-    uint8_t dio_mapping_2 = sx127x_read_reg(sx127x, REG_DIO_MAPPING_2);
-    sx127x_write_reg(sx127x, REG_DIO_MAPPING_2, dio_mapping_2 | (1 << 5));
+    uint8_t dio_mapping_2 = sx127x_get_reg(sx127x, REG_DIO_MAPPING_2);
+    sx127x_set_reg(sx127x, REG_DIO_MAPPING_2, dio_mapping_2 | (1 << 5));
 #endif
 
     sx127x_set_lora_sync_word(sx127x);
+
+    sx127x_flush_regs(sx127x, false);
 }
 
-static float sx127x_get_lora_signal_bw_khz(sx127x_t *sx127x, sx127x_lora_signal_bw_e sbw)
+static float sx127x_get_lora_signal_bw_khz(sx127x_lora_signal_bw_e sbw)
 {
     switch (sbw)
     {
@@ -1035,7 +1302,7 @@ static float sx127x_get_lora_signal_bw_khz(sx127x_t *sx127x, sx127x_lora_signal_
     case SX127X_LORA_SIGNAL_BW_31_25:
         return 31.25f;
     case SX127X_LORA_SIGNAL_BW_41_7:
-        return 41.27f;
+        return 41.7f;
     case SX127X_LORA_SIGNAL_BW_62_5:
         return 62.5f;
     case SX127X_LORA_SIGNAL_BW_250:
@@ -1078,15 +1345,15 @@ static void sx127x_apply_bw500_sensitivity_workaround(sx127x_t *sx127x)
         switch (workaround)
         {
         case SX127X_RX_SENSITIVITY_BW500_WORKAROUND_NONE:
-            sx127x_write_reg(sx127x, REG_LORA_DETECTION_BW500_OPTIMIZE_1, 0x03);
+            sx127x_set_reg(sx127x, REG_LORA_DETECTION_BW500_OPTIMIZE_1, 0x03);
             break;
         case SX127X_RX_SENSITIVITY_BW500_WORKAROUND_HIGH_BAND:
-            sx127x_write_reg(sx127x, REG_LORA_DETECTION_BW500_OPTIMIZE_1, 0x02);
-            sx127x_write_reg(sx127x, REG_LORA_DETECTION_BW500_OPTIMIZE_2, 0x64);
+            sx127x_set_reg(sx127x, REG_LORA_DETECTION_BW500_OPTIMIZE_1, 0x02);
+            sx127x_set_reg(sx127x, REG_LORA_DETECTION_BW500_OPTIMIZE_2, 0x64);
             break;
         case SX127X_RX_SENSITIVITY_BW500_WORKAROUND_LOW_BAND:
-            sx127x_write_reg(sx127x, REG_LORA_DETECTION_BW500_OPTIMIZE_1, 0x02);
-            sx127x_write_reg(sx127x, REG_LORA_DETECTION_BW500_OPTIMIZE_2, 0x7F);
+            sx127x_set_reg(sx127x, REG_LORA_DETECTION_BW500_OPTIMIZE_1, 0x02);
+            sx127x_set_reg(sx127x, REG_LORA_DETECTION_BW500_OPTIMIZE_2, 0x7F);
             break;
         }
         sx127x->state.lora.bw_workaround = workaround;
@@ -1106,13 +1373,11 @@ static void sx127x_set_lora_sync_word(sx127x_t *sx127x)
         // 0x34 is reserved for LoRaWAN
         sw = 0x35;
     }
-    sx127x_write_reg(sx127x, REG_LORA_SYNC_WORD, sw);
+    sx127x_set_reg(sx127x, REG_LORA_SYNC_WORD, sw);
 }
 
 void sx127x_set_lora_spreading_factor(sx127x_t *sx127x, int sf)
 {
-    sx127x_prepare_write(sx127x);
-
     if (sf < 6)
     {
         sf = 6;
@@ -1124,22 +1389,21 @@ void sx127x_set_lora_spreading_factor(sx127x_t *sx127x, int sf)
 
     if (sf == 6)
     {
-        sx127x_write_reg(sx127x, REG_LORA_DETECTION_OPTIMIZE, 0xc5);
-        sx127x_write_reg(sx127x, REG_LORA_DETECTION_THRESHOLD, 0x0c);
+        sx127x_set_reg(sx127x, REG_LORA_DETECTION_OPTIMIZE, 0xc5);
+        sx127x_set_reg(sx127x, REG_LORA_DETECTION_THRESHOLD, 0x0c);
     }
     else
     {
-        sx127x_write_reg(sx127x, REG_LORA_DETECTION_OPTIMIZE, 0xc3);
-        sx127x_write_reg(sx127x, REG_LORA_DETECTION_THRESHOLD, 0x0a);
+        sx127x_set_reg(sx127x, REG_LORA_DETECTION_OPTIMIZE, 0xc3);
+        sx127x_set_reg(sx127x, REG_LORA_DETECTION_THRESHOLD, 0x0a);
     }
-    sx127x_write_reg(sx127x, REG_LORA_MODEM_CONFIG_2, (sx127x_read_reg(sx127x, REG_LORA_MODEM_CONFIG_2) & 0x0f) | ((sf << 4) & 0xf0));
+    sx127x_set_reg(sx127x, REG_LORA_MODEM_CONFIG_2, (sx127x_get_reg(sx127x, REG_LORA_MODEM_CONFIG_2) & 0x0f) | ((sf << 4) & 0xf0));
+    sx127x_flush_regs(sx127x, true);
     sx127x->state.lora.sf = sf;
 }
 
 void sx127x_set_lora_signal_bw(sx127x_t *sx127x, sx127x_lora_signal_bw_e sbw)
 {
-    sx127x_prepare_write(sx127x);
-
     if (sbw < SX127X_LORA_SIGNAL_BW_7_8)
     {
         sbw = SX127X_LORA_SIGNAL_BW_7_8;
@@ -1148,17 +1412,16 @@ void sx127x_set_lora_signal_bw(sx127x_t *sx127x, sx127x_lora_signal_bw_e sbw)
     {
         sbw = SX127X_LORA_SIGNAL_BW_500;
     }
-    uint8_t reg = sx127x_read_reg(sx127x, REG_LORA_MODEM_CONFIG_1);
+    uint8_t reg = sx127x_get_reg(sx127x, REG_LORA_MODEM_CONFIG_1);
     reg = (reg & 0x0f) | (sbw << 4);
-    sx127x_write_reg(sx127x, REG_LORA_MODEM_CONFIG_1, reg);
+    sx127x_set_reg(sx127x, REG_LORA_MODEM_CONFIG_1, reg);
     sx127x->state.lora.signal_bw = sbw;
     sx127x_apply_bw500_sensitivity_workaround(sx127x);
+    sx127x_flush_regs(sx127x, true);
 }
 
 void sx127x_set_lora_coding_rate(sx127x_t *sx127x, sx127x_lora_coding_rate_e rate)
 {
-    sx127x_prepare_write(sx127x);
-
     if (rate < SX127X_LORA_CODING_RATE_4_5)
     {
         rate = SX127X_LORA_CODING_RATE_4_5;
@@ -1168,24 +1431,22 @@ void sx127x_set_lora_coding_rate(sx127x_t *sx127x, sx127x_lora_coding_rate_e rat
         rate = SX127X_LORA_CODING_RATE_4_8;
     }
 
-    uint8_t reg = sx127x_read_reg(sx127x, REG_LORA_MODEM_CONFIG_1);
+    uint8_t reg = sx127x_get_reg(sx127x, REG_LORA_MODEM_CONFIG_1);
     reg = (reg & 0xf1) | (rate << 1);
-    sx127x_write_reg(sx127x, REG_LORA_MODEM_CONFIG_1, reg);
+    sx127x_set_reg(sx127x, REG_LORA_MODEM_CONFIG_1, reg);
+    sx127x_flush_regs(sx127x, true);
 }
 
 void sx127x_set_lora_preamble_length(sx127x_t *sx127x, long length)
 {
-    sx127x_prepare_write(sx127x);
-
-    sx127x_write_reg(sx127x, REG_LORA_PREAMBLE_MSB, (uint8_t)(length >> 8));
-    sx127x_write_reg(sx127x, REG_LORA_PREAMBLE_LSB, (uint8_t)(length >> 0));
+    sx127x_set_reg(sx127x, REG_LORA_PREAMBLE_MSB, (uint8_t)(length >> 8));
+    sx127x_set_reg(sx127x, REG_LORA_PREAMBLE_LSB, (uint8_t)(length >> 0));
+    sx127x_flush_regs(sx127x, true);
 }
 
 void sx127x_set_lora_crc(sx127x_t *sx127x, bool crc)
 {
-    sx127x_prepare_write(sx127x);
-
-    uint8_t reg = sx127x_read_reg(sx127x, REG_LORA_MODEM_CONFIG_2);
+    uint8_t reg = sx127x_get_reg(sx127x, REG_LORA_MODEM_CONFIG_2);
     if (crc)
     {
         reg |= 0x04;
@@ -1194,12 +1455,13 @@ void sx127x_set_lora_crc(sx127x_t *sx127x, bool crc)
     {
         reg &= 0xfb;
     }
-    sx127x_write_reg(sx127x, REG_LORA_MODEM_CONFIG_2, reg);
+    sx127x_set_reg(sx127x, REG_LORA_MODEM_CONFIG_2, reg);
+    sx127x_flush_regs(sx127x, true);
 }
 
 void sx127x_set_lora_header_mode(sx127x_t *sx127x, sx127x_lora_header_e mode)
 {
-    uint8_t reg = sx127x_read_reg(sx127x, REG_LORA_MODEM_CONFIG_1);
+    uint8_t reg = sx127x_get_reg(sx127x, REG_LORA_MODEM_CONFIG_1);
     switch (mode)
     {
     case SX127X_LORA_HEADER_IMPLICIT:
@@ -1209,7 +1471,8 @@ void sx127x_set_lora_header_mode(sx127x_t *sx127x, sx127x_lora_header_e mode)
         reg &= 0xfe;
         break;
     }
-    sx127x_write_reg(sx127x, REG_LORA_MODEM_CONFIG_1, reg);
+    sx127x_set_reg(sx127x, REG_LORA_MODEM_CONFIG_1, reg);
+    sx127x_flush_regs(sx127x, false);
 }
 
 int sx127x_lora_min_rssi(sx127x_t *sx127x)
@@ -1224,6 +1487,25 @@ int sx127x_lora_min_rssi(sx127x_t *sx127x)
     return -164;
 }
 
+time_micros_t sx127x_lora_symbol_time(int sf, sx127x_lora_signal_bw_e sbw)
+{
+    return (1L << sf) * 1000.0f / sx127x_get_lora_signal_bw_khz(sbw);
+}
+
+time_micros_t sx127x_lora_time_on_air(int sf, sx127x_lora_signal_bw_e sbw, sx127x_lora_coding_rate_e rate,
+                                      long preamble_length, sx127x_lora_header_e header, bool crc, size_t size)
+{
+    // Datasheet page 31, 4.1.1.7. LowDataRateOptimize is never enabled
+    // (see sx127x_set_lora_parameters()), so DE = 0.
+    float symbol_micros = sx127x_lora_symbol_time(sf, sbw);
+    int ih = header == SX127X_LORA_HEADER_IMPLICIT ? 1 : 0;
+    int bits = 8 * (int)size - 4 * sf + 28 + (crc ? 16 : 0) - 20 * ih;
+    int blocks = bits > 0 ? (bits + 4 * sf - 1) / (4 * sf) : 0;
+    int payload_symbols = 8 + blocks * ((int)rate + 4);
+    float preamble_symbols = preamble_length + 4.25f;
+    return ceilf((preamble_symbols + payload_symbols) * symbol_micros);
+}
+
 // #pragma endregion
 
 #endif
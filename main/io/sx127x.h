@@ -8,11 +8,17 @@
 
 #include "air/air_radio.h"
 
+#include "util/fec.h"
+#include "util/histogram.h"
 #include "util/time.h"
 
 #define SX127X_MAX_PKT_LENGTH 255
 #define SX127X_SNR_SCALE 4
 #define SX127X_SYNC_WORD_DEFAULT -1
+// Registers 0x00-0x4f, which include all the ones we configure
+#define SX127X_NUM_REGS 0x50
+// Must be a power of 2
+#define SX127X_EVENT_RING_SIZE 8
 
 typedef enum
 {
@@ -62,6 +68,21 @@ typedef enum {
 } lora_band_e;
 #endif
 
+// Register values for a frequency, see sx127x_prepare_frequency()
+typedef struct sx127x_freq_s
+{
+    unsigned long freq;    // Frequency with the error applied, in Hz
+    uint32_t frf;          // Value for the RegFrf registers
+    int8_t ppm_correction; // Only used in LoRa mode
+} sx127x_freq_t;
+
+// DIO0 interrupt, as captured by the handler
+typedef struct sx127x_event_s
+{
+    time_micros_t at; // When the interrupt fired
+    int trigger;      // Value of state.dio0_trigger at that time
+} sx127x_event_t;
+
 typedef struct sx127x_s
 {
     const hal_spi_bus_t spi_bus;
@@ -85,6 +106,7 @@ typedef struct sx127x_s
             unsigned long freq;
             uint8_t payload_length;
             unsigned rx_bandwidth;
+            const fec_t *fec;
         } fsk;
         struct
         {
@@ -97,9 +119,30 @@ typedef struct sx127x_s
         } lora;
         bool rx_done;
         bool tx_done;
+        bool cad_done;
+        time_micros_t rx_done_at;
+        time_micros_t tx_done_at;
         int dio0_trigger;
+        // Written by the DIO0 interrupt handler and consumed by the
+        // callback task. Each index is only written by one of them.
+        struct
+        {
+            sx127x_event_t ring[SX127X_EVENT_RING_SIZE];
+            uint8_t head;
+            uint8_t tail;
+            unsigned dropped;
+            histogram_t latency; // From the interrupt to its processing, in us
+        } events;
         void *callback;
         void *callback_data;
+        // Shadow copy of the configuration registers. valid and dirty
+        // are bitmaps, with a bit per register.
+        struct
+        {
+            uint8_t values[SX127X_NUM_REGS];
+            uint8_t valid[SX127X_NUM_REGS / 8];
+            uint8_t dirty[SX127X_NUM_REGS / 8];
+        } regs;
     } state;
 } sx127x_t;
 
@@ -110,6 +153,11 @@ void sx127x_set_op_mode(sx127x_t *sx127x, sx127x_op_mode_e op_mode);
 void sx127x_set_tx_power(sx127x_t *sx127x, int dBm);
 // freq is in Hz
 void sx127x_set_frequency(sx127x_t *sx127x, unsigned long freq, int error);
+// Computes the register values for a frequency in advance, so switching
+// to it with sx127x_set_prepared_frequency() doesn't need to do any math.
+// Valid for both FSK and LoRa modes.
+void sx127x_prepare_frequency(sx127x_freq_t *f, unsigned long freq, int error);
+void sx127x_set_prepared_frequency(sx127x_t *sx127x, const sx127x_freq_t *f);
 // Should be called with center-ish frequency
 void sx127x_calibrate(sx127x_t *sx127x, unsigned long freq);
 
@@ -122,6 +170,26 @@ void sx127x_enable_continous_rx(sx127x_t *sx127x);
 bool sx127x_is_tx_done(sx127x_t *sx127x);
 bool sx127x_is_rx_done(sx127x_t *sx127x);
 bool sx127x_is_rx_in_progress(sx127x_t *sx127x);
+// Starts channel activity detection, which looks for a LoRa preamble
+// for about 2 symbols. Returns false if not in LoRa mode.
+bool sx127x_start_cad(sx127x_t *sx127x);
+// Returns true once the CAD started by sx127x_start_cad() is done,
+// setting detected to wether a preamble was found.
+bool sx127x_is_cad_done(sx127x_t *sx127x, bool *detected);
+// Return the time at which the DIO0 interrupt for the last received or
+// sent packet fired.
+time_micros_t sx127x_rx_done_at(sx127x_t *sx127x);
+time_micros_t sx127x_tx_done_at(sx127x_t *sx127x);
+
+// Queues an event for the current DIO0 trigger which happened at the
+// given time. Called from the interrupt handler, but it can also be used
+// to inject synthetic events. Events are processed by
+// sx127x_process_events(), which is called by the callback task.
+void sx127x_queue_event(sx127x_t *sx127x, time_micros_t at);
+void sx127x_process_events(sx127x_t *sx127x);
+// Latencies between the DIO0 interrupt and the processing of its event
+const histogram_t *sx127x_event_latency(sx127x_t *sx127x);
+unsigned sx127x_dropped_events(sx127x_t *sx127x);
 
 void sx127x_set_callback(sx127x_t *sx127x, air_radio_callback_t callback, void *data);
 
@@ -142,6 +210,11 @@ void sx127x_set_fsk_bitrate(sx127x_t *sx127x, unsigned long bps);
 void sx127x_set_fsk_rx_bandwidth(sx127x_t *sx127x, unsigned hz);
 void sx127x_set_fsk_rx_afc_bandwidth(sx127x_t *sx127x, unsigned hz);
 void sx127x_set_fsk_preamble_length(sx127x_t *sx127x, unsigned length);
+// Defaults to FEC_NIBBLE. Takes effect on the next call to sx127x_set_payload_size().
+void sx127x_set_fsk_fec(sx127x_t *sx127x, const fec_t *fec);
+// Returns the time on air for a packet with size bytes (before FEC
+// encoding) using the packet format configured by the driver.
+time_micros_t sx127x_fsk_time_on_air(unsigned long bps, unsigned preamble_length, const fec_t *fec, size_t size);
 
 // LoRa specific functions
 void sx127x_set_lora_spreading_factor(sx127x_t *sx127x, int sf);
@@ -151,3 +224,8 @@ void sx127x_set_lora_preamble_length(sx127x_t *sx127x, long length);
 void sx127x_set_lora_crc(sx127x_t *sx127x, bool crc);
 void sx127x_set_lora_header_mode(sx127x_t *sx127x, sx127x_lora_header_e mode);
 int sx127x_lora_min_rssi(sx127x_t *sx127x);
+time_micros_t sx127x_lora_symbol_time(int sf, sx127x_lora_signal_bw_e sbw);
+// Returns the time on air for a packet with size bytes, using the formula
+// from the datasheet. Matches the Semtech LoRa calculator.
+time_micros_t sx127x_lora_time_on_air(int sf, sx127x_lora_signal_bw_e sbw, sx127x_lora_coding_rate_e rate,
+                                      long preamble_length, sx127x_lora_header_e header, bool crc, size_t size);
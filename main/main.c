@@ -46,11 +46,15 @@
 
 #include "util/macros.h"
 #include "util/time.h"
+#include "util/wakeup.h"
 
 #if defined(CONFIG_RAVEN_USE_PWM_OUTPUTS)
 static const char *TAG = "Main";
 #endif
 
+// Maximum time the RC task sleeps between updates
+#define RC_TASK_MAX_WAIT_US MILLIS_TO_MICROS(20)
+
 static air_radio_t radio = {
 #if defined(USE_RADIO_SX127X)
     .sx127x.spi_bus = SX127X_SPI_BUS,
@@ -195,6 +199,7 @@ void task_rmp(void *arg)
     for (;;)
     {
         rmp_update(&rmp);
+        rc_update_rmp(&rc);
         vTaskDelay(10 / portTICK_PERIOD_MS);
     }
 }
@@ -208,10 +213,15 @@ void task_rc_update(void *arg)
     air_radio_init(&radio);
     // Enable the WDT for this task
     hal_wd_add_task(NULL);
+    wakeup_init();
     for (;;)
     {
-        rc_update(&rc);
+        time_micros_t next_update_at = rc_update(&rc);
         hal_wd_feed();
+        // Sleep until the next deadline or an event happens. Changes
+        // made by other tasks which don't signal an event are picked
+        // up after at most RC_TASK_MAX_WAIT_US.
+        wakeup_wait_until(MIN(next_update_at, time_micros_now() + RC_TASK_MAX_WAIT_US));
     }
 }
 
@@ -43,10 +43,6 @@ static int msp_air_write(void *transport, msp_direction_e direction, uint16_t cm
         memcpy(buf + 1 + used, payload, size);
     }
     size_t feed_size = 1 + used + size;
-    if (tr->before_feed)
-    {
-        tr->before_feed(tr, feed_size, tr->user_data);
-    }
     return air_stream_feed_output_cmd(tr->air_stream, AIR_CMD_MSP, buf, feed_size);
 }
 
@@ -81,13 +77,11 @@ static bool msp_air_decode(const void *payload, size_t size, msp_direction_e *di
     return true;
 }
 
-void msp_air_init(msp_air_t *tr, air_stream_t *stream, msp_air_before_feed_f before_feed, void *user_data)
+void msp_air_init(msp_air_t *tr, air_stream_t *stream)
 {
     tr->transport.vtable.read = msp_air_read;
     tr->transport.vtable.write = msp_air_write;
     tr->air_stream = stream;
-    tr->before_feed = before_feed;
-    tr->user_data = user_data;
 }
 
 void msp_air_dispatch(msp_air_t *tr, msp_conn_t *conn, const void *payload, size_t size)
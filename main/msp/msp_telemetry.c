@@ -80,28 +80,16 @@ static void msp_telemetry_init(msp_telemetry_t *tr, size_t max_size)
 
 static bool msp_telemetry_push_data(ring_buffer_t *rb, const void *data, size_t size)
 {
-    uint8_t *ptr = (uint8_t *)data;
-    for (size_t ii = 0; ii < size; ii++, ptr++)
-    {
-        if (!ring_buffer_push(rb, ptr))
-        {
-            return false;
-        }
-    }
-    return true;
+    return ring_buffer_push_n(rb, data, size);
 }
 
 static bool msp_telemetry_pop_data(ring_buffer_t *rb, void *data, size_t size)
 {
-    uint8_t *ptr = (uint8_t *)data;
-    for (size_t ii = 0; ii < size; ii++, ptr++)
+    if (ring_buffer_count(rb) < size)
     {
-        if (!ring_buffer_pop(rb, ptr))
-        {
-            return false;
-        }
+        return false;
     }
-    return true;
+    return ring_buffer_pop_n(rb, data, size) == size;
 }
 
 static bool msp_telemetry_push_chunk(ring_buffer_t *rb, msp_telemetry_chunk_t *chunk)
@@ -157,23 +145,30 @@ static int msp_telemetry_read(msp_telemetry_t *tr, ring_buffer_t *rb, uint16_t *
     uint8_t cmd8 = (uint8_t)blob.cmd;
     ccrc = crc_xor(ccrc, cmd8);
 
-    uint8_t b;
+    if (ring_buffer_count(rb) < blob.payload_size)
+    {
+        LOG_E(TAG, "Error popping payload with payload_size = %u, %u available", blob.payload_size, ring_buffer_count(rb));
+        return MSP_EOF;
+    }
+
+    // Checksum and copy the payload directly from the buffer
     unsigned ptr_pos = 0;
     uint8_t *ptr = payload;
-
-    for (int ii = 0; ii < blob.payload_size; ii++, ptr_pos++)
+    ring_buffer_span_t spans[RING_BUFFER_MAX_SPANS];
+    size_t ns = ring_buffer_peek_span(rb, spans);
+    size_t rem = blob.payload_size;
+    for (size_t ii = 0; ii < ns && rem > 0; ii++)
     {
-        if (!ring_buffer_pop(rb, &b))
-        {
-            LOG_E(TAG, "Error popping byte %d with payload_size = %u", ii, blob.payload_size);
-            return MSP_EOF;
-        }
-        ccrc = crc_xor(ccrc, b);
+        size_t n = MIN(spans[ii].count, rem);
+        ccrc ^= crc_xor_bytes(spans[ii].ptr, n);
         if (ptr_pos < size)
         {
-            ptr[ptr_pos] = b;
+            memcpy(&ptr[ptr_pos], spans[ii].ptr, MIN(n, size - ptr_pos));
         }
+        ptr_pos += n;
+        rem -= n;
     }
+    ring_buffer_consume(rb, blob.payload_size);
 
     // Read the checksum
     uint8_t crc;
@@ -247,14 +242,16 @@ static int msp_telemetry_write(msp_telemetry_t *tr, ring_buffer_t *rb, msp_direc
     const uint8_t *payload_ptr = payload;
     while (remaining > 1)
     {
-        if (!ring_buffer_push(rb, payload_ptr))
+        // Push as much as we can from the payload in the current chunk
+        size_t n = MIN(chunk_size, remaining - 1);
+        if (!ring_buffer_push_n(rb, payload_ptr, n))
         {
             return -1;
         }
-        crc = crc_xor(crc, *payload_ptr);
-        remaining--;
-        chunk_size--;
-        payload_ptr++;
+        crc ^= crc_xor_bytes(payload_ptr, n);
+        remaining -= n;
+        chunk_size -= n;
+        payload_ptr += n;
         if (chunk_size == 0)
         {
             // Push another chunk. We will always need at least
@@ -338,9 +335,11 @@ bool msp_telemetry_push_request_chunk(msp_telemetry_t *tr, const void *payload,
         return false;
     }
     size_t data_size = MIN(size, (unsigned)(tr->size - tr->recv));
-    for (size_t ii = 0; ii < data_size; ii++, ptr++)
+    if (!ring_buffer_push_n(&tr->req, ptr, data_size))
     {
-        ring_buffer_push(&tr->req, ptr);
+        LOG_W(TAG, "MSP request buffer full");
+        ring_buffer_empty(&tr->req);
+        return false;
     }
     tr->recv += data_size;
     if (tr->size == tr->recv)
@@ -362,13 +361,9 @@ size_t msp_telemetry_pop_response_chunk(msp_telemetry_t *tr, void *buf)
         resp_chunk->start = chunk.start ? 1 : 0;
         resp_chunk->error = 0;
         resp_chunk->reserved1 = 0;
-        uint8_t *ptr = resp_chunk->data;
-        for (int ii = 0; ii < chunk.size; ii++)
+        if (!msp_telemetry_pop_data(&tr->resp, resp_chunk->data, chunk.size))
         {
-            if (!ring_buffer_pop(&tr->resp, ptr++))
-            {
-                return 0;
-            }
+            return 0;
         }
         // Padding added by the caller if required
         return chunk.size + 1;
@@ -442,11 +437,14 @@ bool msp_telemetry_push_response_chunk(msp_telemetry_t *tr, const void *payload,
         tr->in_use_since = 0;
         return false;
     }
-    for (size_t ii = 0; ii < size && tr->recv < tr->size; ii++, tr->recv++, ptr++)
+    size_t data_size = MIN(size, (unsigned)(tr->size - tr->recv));
+    if (!ring_buffer_push_n(&tr->resp, ptr, data_size))
     {
-        LOG_D(TAG, "Push byte %u", *ptr);
-        ring_buffer_push(&tr->resp, ptr);
+        LOG_W(TAG, "MSP response buffer full");
+        tr->in_use_since = 0;
+        return false;
     }
+    tr->recv += data_size;
     if (tr->recv == tr->size)
     {
         tr->in_use_since = 0;
@@ -476,13 +474,9 @@ size_t msp_telemetry_pop_request_chunk(msp_telemetry_t *tr, void *buf)
     output_chunk->seq = tr->req_seq++;
     output_chunk->start = chunk.start;
     output_chunk->version = MSP_TELEMETRY_MSP_VERSION;
-    uint8_t *ptr = output_chunk->data;
-    for (unsigned ii = 0; ii < chunk.size; ii++, ptr++)
+    if (!msp_telemetry_pop_data(&tr->req, output_chunk->data, chunk.size))
     {
-        if (!ring_buffer_pop(&tr->req, ptr))
-        {
-            return 0;
-        }
+        return 0;
     }
     if (chunk.start)
     {
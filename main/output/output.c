@@ -362,6 +362,29 @@ bool output_open(rc_data_t *data, output_t *output, void *config)
     return is_open;
 }
 
+// Returns when the RC data needs to be sent to the output without new
+// data from the input, TIME_MICROS_MAX if it doesn't.
+static time_micros_t output_next_rc_update_at(output_t *output)
+{
+    time_micros_t at = TIME_MICROS_MAX;
+    if (OUTPUT_HAS_FLAG(output, OUTPUT_FLAG_REMOTE))
+    {
+        // Remote outputs schedule their own packets
+        return at;
+    }
+    if (output->next_rc_update_no_later_than != TIME_MICROS_MAX &&
+        !failsafe_is_active(output->rc_data->failsafe.input))
+    {
+        at = output->next_rc_update_no_later_than + 1;
+    }
+    if (rc_data_has_dirty_channels(output->rc_data))
+    {
+        // Sending was delayed by min_rc_update_interval
+        at = MIN(at, output->next_rc_update_no_earlier_than + 1);
+    }
+    return at;
+}
+
 bool output_update(output_t *output, bool input_was_updated, time_micros_t now)
 {
     bool updated = false;
@@ -387,10 +410,12 @@ bool output_update(output_t *output, bool input_was_updated, time_micros_t now)
                 rssi_channel->value = RC_CHANNEL_VALUE_FROM_PERCENTAGE(lq);
             }
         }
+        output->next_update_at = 0;
         updated = output->vtable.update(output, output->rc_data, update_rc, now);
         if (updated && update_rc)
         {
             rc_data_channels_sent(output->rc_data, now);
+            rc_trace_output(&output->rc_data->trace, now);
             output->next_rc_update_no_earlier_than = now + output->min_rc_update_interval;
             if (output->max_rc_update_interval > 0)
             {
@@ -419,10 +444,29 @@ bool output_update(output_t *output, bool input_was_updated, time_micros_t now)
             }
             msp_io_update(&output->msp);
         }
+        if (output->next_update_at > 0)
+        {
+            output->next_update_at = MIN(output->next_update_at, output_next_rc_update_at(output));
+            output->next_update_at = MIN(output->next_update_at, failsafe_next_update_at(&output->failsafe));
+            if (msp_io_is_connected(&output->msp) && !OUTPUT_HAS_FLAG(output, OUTPUT_FLAG_REMOTE))
+            {
+                // MSP polls are not scheduled
+                output->next_update_at = 0;
+            }
+        }
     }
     return updated;
 }
 
+time_micros_t output_next_update_at(const output_t *output)
+{
+    if (output && output->is_open)
+    {
+        return output->next_update_at;
+    }
+    return 0;
+}
+
 void output_close(output_t *output, void *config)
 {
     if (output && output->is_open && output->vtable.close)
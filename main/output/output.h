@@ -146,6 +146,13 @@ typedef struct output_s
     time_micros_t max_rc_update_interval;
     time_micros_t next_rc_update_no_earlier_than;
     time_micros_t next_rc_update_no_later_than;
+    // Set by update() to the latest time at which it needs to be called
+    // again if no events happen, like in input_t. 0 means the output
+    // needs to be polled continuously, which is the default. Only the
+    // air outputs set it. The serial ones (CRSF, SBUS, FPort, MSP) still
+    // poll, so an RX using them keeps the RC task busy even though their
+    // serial ports already signal the wakeup on received bytes.
+    time_micros_t next_update_at;
     const setting_t *craft_name_setting;
     output_flags_e flags;
     output_vtable_t vtable;
@@ -155,4 +162,7 @@ bool output_open(rc_data_t *data, output_t *output, void *config);
 // input_was_updated will be true iff the input returned new data
 // during this cycle.
 bool output_update(output_t *output, bool input_was_updated, time_micros_t now);
+// Returns the latest time at which output_update() needs to be called
+// again, 0 if it needs to be polled.
+time_micros_t output_next_update_at(const output_t *output);
 void output_close(output_t *output, void *config);
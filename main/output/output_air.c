@@ -1,3 +1,5 @@
+#include <string.h>
+
 #include <hal/log.h>
 
 #include "air/air_radio.h"
@@ -56,7 +58,8 @@ static void output_air_update_mode(output_air_t *output_air)
     air_radio_set_mode(radio, air_mode);
     output_air->air_modes.faster = air_mode_faster(air_mode, output_air->air_modes.common);
     output_air->air_modes.longer = air_mode_longer(air_mode, output_air->air_modes.common);
-    output_air->cycle_time = air_radio_cycle_time(radio, air_mode);
+    output_air->packet_layout = air_io_get_packet_layout(&output_air->air, radio, air_mode);
+    output_air->cycle_time = air_radio_cycle_time(radio, air_mode, output_air->packet_layout);
     output_air_invalidate_mode_sw(output_air);
     failsafe_set_max_interval(&output_air->output.failsafe, air_radio_tx_failsafe_interval(radio, air_mode));
 }
@@ -66,7 +69,7 @@ static void output_air_update_frequency(output_air_t *output_air, unsigned freq_
     if (output_air->freq_index != freq_index)
     {
         output_air->freq_index = freq_index;
-        air_radio_set_frequency(output_air->air_config.radio, output_air->air.freq_table.freqs[freq_index], 0);
+        air_radio_set_hop(output_air->air_config.radio, freq_index);
     }
 }
 
@@ -112,6 +115,7 @@ static void output_air_start(output_air_t *output_air)
     output_air->tx_power = -1;
     air_radio_set_sync_word(radio, air_sync_word(output_air->air.pairing.key));
     air_freq_table_init(&output_air->air.freq_table, output_air->air.pairing.key, center_freq);
+    air_freq_table_prepare_hops(&output_air->air.freq_table, radio);
     output_air->freq_index = 0xFF;
     output_air_update_frequency(output_air, 0);
     air_radio_set_callback(radio, output_air_radio_callback, output_air);
@@ -229,32 +233,38 @@ static void output_air_stream_cmd_decoded(void *user, air_cmd_e cmd, const void
     case AIR_CMD_RMP:
         rmp_air_decode(&output_air->rmp_air, data, size);
         break;
+    case AIR_CMD_RELIABLE_SEGMENT:
+    case AIR_CMD_RELIABLE_ACK:
+    case AIR_CMD_RELIABLE_SYN_ACK:
+    case AIR_CMD_TELEMETRY_ACK:
+        // Handled by air_stream_t
+        break;
     }
 }
 
-static size_t output_air_feed_stream(output_air_t *output_air, rc_data_t *data, unsigned cur_seq, time_micros_t now, size_t *count)
+static void output_air_feed_channel(output_air_t *output_air, rc_data_t *data, size_t offset, time_micros_t now)
 {
-    control_channel_t *dch = NULL;
-    unsigned dchn = 0;
-    telemetry_t *dt = NULL;
-    int dtidx = -1;
-    uint32_t max_score = 0;
-    // First, try to fill the buffer with dirty data
-    for (unsigned ii = 4; ii < data->channels_num; ii++)
+    bool packed = output_air->air.pairing_info.capabilities & AIR_CAP_STREAM_PACKED_CHANNELS;
+    uint32_t sent;
+    size_t n = air_stream_feed_output_unacked_channels(&output_air->air_stream, data->channels, data->channels_num, packed, &sent, now);
+    if (n > 0)
     {
-        control_channel_t *ch = &data->channels[ii];
-        if (data_state_is_ack_received(&ch->data_state))
+        int ack_at_seq = AIR_SEQ_TO_SEND(output_air->seq, offset + n, output_air->packet_layout->uplink_data_bytes);
+        for (unsigned ii = 4; ii < data->channels_num; ii++)
         {
-            continue;
-        }
-        uint32_t score = data_state_score(&ch->data_state, now);
-        if (score > max_score)
-        {
-            dch = ch;
-            dchn = ii;
-            max_score = score;
+            if (sent & (1 << ii))
+            {
+                data_state_sent(&data->channels[ii].data_state, ack_at_seq, now);
+            }
         }
     }
+}
+
+static void output_air_feed_telemetry(output_air_t *output_air, rc_data_t *data, size_t offset, time_micros_t now)
+{
+    telemetry_t *dt = NULL;
+    int dtidx = -1;
+    uint32_t max_score = 0;
     for (int ii = 0; ii < TELEMETRY_UPLINK_COUNT; ii++)
     {
         telemetry_t *t = &data->telemetry_uplink[ii];
@@ -269,36 +279,35 @@ static size_t output_air_feed_stream(output_air_t *output_air, rc_data_t *data,
         uint32_t score = data_state_score(&t->data_state, now);
         if (score > max_score)
         {
-            dch = NULL;
             dt = t;
             dtidx = ii;
             max_score = score;
         }
     }
-    if (dch)
-    {
-        size_t n = air_stream_feed_output_channel(&output_air->air_stream, dchn, dch->value);
-        *count += n;
-        data_state_sent(&dch->data_state, AIR_SEQ_TO_SEND_UPLINK(cur_seq, *count), now);
-        return n;
-    }
     if (dt)
     {
         size_t n = air_stream_feed_output_uplink_telemetry(&output_air->air_stream, dt, TELEMETRY_UPLINK_ID(dtidx));
-        *count += n;
-        data_state_sent(&dt->data_state, AIR_SEQ_TO_SEND_UPLINK(cur_seq, *count), now);
-        return n;
+        data_state_sent(&dt->data_state, AIR_SEQ_TO_SEND(output_air->seq, offset + n, output_air->packet_layout->uplink_data_bytes), now);
     }
-    // No data to send
-    return 0;
 }
 
-static void output_air_msp_before_feed(msp_air_t *msp_air, size_t size, void *user_data)
+static void output_air_stream_pull(void *user, air_stream_class_e cls, size_t offset, time_micros_t now)
 {
-    // Always feed one uplink channel or telemetry value after writing an MSP
-    // request, to prevent uplink starvation when too may MSP requests come
-    output_air_t *output_air = user_data;
-    output_air->force_stream_feed = true;
+    // Channels and telemetry are pulled right before they're sent, so
+    // we know in which packet they'll end for the ACK and we always
+    // send the most recent values.
+    output_air_t *output_air = user;
+    switch (cls)
+    {
+    case AIR_STREAM_CLASS_CHANNELS:
+        output_air_feed_channel(output_air, output_air->output.rc_data, offset, now);
+        break;
+    case AIR_STREAM_CLASS_TELEMETRY:
+        output_air_feed_telemetry(output_air, output_air->output.rc_data, offset, now);
+        break;
+    default:
+        break;
+    }
 }
 
 static void output_air_send_control_packet(output_air_t *output_air, rc_data_t *data, time_micros_t now)
@@ -351,43 +360,31 @@ static void output_air_send_control_packet(output_air_t *output_air, rc_data_t *
     {
         return;
     }
-    unsigned cur_seq = output_air->seq;
+    // Keep the cycle time, but drift towards the input frames if
+    // the input can't adjust its own timing to ours.
+    output_air->next_packet += rc_sync_output_packet(&data->sync, now, output_air->cycle_time);
     air_tx_packet_t pkt = {
-        .seq = output_air->seq++,
+        .seq = output_air->seq,
         .ch0 = CHANNEL_TO_AIR_OUTPUT(data->channels[0].value),
         .ch1 = CHANNEL_TO_AIR_OUTPUT(data->channels[1].value),
         .ch2 = CHANNEL_TO_AIR_OUTPUT(data->channels[2].value),
         .ch3 = CHANNEL_TO_AIR_OUTPUT(data->channels[3].value),
-        // We might have no data to send. This leaves the data
-        // stream ready to accept data.
-        .data = {AIR_DATA_START_STOP, AIR_DATA_START_STOP},
     };
-    // Check if we need to generate some data for other channels/telemetry
-    size_t count = air_stream_output_count(&output_air->air_stream);
-    if (output_air->force_stream_feed)
-    {
-        output_air->force_stream_feed = false;
-        output_air_feed_stream(output_air, data, cur_seq, now, &count);
-    }
-    while (count < sizeof(pkt.data))
-    {
-        size_t n = output_air_feed_stream(output_air, data, cur_seq, now, &count);
-        if (n == 0)
-        {
-            // No more data to send
-            break;
-        }
-    }
-    size_t p = 0;
-    uint8_t c;
-    // Check if we have buffered data to send
-    while (p < sizeof(pkt.data) && air_stream_pop_output(&output_air->air_stream, &c))
-    {
-        pkt.data[p++] = c;
-    }
-    air_tx_packet_prepare(&pkt, output_air->air.pairing.key);
-    air_radio_send(output_air->air_config.radio, &pkt, sizeof(pkt));
-    //LOG_BUFFER_I("RADIO-OUT", &pkt, sizeof(pkt));
+    const air_packet_layout_t *layout = output_air->packet_layout;
+    // We might have no data to send. This leaves the data
+    // stream ready to accept data.
+    memset(pkt.data, AIR_DATA_START_STOP, layout->uplink_data_bytes);
+    // Channels and telemetry are pulled by the stream as it fills the
+    // packet, see output_air_stream_pull(). They use the seq of this
+    // packet, so it's only incremented afterwards.
+    air_stream_pop_output_n(&output_air->air_stream, pkt.data, layout->uplink_data_bytes, now);
+    output_air->seq++;
+    air_tx_packet_prepare(&pkt, layout, output_air->air.pairing.key);
+    const uint16_t air_values[RC_TRACE_CHANNELS] = {pkt.ch0, pkt.ch1, pkt.ch2, pkt.ch3};
+    rc_trace_air_tx(&data->trace, pkt.seq, output_air->air_modes.current, air_values, now);
+    size_t size = air_tx_packet_size(layout);
+    air_radio_send(output_air->air_config.radio, &pkt, size);
+    //LOG_BUFFER_I("RADIO-OUT", &pkt, size);
 }
 
 static void output_air_recv_packet(output_air_t *output_air, rc_data_t *data, time_micros_t now)
@@ -396,19 +393,22 @@ static void output_air_recv_packet(output_air_t *output_air, rc_data_t *data, ti
     air_rx_packet_t in_pkt;
     int rssi, snr, lq;
 
-    if (air_radio_read(radio, &in_pkt, sizeof(in_pkt)) == sizeof(in_pkt))
+    const air_packet_layout_t *layout = output_air->packet_layout;
+    size_t size = air_rx_packet_size(layout);
+
+    if (air_radio_read(radio, &in_pkt, size) == size)
     {
-        //LOG_BUFFER_I("RADIO-IN", &in_pkt, sizeof(in_pkt));
-        if (air_rx_packet_validate(&in_pkt, output_air->air.pairing.key))
+        //LOG_BUFFER_I("RADIO-IN", &in_pkt, size);
+        if (air_rx_packet_validate(&in_pkt, layout, output_air->air.pairing.key))
         {
-            air_stream_feed_input(&output_air->air_stream, in_pkt.seq, in_pkt.data, sizeof(in_pkt.data), now);
+            air_stream_feed_input(&output_air->air_stream, in_pkt.seq, in_pkt.data, layout->downlink_data_bytes, now);
             rssi = air_radio_rssi(radio, &snr, &lq);
             air_io_update_rssi(&output_air->air, rssi, snr, lq, now);
             output_air->consecutive_downlink_lost_packets = 0;
             output_air->expecting_downlink_packet = false;
             output_air_update_frequency(output_air, output_air->seq);
             failsafe_reset_interval(&output_air->output.failsafe, now);
-            output_air->last_downlink_packet_at = now;
+            output_air->last_downlink_packet_at = air_radio_rx_done_at(radio);
 
             // XXX: This only works when ALL cycles have both uplink and downlink stages
             for (int ii = 0; ii < ARRAY_COUNT(data->channels); ii++)
@@ -457,13 +457,24 @@ static bool output_air_open(void *output, void *config)
     output_air_config_t *config_air = config;
     output_air->tx_power = config_air->tx_power;
     output_air->seq = 0;
-    output_air->force_stream_feed = false;
     output_air->next_packet = 0;
+    histogram_init(&output_air->send_jitter);
     output_air->state = OUTPUT_AIR_STATE_IDLE;
+    air_radio_set_fec_reed_solomon(output_air->air_config.radio, output_air->air.pairing_info.capabilities & AIR_CAP_FEC_REED_SOLOMON);
+    air_radio_set_fec_interleaving(output_air->air_config.radio, output_air->air.pairing_info.capabilities & AIR_CAP_FEC_INTERLEAVING);
+    air_radio_set_airtime_cycles(output_air->air_config.radio, output_air->air.pairing_info.capabilities & AIR_CAP_AIRTIME_CYCLES);
     output_air_start(output_air);
     air_stream_init(&output_air->air_stream, NULL,
-                    output_air_stream_telemetry_decoded, output_air_stream_cmd_decoded, output);
-    msp_air_init(&output_air->msp_air, &output_air->air_stream, output_air_msp_before_feed, output_air);
+                    output_air_stream_telemetry_decoded, output_air_stream_cmd_decoded,
+                    output_air_stream_pull, output);
+    air_stream_set_cobs(&output_air->air_stream, output_air->air.pairing_info.capabilities & AIR_CAP_STREAM_COBS);
+#if defined(USE_AIR_STREAM_RELIABLE)
+    air_stream_set_reliable(&output_air->air_stream, output_air->air.pairing_info.capabilities & AIR_CAP_STREAM_RELIABLE);
+#endif
+#if defined(USE_AIR_STREAM_TELEMETRY_DELTA)
+    air_stream_set_telemetry_delta(&output_air->air_stream, output_air->air.pairing_info.capabilities & AIR_CAP_STREAM_TELEMETRY_DELTA);
+#endif
+    msp_air_init(&output_air->msp_air, &output_air->air_stream);
     OUTPUT_SET_MSP_TRANSPORT(output_air, MSP_TRANSPORT(&output_air->msp_air));
     return true;
 }
@@ -476,6 +487,10 @@ static bool output_air_update(void *output, rc_data_t *data, bool update_rc, tim
     // else and start transmitting.
     if (now > output_air->next_packet)
     {
+        if (output_air->next_packet > 0)
+        {
+            histogram_add(&output_air->send_jitter, now - output_air->next_packet);
+        }
         output_air->state = OUTPUT_AIR_STATE_TX;
         output_air_send_control_packet(output_air, data, now);
 #ifdef AIR_DEBUG_CYCLE_TIME
@@ -499,7 +514,7 @@ static bool output_air_update(void *output, rc_data_t *data, bool update_rc, tim
         // payload size.
         air_radio_sleep(output_air->air_config.radio);
         // Enable RX mode
-        air_radio_set_payload_size(output_air->air_config.radio, sizeof(air_rx_packet_t));
+        air_radio_set_payload_size(output_air->air_config.radio, air_rx_packet_size(output_air->packet_layout));
         air_radio_start_rx(output_air->air_config.radio);
         output_air->state = OUTPUT_AIR_STATE_RX;
         break;
@@ -517,6 +532,10 @@ static bool output_air_update(void *output, rc_data_t *data, bool update_rc, tim
 #endif
         break;
     }
+    // Radio interrupts wake up the RC task when the state changes
+    // via output_air_radio_callback(), so we only need to run again
+    // for sending the next packet.
+    output_air->output.next_update_at = output_air->next_packet + 1;
     // Tell the output layer to not mess with the channel dirty states
     return false;
 }
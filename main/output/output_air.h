@@ -9,6 +9,7 @@
 
 #include "rmp/rmp_air.h"
 
+#include "util/histogram.h"
 #include "util/time.h"
 
 #include "msp/msp_air.h"
@@ -38,10 +39,11 @@ typedef struct output_air_s
             time_micros_t to_longer_scheduled_at;
         } sw; // Mode switching
     } air_modes;
-    bool force_stream_feed;
     time_micros_t last_downlink_packet_at;
     time_micros_t cycle_time;
+    const air_packet_layout_t *packet_layout;
     time_micros_t next_packet;
+    histogram_t send_jitter; // Delay from next_packet to actually sending it, in us
     int state;
     unsigned seq : AIR_SEQ_BITS;
     unsigned freq_index;
@@ -4,6 +4,8 @@
 
 #include "ui/led.h"
 
+#include "util/macros.h"
+
 #include "output_air_bind.h"
 
 static const char *TAG = "Output.Air.Bind";
@@ -76,6 +78,12 @@ static bool output_air_bind_update(void *data, rc_data_t *rc_data, bool update_r
             }
         }
     }
+    // TX and RX done wake us up, the rest is on a timer
+    output->output.next_update_at = output->next_bind_offer + 1;
+    if (output->bind_packet_expires > now)
+    {
+        output->output.next_update_at = MIN(output->output.next_update_at, output->bind_packet_expires);
+    }
     return false;
 }
 
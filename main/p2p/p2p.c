@@ -16,7 +16,7 @@ typedef struct p2p_rmp_hdr_s
     air_addr_t dst;
     uint8_t dst_port;
     uint8_t payload_size;
-    uint8_t has_signature;
+    uint8_t has_signature; // 0 for unsigned messages, rmp_signature_e otherwise
 } PACKED p2p_rmp_hdr_t;
 
 typedef struct p2p_rmp_msg_s
@@ -45,6 +45,7 @@ static bool p2p_decode_rmp(rmp_msg_t *msg, const void *data, size_t size)
         msg->dst_port = hdr->dst_port;
         msg->payload_size = hdr->payload_size;
         msg->has_signature = hdr->has_signature ? true : false;
+        msg->signature_type = hdr->has_signature;
         const uint8_t *ptr = ((const uint8_t *)data) + sizeof(*hdr);
         if (hdr->payload_size > 0)
         {
@@ -79,7 +80,7 @@ static int p2p_encode_rmp(rmp_msg_t *msg, void *data, size_t size)
     hdr->dst = msg->dst;
     hdr->dst_port = msg->dst_port;
     hdr->payload_size = msg->payload_size;
-    hdr->has_signature = msg->has_signature ? 1 : 0;
+    hdr->has_signature = msg->has_signature ? msg->signature_type : 0;
     uint8_t *ptr = data;
     ptr += sizeof(*hdr);
     if (msg->payload)
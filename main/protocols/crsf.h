@@ -38,6 +38,8 @@
 #define CRSF_DEC_U24(x) (CRSF_DEC_U32((uint32_t)x << 8))
 #define CRSF_DEC_U32(x) ((uint32_t)__builtin_bswap32(x))
 #define CRSF_DEC_I32(x) ((int32_t)CRSF_DEC_U32(x))
+#define CRSF_ENC_U32(x) ((uint32_t)__builtin_bswap32(x))
+#define CRSF_ENC_I32(x) ((int32_t)CRSF_ENC_U32(x))
 
 #define CRSF_MSP_REQ_PAYLOAD_SIZE 8
 #define CRSF_MSP_RESP_PAYLOAD_SIZE 58
@@ -58,6 +60,7 @@ typedef enum
     CRSF_FRAMETYPE_PARAMETER_READ = 0x2C,
     CRSF_FRAMETYPE_PARAMETER_WRITE = 0x2D,
     CRSF_FRAMETYPE_COMMAND = 0x32,
+    CRSF_FRAMETYPE_RADIO_ID = 0x3A,
     // MSP commands
     CRSF_FRAMETYPE_MSP_REQ = 0x7A,   // response request using msp sequence as command
     CRSF_FRAMETYPE_MSP_RESP = 0x7B,  // reply with 58 byte chunked binary
@@ -277,6 +280,18 @@ typedef struct crsf_parameter_write_s
     } payload;
 } PACKED crsf_parameter_write_t;
 
+#define CRSF_SUBCOMMAND_OPENTX_SYNC 0x10
+
+// Sent to the radio in a CRSF_FRAMETYPE_RADIO_ID frame to adjust the
+// timing of its channel frames. OpenTX sends its frames every rate and
+// shifts them until offset matches its own target lag.
+typedef struct crsf_opentx_sync_s
+{
+    uint8_t subcommand; // CRSF_SUBCOMMAND_OPENTX_SYNC
+    uint32_t rate;      // Interval between frames, in 0.1us units
+    int32_t offset;     // Time from the last frame to its use, in 0.1us units
+} PACKED crsf_opentx_sync_t;
+
 typedef struct crsf_ext_frame_s
 {
     crsf_ext_header_t header;
@@ -289,6 +304,7 @@ typedef struct crsf_ext_frame_s
         crsf_parameter_read_t parameter_read;
         crsf_settings_entry_t settings_entry;
         crsf_parameter_write_t parameter_write;
+        crsf_opentx_sync_t opentx_sync;
     };
     // Used to guarantee we have space to write the CRC in crsf_port_write
     uint8_t crc_pad;
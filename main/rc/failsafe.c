@@ -86,4 +86,13 @@ void failsafe_update(failsafe_t *fs, time_micros_t now)
 bool failsafe_is_active(const failsafe_t *fs)
 {
     return fs && fs->active_since > 0;
-}
\ No newline at end of file
+}
+
+time_micros_t failsafe_next_update_at(const failsafe_t *fs)
+{
+    if (failsafe_is_active(fs) || fs->enable_at == TIME_MICROS_MAX)
+    {
+        return TIME_MICROS_MAX;
+    }
+    return fs->enable_at + 1;
+}
@@ -28,4 +28,7 @@ void failsafe_init(failsafe_t *fs);
 void failsafe_set_max_interval(failsafe_t *fs, time_micros_t interval);
 void failsafe_reset_interval(failsafe_t *fs, time_micros_t now);
 void failsafe_update(failsafe_t *fs, time_micros_t now);
-bool failsafe_is_active(const failsafe_t *fs);
\ No newline at end of file
+bool failsafe_is_active(const failsafe_t *fs);
+// Returns the time at which failsafe_update() needs to be called for
+// the failsafe to become active, TIME_MICROS_MAX if there's no need.
+time_micros_t failsafe_next_update_at(const failsafe_t *fs);
\ No newline at end of file
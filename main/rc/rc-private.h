@@ -1,11 +1,25 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stddef.h>
+
 #include "air/air_band.h"
 #include "air/air_mode.h"
 
 typedef struct air_addr_s air_addr_t;
 typedef struct air_config_s air_config_t;
 typedef struct rc_s rc_t;
+typedef struct rmp_port_s rmp_port_t;
 
+// Returns true iff called from the task running rc_update()
+bool rc_is_rc_task(const rc_t *rc);
 void rc_get_air_config(rc_t *rc, air_config_t *air_config);
 void rc_set_peer_air_config(rc_t *rc, air_addr_t *addr, air_band_e band, air_supported_modes_e modes);
+// Like rmp_send(), but when called from the RC task the message is
+// passed to the RMP task to be sent. Returns true iff the message was
+// sent or queued.
+bool rc_send_rmp_message(rc_t *rc, const rmp_port_t *port, const air_addr_t *dst, int dst_port, const void *payload, size_t size);
+// Passes a message received on RMP_PORT_RC by another task to the RC
+// task, which handles it with rc_rmp_handle_message(). Returns true iff
+// the message was queued.
+bool rc_send_rmp_rc_message(rc_t *rc, const air_addr_t *src, const void *payload, size_t size);
@@ -5,6 +5,7 @@
 #include <hal/log.h>
 
 #include "air/air.h"
+#include "air/air_radio.h"
 #include "air/air_rf_power.h"
 
 #include "config/config.h"
@@ -24,6 +25,7 @@
 #include "util/crc.h"
 #include "util/lpf.h"
 #include "util/macros.h"
+#include "util/wakeup.h"
 
 #include "rc.h"
 
@@ -33,6 +35,24 @@ static const char *TAG = "RC";
 static bool custom_failsafe_warning_logged = false;
 #endif
 
+// Interval for logging the latency statistics of this end
+#define RC_TRACE_LOG_INTERVAL_US SECS_TO_MICROS(10)
+// Interval for logging the link statistics, see rc_log_link_stats()
+#define RC_LINK_STATS_LOG_INTERVAL_US SECS_TO_MICROS(10)
+
+#if defined(USE_RC_PROFILER)
+#define RC_PROFILER_LOG_INTERVAL_US SECS_TO_MICROS(10)
+#define RC_PROFILER_BEGIN(rc) rc_profiler_begin(&(rc)->state.profiler)
+#define RC_PROFILER_BEGIN_PHASE(rc) rc_profiler_begin_phase(&(rc)->state.profiler)
+#define RC_PROFILER_END_PHASE(rc, phase) rc_profiler_end_phase(&(rc)->state.profiler, RC_PROFILER_SLOT_##phase)
+#define RC_PROFILER_END(rc) rc_profiler_end(&(rc)->state.profiler)
+#else
+#define RC_PROFILER_BEGIN(rc)
+#define RC_PROFILER_BEGIN_PHASE(rc)
+#define RC_PROFILER_END_PHASE(rc, phase)
+#define RC_PROFILER_END(rc)
+#endif
+
 #define GET_AIR_IO_FILTERED_FIELD(rc, field) ({ \
     air_io_t *__air_io = rc_get_air_io(rc);     \
     __air_io ? lpf_value(&__air_io->field) : 0; \
@@ -45,6 +65,49 @@ typedef struct rc_rmp_msp_s
     uint8_t payload[512];
 } PACKED rc_rmp_msp_t;
 
+typedef enum
+{
+    RC_MSG_SETTING_CHANGED,
+    RC_MSG_RMP_MSP_REQUEST,
+    RC_MSG_RMP_AIR,
+    RC_MSG_RMP_RC,
+} rc_msg_type_e;
+
+// Messages sent to the RC task via rc->state.to_rc
+typedef struct rc_msg_s
+{
+    uint8_t type; // From rc_msg_type_e
+    union {
+        const setting_t *setting;
+        struct
+        {
+            air_addr_t src;
+            uint8_t src_port;
+            rc_rmp_msp_t msp; // Truncated to its payload_size
+        } msp_request;
+        struct
+        {
+            rmp_msg_t msg; // Followed by the payload
+        } rmp_air;
+        struct
+        {
+            air_addr_t src;
+            rc_rmp_msg_t msg; // Truncated to the received size
+        } rmp_rc;
+    };
+} rc_msg_t;
+
+_Static_assert(sizeof(rc_msg_t) + SPSC_QUEUE_MESSAGE_OVERHEAD <= RC_QUEUE_SIZE, "RC_QUEUE_SIZE can't fit an MSP message");
+
+// Messages sent by the RC task via rc->state.from_rc, see rc_update_rmp()
+typedef struct rc_rmp_send_msg_s
+{
+    const rmp_port_t *port;
+    air_addr_t dst;
+    uint8_t dst_port;
+    uint8_t payload[];
+} rc_rmp_send_msg_t;
+
 static void rc_update_tx_pilot_name(rc_t *rc, time_micros_t now)
 {
     char buf[AIR_MAX_NAME_LENGTH + 1];
@@ -86,6 +149,7 @@ static void rc_update_tx_rf_power(rc_t *rc)
     // it and change it in the main RC loop.
     rc->state.tx_rf_power = power;
     (void)TELEMETRY_SET_I8(&rc->data, TELEMETRY_ID_TX_RF_POWER, power, time_micros_now());
+    wakeup_signal();
 }
 
 // Initialize local telemetry values
@@ -296,6 +360,28 @@ void rc_set_peer_air_config(rc_t *rc, air_addr_t *addr, air_band_e band, air_sup
     }
 }
 
+// All the implementations share the same address in rc->inputs and
+// rc->outputs, so the profiler slot must be provided by the caller.
+static void rc_set_input(rc_t *rc, input_t *input, rc_profiler_slot_e slot)
+{
+    rc->input = input;
+#if defined(USE_RC_PROFILER)
+    rc_profiler_set_input(&rc->state.profiler, slot);
+#else
+    UNUSED(slot);
+#endif
+}
+
+static void rc_set_output(rc_t *rc, output_t *output, rc_profiler_slot_e slot)
+{
+    rc->output = output;
+#if defined(USE_RC_PROFILER)
+    rc_profiler_set_output(&rc->state.profiler, slot);
+#else
+    UNUSED(slot);
+#endif
+}
+
 static void rc_reconfigure_input(rc_t *rc)
 {
     LOG_I(TAG, "Reconfigure input");
@@ -308,7 +394,7 @@ static void rc_reconfigure_input(rc_t *rc)
     if (rc->input != NULL)
     {
         input_close(rc->input, rc->input_config);
-        rc->input = NULL;
+        rc_set_input(rc, NULL, RC_PROFILER_SLOT_COUNT);
         rc->data.failsafe.input = NULL;
         rc->input_config = NULL;
     }
@@ -320,31 +406,31 @@ static void rc_reconfigure_input(rc_t *rc)
         {
         case TX_INPUT_CRSF:
             input_crsf_init(&rc->inputs.crsf);
-            rc->input = (input_t *)&rc->inputs.crsf;
+            rc_set_input(rc, (input_t *)&rc->inputs.crsf, RC_PROFILER_SLOT_INPUT_CRSF);
             input_config.crsf.gpio = gpio_get_by_tag(GPIO_TAG_INPUT_BIDIR);
             rc->input_config = &input_config.crsf;
             break;
         case TX_INPUT_PPM:
             input_ppm_init(&rc->inputs.ppm);
-            rc->input = (input_t *)&rc->inputs.ppm;
+            rc_set_input(rc, (input_t *)&rc->inputs.ppm, RC_PROFILER_SLOT_INPUT_PPM);
             input_config.ppm.gpio = gpio_get_by_tag(GPIO_TAG_INPUT_RX);
             rc->input_config = &input_config.ppm;
             break;
         case TX_INPUT_IBUS:
             input_ibus_init(&rc->inputs.ibus);
-            rc->input = (input_t *)&rc->inputs.ibus;
+            rc_set_input(rc, (input_t *)&rc->inputs.ibus, RC_PROFILER_SLOT_INPUT_IBUS);
             input_config.ibus.gpio = gpio_get_by_tag(GPIO_TAG_INPUT_RX);
             rc->input_config = &input_config.ibus;
             break;
         case TX_INPUT_SBUS:
             input_sbus_init(&rc->inputs.sbus);
-            rc->input = (input_t *)&rc->inputs.sbus;
+            rc_set_input(rc, (input_t *)&rc->inputs.sbus, RC_PROFILER_SLOT_INPUT_SBUS);
             input_config.sbus.rx = gpio_get_by_tag(GPIO_TAG_INPUT_RX);
             rc->input_config = &input_config.sbus;
             break;
         case TX_INPUT_FAKE:
             input_fake_init(&rc->inputs.fake);
-            rc->input = (input_t *)&rc->inputs.fake;
+            rc_set_input(rc, (input_t *)&rc->inputs.fake, RC_PROFILER_SLOT_INPUT_FAKE);
             rc->input_config = NULL;
             break;
         }
@@ -360,7 +446,7 @@ static void rc_reconfigure_input(rc_t *rc)
 #if defined(CONFIG_RAVEN_FAKE_INPUT)
         input_fake_init(&rc->inputs.fake);
         rc->inputs.fake.update_interval = FREQ_TO_MICROS(100);
-        rc->input = (input_t *)&rc->inputs.fake;
+        rc_set_input(rc, (input_t *)&rc->inputs.fake, RC_PROFILER_SLOT_INPUT_FAKE);
         rc->input_config = NULL;
 #else
         air_pairing_t pairing;
@@ -371,12 +457,13 @@ static void rc_reconfigure_input(rc_t *rc)
         if (rc->state.bind_active)
         {
             input_air_bind_init(&rc->inputs.air_bind, config_get_addr(), &air_config);
-            rc->input = (input_t *)&rc->inputs.air_bind;
+            rc_set_input(rc, (input_t *)&rc->inputs.air_bind, RC_PROFILER_SLOT_INPUT_AIR_BIND);
         }
         else
         {
             input_air_init(&rc->inputs.air, config_get_addr(), &air_config, rc->rmp);
-            rc->input = (input_t *)&rc->inputs.air;
+            rc->inputs.air.cad_enabled = settings_get_key_bool(SETTING_KEY_RX_EARLY_LOSS_DETECTION);
+            rc_set_input(rc, (input_t *)&rc->inputs.air, RC_PROFILER_SLOT_INPUT_AIR);
             if (config_get_paired_tx(&pairing))
             {
                 air_io_bind(&rc->inputs.air.air, &pairing);
@@ -418,7 +505,7 @@ static void rc_reconfigure_output(rc_t *rc)
     if (rc->output != NULL)
     {
         output_close(rc->output, rc->output_config);
-        rc->output = NULL;
+        rc_set_output(rc, NULL, RC_PROFILER_SLOT_COUNT);
         rc->data.failsafe.output = NULL;
         rc->output_config = NULL;
     }
@@ -435,19 +522,19 @@ static void rc_reconfigure_output(rc_t *rc)
         if (rc_should_enable_power_test(rc))
         {
             output_air_rf_power_test_init(&rc->outputs.air_power_test, &air_config);
-            rc->output = (output_t *)&rc->outputs.air_power_test;
+            rc_set_output(rc, (output_t *)&rc->outputs.air_power_test, RC_PROFILER_SLOT_OUTPUT_AIR_POWER_TEST);
             break;
         }
 
         if (rc->state.bind_active)
         {
             output_air_bind_init(&rc->outputs.air_bind, config_get_addr(), &air_config);
-            rc->output = (output_t *)&rc->outputs.air_bind;
+            rc_set_output(rc, (output_t *)&rc->outputs.air_bind, RC_PROFILER_SLOT_OUTPUT_AIR_BIND);
             break;
         }
 
         output_air_init(&rc->outputs.air, config_get_addr(), &air_config, rc->rmp);
-        rc->output = (output_t *)&rc->outputs.air;
+        rc_set_output(rc, (output_t *)&rc->outputs.air, RC_PROFILER_SLOT_OUTPUT_AIR);
         output_config.air.tx_power = rc_get_tx_rf_power(rc);
         if (config_get_paired_rx(&pairing, NULL))
         {
@@ -464,7 +551,7 @@ static void rc_reconfigure_output(rc_t *rc)
         {
             rc_get_air_config(rc, &air_config);
             output_air_rf_power_test_init(&rc->outputs.air_power_test, &air_config);
-            rc->output = (output_t *)&rc->outputs.air_power_test;
+            rc_set_output(rc, (output_t *)&rc->outputs.air_power_test, RC_PROFILER_SLOT_OUTPUT_AIR_POWER_TEST);
             break;
         }
 
@@ -472,7 +559,7 @@ static void rc_reconfigure_output(rc_t *rc)
         {
         case RX_OUTPUT_MSP:
             output_msp_init(&rc->outputs.msp);
-            rc->output = (output_t *)&rc->outputs.msp;
+            rc_set_output(rc, (output_t *)&rc->outputs.msp, RC_PROFILER_SLOT_OUTPUT_MSP);
             output_config.msp.tx = gpio_get_by_tag(GPIO_TAG_OUTPUT_TX);
             output_config.msp.rx = gpio_get_by_tag(GPIO_TAG_OUTPUT_RX);
             output_config.msp.baud_rate = settings_get_key_u8(SETTING_KEY_RX_MSP_BAUDRATE);
@@ -480,7 +567,7 @@ static void rc_reconfigure_output(rc_t *rc)
             break;
         case RX_OUTPUT_CRSF:
             output_crsf_init(&rc->outputs.crsf);
-            rc->output = (output_t *)&rc->outputs.crsf;
+            rc_set_output(rc, (output_t *)&rc->outputs.crsf, RC_PROFILER_SLOT_OUTPUT_CRSF);
             output_config.crsf.tx = gpio_get_by_tag(GPIO_TAG_OUTPUT_TX);
             output_config.crsf.rx = gpio_get_by_tag(GPIO_TAG_OUTPUT_RX);
             output_config.crsf.inverted = false;
@@ -488,7 +575,7 @@ static void rc_reconfigure_output(rc_t *rc)
             break;
         case RX_OUTPUT_FPORT:
             output_fport_init(&rc->outputs.fport);
-            rc->output = (output_t *)&rc->outputs.fport;
+            rc_set_output(rc, (output_t *)&rc->outputs.fport, RC_PROFILER_SLOT_OUTPUT_FPORT);
             // Nothing expects full duplex FPort right now, so
             // we only support it as half duplex although the driver
             // is capable of both.
@@ -499,7 +586,7 @@ static void rc_reconfigure_output(rc_t *rc)
             break;
         case RX_OUTPUT_SBUS_SPORT:
             output_sbus_init(&rc->outputs.sbus);
-            rc->output = (output_t *)&rc->outputs.sbus;
+            rc_set_output(rc, (output_t *)&rc->outputs.sbus, RC_PROFILER_SLOT_OUTPUT_SBUS);
             output_config.sbus.sbus = gpio_get_by_tag(GPIO_TAG_OUTPUT_TX);
             output_config.sbus.sbus_inverted = settings_get_key_bool(SETTING_KEY_RX_SBUS_INVERTED);
             // TODO: This doesn't work on hardware that doesn't allow
@@ -510,7 +597,7 @@ static void rc_reconfigure_output(rc_t *rc)
             break;
         case RX_OUTPUT_NONE:
             output_none_init(&rc->outputs.none);
-            rc->output = (output_t *)&rc->outputs.none;
+            rc_set_output(rc, (output_t *)&rc->outputs.none, RC_PROFILER_SLOT_OUTPUT_NONE);
             break;
         }
 
@@ -610,9 +697,59 @@ static void rc_rssi_update(rc_t *rc)
     }
 }
 
-bool rc_send_rmp(rmp_t *rmp, rmp_msg_t *msg, void *user_data)
+bool rc_is_rc_task(const rc_t *rc)
+{
+    return rc->state.task == xTaskGetCurrentTaskHandle();
+}
+
+// Other tasks might send messages to the RC task at the same time, so
+// each one produces to its own queue, claimed by its first message.
+static spsc_queue_t *rc_get_producer_queue(rc_t *rc)
+{
+    TaskHandle_t task = xTaskGetCurrentTaskHandle();
+    for (int ii = 0; ii < ARRAY_COUNT(rc->state.to_rc); ii++)
+    {
+        rc_producer_queue_t *q = &rc->state.to_rc[ii];
+        TaskHandle_t owner = __atomic_load_n(&q->task, __ATOMIC_ACQUIRE);
+        if (!owner && __atomic_compare_exchange_n(&q->task, &owner, task, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        {
+            return &q->queue;
+        }
+        // If the claim failed, owner is the task that won it
+        if (owner == task)
+        {
+            return &q->queue;
+        }
+    }
+    return NULL;
+}
+
+static void *rc_reserve_msg(rc_t *rc, rc_msg_type_e type, size_t size, spsc_queue_t **queue)
+{
+    *queue = rc_get_producer_queue(rc);
+    if (!*queue)
+    {
+        LOG_W(TAG, "Too many tasks sending to RC, dropping message of type %d", type);
+        return NULL;
+    }
+    rc_msg_t *msg = spsc_queue_reserve(*queue, size);
+    if (!msg)
+    {
+        LOG_W(TAG, "Queue to RC full, dropping message of type %d", type);
+        return NULL;
+    }
+    msg->type = type;
+    return msg;
+}
+
+static void rc_commit_msg(spsc_queue_t *queue)
+{
+    spsc_queue_commit(queue);
+    wakeup_signal();
+}
+
+static bool rc_encode_rmp_air(rc_t *rc, rmp_msg_t *msg)
 {
-    rc_t *rc = user_data;
     air_io_t *air_io = rc_get_air_io(rc);
     if (air_io)
     {
@@ -625,6 +762,72 @@ bool rc_send_rmp(rmp_t *rmp, rmp_msg_t *msg, void *user_data)
     return false;
 }
 
+bool rc_send_rmp(rmp_t *rmp, rmp_msg_t *msg, void *user_data)
+{
+    rc_t *rc = user_data;
+    if (rc_is_rc_task(rc))
+    {
+        return rc_encode_rmp_air(rc, msg);
+    }
+    // The air stream belongs to the RC task, pass a copy
+    spsc_queue_t *queue;
+    rc_msg_t *rc_msg = rc_reserve_msg(rc, RC_MSG_RMP_AIR, offsetof(rc_msg_t, rmp_air.msg) + sizeof(*msg) + msg->payload_size, &queue);
+    if (!rc_msg)
+    {
+        return false;
+    }
+    rc_msg->rmp_air.msg = *msg;
+    rc_msg->rmp_air.msg.payload = NULL;
+    if (msg->payload_size > 0)
+    {
+        memcpy(&rc_msg->rmp_air.msg + 1, msg->payload, msg->payload_size);
+    }
+    rc_commit_msg(queue);
+    return true;
+}
+
+bool rc_send_rmp_rc_message(rc_t *rc, const air_addr_t *src, const void *payload, size_t size)
+{
+    if (size > sizeof(rc_rmp_msg_t))
+    {
+        return false;
+    }
+    spsc_queue_t *queue;
+    rc_msg_t *msg = rc_reserve_msg(rc, RC_MSG_RMP_RC, offsetof(rc_msg_t, rmp_rc.msg) + size, &queue);
+    if (!msg)
+    {
+        return false;
+    }
+    air_addr_cpy(&msg->rmp_rc.src, src);
+    memcpy(&msg->rmp_rc.msg, payload, size);
+    rc_commit_msg(queue);
+    return true;
+}
+
+bool rc_send_rmp_message(rc_t *rc, const rmp_port_t *port, const air_addr_t *dst, int dst_port, const void *payload, size_t size)
+{
+    if (!rc_is_rc_task(rc))
+    {
+        return rmp_send(rc->rmp, port, dst, dst_port, payload, size);
+    }
+    // RMP belongs to the task calling rmp_update(), pass a copy
+    rc_rmp_send_msg_t *msg = spsc_queue_reserve(&rc->state.from_rc, sizeof(*msg) + size);
+    if (!msg)
+    {
+        LOG_W(TAG, "Queue from RC full, dropping RMP message to port %d", dst_port);
+        return false;
+    }
+    msg->port = port;
+    msg->dst = dst ? *dst : *AIR_ADDR_BROADCAST;
+    msg->dst_port = dst_port;
+    if (size > 0)
+    {
+        memcpy(msg->payload, payload, size);
+    }
+    spsc_queue_commit(&rc->state.from_rc);
+    return true;
+}
+
 static bool rc_rmp_msp_validate(rmp_req_t *req)
 {
     if (req->is_authenticated)
@@ -675,8 +878,8 @@ static void rc_rmp_free_resp_ctx(rc_rmp_resp_ctx_t *ctx)
 // Handle the MSP response from an MSP request originated via RMP
 static void rc_rmp_msp_request_response_handler(msp_conn_t *conn, uint16_t cmd, const void *payload, int size, void *callback_data)
 {
-    // Note that this callback will run on core 1, while RMP runs
-    // on core 0, so we need some synchronization. TODO: Locking
+    // Runs on the RC task, rc_send_rmp_message() passes the
+    // response to the RMP task.
     rc_rmp_resp_ctx_t *ctx = callback_data;
     rc_rmp_msp_t resp = {
         .cmd = cmd,
@@ -685,26 +888,17 @@ static void rc_rmp_msp_request_response_handler(msp_conn_t *conn, uint16_t cmd,
     size_t cpy_size = MIN((unsigned)MAX(size, 0), sizeof(resp.payload));
     memcpy(resp.payload, payload, cpy_size);
     size_t rmp_payload_size = sizeof(resp) - sizeof(resp.payload) + cpy_size;
-    rmp_send(ctx->rc->rmp, ctx->rc->state.msp_recv_port, &ctx->dst, ctx->dst_port, &resp, rmp_payload_size);
+    rc_send_rmp_message(ctx->rc, ctx->rc->state.msp_recv_port, &ctx->dst, ctx->dst_port, &resp, rmp_payload_size);
     rc_rmp_free_resp_ctx(ctx);
 }
 
-// Handle an MSP request from RMP and forward it to the output's MSP
-static void rc_rmp_msp_request_handler(rmp_t *rmp, rmp_req_t *req, void *user_data)
+// Forwards an MSP request received via RMP to the output's MSP. Must
+// be called from the RC task.
+static void rc_rmp_msp_send_request(rc_t *rc, const air_addr_t *src, uint8_t src_port, const rc_rmp_msp_t *msp_req)
 {
-    // Note that typically this will be run on core 0, while the RC
-    // pipeline runs on core 1. TODO: Add locking
-    rc_t *rc = user_data;
-
-    // Got an MSP request from the TX via RMP
-    if (rc_get_mode(rc) != RC_MODE_RX || !rc_rmp_msp_validate(req))
-    {
-        return;
-    }
-    msp_conn_t *request_output = msp_io_get_conn(&rc->output->msp);
+    msp_conn_t *request_output = rc->output ? msp_io_get_conn(&rc->output->msp) : NULL;
     if (request_output)
     {
-        const rc_rmp_msp_t *msp_req = req->msg->payload;
         rc_rmp_resp_ctx_t *ctx = rc_rmp_alloc_resp_ctx(rc);
         if (!ctx)
         {
@@ -712,13 +906,42 @@ static void rc_rmp_msp_request_handler(rmp_t *rmp, rmp_req_t *req, void *user_da
             return;
         }
         ctx->rc = rc;
-        air_addr_cpy(&ctx->dst, &req->msg->src);
-        ctx->dst_port = req->msg->src_port;
+        air_addr_cpy(&ctx->dst, src);
+        ctx->dst_port = src_port;
         msp_conn_send(request_output, msp_req->cmd, msp_req->payload, msp_req->payload_size,
                       rc_rmp_msp_request_response_handler, ctx);
     }
 }
 
+// Handle an MSP request from RMP and forward it to the output's MSP
+static void rc_rmp_msp_request_handler(rmp_t *rmp, rmp_req_t *req, void *user_data)
+{
+    // Runs on the task which received the message: the RC task
+    // for messages received over the air, another one for P2P.
+    rc_t *rc = user_data;
+
+    // Got an MSP request from the TX via RMP
+    if (rc_get_mode(rc) != RC_MODE_RX || !rc_rmp_msp_validate(req))
+    {
+        return;
+    }
+    const rc_rmp_msp_t *msp_req = req->msg->payload;
+    if (rc_is_rc_task(rc))
+    {
+        rc_rmp_msp_send_request(rc, &req->msg->src, req->msg->src_port, msp_req);
+        return;
+    }
+    spsc_queue_t *queue;
+    rc_msg_t *msg = rc_reserve_msg(rc, RC_MSG_RMP_MSP_REQUEST, offsetof(rc_msg_t, msp_request.msp) + req->msg->payload_size, &queue);
+    if (msg)
+    {
+        air_addr_cpy(&msg->msp_request.src, &req->msg->src);
+        msg->msp_request.src_port = req->msg->src_port;
+        memcpy(&msg->msp_request.msp, msp_req, req->msg->payload_size);
+        rc_commit_msg(queue);
+    }
+}
+
 static void rc_rmp_msp_response_handler(rmp_t *rmp, rmp_req_t *req, void *user_data)
 {
     // Got an MSP response from RX via RMP
@@ -799,7 +1022,7 @@ static void rc_msp_request_callback(msp_conn_t *conn, uint16_t cmd, const void *
                 size_t cpy_size = MIN((unsigned)MAX(0, size), sizeof(req.payload));
                 memcpy(req.payload, payload, cpy_size);
                 size_t rmp_payload_size = sizeof(req) - sizeof(req.payload) + cpy_size;
-                if (rmp_send(rc->rmp, port, &pair_addr, RMP_PORT_MSP, &req, rmp_payload_size))
+                if (rc_send_rmp_message(rc, port, &pair_addr, RMP_PORT_MSP, &req, rmp_payload_size))
                 {
                     return;
                 }
@@ -826,10 +1049,8 @@ static void rc_send_air_config_to_pair(rc_t *rc)
     }
 }
 
-static void rc_setting_changed(const setting_t *setting, void *user_data)
+static void rc_handle_setting_changed(rc_t *rc, const setting_t *setting)
 {
-    rc_t *rc = user_data;
-
     if (SETTING_IS(setting, SETTING_KEY_RC_MODE))
     {
         // Reboot after 500ms to allow the setting to be written
@@ -838,6 +1059,7 @@ static void rc_setting_changed(const setting_t *setting, void *user_data)
     else if (SETTING_IS(setting, SETTING_KEY_BIND))
     {
         rc->state.bind_requested = setting_get_bool(setting);
+        wakeup_signal();
     }
     else if (SETTING_IS(setting, SETTING_KEY_AIR_BAND))
     {
@@ -920,6 +1142,10 @@ static void rc_setting_changed(const setting_t *setting, void *user_data)
                 rc_send_air_config_to_pair(rc);
                 rc_invalidate_input(rc);
             }
+            if (SETTING_IS(setting, SETTING_KEY_RX_EARLY_LOSS_DETECTION))
+            {
+                rc_invalidate_input(rc);
+            }
 #if defined(CONFIG_RAVEN_USE_PWM_OUTPUTS)
             if (SETTING_IS_FROM_FOLDER(setting, SETTING_KEY_RX_CHANNEL_OUTPUTS))
             {
@@ -935,6 +1161,67 @@ static void rc_setting_changed(const setting_t *setting, void *user_data)
     }
 }
 
+static void rc_setting_changed(const setting_t *setting, void *user_data)
+{
+    rc_t *rc = user_data;
+    if (rc_is_rc_task(rc))
+    {
+        rc_handle_setting_changed(rc, setting);
+        return;
+    }
+    spsc_queue_t *queue;
+    rc_msg_t *msg = rc_reserve_msg(rc, RC_MSG_SETTING_CHANGED, offsetof(rc_msg_t, setting) + sizeof(msg->setting), &queue);
+    if (msg)
+    {
+        msg->setting = setting;
+        rc_commit_msg(queue);
+    }
+}
+
+static void rc_process_queue_msgs(rc_t *rc, spsc_queue_t *queue)
+{
+    const rc_msg_t *msg;
+    size_t size;
+    while ((msg = spsc_queue_peek(queue, &size)))
+    {
+        switch ((rc_msg_type_e)msg->type)
+        {
+        case RC_MSG_SETTING_CHANGED:
+            rc_handle_setting_changed(rc, msg->setting);
+            break;
+        case RC_MSG_RMP_MSP_REQUEST:
+            rc_rmp_msp_send_request(rc, &msg->msp_request.src, msg->msp_request.src_port, &msg->msp_request.msp);
+            break;
+        case RC_MSG_RMP_AIR:
+        {
+            rmp_msg_t rmp_msg = msg->rmp_air.msg;
+            rmp_msg.payload = rmp_msg.payload_size > 0 ? &msg->rmp_air.msg + 1 : NULL;
+            rc_encode_rmp_air(rc, &rmp_msg);
+            break;
+        }
+        case RC_MSG_RMP_RC:
+            rc_rmp_handle_message(&rc->state.rc_rmp, &msg->rmp_rc.src, &msg->rmp_rc.msg, size - offsetof(rc_msg_t, rmp_rc.msg));
+            break;
+        }
+        spsc_queue_consume(queue);
+    }
+}
+
+// Handles the messages sent to the RC task by other tasks
+static void rc_process_msgs(rc_t *rc)
+{
+    for (int ii = 0; ii < ARRAY_COUNT(rc->state.to_rc); ii++)
+    {
+        rc_producer_queue_t *q = &rc->state.to_rc[ii];
+        if (!__atomic_load_n(&q->task, __ATOMIC_ACQUIRE))
+        {
+            // Queues are claimed in order
+            break;
+        }
+        rc_process_queue_msgs(rc, &q->queue);
+    }
+}
+
 static bool rc_should_autostart_bind(rc_t *rc)
 {
     air_pairing_t pairing;
@@ -978,6 +1265,17 @@ void rc_init(rc_t *rc, air_radio_t *radio, rmp_t *rmp)
     rc->output_config = NULL;
 
     rc->data.rmp = rmp;
+    rc_trace_init(&rc->data.trace);
+#if defined(USE_RC_PROFILER)
+    rc_profiler_init(&rc->state.profiler);
+    air_radio_set_hop_stats(radio, &rc->state.profiler.slots[RC_PROFILER_SLOT_HOP]);
+#endif
+
+    for (int ii = 0; ii < ARRAY_COUNT(rc->state.to_rc); ii++)
+    {
+        spsc_queue_init(&rc->state.to_rc[ii].queue, rc->state.to_rc[ii].buf, sizeof(rc->state.to_rc[ii].buf));
+    }
+    spsc_queue_init(&rc->state.from_rc, rc->state.from_rc_buf, sizeof(rc->state.from_rc_buf));
 
     rc_rmp_init(&rc->state.rc_rmp, rc, rmp);
 
@@ -1030,6 +1328,7 @@ bool rc_is_binding(const rc_t *rc)
 void rc_accept_bind(rc_t *rc)
 {
     rc->state.accept_bind = true;
+    wakeup_signal();
 }
 
 bool rc_has_pending_bind_request(rc_t *rc, air_bind_packet_t *packet)
@@ -1180,6 +1479,103 @@ bool rc_get_frequencies_table(rc_t *rc, air_freq_table_t *freqs)
     return false;
 }
 
+bool rc_get_air_clock(rc_t *rc, air_clock_t *clock)
+{
+    if (rc_get_mode(rc) == RC_MODE_RX && !rc->state.bind_active &&
+        air_clock_has_reference(&rc->inputs.air.clock))
+    {
+        if (clock)
+        {
+            memcpy(clock, &rc->inputs.air.clock, sizeof(*clock));
+        }
+        return true;
+    }
+    return false;
+}
+
+bool rc_get_input_latency(rc_t *rc, histogram_t *latency)
+{
+    if (rc_get_mode(rc) == RC_MODE_TX && !rc->state.bind_active &&
+        rc->data.sync.latency.count > 0)
+    {
+        if (latency)
+        {
+            memcpy(latency, &rc->data.sync.latency, sizeof(*latency));
+        }
+        return true;
+    }
+    return false;
+}
+
+void rc_get_latency_trace(rc_t *rc, rc_trace_t *trace)
+{
+    memcpy(trace, &rc->data.trace, sizeof(*trace));
+}
+
+void rc_get_queue_stats(rc_t *rc, spsc_queue_stats_t *to_rc, spsc_queue_stats_t *from_rc)
+{
+    memset(to_rc, 0, sizeof(*to_rc));
+    for (int ii = 0; ii < ARRAY_COUNT(rc->state.to_rc); ii++)
+    {
+        spsc_queue_stats_t stats;
+        spsc_queue_get_stats(&rc->state.to_rc[ii].queue, &stats);
+        to_rc->depth += stats.depth;
+        to_rc->max_depth = MAX(to_rc->max_depth, stats.max_depth);
+        to_rc->used += stats.used;
+        to_rc->pushed += stats.pushed;
+        to_rc->dropped += stats.dropped;
+    }
+    spsc_queue_get_stats(&rc->state.from_rc, from_rc);
+}
+
+const air_stream_t *rc_get_air_stream(rc_t *rc)
+{
+    if (rc->state.bind_active)
+    {
+        return NULL;
+    }
+    switch (rc_get_mode(rc))
+    {
+    case RC_MODE_TX:
+        if (rc->output == (output_t *)&rc->outputs.air)
+        {
+            return &rc->outputs.air.air_stream;
+        }
+        break;
+    case RC_MODE_RX:
+        if (rc->input == (input_t *)&rc->inputs.air)
+        {
+            return &rc->inputs.air.air_stream;
+        }
+        break;
+    }
+    return NULL;
+}
+
+void rc_update_rmp(rc_t *rc)
+{
+    const rc_rmp_send_msg_t *msg;
+    size_t size;
+    while ((msg = spsc_queue_peek(&rc->state.from_rc, &size)))
+    {
+        size_t payload_size = size - sizeof(*msg);
+        rmp_send(rc->rmp, msg->port, &msg->dst, msg->dst_port, payload_size > 0 ? msg->payload : NULL, payload_size);
+        spsc_queue_consume(&rc->state.from_rc);
+    }
+}
+
+bool rc_get_profiler_report(rc_t *rc, rc_profiler_slot_e slot, profiler_report_t *report)
+{
+#if defined(USE_RC_PROFILER)
+    return rc_profiler_get_report(&rc->state.profiler, slot, report);
+#else
+    UNUSED(rc);
+    UNUSED(slot);
+    UNUSED(report);
+    return false;
+#endif
+}
+
 const char *rc_get_pilot_name(rc_t *rc)
 {
     return rc_data_get_pilot_name(&rc->data);
@@ -1327,15 +1723,138 @@ void rc_invalidate_input(rc_t *rc)
 {
     LOG_I(TAG, "Input invalidated");
     rc->state.invalidate_input = true;
+    wakeup_signal();
 }
 
 void rc_invalidate_output(rc_t *rc)
 {
     rc->state.invalidate_output = true;
+    wakeup_signal();
+}
+
+// Returns when rc_update_pair_air_config() needs to run again
+static time_micros_t rc_pair_air_config_next_update_at(rc_t *rc, time_micros_t now)
+{
+    time_ticks_t ticks_now = time_ticks_now();
+    if (ticks_now >= rc->state.pair_air_config_next_req)
+    {
+        return 0;
+    }
+    time_ticks_t ticks = rc->state.pair_air_config_next_req - ticks_now;
+    return now + MILLIS_TO_MICROS(TICKS_TO_MILLIS(ticks));
+}
+
+static void rc_log_latency_trace(rc_t *rc, time_micros_t now)
+{
+    if (now < rc->state.trace_log_at)
+    {
+        return;
+    }
+    rc->state.trace_log_at = now + RC_TRACE_LOG_INTERVAL_US;
+    // Each end only sees its own stages, use rc_trace_merge()
+    // with the traces of both to get the end to end latency.
+    rc_trace_stage_e from = RC_TRACE_STAGE_INPUT;
+    rc_trace_stage_e to = RC_TRACE_STAGE_AIR_TX;
+    if (rc_get_mode(rc) == RC_MODE_RX)
+    {
+        from = RC_TRACE_STAGE_AIR_RX;
+        to = RC_TRACE_STAGE_OUTPUT;
+    }
+    for (air_mode_e mode = AIR_MODE_FASTEST; mode <= AIR_MODE_LONGEST; mode++)
+    {
+        rc_trace_stats_t stats;
+        if (rc_trace_stats(&rc->data.trace, mode, from, to, &stats))
+        {
+            LOG_D(TAG, "Latency in mode %d: p50 %uus, p99 %uus, max %uus (%u samples)",
+                  mode, stats.p50, stats.p99, stats.max, stats.count);
+        }
+    }
+}
+
+static void rc_log_link_stats(rc_t *rc, time_micros_t now)
+{
+    if (now < rc->state.link_stats_log_at)
+    {
+        return;
+    }
+    rc->state.link_stats_log_at = now + RC_LINK_STATS_LOG_INTERVAL_US;
+    // Outputs which are polled (see output_t.next_update_at) keep the
+    // task busy, so idle stays close to 0% on RX with serial outputs.
+    wakeup_stats_t wakeup;
+    wakeup_get_stats(&wakeup);
+    LOG_D(TAG, "RC task: %u%% idle, %u events, %u deadlines, %uus spinning",
+          wakeup_idle_percentage(), wakeup.events, wakeup.deadlines, (unsigned)wakeup.spinning);
+    wakeup_reset_stats();
+    spsc_queue_stats_t to_rc, from_rc;
+    rc_get_queue_stats(rc, &to_rc, &from_rc);
+    LOG_D(TAG, "Queues: to RC %u msgs (max %u), %u dropped, from RC %u msgs (max %u), %u dropped",
+          (unsigned)to_rc.depth, (unsigned)to_rc.max_depth, (unsigned)to_rc.dropped,
+          (unsigned)from_rc.depth, (unsigned)from_rc.max_depth, (unsigned)from_rc.dropped);
+    const air_stream_t *stream = rc_get_air_stream(rc);
+    if (!stream)
+    {
+        return;
+    }
+    if (rc_get_mode(rc) == RC_MODE_TX && rc->outputs.air.send_jitter.count > 0)
+    {
+        const histogram_t *jitter = &rc->outputs.air.send_jitter;
+        LOG_D(TAG, "Send jitter: %u packets, p50 %uus, p99 %uus, max %uus", (unsigned)jitter->count,
+              (unsigned)histogram_percentile(jitter, 50), (unsigned)histogram_percentile(jitter, 99), (unsigned)jitter->max);
+    }
+    if (rc_get_mode(rc) == RC_MODE_RX && rc->inputs.air.cad_enabled)
+    {
+        const input_air_cad_stats_t *cad = &rc->inputs.air.cad_stats;
+        LOG_D(TAG, "CAD: %u hits, %u misses, %u audited, %u false negatives",
+              cad->hits, cad->misses, cad->audits, cad->false_negatives);
+    }
+#if defined(USE_AIR_STREAM_RELIABLE)
+    const air_stream_reliable_stats_t *reliable = air_stream_get_reliable_stats(stream);
+    LOG_D(TAG, "ARQ: %u segments sent, %u retransmitted, %u resets, RTT %u packets, RTO %u packets",
+          reliable->segments_sent, reliable->retransmissions, reliable->resets, reliable->rtt, reliable->rto);
+#endif
+    for (air_stream_class_e cls = AIR_STREAM_CLASS_CONTROL; cls < AIR_STREAM_CLASS_COUNT; cls++)
+    {
+        const air_stream_class_stats_t *stats = air_stream_get_class_stats(stream, cls);
+        if (stats->frames > 0)
+        {
+            LOG_D(TAG, "Class %s: %u frames, %u bytes, %u dropped, wait avg %uus, max %uus",
+                  air_stream_class_name(cls), stats->frames, stats->bytes, stats->dropped,
+                  (unsigned)(stats->total_wait / stats->frames), stats->max_wait);
+        }
+    }
+}
+
+static void rc_log_profiler(rc_t *rc, time_micros_t now)
+{
+#if defined(USE_RC_PROFILER)
+    if (now < rc->state.profiler_log_at)
+    {
+        return;
+    }
+    rc->state.profiler_log_at = now + RC_PROFILER_LOG_INTERVAL_US;
+    for (rc_profiler_slot_e slot = 0; slot < RC_PROFILER_SLOT_COUNT; slot++)
+    {
+        profiler_report_t report;
+        if (rc_profiler_get_report(&rc->state.profiler, slot, &report))
+        {
+            LOG_D(TAG, "Profile %s: min %uns, avg %uns, p99 %uns, max %uns (%u samples)",
+                  rc_profiler_slot_name(slot), report.min, report.avg, report.p99, report.max, report.count);
+        }
+    }
+#else
+    UNUSED(rc);
+    UNUSED(now);
+#endif
 }
 
-void rc_update(rc_t *rc)
+time_micros_t rc_update(rc_t *rc)
 {
+    RC_PROFILER_BEGIN(rc);
+    if (UNLIKELY(!rc->state.task))
+    {
+        rc->state.task = xTaskGetCurrentTaskHandle();
+    }
+    rc_process_msgs(rc);
     if (UNLIKELY(rc->state.invalidate_input))
     {
         rc_reconfigure_input(rc);
@@ -1378,10 +1897,12 @@ void rc_update(rc_t *rc)
         output_air_set_tx_power(&rc->outputs.air, rc->state.tx_rf_power);
         rc->state.tx_rf_power = -1;
     }
+    RC_PROFILER_END_PHASE(rc, RECONFIGURE);
 
     time_micros_t now = time_micros_now();
     bool input_new_data = input_update(rc->input, now);
     rc->state.dirty |= input_new_data;
+    RC_PROFILER_END_PHASE(rc, INPUT);
     // We always need to update the output because the air output
     // might need to read the telemetry response before the
     // input is dirty again. Eventually we should refactor this to
@@ -1389,8 +1910,13 @@ void rc_update(rc_t *rc)
     // needs to process another data.
     if (LIKELY(rc_should_update_output(rc)))
     {
+        RC_PROFILER_BEGIN_PHASE(rc);
         rc->state.dirty &= !output_update(rc->output, input_new_data, now);
+        RC_PROFILER_END_PHASE(rc, OUTPUT);
     }
+    rc_log_latency_trace(rc, now);
+    rc_log_link_stats(rc, now);
+    rc_log_profiler(rc, now);
 
 #if defined(CONFIG_RAVEN_USE_PWM_OUTPUTS)
     input_new_data = input_new_data || rc_is_failsafe_active(rc, NULL);
@@ -1417,19 +1943,35 @@ void rc_update(rc_t *rc)
         {
             custom_failsafe_warning_logged = false;
         }
+        RC_PROFILER_BEGIN_PHASE(rc);
         pwm_update(&rc->data);
+        RC_PROFILER_END_PHASE(rc, PWM);
 #endif
     }
 
+    time_micros_t next_update_at = MIN(input_next_update_at(rc->input), output_next_update_at(rc->output));
+
     if (UNLIKELY(rc->state.bind_active))
     {
+        RC_PROFILER_BEGIN_PHASE(rc);
         rc_update_binding(rc);
+        RC_PROFILER_END_PHASE(rc, BIND);
     }
 
     if (UNLIKELY(rc_needs_pair_air_config(rc)))
     {
+        RC_PROFILER_BEGIN_PHASE(rc);
         rc_update_pair_air_config(rc);
+        RC_PROFILER_END_PHASE(rc, PAIR);
+        if (rc_needs_pair_air_config(rc))
+        {
+            next_update_at = MIN(next_update_at, rc_pair_air_config_next_update_at(rc, now));
+        }
     }
 
+    RC_PROFILER_BEGIN_PHASE(rc);
     rc_rssi_update(rc);
+    RC_PROFILER_END_PHASE(rc, RSSI);
+    RC_PROFILER_END(rc);
+    return next_update_at;
 }
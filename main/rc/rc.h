@@ -24,12 +24,39 @@
 
 #include "rc/failsafe.h"
 #include "rc/rc_data.h"
+#include "rc/rc_profiler.h"
 #include "rc/rc_rmp.h"
 
+#include "util/spsc_queue.h"
+
+// Size of each queue between the RC task and the other tasks. The
+// biggest message is an MSP request or response over RMP, which takes
+// a bit over MSP_MAX_PAYLOAD_SIZE (512) bytes in the queue, so the
+// default lets each producer queue a second MSP message while the RC
+// task handles the first one. With RC_QUEUE_PRODUCERS queues to the RC
+// task and one from it, that's 10KB. Targets short on RAM can shrink it
+// to 1024, which still fits a single MSP message (see rc.c).
+#if !defined(RC_QUEUE_SIZE)
+#define RC_QUEUE_SIZE 2048
+#endif
+
+// Maximum number of tasks sending messages to the RC task, each one
+// gets its own queue.
+#if !defined(RC_QUEUE_PRODUCERS)
+#define RC_QUEUE_PRODUCERS 4 // RMP, UI, P2P and Bluetooth
+#endif
+
 typedef struct air_bind_packet_s air_bind_packet_t;
 typedef struct air_freq_table_s air_freq_table_t;
 typedef struct air_radio_s air_radio_t;
 typedef struct rc_s rc_t;
+
+typedef struct rc_producer_queue_s
+{
+    TaskHandle_t task; // Producer, claimed by its first message
+    spsc_queue_t queue;
+    uint32_t buf[RC_QUEUE_SIZE / 4];
+} rc_producer_queue_t;
 typedef struct rmp_s rmp_t;
 typedef struct rmp_port_s rmp_port_t;
 typedef struct msp_conn_s msp_conn_t;
@@ -94,12 +121,24 @@ typedef struct rc_s
         int dismissed_pairings;
         int tx_rf_power;
         time_ticks_t pair_air_config_next_req; // 0 zero means the data is confirmed
+        time_micros_t trace_log_at;
+        time_micros_t link_stats_log_at;
+#if defined(USE_RC_PROFILER)
+        rc_profiler_t profiler;
+        time_micros_t profiler_log_at;
+#endif
         // RMP messages handled by rc_t
         rc_rmp_t rc_rmp;
         // MSP/RMP Transport fields
         rc_rmp_msp_port_t rmp_msp_port[3];  // Used for sending MSP requests
         const rmp_port_t *msp_recv_port;    // Used for receiving MSP requests
         rc_rmp_resp_ctx_t msp_resp_ctx[30]; // Used for keeping data to handlea sync MSP responses via RMP
+        // Other tasks don't touch the state owned by the RC task (and
+        // vice versa), they send messages to it instead.
+        TaskHandle_t task;                           // Task running rc_update(), NULL until it runs
+        rc_producer_queue_t to_rc[RC_QUEUE_PRODUCERS]; // Consumed by rc_update()
+        spsc_queue_t from_rc;                        // Produced by rc_update(), consumed by rc_update_rmp()
+        uint32_t from_rc_buf[RC_QUEUE_SIZE / 4];
     } state;
 } rc_t;
 
@@ -116,6 +155,30 @@ int rc_get_rssi_percentage(rc_t *rc);
 float rc_get_snr(rc_t *rc);
 unsigned rc_get_update_frequency(rc_t *rc);
 bool rc_get_frequencies_table(rc_t *rc, air_freq_table_t *freqs);
+// Returns the estimated TX timing when running as a linked RX
+bool rc_get_air_clock(rc_t *rc, air_clock_t *clock);
+// Returns the time channel frames from the radio wait before being
+// sent over the air when running as a TX
+bool rc_get_input_latency(rc_t *rc, histogram_t *latency);
+// Copies the sampled latency trace for this end of the link. The
+// firmware only logs the stages of its own end (see rc_trace_stats()),
+// the end to end latency is computed on the host by feeding the traces
+// of both ends to rc_trace_merge(). They're not sent over RMP.
+void rc_get_latency_trace(rc_t *rc, rc_trace_t *trace);
+// Returns the depth and drop counters of the queues used to send
+// messages to and from the RC task. The ones for the queues to the RC
+// task are added up.
+void rc_get_queue_stats(rc_t *rc, spsc_queue_stats_t *to_rc, spsc_queue_stats_t *from_rc);
+// Returns the air stream used to talk to the other end, NULL when
+// binding or when the air input/output is not in use.
+const air_stream_t *rc_get_air_stream(rc_t *rc);
+// Sends the RMP messages produced by rc_update(). Must be called
+// periodically from the task calling rmp_update().
+void rc_update_rmp(rc_t *rc);
+
+// Returns the cycles spent in the given slot of rc_update(). Returns
+// false if the slot has no samples or USE_RC_PROFILER is not defined.
+bool rc_get_profiler_report(rc_t *rc, rc_profiler_slot_e slot, profiler_report_t *report);
 
 const char *rc_get_pilot_name(rc_t *rc);
 const char *rc_get_craft_name(rc_t *rc);
@@ -132,4 +195,7 @@ void rc_dismiss_alternative_pairings(rc_t *rc);
 void rc_invalidate_input(rc_t *rc);
 void rc_invalidate_output(rc_t *rc);
 
-void rc_update(rc_t *rc);
\ No newline at end of file
+// Returns the latest time at which rc_update() needs to be called again
+// if no events happen (see util/wakeup.h), 0 if it needs to be called
+// again as soon as possible.
+time_micros_t rc_update(rc_t *rc);
\ No newline at end of file
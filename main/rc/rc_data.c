@@ -37,6 +37,7 @@ void rc_data_reset_input(rc_data_t *data)
     }
     data->channels_num = RC_CHANNELS_NUM;
     data->ready = false;
+    rc_sync_reset_input(&data->sync);
 #ifdef SETUP_FAKE_TELEMETRY
     time_ticks_t now = time_ticks_now();
     TELEMETRY_SET_I8(data, TELEMETRY_ID_TX_RSSI_ANT1, 73, now);
@@ -76,6 +77,7 @@ void rc_data_reset_output(rc_data_t *data)
     {
         data_state_init(&data->telemetry_downlink[ii].data_state);
     }
+    rc_sync_reset_output(&data->sync);
 #ifdef SETUP_FAKE_TELEMETRY
     time_ticks_t now = time_ticks_now();
     (void)TELEMETRY_SET_U16(data, TELEMETRY_ID_BAT_VOLTAGE, 14.7 * 100, now);
@@ -109,6 +111,10 @@ void rc_data_update_channel(rc_data_t *data, unsigned ch, unsigned value, time_m
     value = value > RC_CHANNEL_MIN_VALUE ? value : RC_CHANNEL_MIN_VALUE;
     bool changed = channel->value != value;
     channel->value = value;
+    if (changed)
+    {
+        rc_trace_channel_changed(&data->trace, ch, now);
+    }
     data_state_update(&channel->data_state, changed, now);
 }
 
@@ -3,6 +3,8 @@
 #include <stdint.h>
 
 #include "rc/failsafe.h"
+#include "rc/rc_sync.h"
+#include "rc/rc_trace.h"
 #include "rc/telemetry.h"
 
 #include "util/data_state.h"
@@ -76,6 +78,11 @@ typedef struct rc_data_s
     } failsafe;
     telemetry_t telemetry_uplink[TELEMETRY_UPLINK_COUNT];
     telemetry_t telemetry_downlink[TELEMETRY_DOWNLINK_COUNT];
+    // Timing of the input frames and the output packets, used
+    // to keep the latency between them low.
+    rc_sync_t sync;
+    // Sampled latency of the channel changes through the link
+    rc_trace_t trace;
     // Provided here so inputs and outputs can both use
     // RMP messages.
     rmp_t *rmp;
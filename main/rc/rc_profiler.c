@@ -0,0 +1,116 @@
+#include <stddef.h>
+
+#include "util/macros.h"
+
+#include "rc_profiler.h"
+
+static const char *slot_names[] = {
+    [RC_PROFILER_SLOT_UPDATE] = "Update",
+    [RC_PROFILER_SLOT_RECONFIGURE] = "Reconfigure",
+    [RC_PROFILER_SLOT_INPUT] = "Input",
+    [RC_PROFILER_SLOT_OUTPUT] = "Output",
+    [RC_PROFILER_SLOT_PWM] = "PWM",
+    [RC_PROFILER_SLOT_BIND] = "Bind",
+    [RC_PROFILER_SLOT_PAIR] = "Pair",
+    [RC_PROFILER_SLOT_RSSI] = "RSSI",
+    [RC_PROFILER_SLOT_HOP] = "Hop",
+
+    [RC_PROFILER_SLOT_INPUT_AIR] = "In.Air",
+    [RC_PROFILER_SLOT_INPUT_AIR_BIND] = "In.AirBind",
+    [RC_PROFILER_SLOT_INPUT_CRSF] = "In.CRSF",
+    [RC_PROFILER_SLOT_INPUT_FAKE] = "In.Fake",
+    [RC_PROFILER_SLOT_INPUT_IBUS] = "In.IBUS",
+    [RC_PROFILER_SLOT_INPUT_PPM] = "In.PPM",
+    [RC_PROFILER_SLOT_INPUT_SBUS] = "In.SBUS",
+
+    [RC_PROFILER_SLOT_OUTPUT_AIR] = "Out.Air",
+    [RC_PROFILER_SLOT_OUTPUT_AIR_BIND] = "Out.AirBind",
+    [RC_PROFILER_SLOT_OUTPUT_AIR_POWER_TEST] = "Out.AirPwr",
+    [RC_PROFILER_SLOT_OUTPUT_CRSF] = "Out.CRSF",
+    [RC_PROFILER_SLOT_OUTPUT_FPORT] = "Out.FPort",
+    [RC_PROFILER_SLOT_OUTPUT_MSP] = "Out.MSP",
+    [RC_PROFILER_SLOT_OUTPUT_NONE] = "Out.None",
+    [RC_PROFILER_SLOT_OUTPUT_SBUS] = "Out.SBUS",
+};
+
+ARRAY_ASSERT_COUNT(slot_names, RC_PROFILER_SLOT_COUNT, "invalid number of profiler slot names");
+
+void rc_profiler_init(rc_profiler_t *profiler)
+{
+    profiler_cycles_init();
+    for (int ii = 0; ii < RC_PROFILER_SLOT_COUNT; ii++)
+    {
+        profiler_stats_init(&profiler->slots[ii]);
+    }
+    profiler->input_slot = RC_PROFILER_SLOT_COUNT;
+    profiler->output_slot = RC_PROFILER_SLOT_COUNT;
+    profiler->update_start = 0;
+    profiler->phase_start = 0;
+}
+
+void rc_profiler_set_input(rc_profiler_t *profiler, rc_profiler_slot_e slot)
+{
+    profiler->input_slot = slot;
+}
+
+void rc_profiler_set_output(rc_profiler_t *profiler, rc_profiler_slot_e slot)
+{
+    profiler->output_slot = slot;
+}
+
+void rc_profiler_begin(rc_profiler_t *profiler)
+{
+    profiler->update_start = profiler->phase_start = profiler_cycles_now();
+}
+
+void rc_profiler_begin_phase(rc_profiler_t *profiler)
+{
+    profiler->phase_start = profiler_cycles_now();
+}
+
+void rc_profiler_end_phase(rc_profiler_t *profiler, rc_profiler_slot_e slot)
+{
+    profiler_cycles_t now = profiler_cycles_now();
+    profiler_cycles_t cycles = now - profiler->phase_start;
+    profiler_stats_add(&profiler->slots[slot], cycles);
+    unsigned impl_slot = RC_PROFILER_SLOT_COUNT;
+    switch (slot)
+    {
+    case RC_PROFILER_SLOT_INPUT:
+        impl_slot = profiler->input_slot;
+        break;
+    case RC_PROFILER_SLOT_OUTPUT:
+        impl_slot = profiler->output_slot;
+        break;
+    default:
+        break;
+    }
+    if (impl_slot < RC_PROFILER_SLOT_COUNT)
+    {
+        profiler_stats_add(&profiler->slots[impl_slot], cycles);
+    }
+    profiler->phase_start = now;
+}
+
+void rc_profiler_end(rc_profiler_t *profiler)
+{
+    profiler_stats_add_since(&profiler->slots[RC_PROFILER_SLOT_UPDATE], profiler->update_start);
+}
+
+const char *rc_profiler_slot_name(rc_profiler_slot_e slot)
+{
+    if (slot < RC_PROFILER_SLOT_COUNT)
+    {
+        return slot_names[slot];
+    }
+    return NULL;
+}
+
+bool rc_profiler_get_report(const rc_profiler_t *profiler, rc_profiler_slot_e slot, profiler_report_t *report)
+{
+    if (slot >= RC_PROFILER_SLOT_COUNT)
+    {
+        return false;
+    }
+    return profiler_stats_get_report(&profiler->slots[slot], report);
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "util/profiler.h"
+
+// Accounts the cycles spent in each phase of rc_update(). The input
+// and output phases are also accounted to the slot of the input or
+// output implementation in use, so they can be compared between them.
+// RC_PROFILER_SLOT_HOP is filled by the radio, see air_radio_set_hop_stats().
+
+typedef enum
+{
+    RC_PROFILER_SLOT_UPDATE, // Whole rc_update()
+    RC_PROFILER_SLOT_RECONFIGURE,
+    RC_PROFILER_SLOT_INPUT,
+    RC_PROFILER_SLOT_OUTPUT,
+    RC_PROFILER_SLOT_PWM,
+    RC_PROFILER_SLOT_BIND,
+    RC_PROFILER_SLOT_PAIR,
+    RC_PROFILER_SLOT_RSSI,
+    RC_PROFILER_SLOT_HOP, // Each air_radio_set_hop(), within INPUT or OUTPUT
+
+    RC_PROFILER_SLOT_INPUT_AIR,
+    RC_PROFILER_SLOT_INPUT_AIR_BIND,
+    RC_PROFILER_SLOT_INPUT_CRSF,
+    RC_PROFILER_SLOT_INPUT_FAKE,
+    RC_PROFILER_SLOT_INPUT_IBUS,
+    RC_PROFILER_SLOT_INPUT_PPM,
+    RC_PROFILER_SLOT_INPUT_SBUS,
+
+    RC_PROFILER_SLOT_OUTPUT_AIR,
+    RC_PROFILER_SLOT_OUTPUT_AIR_BIND,
+    RC_PROFILER_SLOT_OUTPUT_AIR_POWER_TEST,
+    RC_PROFILER_SLOT_OUTPUT_CRSF,
+    RC_PROFILER_SLOT_OUTPUT_FPORT,
+    RC_PROFILER_SLOT_OUTPUT_MSP,
+    RC_PROFILER_SLOT_OUTPUT_NONE,
+    RC_PROFILER_SLOT_OUTPUT_SBUS,
+
+    RC_PROFILER_SLOT_COUNT,
+} rc_profiler_slot_e;
+
+#define RC_PROFILER_SLOT_NAME_MAX_LENGTH 11
+
+typedef struct rc_profiler_s
+{
+    profiler_stats_t slots[RC_PROFILER_SLOT_COUNT];
+    uint8_t input_slot;  // From rc_profiler_slot_e, RC_PROFILER_SLOT_COUNT if none
+    uint8_t output_slot; // From rc_profiler_slot_e, RC_PROFILER_SLOT_COUNT if none
+    profiler_cycles_t update_start;
+    profiler_cycles_t phase_start;
+} rc_profiler_t;
+
+void rc_profiler_init(rc_profiler_t *profiler);
+void rc_profiler_set_input(rc_profiler_t *profiler, rc_profiler_slot_e slot);
+void rc_profiler_set_output(rc_profiler_t *profiler, rc_profiler_slot_e slot);
+// Called at the start of rc_update()
+void rc_profiler_begin(rc_profiler_t *profiler);
+// Starts timing a phase. Phases are also started by rc_profiler_begin()
+// and rc_profiler_end_phase(), so this is only needed to skip the code
+// between two phases.
+void rc_profiler_begin_phase(rc_profiler_t *profiler);
+// Accounts the cycles since the phase started to slot
+void rc_profiler_end_phase(rc_profiler_t *profiler, rc_profiler_slot_e slot);
+// Called at the end of rc_update()
+void rc_profiler_end(rc_profiler_t *profiler);
+
+// Returns the name of the slot, at most RC_PROFILER_SLOT_NAME_MAX_LENGTH
+// characters long.
+const char *rc_profiler_slot_name(rc_profiler_slot_e slot);
+// Returns false if the slot has no samples
+bool rc_profiler_get_report(const rc_profiler_t *profiler, rc_profiler_slot_e slot, profiler_report_t *report);
@@ -1,3 +1,7 @@
+#include <string.h>
+
+#include <hal/log.h>
+
 #include "rc/rc-private.h"
 #include "rc/rc.h"
 
@@ -5,6 +9,8 @@
 
 #include "rc_rmp.h"
 
+static const char *TAG = "RC.RMP";
+
 static void rc_rmp_send_air_config_raw(rc_rmp_t *rc_rmp, const air_addr_t *addr, rc_rmp_code_e code, bool ack)
 {
     air_config_t air_config;
@@ -16,7 +22,7 @@ static void rc_rmp_send_air_config_raw(rc_rmp_t *rc_rmp, const air_addr_t *addr,
         .air_config.ack = ack,
     };
 
-    rmp_send(rc_rmp->rmp, rc_rmp->port, addr, RMP_PORT_RC, &resp, 1 + sizeof(resp.air_config));
+    rc_send_rmp_message(rc_rmp->rc, rc_rmp->port, addr, RMP_PORT_RC, &resp, 1 + sizeof(resp.air_config));
 }
 
 static void rc_rmp_send_air_config_ack(rc_rmp_t *rc_rmp, const air_addr_t *addr)
@@ -24,33 +30,92 @@ static void rc_rmp_send_air_config_ack(rc_rmp_t *rc_rmp, const air_addr_t *addr)
     rc_rmp_send_air_config_raw(rc_rmp, addr, RC_RMP_AIR_CONFIG_ACK, false);
 }
 
+static void rc_rmp_send_profiler(rc_rmp_t *rc_rmp, const air_addr_t *addr, rc_profiler_slot_e slot)
+{
+    rc_rmp_msg_t resp = {
+        .code = RC_RMP_PROFILER_RESP,
+        .profiler_resp.slot = slot,
+        .profiler_resp.slot_count = RC_PROFILER_SLOT_COUNT,
+    };
+    const char *name = rc_profiler_slot_name(slot);
+    if (name)
+    {
+        strncpy(resp.profiler_resp.name, name, sizeof(resp.profiler_resp.name) - 1);
+    }
+    profiler_report_t report;
+    if (rc_get_profiler_report(rc_rmp->rc, slot, &report))
+    {
+        resp.profiler_resp.count = report.count;
+        resp.profiler_resp.min = report.min;
+        resp.profiler_resp.avg = report.avg;
+        resp.profiler_resp.max = report.max;
+        resp.profiler_resp.p99 = report.p99;
+    }
+    rc_send_rmp_message(rc_rmp->rc, rc_rmp->port, addr, RMP_PORT_RC, &resp, 1 + sizeof(resp.profiler_resp));
+}
+
 static void rc_rmp_port_handler(rmp_t *rmp, rmp_req_t *req, void *user_data)
 {
+    // Runs on the task which received the message: the RC task
+    // for messages received over the air, another one for P2P.
     rc_rmp_t *rc_rmp = user_data;
     const rc_rmp_msg_t *msg = req->msg->payload;
     if (!msg || req->msg->payload_size < 1 || !req->msg->has_signature)
     {
         return;
     }
+    if (rc_is_rc_task(rc_rmp->rc))
+    {
+        rc_rmp_handle_message(rc_rmp, &req->msg->src, msg, req->msg->payload_size);
+        return;
+    }
+    if (!rc_send_rmp_rc_message(rc_rmp->rc, &req->msg->src, msg, req->msg->payload_size))
+    {
+        LOG_W(TAG, "Dropping message with code %u", msg->code);
+    }
+}
+
+void rc_rmp_handle_message(rc_rmp_t *rc_rmp, const air_addr_t *src, const rc_rmp_msg_t *msg, size_t size)
+{
+    air_addr_t addr;
     switch ((rc_rmp_code_e)msg->code)
     {
     case RC_RMP_AIR_CONFIG_REQ:
-        rc_rmp_send_air_config(rc_rmp, &req->msg->src, false);
+        rc_rmp_send_air_config(rc_rmp, src, false);
         break;
     case RC_RMP_AIR_CONFIG_RESP:
-        if (req->msg->payload_size != 1 + sizeof(rc_rmp_air_config_t))
+        if (size != 1 + sizeof(rc_rmp_air_config_t))
         {
             break;
         }
-        rc_set_peer_air_config(rc_rmp->rc, &req->msg->src, msg->air_config.band, msg->air_config.modes);
+        air_addr_cpy(&addr, src);
+        rc_set_peer_air_config(rc_rmp->rc, &addr, msg->air_config.band, msg->air_config.modes);
         if (msg->air_config.ack)
         {
-            rc_rmp_send_air_config_ack(rc_rmp, &req->msg->src);
+            rc_rmp_send_air_config_ack(rc_rmp, src);
         }
         break;
     case RC_RMP_AIR_CONFIG_ACK:
         // TODO: Ignored for now
         break;
+    case RC_RMP_PROFILER_REQ:
+        if (size != 1 + sizeof(rc_rmp_profiler_req_t))
+        {
+            break;
+        }
+        rc_rmp_send_profiler(rc_rmp, src, msg->profiler_req.slot);
+        break;
+    case RC_RMP_PROFILER_RESP:
+        if (size != 1 + sizeof(rc_rmp_profiler_resp_t))
+        {
+            break;
+        }
+        LOG_I(TAG, "Peer profile %u/%u %.*s: min %uns, avg %uns, p99 %uns, max %uns (%u samples)",
+              msg->profiler_resp.slot, msg->profiler_resp.slot_count,
+              (int)sizeof(msg->profiler_resp.name), msg->profiler_resp.name,
+              msg->profiler_resp.min, msg->profiler_resp.avg, msg->profiler_resp.p99,
+              msg->profiler_resp.max, msg->profiler_resp.count);
+        break;
     }
 }
 
@@ -66,10 +131,19 @@ void rc_rmp_request_air_config(rc_rmp_t *rc_rmp, const air_addr_t *addr)
     rc_rmp_msg_t req = {
         .code = RC_RMP_AIR_CONFIG_REQ,
     };
-    rmp_send(rc_rmp->rmp, rc_rmp->port, addr, RMP_PORT_RC, &req, 1);
+    rc_send_rmp_message(rc_rmp->rc, rc_rmp->port, addr, RMP_PORT_RC, &req, 1);
 }
 
 void rc_rmp_send_air_config(rc_rmp_t *rc_rmp, const air_addr_t *addr, bool ack)
 {
     rc_rmp_send_air_config_raw(rc_rmp, addr, RC_RMP_AIR_CONFIG_RESP, ack);
+}
+
+void rc_rmp_request_profiler(rc_rmp_t *rc_rmp, const air_addr_t *addr, rc_profiler_slot_e slot)
+{
+    rc_rmp_msg_t req = {
+        .code = RC_RMP_PROFILER_REQ,
+        .profiler_req.slot = slot,
+    };
+    rc_send_rmp_message(rc_rmp->rc, rc_rmp->port, addr, RMP_PORT_RC, &req, 1 + sizeof(req.profiler_req));
 }
\ No newline at end of file
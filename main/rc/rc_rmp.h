@@ -1,6 +1,9 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
+
+#include "rc/rc_profiler.h"
 
 #include "util/macros.h"
 
@@ -14,6 +17,8 @@ typedef enum
     RC_RMP_AIR_CONFIG_REQ = 0,
     RC_RMP_AIR_CONFIG_RESP,
     RC_RMP_AIR_CONFIG_ACK,
+    RC_RMP_PROFILER_REQ,
+    RC_RMP_PROFILER_RESP,
 } rc_rmp_code_e;
 
 typedef struct rc_rmp_air_config_s
@@ -23,11 +28,31 @@ typedef struct rc_rmp_air_config_s
     uint8_t ack;   // Wether the sender was an ack. Ignored for RC_RMP_AIR_CONFIG_ACK.
 } PACKED rc_rmp_air_config_t;
 
+typedef struct rc_rmp_profiler_req_s
+{
+    uint8_t slot; // From rc_profiler_slot_e
+} PACKED rc_rmp_profiler_req_t;
+
+// All times in ns, see profiler_report_t
+typedef struct rc_rmp_profiler_resp_s
+{
+    uint8_t slot;       // From rc_profiler_slot_e
+    uint8_t slot_count; // Number of slots supported by the sender
+    char name[RC_PROFILER_SLOT_NAME_MAX_LENGTH + 1];
+    uint32_t count; // 0 if the slot has no samples or the sender has no profiler
+    uint32_t min;
+    uint32_t avg;
+    uint32_t max;
+    uint32_t p99;
+} PACKED rc_rmp_profiler_resp_t;
+
 typedef struct rc_rmp_msg_s
 {
     uint8_t code; // from rc_rmp_code_e
     union {
         rc_rmp_air_config_t air_config;
+        rc_rmp_profiler_req_t profiler_req;
+        rc_rmp_profiler_resp_t profiler_resp;
     };
 } PACKED rc_rmp_msg_t;
 
@@ -39,5 +64,11 @@ typedef struct rc_rmp_s
 } rc_rmp_t;
 
 void rc_rmp_init(rc_rmp_t *rc_rmp, rc_t *rc, rmp_t *rmp);
+// Handles a message received on RMP_PORT_RC. Must be called from the
+// RC task, since it reads and updates the RC state.
+void rc_rmp_handle_message(rc_rmp_t *rc_rmp, const air_addr_t *src, const rc_rmp_msg_t *msg, size_t size);
 void rc_rmp_request_air_config(rc_rmp_t *rc_rmp, const air_addr_t *addr);
-void rc_rmp_send_air_config(rc_rmp_t *rc_rmp, const air_addr_t *addr, bool ack);
\ No newline at end of file
+void rc_rmp_send_air_config(rc_rmp_t *rc_rmp, const air_addr_t *addr, bool ack);
+// Requests the rc_update() profile of the given slot from addr. The
+// response is written to the log.
+void rc_rmp_request_profiler(rc_rmp_t *rc_rmp, const air_addr_t *addr, rc_profiler_slot_e slot);
\ No newline at end of file
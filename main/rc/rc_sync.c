@@ -0,0 +1,134 @@
+#include <math.h>
+
+#include "util/macros.h"
+
+#include "rc_sync.h"
+
+// Smoothing for the input and output intervals, as 1/N of the new value
+#define RC_SYNC_INTERVAL_SMOOTHING 16
+// Intervals longer than this factor are considered lost frames
+#define RC_SYNC_LOST_FACTOR 1.5f
+// After this many lost frames in a row, the input interval is assumed
+// to have changed and it's measured again
+#define RC_SYNC_INPUT_MAX_LOST 4
+// Frames older than this factor of the input interval are stale, the
+// input stopped sending them and we can't relate packets to them.
+#define RC_SYNC_INPUT_STALE_FACTOR 2
+// Time the output waits after the input asked for its timing to start
+// nudging its own schedule again.
+#define RC_SYNC_INPUT_FOLLOWS_INTERVAL_US SECS_TO_MICROS(1)
+// Lag from the input frame to the packet the output nudges its schedule
+// towards. Leaves some margin for the jitter of both ends.
+#define RC_SYNC_TARGET_LAG_US 500
+// Maximum nudge for a single packet. Keeps the packet rate within the
+// margin the other end uses to predict its arrivals.
+#define RC_SYNC_MAX_NUDGE_US 50
+
+void rc_sync_reset_input(rc_sync_t *sync)
+{
+    sync->input_frame_at = 0;
+    sync->input_interval = 0;
+    sync->input_lost = 0;
+    sync->input_follows_until = 0;
+}
+
+void rc_sync_reset_output(rc_sync_t *sync)
+{
+    sync->output_interval = 0;
+    sync->output_at = 0;
+    sync->output_period = 0;
+    sync->lag = -1;
+    histogram_init(&sync->latency);
+}
+
+void rc_sync_input_frame(rc_sync_t *sync, time_micros_t at)
+{
+    if (sync->input_frame_at > 0 && at > sync->input_frame_at)
+    {
+        float interval = at - sync->input_frame_at;
+        if (sync->input_interval == 0 || sync->input_lost >= RC_SYNC_INPUT_MAX_LOST)
+        {
+            sync->input_interval = interval;
+            sync->input_lost = 0;
+        }
+        else if (interval > sync->input_interval * RC_SYNC_LOST_FACTOR)
+        {
+            sync->input_lost++;
+        }
+        else
+        {
+            sync->input_interval += (interval - sync->input_interval) / RC_SYNC_INTERVAL_SMOOTHING;
+            sync->input_lost = 0;
+        }
+    }
+    sync->input_frame_at = at;
+}
+
+bool rc_sync_get_input_timing(rc_sync_t *sync, time_micros_t min_interval, time_micros_t now,
+                              float *interval, int32_t *lag)
+{
+    if (sync->output_interval == 0 || sync->lag < 0 || min_interval == 0)
+    {
+        return false;
+    }
+    sync->input_follows_until = now + RC_SYNC_INPUT_FOLLOWS_INTERVAL_US;
+    // Use the measured period, since it includes the scheduling
+    // delays of the output. Otherwise the input would slowly drift
+    // away from it between each call.
+    *interval = sync->output_period / MAX(1, sync->output_interval / min_interval);
+    *lag = sync->lag;
+    return true;
+}
+
+static void rc_sync_update_output_period(rc_sync_t *sync, time_micros_t now, time_micros_t interval)
+{
+    if (interval != sync->output_interval)
+    {
+        sync->output_interval = interval;
+        sync->output_period = interval;
+    }
+    else if (sync->output_at > 0 && now > sync->output_at)
+    {
+        float period = now - sync->output_at;
+        if (period < interval * RC_SYNC_LOST_FACTOR)
+        {
+            sync->output_period += (period - sync->output_period) / RC_SYNC_INTERVAL_SMOOTHING;
+        }
+    }
+    sync->output_at = now;
+}
+
+int rc_sync_output_packet(rc_sync_t *sync, time_micros_t now, time_micros_t interval)
+{
+    rc_sync_update_output_period(sync, now, interval);
+    if (sync->input_interval == 0 || now < sync->input_frame_at ||
+        now - sync->input_frame_at > sync->input_interval * RC_SYNC_INPUT_STALE_FACTOR)
+    {
+        sync->lag = -1;
+        return 0;
+    }
+    sync->lag = now - sync->input_frame_at;
+    histogram_add(&sync->latency, sync->lag);
+
+    if (now < sync->input_follows_until)
+    {
+        // The input is adjusting to us, don't move the target
+        return 0;
+    }
+    // We can only get closer to the input frames if the output
+    // interval is a multiple of the input one. Otherwise the
+    // lag goes through all the possible values anyway.
+    float frames = interval / sync->input_interval;
+    float multiple = roundf(frames);
+    if (multiple < 1 || fabsf(interval - multiple * sync->input_interval) > RC_SYNC_MAX_NUDGE_US / 2)
+    {
+        return 0;
+    }
+    float error = sync->lag - RC_SYNC_TARGET_LAG_US;
+    if (error > sync->input_interval / 2)
+    {
+        // Closer to the next frame
+        error -= sync->input_interval;
+    }
+    return CONSTRAIN(lroundf(-error / 4), -RC_SYNC_MAX_NUDGE_US, RC_SYNC_MAX_NUDGE_US);
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "util/histogram.h"
+#include "util/time.h"
+
+// Phase locking between the channel frames received by the input and
+// the packets sent by the output, so channel values wait as little as
+// possible before being sent. Inputs which can adjust their timing (e.g.
+// OpenTX via CRSF) are told the frame interval to use and how long their
+// last frame waited, see rc_sync_get_input_timing(). For other inputs,
+// the output nudges its own schedule towards their frames when both
+// intervals are compatible, see rc_sync_output_packet().
+
+typedef struct rc_sync_s
+{
+    // Updated by the input
+    time_micros_t input_frame_at;      // Last frame with channels, 0 if none
+    float input_interval;              // Smoothed interval between frames (us), 0 if unknown
+    unsigned input_lost;               // Frames lost in a row while measuring the interval
+    time_micros_t input_follows_until; // The input adjusts its timing to the output until then
+    // Updated by the output
+    time_micros_t output_interval; // Scheduled interval between packets (us), 0 if not sending
+    time_micros_t output_at;       // Last packet sent, 0 if none
+    float output_period;           // Smoothed measured interval between packets (us)
+    int32_t lag;                   // From the last frame to the last packet (us), -1 if unknown
+    histogram_t latency;           // From the last frame to each packet (us)
+} rc_sync_t;
+
+void rc_sync_reset_input(rc_sync_t *sync);
+void rc_sync_reset_output(rc_sync_t *sync);
+
+// Called by the input when it receives a frame with channels. at should
+// be the time its last byte was received.
+void rc_sync_input_frame(rc_sync_t *sync, time_micros_t at);
+// Called by inputs which can adjust their timing. Returns false if the
+// output is not sending packets. Otherwise interval is set to the frame
+// interval the input should use in us (the measured output interval
+// divided by the biggest integer which keeps it >= min_interval) and lag
+// to the time the last packet waited after the last input frame. The
+// output won't nudge its schedule for a while after this is called.
+bool rc_sync_get_input_timing(rc_sync_t *sync, time_micros_t min_interval, time_micros_t now,
+                              float *interval, int32_t *lag);
+// Called by the output when sending a packet at now, with interval until
+// the next one. Returns how many us the next packet should be moved to
+// get closer to the input frames, negative meaning earlier.
+int rc_sync_output_packet(rc_sync_t *sync, time_micros_t now, time_micros_t interval);
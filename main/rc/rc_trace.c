@@ -0,0 +1,173 @@
+#include <string.h>
+
+#include "util/macros.h"
+
+#include "rc_trace.h"
+
+// RX entries are related to the TX entry sent right before them, as long
+// as they're closer than this. Both ends trace at most one entry every
+// AIR_SEQ_COUNT packets, which is always longer than this.
+#define RC_TRACE_MATCH_WINDOW_US MILLIS_TO_MICROS(100)
+
+static rc_trace_entry_t *rc_trace_new_entry(rc_trace_t *trace, unsigned ch, uint16_t value, air_mode_e mode)
+{
+    rc_trace_entry_t *entry = &trace->entries[trace->head];
+    memset(entry, 0, sizeof(*entry));
+    entry->channel = ch;
+    entry->value = value;
+    entry->mode = mode;
+    if (trace->pending == (int)trace->head)
+    {
+        trace->pending = -1;
+    }
+    trace->head = (trace->head + 1) % RC_TRACE_RING_SIZE;
+    if (trace->count < RC_TRACE_RING_SIZE)
+    {
+        trace->count++;
+    }
+    return entry;
+}
+
+// Returns the first channel with a different value than in the last
+// packet, or -1 if none changed.
+static int rc_trace_changed_channel(rc_trace_t *trace, const uint16_t *air_values)
+{
+    int changed = -1;
+    for (int ii = 0; ii < RC_TRACE_CHANNELS; ii++)
+    {
+        if (changed < 0 && air_values[ii] != trace->air_values[ii])
+        {
+            changed = ii;
+        }
+        trace->air_values[ii] = air_values[ii];
+    }
+    return changed;
+}
+
+void rc_trace_init(rc_trace_t *trace)
+{
+    memset(trace, 0, sizeof(*trace));
+    trace->pending = -1;
+}
+
+void rc_trace_channel_changed(rc_trace_t *trace, unsigned ch, time_micros_t now)
+{
+    if (ch < RC_TRACE_CHANNELS)
+    {
+        trace->changed_at[ch] = now;
+    }
+}
+
+void rc_trace_air_tx(rc_trace_t *trace, unsigned seq, air_mode_e mode, const uint16_t *air_values, time_micros_t now)
+{
+    int ch = rc_trace_changed_channel(trace, air_values);
+    if (seq == RC_TRACE_SAMPLE_SEQ && ch >= 0 && trace->changed_at[ch] > 0)
+    {
+        rc_trace_entry_t *entry = rc_trace_new_entry(trace, ch, air_values[ch], mode);
+        entry->at[RC_TRACE_STAGE_INPUT] = trace->changed_at[ch];
+        entry->at[RC_TRACE_STAGE_AIR_TX] = now;
+    }
+}
+
+void rc_trace_air_rx(rc_trace_t *trace, unsigned seq, air_mode_e mode, const uint16_t *air_values, time_micros_t rx_at)
+{
+    int ch = rc_trace_changed_channel(trace, air_values);
+    if (seq == RC_TRACE_SAMPLE_SEQ && ch >= 0)
+    {
+        rc_trace_entry_t *entry = rc_trace_new_entry(trace, ch, air_values[ch], mode);
+        entry->at[RC_TRACE_STAGE_AIR_RX] = rx_at;
+        trace->pending = (entry - trace->entries);
+    }
+}
+
+void rc_trace_output(rc_trace_t *trace, time_micros_t now)
+{
+    if (trace->pending >= 0)
+    {
+        trace->entries[trace->pending].at[RC_TRACE_STAGE_OUTPUT] = now;
+        trace->pending = -1;
+    }
+}
+
+unsigned rc_trace_get_entries(const rc_trace_t *trace, rc_trace_entry_t *entries, unsigned size)
+{
+    unsigned count = MIN(size, trace->count);
+    unsigned first = (trace->head + RC_TRACE_RING_SIZE - trace->count) % RC_TRACE_RING_SIZE;
+    for (unsigned ii = 0; ii < count; ii++)
+    {
+        entries[ii] = trace->entries[(first + ii) % RC_TRACE_RING_SIZE];
+    }
+    return count;
+}
+
+unsigned rc_trace_merge(const rc_trace_t *tx, const rc_trace_t *rx, int32_t rx_offset, rc_trace_entry_t *out, unsigned size)
+{
+    unsigned count = 0;
+    for (unsigned ii = 0; ii < tx->count && count < size; ii++)
+    {
+        const rc_trace_entry_t *tx_entry = &tx->entries[ii];
+        const rc_trace_entry_t *match = NULL;
+        uint32_t match_delay = 0;
+        for (unsigned jj = 0; jj < rx->count; jj++)
+        {
+            const rc_trace_entry_t *rx_entry = &rx->entries[jj];
+            if (rx_entry->channel != tx_entry->channel || rx_entry->value != tx_entry->value ||
+                rx_entry->mode != tx_entry->mode || rx_entry->at[RC_TRACE_STAGE_OUTPUT] == 0)
+            {
+                continue;
+            }
+            // Unsigned arithmetic handles the wrap around
+            uint32_t delay = rx_entry->at[RC_TRACE_STAGE_AIR_RX] - rx_offset - tx_entry->at[RC_TRACE_STAGE_AIR_TX];
+            if (delay < RC_TRACE_MATCH_WINDOW_US && (!match || delay < match_delay))
+            {
+                match = rx_entry;
+                match_delay = delay;
+            }
+        }
+        if (match)
+        {
+            rc_trace_entry_t *entry = &out[count++];
+            *entry = *tx_entry;
+            entry->at[RC_TRACE_STAGE_AIR_RX] = match->at[RC_TRACE_STAGE_AIR_RX] - rx_offset;
+            entry->at[RC_TRACE_STAGE_OUTPUT] = match->at[RC_TRACE_STAGE_OUTPUT] - rx_offset;
+        }
+    }
+    return count;
+}
+
+bool rc_trace_entries_stats(const rc_trace_entry_t *entries, unsigned count, air_mode_e mode,
+                            rc_trace_stage_e from, rc_trace_stage_e to, rc_trace_stats_t *stats)
+{
+    uint32_t values[RC_TRACE_RING_SIZE];
+    unsigned n = 0;
+    for (unsigned ii = 0; ii < count && n < ARRAY_COUNT(values); ii++)
+    {
+        const rc_trace_entry_t *entry = &entries[ii];
+        if (entry->mode != mode || entry->at[from] == 0 || entry->at[to] == 0)
+        {
+            continue;
+        }
+        // Insertion sort, there are just a few values
+        uint32_t value = entry->at[to] - entry->at[from];
+        unsigned jj = n++;
+        for (; jj > 0 && values[jj - 1] > value; jj--)
+        {
+            values[jj] = values[jj - 1];
+        }
+        values[jj] = value;
+    }
+    if (n == 0)
+    {
+        return false;
+    }
+    stats->count = n;
+    stats->p50 = values[(n - 1) / 2];
+    stats->p99 = values[(n - 1) * 99 / 100];
+    stats->max = values[n - 1];
+    return true;
+}
+
+bool rc_trace_stats(const rc_trace_t *trace, air_mode_e mode, rc_trace_stage_e from, rc_trace_stage_e to, rc_trace_stats_t *stats)
+{
+    return rc_trace_entries_stats(trace->entries, trace->count, mode, from, to, stats);
+}
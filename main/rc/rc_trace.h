@@ -0,0 +1,88 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "air/air_mode.h"
+
+#include "util/time.h"
+
+// Sampled tracing of the latency of channel changes through both ends of
+// the link. Only changes to the first RC_TRACE_CHANNELS channels carried
+// by packets with seq RC_TRACE_SAMPLE_SEQ are traced, which lets both
+// ends pick the same changes without sending anything extra over the air.
+// The TX records when the change arrived from the input and when its
+// packet was sent, while the RX records when the packet was received and
+// when the change was sent to the output. Entries from both ends are
+// related by their channel, value and mode, see rc_trace_merge(). Values
+// are compared as sent over the air, since the input might have more
+// resolution.
+
+#define RC_TRACE_CHANNELS 4
+#define RC_TRACE_SAMPLE_SEQ 0
+#define RC_TRACE_RING_SIZE 32
+
+typedef enum
+{
+    RC_TRACE_STAGE_INPUT,  // TX: Change received from the input
+    RC_TRACE_STAGE_AIR_TX, // TX: Packet with the change sent
+    RC_TRACE_STAGE_AIR_RX, // RX: Packet with the change received
+    RC_TRACE_STAGE_OUTPUT, // RX: Change sent to the output
+
+    RC_TRACE_STAGE_COUNT,
+} rc_trace_stage_e;
+
+typedef struct rc_trace_entry_s
+{
+    // Lower 32 bits of the time each stage was reached, 0 if it wasn't
+    uint32_t at[RC_TRACE_STAGE_COUNT];
+    uint16_t value; // As sent over the air
+    uint8_t channel;
+    uint8_t mode; // air_mode_e
+} rc_trace_entry_t;
+
+typedef struct rc_trace_stats_s
+{
+    unsigned count;
+    uint32_t p50;
+    uint32_t p99;
+    uint32_t max;
+} rc_trace_stats_t;
+
+typedef struct rc_trace_s
+{
+    time_micros_t changed_at[RC_TRACE_CHANNELS]; // Last change from the input, 0 if none
+    uint16_t air_values[RC_TRACE_CHANNELS];      // Values in the last packet
+    int pending;                                 // Entry waiting for RC_TRACE_STAGE_OUTPUT, -1 if none
+    unsigned head;                               // Next entry to write
+    unsigned count;
+    rc_trace_entry_t entries[RC_TRACE_RING_SIZE];
+} rc_trace_t;
+
+void rc_trace_init(rc_trace_t *trace);
+// Called when the input changes the value of a channel. Traced changes
+// are timed from the last one before their packet, so they measure the
+// age of the values that were sent.
+void rc_trace_channel_changed(rc_trace_t *trace, unsigned ch, time_micros_t now);
+// Called by the TX right before sending a packet, with the first
+// RC_TRACE_CHANNELS channels as encoded in the packet.
+void rc_trace_air_tx(rc_trace_t *trace, unsigned seq, air_mode_e mode, const uint16_t *air_values, time_micros_t now);
+// Called by the RX for each received packet, with rx_at being the time
+// the radio received it.
+void rc_trace_air_rx(rc_trace_t *trace, unsigned seq, air_mode_e mode, const uint16_t *air_values, time_micros_t rx_at);
+// Called by the RX after sending the channels to the output
+void rc_trace_output(rc_trace_t *trace, time_micros_t now);
+
+// Returns the traced entries in chronological order, up to size. Entries
+// still missing a stage of their end are also included.
+unsigned rc_trace_get_entries(const rc_trace_t *trace, rc_trace_entry_t *entries, unsigned size);
+// Relates the entries of the TX and the RX, storing the complete entries in
+// out and returning how many were stored. rx_offset is the difference
+// between the RX and TX clocks (0 if both ends share the clock). Only
+// used on the host, since neither end has the trace of the other one.
+unsigned rc_trace_merge(const rc_trace_t *tx, const rc_trace_t *rx, int32_t rx_offset, rc_trace_entry_t *out, unsigned size);
+// Computes the statistics of the time between from and to for the given
+// mode. Returns false if no entry reached both stages.
+bool rc_trace_entries_stats(const rc_trace_entry_t *entries, unsigned count, air_mode_e mode,
+                            rc_trace_stage_e from, rc_trace_stage_e to, rc_trace_stats_t *stats);
+bool rc_trace_stats(const rc_trace_t *trace, air_mode_e mode, rc_trace_stage_e from, rc_trace_stage_e to, rc_trace_stats_t *stats);
@@ -3,6 +3,7 @@
 
 #include "config/config.h"
 
+#include "util/siphash.h"
 #include "util/time.h"
 
 #include "rmp.h"
@@ -21,6 +22,14 @@ typedef enum
     RMP_DEVICE_CODE_INFO,
 } rmp_device_code_e;
 
+typedef enum
+{
+    RMP_DEVICE_FEATURE_SIGNATURE_SIPHASH = 1 << 0,
+} rmp_device_feature_e;
+
+// Sent after the name in rmp_device_info_t. Older versions ignore them.
+#define RMP_DEVICE_FEATURES (RMP_DEVICE_FEATURE_SIGNATURE_SIPHASH)
+
 typedef struct rmp_device_info_s
 {
     air_role_e role;
@@ -61,9 +70,11 @@ static void rmp_update_peer_authentication(rmp_t *rmp, rmp_peer_t *peer)
 {
     UNUSED(rmp);
 
-    bool can_authenticate = config_get_pairing(NULL, &peer->addr);
+    air_pairing_t pairing;
+    bool can_authenticate = config_get_pairing(&pairing, &peer->addr);
     if (can_authenticate)
     {
+        peer->key = pairing.key;
         peer->flags |= RMP_PEER_FLAG_CAN_AUTHENTICATE;
     }
     else
@@ -72,6 +83,25 @@ static void rmp_update_peer_authentication(rmp_t *rmp, rmp_peer_t *peer)
     }
 }
 
+// Reload the cached keys if any pairing changed since they were loaded
+static void rmp_check_pairing_generation(rmp_t *rmp)
+{
+    uint32_t generation = config_get_pairing_generation();
+    if (generation != rmp->internal.pairing_generation)
+    {
+        for (int ii = 0; ii < RMP_MAX_PEERS; ii++)
+        {
+            rmp_peer_t *peer = &rmp->internal.peers[ii];
+            if (air_addr_is_valid(&peer->addr))
+            {
+                rmp_update_peer_authentication(rmp, peer);
+            }
+        }
+        rmp->internal.pairing_generation = generation;
+        rmp->internal.key_cache_reloads++;
+    }
+}
+
 static rmp_peer_t *rmp_add_peer(rmp_t *rmp, air_addr_t *addr)
 {
     for (int ii = 0; ii < RMP_MAX_PEERS; ii++)
@@ -89,10 +119,25 @@ static rmp_peer_t *rmp_add_peer(rmp_t *rmp, air_addr_t *addr)
     return NULL;
 }
 
-static bool rmp_get_peer_key(rmp_t *rmp, air_key_t *key, const air_addr_t *addr)
+static bool rmp_get_peer_key(rmp_t *rmp, air_key_t *key, const air_addr_t *addr, rmp_peer_t *peer)
 {
-    UNUSED(rmp);
-
+    rmp_check_pairing_generation(rmp);
+    if (!peer)
+    {
+        peer = rmp_get_peer(rmp, addr);
+    }
+    if (peer)
+    {
+        // Peer keys are always up to date, no need to check the config
+        rmp->internal.key_cache_hits++;
+        if (peer->flags & RMP_PEER_FLAG_CAN_AUTHENTICATE)
+        {
+            *key = peer->key;
+            return true;
+        }
+        return false;
+    }
+    rmp->internal.key_cache_misses++;
     air_pairing_t pairing;
     if (config_get_pairing(&pairing, addr))
     {
@@ -102,10 +147,8 @@ static bool rmp_get_peer_key(rmp_t *rmp, air_key_t *key, const air_addr_t *addr)
     return false;
 }
 
-static void rmp_get_message_signature(rmp_t *rmp, uint8_t *signature, rmp_msg_t *msg, air_key_t *key)
+static void rmp_get_message_signature_md5(uint8_t *signature, rmp_msg_t *msg, air_key_t *key)
 {
-    UNUSED(rmp);
-
     hal_md5_ctx_t ctx;
     uint8_t md5_output[HAL_MD5_OUTPUT_SIZE];
 
@@ -125,9 +168,53 @@ static void rmp_get_message_signature(rmp_t *rmp, uint8_t *signature, rmp_msg_t
     memcpy(signature, &md5_output[sizeof(md5_output) - RMP_SIGNATURE_SIZE], RMP_SIGNATURE_SIZE);
 }
 
+static void rmp_get_message_signature_siphash(uint8_t *signature, rmp_msg_t *msg, air_key_t *key)
+{
+    // Pairing keys are 32 bits, so that's all the entropy we have
+    siphash_key_t sip_key = {
+        .k0 = ((uint64_t)*key << 32) | *key,
+        .k1 = ~(((uint64_t)*key << 32) | *key),
+    };
+    siphash_t h;
+    siphash_init(&h, &sip_key);
+    siphash_update(&h, &msg->src, sizeof(msg->src));
+    siphash_update(&h, &msg->src_port, sizeof(msg->src_port));
+    siphash_update(&h, &msg->dst, sizeof(msg->dst));
+    siphash_update(&h, &msg->dst_port, sizeof(msg->dst_port));
+    if (msg->payload && msg->payload_size > 0)
+    {
+        siphash_update(&h, msg->payload, msg->payload_size);
+    }
+    uint64_t hash = siphash_final(&h);
+    for (int ii = 0; ii < RMP_SIGNATURE_SIZE; ii++)
+    {
+        signature[ii] = hash >> (8 * ii);
+    }
+}
+
+// Returns false if the signature type is not supported
+static bool rmp_get_message_signature(rmp_t *rmp, uint8_t *signature, rmp_msg_t *msg, air_key_t *key)
+{
+    UNUSED(rmp);
+
+    switch ((rmp_signature_e)msg->signature_type)
+    {
+    case RMP_SIGNATURE_MD5:
+        rmp_get_message_signature_md5(signature, msg, key);
+        return true;
+    case RMP_SIGNATURE_SIPHASH:
+        rmp_get_message_signature_siphash(signature, msg, key);
+        return true;
+    }
+    return false;
+}
+
 static void rmp_sign_message(rmp_t *rmp, rmp_msg_t *msg, air_key_t *key)
 {
+    // Use SipHash only with peers that told us they support it
+    rmp_peer_t *peer = rmp_get_peer(rmp, &msg->dst);
     msg->has_signature = true;
+    msg->signature_type = (peer && (peer->flags & RMP_PEER_FLAG_SIGNATURE_SIPHASH)) ? RMP_SIGNATURE_SIPHASH : RMP_SIGNATURE_MD5;
     rmp_get_message_signature(rmp, msg->signature, msg, key);
 }
 
@@ -206,7 +293,10 @@ static void rmp_send_device_info(rmp_t *rmp, const air_addr_t *dst)
         strlcpy(frame.device_info.name, rmp->internal.name, sizeof(frame.device_info.name));
     }
     size_t frame_size = 1 + sizeof(frame.device_info) - sizeof(frame.device_info.name) + strlen(frame.device_info.name) + 1;
-    rmp_send(rmp, NULL, dst, RMP_PORT_DEVICE, &frame, frame_size);
+    uint8_t buf[sizeof(frame) + 1];
+    memcpy(buf, &frame, frame_size);
+    buf[frame_size++] = RMP_DEVICE_FEATURES;
+    rmp_send(rmp, NULL, dst, RMP_PORT_DEVICE, buf, frame_size);
 }
 
 static void rmp_broadcast_device_info(rmp_t *rmp, time_ticks_t now)
@@ -250,6 +340,17 @@ static void rmp_device_handler(rmp_t *rmp, rmp_req_t *req, void *user_data)
                 break;
             }
         }
+        // Features are sent after the name by newer versions
+        size_t features_offset = 1 + offsetof(rmp_device_info_t, name) + strnlen(frame->device_info.name, sizeof(frame->device_info.name)) + 1;
+        uint8_t features = features_offset < req->msg->payload_size ? ((const uint8_t *)req->msg->payload)[features_offset] : 0;
+        if (features & RMP_DEVICE_FEATURE_SIGNATURE_SIPHASH)
+        {
+            peer->flags |= RMP_PEER_FLAG_SIGNATURE_SIPHASH;
+        }
+        else
+        {
+            peer->flags &= ~RMP_PEER_FLAG_SIGNATURE_SIPHASH;
+        }
         peer->last_info_update = time_ticks_now();
         peer->last_info_req = 0;
         rmp_update_peer_authentication(rmp, peer);
@@ -369,6 +470,7 @@ bool rmp_can_authenticate_peer(rmp_t *rmp, const air_addr_t *addr)
     {
         return true;
     }
+    rmp_check_pairing_generation(rmp);
     rmp_peer_t *peer = rmp_get_peer(rmp, addr);
     if (peer && (peer->flags & RMP_PEER_FLAG_CAN_AUTHENTICATE))
     {
@@ -377,6 +479,22 @@ bool rmp_can_authenticate_peer(rmp_t *rmp, const air_addr_t *addr)
     return false;
 }
 
+void rmp_get_key_cache_stats(rmp_t *rmp, unsigned *hits, unsigned *misses, unsigned *reloads)
+{
+    if (hits)
+    {
+        *hits = rmp->internal.key_cache_hits;
+    }
+    if (misses)
+    {
+        *misses = rmp->internal.key_cache_misses;
+    }
+    if (reloads)
+    {
+        *reloads = rmp->internal.key_cache_reloads;
+    }
+}
+
 bool rmp_has_p2p_peer(rmp_t *rmp, const air_addr_t *addr)
 {
 #if defined(USE_P2P)
@@ -521,7 +639,7 @@ bool rmp_send_flags(rmp_t *rmp, const rmp_port_t *port, const air_addr_t *dst, i
     }
     // Not a broadcast message. Check if we should sign it.
     air_key_t key;
-    if (rmp_get_peer_key(rmp, &key, dst))
+    if (rmp_get_peer_key(rmp, &key, dst, NULL))
     {
         rmp_sign_message(rmp, &msg, &key);
     }
@@ -586,13 +704,17 @@ void rmp_process_message(rmp_t *rmp, rmp_msg_t *msg, rmp_transport_type_e source
     {
         // Check the signature for validity
         air_key_t key;
-        if (!rmp_get_peer_key(rmp, &key, &msg->src))
+        if (!rmp_get_peer_key(rmp, &key, &msg->src, peer))
         {
             LOG_W(TAG, "Dropping signed message, no key found");
             return;
         }
         uint8_t signature[RMP_SIGNATURE_SIZE];
-        rmp_get_message_signature(rmp, signature, msg, &key);
+        if (!rmp_get_message_signature(rmp, signature, msg, &key))
+        {
+            LOG_W(TAG, "Dropping signed message, unknown signature type %u", msg->signature_type);
+            return;
+        }
         if (memcmp(signature, msg->signature, RMP_SIGNATURE_SIZE) != 0)
         {
             LOG_W(TAG, "Dropping signed message, invalid signature");
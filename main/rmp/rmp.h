@@ -15,6 +15,12 @@
 
 #define RMP_SIGNATURE_SIZE 4
 
+typedef enum
+{
+    RMP_SIGNATURE_MD5 = 1,     // Last bytes of MD5(key, header, payload). Supported by all versions.
+    RMP_SIGNATURE_SIPHASH = 2, // First bytes of SipHash-2-4(header, payload) keyed with the pairing key
+} rmp_signature_e;
+
 enum
 {
     RMP_PORT_DEVICE = 0x22,
@@ -44,7 +50,8 @@ typedef bool (*rmp_transport_send_f)(rmp_t *rmp, rmp_msg_t *msg, void *user_data
 
 typedef enum
 {
-    RMP_PEER_FLAG_CAN_AUTHENTICATE = 1 << 0, // We have some means to authenticate this peer
+    RMP_PEER_FLAG_CAN_AUTHENTICATE = 1 << 0,  // We have some means to authenticate this peer
+    RMP_PEER_FLAG_SIGNATURE_SIPHASH = 1 << 1, // Peer can verify RMP_SIGNATURE_SIPHASH signatures
 } rmp_peer_flag_e;
 
 typedef struct rmp_peer_s
@@ -54,6 +61,7 @@ typedef struct rmp_peer_s
     air_role_e role;                    // Its role
     air_addr_t pair_addr;               // The addr of the TX/RX/GS paired with this peer
     rmp_peer_flag_e flags;              // See rmp_peer_flag_e
+    air_key_t key;                      // Pairing key, valid iff RMP_PEER_FLAG_CAN_AUTHENTICATE is set
     time_ticks_t last_seen;             // Last time we've seen this peer via p2p
     time_ticks_t last_info_update;      // Last time we got the device info for this peer
     time_ticks_t last_info_req;         // Last time we requested device info from this peer
@@ -68,6 +76,7 @@ typedef struct rmp_msg_s
     const void *payload;
     size_t payload_size;
     bool has_signature;
+    uint8_t signature_type; // From rmp_signature_e, only valid when has_signature is true
     uint8_t signature[RMP_SIGNATURE_SIZE];
 } rmp_msg_t;
 
@@ -108,6 +117,10 @@ typedef struct rmp_s
         rmp_peer_t peers[RMP_MAX_PEERS];
         rmp_port_t ports[RMP_MAX_PORTS];
         rmp_transport_t transports[RMP_TRANSPORT_COUNT];
+        uint32_t pairing_generation; // From config_get_pairing_generation() when peer keys were loaded
+        unsigned key_cache_hits;
+        unsigned key_cache_misses;
+        unsigned key_cache_reloads;
     } internal;
 } rmp_t;
 
@@ -122,6 +135,10 @@ void rmp_set_pairing(rmp_t *rmp, air_pairing_t *pairing);
 bool rmp_can_authenticate_peer(rmp_t *rmp, const air_addr_t *addr);
 bool rmp_has_p2p_peer(rmp_t *rmp, const air_addr_t *addr);
 void rmp_get_p2p_counts(rmp_t *rmp, int *tx_count, int *rx_count, bool *has_pairing_as_peer);
+// Keys for known peers are cached in RAM. Returns how many key lookups
+// were served from the cache, how many needed to check the config and
+// how many times the cache was reloaded because a pairing changed.
+void rmp_get_key_cache_stats(rmp_t *rmp, unsigned *hits, unsigned *misses, unsigned *reloads);
 
 // Open/close ports and send
 const rmp_port_t *rmp_open_port(rmp_t *rmp, uint8_t number, rmp_port_f handler, void *user_data);
@@ -16,6 +16,7 @@ typedef enum
     RMP_AIR_MSG_DPORT = 1 << 3,
     RMP_AIR_MSG_SIGNED = 1 << 4,
     RMP_AIR_MSG_BROADCAST = 1 << 5,
+    RMP_AIR_MSG_SIGNATURE_SIPHASH = 1 << 6, // Signed with RMP_SIGNATURE_SIPHASH rather than RMP_SIGNATURE_MD5
 } rmp_air_msg_flags_e;
 
 void rmp_air_init(rmp_air_t *rmp_air, rmp_t *rmp, air_addr_t *addr, air_stream_t *stream)
@@ -80,6 +81,10 @@ bool rmp_air_encode(rmp_air_t *rmp_air, rmp_msg_t *msg)
         if (msg->has_signature)
         {
             flags |= RMP_AIR_MSG_SIGNED;
+            if (msg->signature_type == RMP_SIGNATURE_SIPHASH)
+            {
+                flags |= RMP_AIR_MSG_SIGNATURE_SIPHASH;
+            }
             memcpy(&buf[pos], msg->signature, RMP_SIGNATURE_SIZE);
             pos += RMP_SIGNATURE_SIZE;
         }
@@ -177,6 +182,7 @@ void rmp_air_decode(rmp_air_t *rmp_air, const void *data, size_t size)
     {
         ENSURE_REMAINING_BYTES(RMP_SIGNATURE_SIZE, RMP_AIR_MSG_SIGNED);
         msg.has_signature = true;
+        msg.signature_type = (flags & RMP_AIR_MSG_SIGNATURE_SIPHASH) ? RMP_SIGNATURE_SIPHASH : RMP_SIGNATURE_MD5;
         memcpy(msg.signature, ptr, RMP_SIGNATURE_SIZE);
         ptr += RMP_SIGNATURE_SIZE;
     }
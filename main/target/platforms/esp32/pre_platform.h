@@ -6,6 +6,10 @@
 #define USE_OTA
 #define USE_DEVELOPER_MENU
 #define USE_IDF_WMONITOR
+#define USE_AIR_STREAM_RELIABLE         // Needs ~1.6KB of RAM per air_stream_t
+#define USE_AIR_STREAM_TELEMETRY_DELTA  // Needs ~1.9KB of RAM per air_stream_t
+#define USE_CRC8_DVB_S2_SLICING_BY_4    // Needs 768 extra bytes of flash, see test/crc_bench.c
+#define USE_RC_PROFILER                 // Needs ~2.2KB of RAM
 
 #define RC_TASK_STACK_SIZE 4096 // We need a bigger stack on ESP32 because of the SPI libraries
 #define RMP_TASK_STACK_SIZE 4096
@@ -9,6 +9,7 @@
 #include "io/serial.h"
 
 #include "util/macros.h"
+#include "util/wakeup.h"
 
 #include "target.h"
 
@@ -106,6 +107,7 @@ static void serial_isr(void *arg)
             }
         }
         port->dev->int_clr.rxfifo_full = 1;
+        wakeup_signal_from_isr();
     }
 }
 
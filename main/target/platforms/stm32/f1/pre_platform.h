@@ -1,6 +1,9 @@
 // Needed for SPI bus defines
 #include <libopencm3/stm32/spi.h>
 
+#define RC_QUEUE_SIZE 1024 // Fits a single MSP message over RMP
+#define RC_QUEUE_PRODUCERS 2 // RMP and UI
+
 #define RC_TASK_STACK_SIZE 512
 #define RMP_TASK_STACK_SIZE 128
 #define UI_TASK_STACK_SIZE configMINIMAL_STACK_SIZE
\ No newline at end of file
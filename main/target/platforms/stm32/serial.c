@@ -12,6 +12,9 @@
 #include "io/serial.h"
 
 #include "util/macros.h"
+#include "util/wakeup.h"
+
+#include "FreeRTOSConfig.h"
 
 typedef struct serial_port_data_s
 {
@@ -177,6 +180,9 @@ serial_port_t *serial_port_open(const serial_port_config_t *config)
 
     if (config->byte_callback)
     {
+        // The RX handler signals the RC task, so the IRQ must not be
+        // more urgent than the ones allowed to call FreeRTOS APIs
+        nvic_set_priority(p->irqn, configMAX_SYSCALL_INTERRUPT_PRIORITY);
         nvic_enable_irq(p->irqn);
         usart_enable_rx_interrupt(port->usart);
     }
@@ -293,6 +299,7 @@ static void usart_isr(serial_port_t *port)
         {
             uint8_t c = usart_recv(port->usart);
             callback(port, c, port->byte_callback_data);
+            wakeup_signal_from_isr();
         }
     }
 }
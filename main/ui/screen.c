@@ -21,6 +21,7 @@
 #include "ui/menu.h"
 #include "ui/screen_i2c.h"
 
+#include "util/histogram.h"
 #include "util/time.h"
 #include "util/version.h"
 
@@ -1167,6 +1168,129 @@ static void screen_draw_frequencies(screen_t *s)
     }
 }
 
+static uint16_t screen_draw_profiler(screen_t *s, uint16_t y)
+{
+    static const rc_profiler_slot_e slots[] = {
+        RC_PROFILER_SLOT_UPDATE,
+        RC_PROFILER_SLOT_INPUT,
+        RC_PROFILER_SLOT_OUTPUT,
+        RC_PROFILER_SLOT_RSSI,
+    };
+    char *buf = SCREEN_BUF(s);
+    char label[RC_PROFILER_SLOT_NAME_MAX_LENGTH + 2];
+    for (int ii = 0; ii < ARRAY_COUNT(slots) && y + 16 <= SCREEN_H(s); ii++)
+    {
+        profiler_report_t report;
+        if (rc_get_profiler_report(s->internal.rc, slots[ii], &report))
+        {
+            // Average, p99 and max
+            snprintf(buf, SCREEN_DRAW_BUF_SIZE, "%u/%u/%uus", (unsigned)(report.avg / 1000),
+                     (unsigned)(report.p99 / 1000), (unsigned)(report.max / 1000));
+        }
+        else
+        {
+            strncpy(buf, "---", SCREEN_DRAW_BUF_SIZE);
+        }
+        snprintf(label, sizeof(label), "%s:", rc_profiler_slot_name(slots[ii]));
+        screen_draw_label_value(s, label, buf, SCREEN_W(s), y, 3);
+        y += 16;
+    }
+    return y;
+}
+
+// Fills the label and value for the given line of the link statistics.
+// Returns false when there are no more lines.
+static bool screen_link_stats_line(screen_t *s, int line, const char **label, char *buf)
+{
+    const air_stream_t *stream = rc_get_air_stream(s->internal.rc);
+    int n = 0;
+#if defined(USE_AIR_STREAM_RELIABLE)
+    if (line == n++)
+    {
+        *label = "ARQ:";
+        if (!stream)
+        {
+            strncpy(buf, "---", SCREEN_DRAW_BUF_SIZE);
+            return true;
+        }
+        // Retransmitted segments, RTT and RTO in packets
+        const air_stream_reliable_stats_t *stats = air_stream_get_reliable_stats(stream);
+        unsigned retx = stats->segments_sent > 0 ? stats->retransmissions * 100 / stats->segments_sent : 0;
+        snprintf(buf, SCREEN_DRAW_BUF_SIZE, "%u%% %u/%up", retx, stats->rtt, stats->rto);
+        return true;
+    }
+#endif
+    for (air_stream_class_e cls = AIR_STREAM_CLASS_CHANNELS; cls < AIR_STREAM_CLASS_COUNT; cls++)
+    {
+        if (line == n++)
+        {
+            static char class_label[8];
+            snprintf(class_label, sizeof(class_label), "%s:", air_stream_class_name(cls));
+            *label = class_label;
+            if (!stream)
+            {
+                strncpy(buf, "---", SCREEN_DRAW_BUF_SIZE);
+                return true;
+            }
+            // Average and max wait in the queue, then dropped frames
+            const air_stream_class_stats_t *stats = air_stream_get_class_stats(stream, cls);
+            unsigned avg = stats->frames > 0 ? stats->total_wait / stats->frames : 0;
+            snprintf(buf, SCREEN_DRAW_BUF_SIZE, "%u/%ums %ud", avg / 1000, (unsigned)stats->max_wait / 1000,
+                     (unsigned)stats->dropped);
+            return true;
+        }
+    }
+    if (line == n++)
+    {
+        // RMP key lookups served from the peers vs from the config,
+        // then reloads after a pairing changed
+        unsigned hits, misses, reloads;
+        rmp_get_key_cache_stats(s->internal.rc->rmp, &hits, &misses, &reloads);
+        *label = "Keys:";
+        snprintf(buf, SCREEN_DRAW_BUF_SIZE, "%u/%u %ur", hits, misses, reloads);
+        return true;
+    }
+    if (line == n++)
+    {
+        // Max messages in the queues to and from the RC task, then
+        // messages dropped by both
+        spsc_queue_stats_t to_rc, from_rc;
+        rc_get_queue_stats(s->internal.rc, &to_rc, &from_rc);
+        *label = "Queues:";
+        snprintf(buf, SCREEN_DRAW_BUF_SIZE, "%u/%u %ud", (unsigned)to_rc.max_depth, (unsigned)from_rc.max_depth,
+                 (unsigned)(to_rc.dropped + from_rc.dropped));
+        return true;
+    }
+    return false;
+}
+
+// Draws the link statistics starting at the given line, returns
+// the number of lines drawn.
+static int screen_draw_link_stats(screen_t *s, int first, uint16_t y)
+{
+    char *buf = SCREEN_BUF(s);
+    const char *label;
+    int count = 0;
+    while (y + 16 <= SCREEN_H(s) && screen_link_stats_line(s, first + count, &label, buf))
+    {
+        screen_draw_label_value(s, label, buf, SCREEN_W(s), y, 3);
+        y += 16;
+        count++;
+    }
+    return count;
+}
+
+static int screen_link_stats_count(screen_t *s)
+{
+    const char *label;
+    int count = 0;
+    while (screen_link_stats_line(s, count, &label, SCREEN_BUF(s)))
+    {
+        count++;
+    }
+    return count;
+}
+
 static void screen_draw_debug_info(screen_t *s)
 {
     char *buf = SCREEN_BUF(s);
@@ -1174,6 +1298,25 @@ static void screen_draw_debug_info(screen_t *s)
     u8g2_SetFontPosTop(&u8g2);
     u8g2_SetFont(&u8g2, u8g2_font_profont10_tf);
 
+    // Pages: this one, the link statistics and, when there's not enough
+    // room for everything, the profiler.
+    int lines_per_page = SCREEN_H(s) / 16;
+    int link_pages = (screen_link_stats_count(s) + lines_per_page - 1) / lines_per_page;
+    bool profiler_page = SCREEN_H(s) < 128;
+    int page = TIME_CYCLE_EVERY_MS(3000, 1 + link_pages + (profiler_page ? 1 : 0));
+    if (page > 0 && page <= link_pages)
+    {
+        screen_draw_link_stats(s, (page - 1) * lines_per_page, 0);
+        return;
+    }
+    profiler_report_t report;
+    if (profiler_page && page > link_pages &&
+        rc_get_profiler_report(s->internal.rc, RC_PROFILER_SLOT_UPDATE, &report))
+    {
+        screen_draw_profiler(s, 0);
+        return;
+    }
+
     air_freq_table_t freqs;
     bool has_freqs = false;
     float freq_error = 0;
@@ -1218,6 +1361,25 @@ static void screen_draw_debug_info(screen_t *s)
 
     snprintf(buf, SCREEN_DRAW_BUF_SIZE, "%.02f C", system_temperature());
     screen_draw_label_value(s, "Core Temp:", buf, SCREEN_W(s), y, 3);
+    y += 16;
+
+    air_clock_t clock;
+    histogram_t latency;
+    if (rc_get_air_clock(s->internal.rc, &clock))
+    {
+        snprintf(buf, SCREEN_DRAW_BUF_SIZE, "%+.1fppm %+dus", air_clock_drift_ppm(&clock), air_clock_offset(&clock));
+        screen_draw_label_value(s, "Clock:", buf, SCREEN_W(s), y, 3);
+    }
+    else if (rc_get_input_latency(s->internal.rc, &latency))
+    {
+        // Median and p99, both rounded up to a power of 2
+        snprintf(buf, SCREEN_DRAW_BUF_SIZE, "%u/%uus", (unsigned)histogram_percentile(&latency, 50),
+                 (unsigned)histogram_percentile(&latency, 99));
+        screen_draw_label_value(s, "Latency:", buf, SCREEN_W(s), y, 3);
+    }
+    y += 16;
+
+    screen_draw_profiler(s, y);
 }
 
 static void screen_draw(screen_t *screen)
@@ -1,5 +1,95 @@
+#include "target.h"
+
 #include "crc.h"
 
+// Define USE_CRC8_DVB_S2_BITWISE to use the bitwise CRC8 implementation, which
+// needs no tables. Otherwise a 256 byte table is used and, if
+// USE_CRC8_DVB_S2_SLICING_BY_4 is defined, buffers are processed 4 bytes at a
+// time using 3 more tables (768 bytes).
+
+#if !defined(USE_CRC8_DVB_S2_BITWISE)
+// crc8_dvb_s2_table[x] is the CRC of the byte x starting from a zero CRC.
+static const uint8_t crc8_dvb_s2_table[256] = {
+    0x00, 0xd5, 0x7f, 0xaa, 0xfe, 0x2b, 0x81, 0x54, 0x29, 0xfc, 0x56, 0x83, 0xd7, 0x02, 0xa8, 0x7d,
+    0x52, 0x87, 0x2d, 0xf8, 0xac, 0x79, 0xd3, 0x06, 0x7b, 0xae, 0x04, 0xd1, 0x85, 0x50, 0xfa, 0x2f,
+    0xa4, 0x71, 0xdb, 0x0e, 0x5a, 0x8f, 0x25, 0xf0, 0x8d, 0x58, 0xf2, 0x27, 0x73, 0xa6, 0x0c, 0xd9,
+    0xf6, 0x23, 0x89, 0x5c, 0x08, 0xdd, 0x77, 0xa2, 0xdf, 0x0a, 0xa0, 0x75, 0x21, 0xf4, 0x5e, 0x8b,
+    0x9d, 0x48, 0xe2, 0x37, 0x63, 0xb6, 0x1c, 0xc9, 0xb4, 0x61, 0xcb, 0x1e, 0x4a, 0x9f, 0x35, 0xe0,
+    0xcf, 0x1a, 0xb0, 0x65, 0x31, 0xe4, 0x4e, 0x9b, 0xe6, 0x33, 0x99, 0x4c, 0x18, 0xcd, 0x67, 0xb2,
+    0x39, 0xec, 0x46, 0x93, 0xc7, 0x12, 0xb8, 0x6d, 0x10, 0xc5, 0x6f, 0xba, 0xee, 0x3b, 0x91, 0x44,
+    0x6b, 0xbe, 0x14, 0xc1, 0x95, 0x40, 0xea, 0x3f, 0x42, 0x97, 0x3d, 0xe8, 0xbc, 0x69, 0xc3, 0x16,
+    0xef, 0x3a, 0x90, 0x45, 0x11, 0xc4, 0x6e, 0xbb, 0xc6, 0x13, 0xb9, 0x6c, 0x38, 0xed, 0x47, 0x92,
+    0xbd, 0x68, 0xc2, 0x17, 0x43, 0x96, 0x3c, 0xe9, 0x94, 0x41, 0xeb, 0x3e, 0x6a, 0xbf, 0x15, 0xc0,
+    0x4b, 0x9e, 0x34, 0xe1, 0xb5, 0x60, 0xca, 0x1f, 0x62, 0xb7, 0x1d, 0xc8, 0x9c, 0x49, 0xe3, 0x36,
+    0x19, 0xcc, 0x66, 0xb3, 0xe7, 0x32, 0x98, 0x4d, 0x30, 0xe5, 0x4f, 0x9a, 0xce, 0x1b, 0xb1, 0x64,
+    0x72, 0xa7, 0x0d, 0xd8, 0x8c, 0x59, 0xf3, 0x26, 0x5b, 0x8e, 0x24, 0xf1, 0xa5, 0x70, 0xda, 0x0f,
+    0x20, 0xf5, 0x5f, 0x8a, 0xde, 0x0b, 0xa1, 0x74, 0x09, 0xdc, 0x76, 0xa3, 0xf7, 0x22, 0x88, 0x5d,
+    0xd6, 0x03, 0xa9, 0x7c, 0x28, 0xfd, 0x57, 0x82, 0xff, 0x2a, 0x80, 0x55, 0x01, 0xd4, 0x7e, 0xab,
+    0x84, 0x51, 0xfb, 0x2e, 0x7a, 0xaf, 0x05, 0xd0, 0xad, 0x78, 0xd2, 0x07, 0x53, 0x86, 0x2c, 0xf9,
+};
+#endif
+
+#if !defined(USE_CRC8_DVB_S2_BITWISE) && defined(USE_CRC8_DVB_S2_SLICING_BY_4)
+// crc8_dvb_s2_table_n[n-1][x] is the CRC of the byte x followed by n zero bytes,
+// starting from a zero CRC.
+static const uint8_t crc8_dvb_s2_table_n[3][256] = {
+    {
+        0x00, 0x0b, 0x16, 0x1d, 0x2c, 0x27, 0x3a, 0x31, 0x58, 0x53, 0x4e, 0x45, 0x74, 0x7f, 0x62, 0x69,
+        0xb0, 0xbb, 0xa6, 0xad, 0x9c, 0x97, 0x8a, 0x81, 0xe8, 0xe3, 0xfe, 0xf5, 0xc4, 0xcf, 0xd2, 0xd9,
+        0xb5, 0xbe, 0xa3, 0xa8, 0x99, 0x92, 0x8f, 0x84, 0xed, 0xe6, 0xfb, 0xf0, 0xc1, 0xca, 0xd7, 0xdc,
+        0x05, 0x0e, 0x13, 0x18, 0x29, 0x22, 0x3f, 0x34, 0x5d, 0x56, 0x4b, 0x40, 0x71, 0x7a, 0x67, 0x6c,
+        0xbf, 0xb4, 0xa9, 0xa2, 0x93, 0x98, 0x85, 0x8e, 0xe7, 0xec, 0xf1, 0xfa, 0xcb, 0xc0, 0xdd, 0xd6,
+        0x0f, 0x04, 0x19, 0x12, 0x23, 0x28, 0x35, 0x3e, 0x57, 0x5c, 0x41, 0x4a, 0x7b, 0x70, 0x6d, 0x66,
+        0x0a, 0x01, 0x1c, 0x17, 0x26, 0x2d, 0x30, 0x3b, 0x52, 0x59, 0x44, 0x4f, 0x7e, 0x75, 0x68, 0x63,
+        0xba, 0xb1, 0xac, 0xa7, 0x96, 0x9d, 0x80, 0x8b, 0xe2, 0xe9, 0xf4, 0xff, 0xce, 0xc5, 0xd8, 0xd3,
+        0xab, 0xa0, 0xbd, 0xb6, 0x87, 0x8c, 0x91, 0x9a, 0xf3, 0xf8, 0xe5, 0xee, 0xdf, 0xd4, 0xc9, 0xc2,
+        0x1b, 0x10, 0x0d, 0x06, 0x37, 0x3c, 0x21, 0x2a, 0x43, 0x48, 0x55, 0x5e, 0x6f, 0x64, 0x79, 0x72,
+        0x1e, 0x15, 0x08, 0x03, 0x32, 0x39, 0x24, 0x2f, 0x46, 0x4d, 0x50, 0x5b, 0x6a, 0x61, 0x7c, 0x77,
+        0xae, 0xa5, 0xb8, 0xb3, 0x82, 0x89, 0x94, 0x9f, 0xf6, 0xfd, 0xe0, 0xeb, 0xda, 0xd1, 0xcc, 0xc7,
+        0x14, 0x1f, 0x02, 0x09, 0x38, 0x33, 0x2e, 0x25, 0x4c, 0x47, 0x5a, 0x51, 0x60, 0x6b, 0x76, 0x7d,
+        0xa4, 0xaf, 0xb2, 0xb9, 0x88, 0x83, 0x9e, 0x95, 0xfc, 0xf7, 0xea, 0xe1, 0xd0, 0xdb, 0xc6, 0xcd,
+        0xa1, 0xaa, 0xb7, 0xbc, 0x8d, 0x86, 0x9b, 0x90, 0xf9, 0xf2, 0xef, 0xe4, 0xd5, 0xde, 0xc3, 0xc8,
+        0x11, 0x1a, 0x07, 0x0c, 0x3d, 0x36, 0x2b, 0x20, 0x49, 0x42, 0x5f, 0x54, 0x65, 0x6e, 0x73, 0x78,
+    },
+    {
+        0x00, 0x83, 0xd3, 0x50, 0x73, 0xf0, 0xa0, 0x23, 0xe6, 0x65, 0x35, 0xb6, 0x95, 0x16, 0x46, 0xc5,
+        0x19, 0x9a, 0xca, 0x49, 0x6a, 0xe9, 0xb9, 0x3a, 0xff, 0x7c, 0x2c, 0xaf, 0x8c, 0x0f, 0x5f, 0xdc,
+        0x32, 0xb1, 0xe1, 0x62, 0x41, 0xc2, 0x92, 0x11, 0xd4, 0x57, 0x07, 0x84, 0xa7, 0x24, 0x74, 0xf7,
+        0x2b, 0xa8, 0xf8, 0x7b, 0x58, 0xdb, 0x8b, 0x08, 0xcd, 0x4e, 0x1e, 0x9d, 0xbe, 0x3d, 0x6d, 0xee,
+        0x64, 0xe7, 0xb7, 0x34, 0x17, 0x94, 0xc4, 0x47, 0x82, 0x01, 0x51, 0xd2, 0xf1, 0x72, 0x22, 0xa1,
+        0x7d, 0xfe, 0xae, 0x2d, 0x0e, 0x8d, 0xdd, 0x5e, 0x9b, 0x18, 0x48, 0xcb, 0xe8, 0x6b, 0x3b, 0xb8,
+        0x56, 0xd5, 0x85, 0x06, 0x25, 0xa6, 0xf6, 0x75, 0xb0, 0x33, 0x63, 0xe0, 0xc3, 0x40, 0x10, 0x93,
+        0x4f, 0xcc, 0x9c, 0x1f, 0x3c, 0xbf, 0xef, 0x6c, 0xa9, 0x2a, 0x7a, 0xf9, 0xda, 0x59, 0x09, 0x8a,
+        0xc8, 0x4b, 0x1b, 0x98, 0xbb, 0x38, 0x68, 0xeb, 0x2e, 0xad, 0xfd, 0x7e, 0x5d, 0xde, 0x8e, 0x0d,
+        0xd1, 0x52, 0x02, 0x81, 0xa2, 0x21, 0x71, 0xf2, 0x37, 0xb4, 0xe4, 0x67, 0x44, 0xc7, 0x97, 0x14,
+        0xfa, 0x79, 0x29, 0xaa, 0x89, 0x0a, 0x5a, 0xd9, 0x1c, 0x9f, 0xcf, 0x4c, 0x6f, 0xec, 0xbc, 0x3f,
+        0xe3, 0x60, 0x30, 0xb3, 0x90, 0x13, 0x43, 0xc0, 0x05, 0x86, 0xd6, 0x55, 0x76, 0xf5, 0xa5, 0x26,
+        0xac, 0x2f, 0x7f, 0xfc, 0xdf, 0x5c, 0x0c, 0x8f, 0x4a, 0xc9, 0x99, 0x1a, 0x39, 0xba, 0xea, 0x69,
+        0xb5, 0x36, 0x66, 0xe5, 0xc6, 0x45, 0x15, 0x96, 0x53, 0xd0, 0x80, 0x03, 0x20, 0xa3, 0xf3, 0x70,
+        0x9e, 0x1d, 0x4d, 0xce, 0xed, 0x6e, 0x3e, 0xbd, 0x78, 0xfb, 0xab, 0x28, 0x0b, 0x88, 0xd8, 0x5b,
+        0x87, 0x04, 0x54, 0xd7, 0xf4, 0x77, 0x27, 0xa4, 0x61, 0xe2, 0xb2, 0x31, 0x12, 0x91, 0xc1, 0x42,
+    },
+    {
+        0x00, 0x45, 0x8a, 0xcf, 0xc1, 0x84, 0x4b, 0x0e, 0x57, 0x12, 0xdd, 0x98, 0x96, 0xd3, 0x1c, 0x59,
+        0xae, 0xeb, 0x24, 0x61, 0x6f, 0x2a, 0xe5, 0xa0, 0xf9, 0xbc, 0x73, 0x36, 0x38, 0x7d, 0xb2, 0xf7,
+        0x89, 0xcc, 0x03, 0x46, 0x48, 0x0d, 0xc2, 0x87, 0xde, 0x9b, 0x54, 0x11, 0x1f, 0x5a, 0x95, 0xd0,
+        0x27, 0x62, 0xad, 0xe8, 0xe6, 0xa3, 0x6c, 0x29, 0x70, 0x35, 0xfa, 0xbf, 0xb1, 0xf4, 0x3b, 0x7e,
+        0xc7, 0x82, 0x4d, 0x08, 0x06, 0x43, 0x8c, 0xc9, 0x90, 0xd5, 0x1a, 0x5f, 0x51, 0x14, 0xdb, 0x9e,
+        0x69, 0x2c, 0xe3, 0xa6, 0xa8, 0xed, 0x22, 0x67, 0x3e, 0x7b, 0xb4, 0xf1, 0xff, 0xba, 0x75, 0x30,
+        0x4e, 0x0b, 0xc4, 0x81, 0x8f, 0xca, 0x05, 0x40, 0x19, 0x5c, 0x93, 0xd6, 0xd8, 0x9d, 0x52, 0x17,
+        0xe0, 0xa5, 0x6a, 0x2f, 0x21, 0x64, 0xab, 0xee, 0xb7, 0xf2, 0x3d, 0x78, 0x76, 0x33, 0xfc, 0xb9,
+        0x5b, 0x1e, 0xd1, 0x94, 0x9a, 0xdf, 0x10, 0x55, 0x0c, 0x49, 0x86, 0xc3, 0xcd, 0x88, 0x47, 0x02,
+        0xf5, 0xb0, 0x7f, 0x3a, 0x34, 0x71, 0xbe, 0xfb, 0xa2, 0xe7, 0x28, 0x6d, 0x63, 0x26, 0xe9, 0xac,
+        0xd2, 0x97, 0x58, 0x1d, 0x13, 0x56, 0x99, 0xdc, 0x85, 0xc0, 0x0f, 0x4a, 0x44, 0x01, 0xce, 0x8b,
+        0x7c, 0x39, 0xf6, 0xb3, 0xbd, 0xf8, 0x37, 0x72, 0x2b, 0x6e, 0xa1, 0xe4, 0xea, 0xaf, 0x60, 0x25,
+        0x9c, 0xd9, 0x16, 0x53, 0x5d, 0x18, 0xd7, 0x92, 0xcb, 0x8e, 0x41, 0x04, 0x0a, 0x4f, 0x80, 0xc5,
+        0x32, 0x77, 0xb8, 0xfd, 0xf3, 0xb6, 0x79, 0x3c, 0x65, 0x20, 0xef, 0xaa, 0xa4, 0xe1, 0x2e, 0x6b,
+        0x15, 0x50, 0x9f, 0xda, 0xd4, 0x91, 0x5e, 0x1b, 0x42, 0x07, 0xc8, 0x8d, 0x83, 0xc6, 0x09, 0x4c,
+        0xbb, 0xfe, 0x31, 0x74, 0x7a, 0x3f, 0xf0, 0xb5, 0xec, 0xa9, 0x66, 0x23, 0x2d, 0x68, 0xa7, 0xe2,
+    },
+};
+#endif
+
 uint8_t crc_xor(uint8_t crc, uint8_t data)
 {
     return crc ^ data;
@@ -18,6 +108,7 @@ uint8_t crc_xor_bytes(const void *data, size_t size)
 
 uint8_t crc8_dvb_s2(uint8_t crc, uint8_t data)
 {
+#if defined(USE_CRC8_DVB_S2_BITWISE)
     crc ^= data;
     for (int ii = 0; ii < 8; ++ii)
     {
@@ -31,6 +122,9 @@ uint8_t crc8_dvb_s2(uint8_t crc, uint8_t data)
         }
     }
     return crc;
+#else
+    return crc8_dvb_s2_table[crc ^ data];
+#endif
 }
 
 uint8_t crc8_dvb_s2_bytes(const void *data, size_t size)
@@ -41,6 +135,18 @@ uint8_t crc8_dvb_s2_bytes(const void *data, size_t size)
 uint8_t crc8_dvb_s2_bytes_from(uint8_t crc, const void *data, size_t size)
 {
     const uint8_t *p = data;
+#if !defined(USE_CRC8_DVB_S2_BITWISE) && defined(USE_CRC8_DVB_S2_SLICING_BY_4)
+    // The CRC is linear, so the CRC of 4 bytes is the XOR of the CRCs of
+    // each one of them followed by the remaining zero bytes. This lets the
+    // 4 lookups run independently instead of waiting on each other.
+    for (; size >= 4; size -= 4, p += 4)
+    {
+        crc = crc8_dvb_s2_table_n[2][crc ^ p[0]] ^
+              crc8_dvb_s2_table_n[1][p[1]] ^
+              crc8_dvb_s2_table_n[0][p[2]] ^
+              crc8_dvb_s2_table[p[3]];
+    }
+#endif
     for (unsigned ii = 0; ii < size; ii++, p++)
     {
         crc = crc8_dvb_s2(crc, *p);
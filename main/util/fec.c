@@ -1,4 +1,6 @@
+#include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
 
 #include "util/macros.h"
 
@@ -29,6 +31,68 @@ static const uint8_t codes[128] = {
     0xfe, 0xee, 0xee, 0xee, 0xe6, 0xae, 0xce, 0xee,
     0xff, 0xff, 0xff, 0xfe, 0xff, 0xfd, 0xfb, 0x7f};
 
+static const fec_t fec_nibble = {
+    .type = FEC_TYPE_NIBBLE,
+};
+
+const fec_t *FEC_NIBBLE = &fec_nibble;
+
+// GF(256) with the 0x11d polynomial. The exponents table is repeated
+// so products can be looked up without reducing the sum of logs.
+static const uint8_t gf_exp[512] = {
+    0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1d, 0x3a, 0x74, 0xe8, 0xcd, 0x87, 0x13, 0x26,
+    0x4c, 0x98, 0x2d, 0x5a, 0xb4, 0x75, 0xea, 0xc9, 0x8f, 0x03, 0x06, 0x0c, 0x18, 0x30, 0x60, 0xc0,
+    0x9d, 0x27, 0x4e, 0x9c, 0x25, 0x4a, 0x94, 0x35, 0x6a, 0xd4, 0xb5, 0x77, 0xee, 0xc1, 0x9f, 0x23,
+    0x46, 0x8c, 0x05, 0x0a, 0x14, 0x28, 0x50, 0xa0, 0x5d, 0xba, 0x69, 0xd2, 0xb9, 0x6f, 0xde, 0xa1,
+    0x5f, 0xbe, 0x61, 0xc2, 0x99, 0x2f, 0x5e, 0xbc, 0x65, 0xca, 0x89, 0x0f, 0x1e, 0x3c, 0x78, 0xf0,
+    0xfd, 0xe7, 0xd3, 0xbb, 0x6b, 0xd6, 0xb1, 0x7f, 0xfe, 0xe1, 0xdf, 0xa3, 0x5b, 0xb6, 0x71, 0xe2,
+    0xd9, 0xaf, 0x43, 0x86, 0x11, 0x22, 0x44, 0x88, 0x0d, 0x1a, 0x34, 0x68, 0xd0, 0xbd, 0x67, 0xce,
+    0x81, 0x1f, 0x3e, 0x7c, 0xf8, 0xed, 0xc7, 0x93, 0x3b, 0x76, 0xec, 0xc5, 0x97, 0x33, 0x66, 0xcc,
+    0x85, 0x17, 0x2e, 0x5c, 0xb8, 0x6d, 0xda, 0xa9, 0x4f, 0x9e, 0x21, 0x42, 0x84, 0x15, 0x2a, 0x54,
+    0xa8, 0x4d, 0x9a, 0x29, 0x52, 0xa4, 0x55, 0xaa, 0x49, 0x92, 0x39, 0x72, 0xe4, 0xd5, 0xb7, 0x73,
+    0xe6, 0xd1, 0xbf, 0x63, 0xc6, 0x91, 0x3f, 0x7e, 0xfc, 0xe5, 0xd7, 0xb3, 0x7b, 0xf6, 0xf1, 0xff,
+    0xe3, 0xdb, 0xab, 0x4b, 0x96, 0x31, 0x62, 0xc4, 0x95, 0x37, 0x6e, 0xdc, 0xa5, 0x57, 0xae, 0x41,
+    0x82, 0x19, 0x32, 0x64, 0xc8, 0x8d, 0x07, 0x0e, 0x1c, 0x38, 0x70, 0xe0, 0xdd, 0xa7, 0x53, 0xa6,
+    0x51, 0xa2, 0x59, 0xb2, 0x79, 0xf2, 0xf9, 0xef, 0xc3, 0x9b, 0x2b, 0x56, 0xac, 0x45, 0x8a, 0x09,
+    0x12, 0x24, 0x48, 0x90, 0x3d, 0x7a, 0xf4, 0xf5, 0xf7, 0xf3, 0xfb, 0xeb, 0xcb, 0x8b, 0x0b, 0x16,
+    0x2c, 0x58, 0xb0, 0x7d, 0xfa, 0xe9, 0xcf, 0x83, 0x1b, 0x36, 0x6c, 0xd8, 0xad, 0x47, 0x8e, 0x01,
+    0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1d, 0x3a, 0x74, 0xe8, 0xcd, 0x87, 0x13, 0x26, 0x4c,
+    0x98, 0x2d, 0x5a, 0xb4, 0x75, 0xea, 0xc9, 0x8f, 0x03, 0x06, 0x0c, 0x18, 0x30, 0x60, 0xc0, 0x9d,
+    0x27, 0x4e, 0x9c, 0x25, 0x4a, 0x94, 0x35, 0x6a, 0xd4, 0xb5, 0x77, 0xee, 0xc1, 0x9f, 0x23, 0x46,
+    0x8c, 0x05, 0x0a, 0x14, 0x28, 0x50, 0xa0, 0x5d, 0xba, 0x69, 0xd2, 0xb9, 0x6f, 0xde, 0xa1, 0x5f,
+    0xbe, 0x61, 0xc2, 0x99, 0x2f, 0x5e, 0xbc, 0x65, 0xca, 0x89, 0x0f, 0x1e, 0x3c, 0x78, 0xf0, 0xfd,
+    0xe7, 0xd3, 0xbb, 0x6b, 0xd6, 0xb1, 0x7f, 0xfe, 0xe1, 0xdf, 0xa3, 0x5b, 0xb6, 0x71, 0xe2, 0xd9,
+    0xaf, 0x43, 0x86, 0x11, 0x22, 0x44, 0x88, 0x0d, 0x1a, 0x34, 0x68, 0xd0, 0xbd, 0x67, 0xce, 0x81,
+    0x1f, 0x3e, 0x7c, 0xf8, 0xed, 0xc7, 0x93, 0x3b, 0x76, 0xec, 0xc5, 0x97, 0x33, 0x66, 0xcc, 0x85,
+    0x17, 0x2e, 0x5c, 0xb8, 0x6d, 0xda, 0xa9, 0x4f, 0x9e, 0x21, 0x42, 0x84, 0x15, 0x2a, 0x54, 0xa8,
+    0x4d, 0x9a, 0x29, 0x52, 0xa4, 0x55, 0xaa, 0x49, 0x92, 0x39, 0x72, 0xe4, 0xd5, 0xb7, 0x73, 0xe6,
+    0xd1, 0xbf, 0x63, 0xc6, 0x91, 0x3f, 0x7e, 0xfc, 0xe5, 0xd7, 0xb3, 0x7b, 0xf6, 0xf1, 0xff, 0xe3,
+    0xdb, 0xab, 0x4b, 0x96, 0x31, 0x62, 0xc4, 0x95, 0x37, 0x6e, 0xdc, 0xa5, 0x57, 0xae, 0x41, 0x82,
+    0x19, 0x32, 0x64, 0xc8, 0x8d, 0x07, 0x0e, 0x1c, 0x38, 0x70, 0xe0, 0xdd, 0xa7, 0x53, 0xa6, 0x51,
+    0xa2, 0x59, 0xb2, 0x79, 0xf2, 0xf9, 0xef, 0xc3, 0x9b, 0x2b, 0x56, 0xac, 0x45, 0x8a, 0x09, 0x12,
+    0x24, 0x48, 0x90, 0x3d, 0x7a, 0xf4, 0xf5, 0xf7, 0xf3, 0xfb, 0xeb, 0xcb, 0x8b, 0x0b, 0x16, 0x2c,
+    0x58, 0xb0, 0x7d, 0xfa, 0xe9, 0xcf, 0x83, 0x1b, 0x36, 0x6c, 0xd8, 0xad, 0x47, 0x8e, 0x01, 0x02,
+};
+
+static const uint8_t gf_log[256] = {
+    0x00, 0x00, 0x01, 0x19, 0x02, 0x32, 0x1a, 0xc6, 0x03, 0xdf, 0x33, 0xee, 0x1b, 0x68, 0xc7, 0x4b,
+    0x04, 0x64, 0xe0, 0x0e, 0x34, 0x8d, 0xef, 0x81, 0x1c, 0xc1, 0x69, 0xf8, 0xc8, 0x08, 0x4c, 0x71,
+    0x05, 0x8a, 0x65, 0x2f, 0xe1, 0x24, 0x0f, 0x21, 0x35, 0x93, 0x8e, 0xda, 0xf0, 0x12, 0x82, 0x45,
+    0x1d, 0xb5, 0xc2, 0x7d, 0x6a, 0x27, 0xf9, 0xb9, 0xc9, 0x9a, 0x09, 0x78, 0x4d, 0xe4, 0x72, 0xa6,
+    0x06, 0xbf, 0x8b, 0x62, 0x66, 0xdd, 0x30, 0xfd, 0xe2, 0x98, 0x25, 0xb3, 0x10, 0x91, 0x22, 0x88,
+    0x36, 0xd0, 0x94, 0xce, 0x8f, 0x96, 0xdb, 0xbd, 0xf1, 0xd2, 0x13, 0x5c, 0x83, 0x38, 0x46, 0x40,
+    0x1e, 0x42, 0xb6, 0xa3, 0xc3, 0x48, 0x7e, 0x6e, 0x6b, 0x3a, 0x28, 0x54, 0xfa, 0x85, 0xba, 0x3d,
+    0xca, 0x5e, 0x9b, 0x9f, 0x0a, 0x15, 0x79, 0x2b, 0x4e, 0xd4, 0xe5, 0xac, 0x73, 0xf3, 0xa7, 0x57,
+    0x07, 0x70, 0xc0, 0xf7, 0x8c, 0x80, 0x63, 0x0d, 0x67, 0x4a, 0xde, 0xed, 0x31, 0xc5, 0xfe, 0x18,
+    0xe3, 0xa5, 0x99, 0x77, 0x26, 0xb8, 0xb4, 0x7c, 0x11, 0x44, 0x92, 0xd9, 0x23, 0x20, 0x89, 0x2e,
+    0x37, 0x3f, 0xd1, 0x5b, 0x95, 0xbc, 0xcf, 0xcd, 0x90, 0x87, 0x97, 0xb2, 0xdc, 0xfc, 0xbe, 0x61,
+    0xf2, 0x56, 0xd3, 0xab, 0x14, 0x2a, 0x5d, 0x9e, 0x84, 0x3c, 0x39, 0x53, 0x47, 0x6d, 0x41, 0xa2,
+    0x1f, 0x2d, 0x43, 0xd8, 0xb7, 0x7b, 0xa4, 0x76, 0xc4, 0x17, 0x49, 0xec, 0x7f, 0x0c, 0x6f, 0xf6,
+    0x6c, 0xa1, 0x3b, 0x52, 0x29, 0x9d, 0x55, 0xaa, 0xfb, 0x60, 0x86, 0xb1, 0xbb, 0xcc, 0x3e, 0x5a,
+    0xcb, 0x59, 0x5f, 0xb0, 0x9c, 0xa9, 0xa0, 0x51, 0x0b, 0xf5, 0x16, 0xeb, 0x7a, 0x75, 0x2c, 0xd7,
+    0x4f, 0xae, 0xd5, 0xe9, 0xe6, 0xe7, 0xad, 0xe8, 0x74, 0xd6, 0xf4, 0xea, 0xa8, 0x50, 0x58, 0xaf,
+};
+
 static uint8_t fec_encode_nibble(uint8_t b)
 {
     assert(b < ARRAY_COUNT(symbols));
@@ -41,13 +105,8 @@ static uint8_t fec_decode_byte(uint8_t b)
     return ((b & 0x01) ? (d & 0x0f) : (d >> 4));
 }
 
-size_t fec_encode(const void *data, size_t size, void *output, size_t output_size)
+static size_t fec_nibble_encode(const void *data, size_t size, void *output)
 {
-    size_t total = FEC_ENCODED_SIZE(size);
-    if (output_size < total)
-    {
-        return 0;
-    }
     const uint8_t *input = data;
     uint8_t *ptr = output;
     for (size_t ii = 0; ii < size; ii++)
@@ -55,16 +114,11 @@ size_t fec_encode(const void *data, size_t size, void *output, size_t output_siz
         ptr[2 * ii] = fec_encode_nibble(input[ii] >> 4);
         ptr[2 * ii + 1] = fec_encode_nibble(input[ii] & 0xf);
     }
-    return total;
+    return size * 2;
 }
 
-size_t fec_decode(const void *data, size_t size, void *output, size_t output_size)
+static size_t fec_nibble_decode(const void *data, size_t size, void *output)
 {
-    size_t total = FEC_DECODED_SIZE(size);
-    if (output_size < total)
-    {
-        return 0;
-    }
     const uint8_t *input = data;
     uint8_t *ptr = output;
     for (size_t ii = 0; ii < size; ii += 2)
@@ -72,5 +126,310 @@ size_t fec_decode(const void *data, size_t size, void *output, size_t output_siz
         ptr[ii / 2] = fec_decode_byte(input[ii]) << 4;
         ptr[ii / 2] |= fec_decode_byte(input[ii + 1]);
     }
-    return total;
-}
\ No newline at end of file
+    return size / 2;
+}
+
+static uint8_t gf_mul(uint8_t a, uint8_t b)
+{
+    if (a == 0 || b == 0)
+    {
+        return 0;
+    }
+    return gf_exp[gf_log[a] + gf_log[b]];
+}
+
+static uint8_t gf_div(uint8_t a, uint8_t b)
+{
+    if (a == 0)
+    {
+        return 0;
+    }
+    return gf_exp[gf_log[a] + 255 - gf_log[b]];
+}
+
+// Evaluates the polynomial p of the given degree, with the lowest
+// degree coefficient first, at x.
+static uint8_t gf_poly_eval(const uint8_t *p, int degree, uint8_t x)
+{
+    uint8_t y = p[degree];
+    for (int ii = degree - 1; ii >= 0; ii--)
+    {
+        y = gf_mul(y, x) ^ p[ii];
+    }
+    return y;
+}
+
+// Codewords are the data followed by the parity bytes. The byte at index
+// ii is the coefficient of x^(size - 1 - ii), and the generator polynomial
+// has alpha^0...alpha^(parity_bytes - 1) as its roots.
+static size_t fec_reed_solomon_encode(const void *data, size_t size, void *output, unsigned parity_bytes)
+{
+    // Generator polynomial, highest degree coefficient first
+    uint8_t gen[FEC_REED_SOLOMON_MAX_PARITY_BYTES + 1];
+    gen[0] = 1;
+    for (unsigned ii = 0; ii < parity_bytes; ii++)
+    {
+        // Multiply by (x - alpha^ii)
+        gen[ii + 1] = 0;
+        for (unsigned jj = ii + 1; jj > 0; jj--)
+        {
+            gen[jj] ^= gf_mul(gen[jj - 1], gf_exp[ii]);
+        }
+    }
+
+    uint8_t *ptr = output;
+    uint8_t *parity = ptr + size;
+    memmove(ptr, data, size);
+    memset(parity, 0, parity_bytes);
+    for (size_t ii = 0; ii < size; ii++)
+    {
+        uint8_t feedback = ptr[ii] ^ parity[0];
+        memmove(parity, parity + 1, parity_bytes - 1);
+        parity[parity_bytes - 1] = 0;
+        if (feedback != 0)
+        {
+            for (unsigned jj = 0; jj < parity_bytes; jj++)
+            {
+                parity[jj] ^= gf_mul(feedback, gen[jj + 1]);
+            }
+        }
+    }
+    return size + parity_bytes;
+}
+
+// Corrects the codeword in place using errors-and-erasures decoding
+// (Berlekamp-Massey initialized with the erasure locator, then Chien
+// search and Forney). Returns false if the errors can't be corrected.
+static bool fec_reed_solomon_correct(uint8_t *code, size_t size, unsigned parity_bytes, const uint8_t *erasures, size_t erasures_count)
+{
+    uint8_t synd[FEC_REED_SOLOMON_MAX_PARITY_BYTES];
+    bool has_errors = false;
+    for (unsigned ii = 0; ii < parity_bytes; ii++)
+    {
+        uint8_t s = 0;
+        for (size_t jj = 0; jj < size; jj++)
+        {
+            s = gf_mul(s, gf_exp[ii]) ^ code[jj];
+        }
+        synd[ii] = s;
+        has_errors |= s != 0;
+    }
+    if (!has_errors)
+    {
+        return true;
+    }
+    if (erasures_count > parity_bytes)
+    {
+        return false;
+    }
+
+    // Polynomials here have the lowest degree coefficient first
+    uint8_t lambda[FEC_REED_SOLOMON_MAX_PARITY_BYTES + 1];
+    uint8_t prev[FEC_REED_SOLOMON_MAX_PARITY_BYTES + 2];
+    uint8_t tmp[FEC_REED_SOLOMON_MAX_PARITY_BYTES + 1];
+    memset(lambda, 0, sizeof(lambda));
+    lambda[0] = 1;
+    // Erasure locator, the product of (1 - X * x) for each erasure
+    for (size_t ii = 0; ii < erasures_count; ii++)
+    {
+        if (erasures[ii] >= size)
+        {
+            return false;
+        }
+        uint8_t x = gf_exp[size - 1 - erasures[ii]];
+        for (size_t jj = ii + 1; jj > 0; jj--)
+        {
+            lambda[jj] ^= gf_mul(lambda[jj - 1], x);
+        }
+    }
+    memcpy(prev, lambda, sizeof(lambda));
+    unsigned len = erasures_count;
+    for (unsigned rr = erasures_count; rr < parity_bytes; rr++)
+    {
+        uint8_t delta = 0;
+        for (unsigned ii = 0; ii <= len; ii++)
+        {
+            delta ^= gf_mul(lambda[ii], synd[rr - ii]);
+        }
+        // prev *= x
+        memmove(prev + 1, prev, parity_bytes);
+        prev[0] = 0;
+        if (delta != 0)
+        {
+            for (unsigned ii = 0; ii <= parity_bytes; ii++)
+            {
+                tmp[ii] = lambda[ii] ^ gf_mul(delta, prev[ii]);
+            }
+            if (2 * len <= rr + erasures_count)
+            {
+                for (unsigned ii = 0; ii <= parity_bytes; ii++)
+                {
+                    prev[ii] = gf_div(lambda[ii], delta);
+                }
+                len = rr + 1 + erasures_count - len;
+            }
+            memcpy(lambda, tmp, parity_bytes + 1);
+        }
+    }
+    if (2 * len > parity_bytes + erasures_count)
+    {
+        return false;
+    }
+
+    // Error evaluator, omega = synd * lambda mod x^parity_bytes
+    uint8_t omega[FEC_REED_SOLOMON_MAX_PARITY_BYTES];
+    for (unsigned ii = 0; ii < parity_bytes; ii++)
+    {
+        uint8_t v = 0;
+        for (unsigned jj = 0; jj <= ii && jj <= len; jj++)
+        {
+            v ^= gf_mul(lambda[jj], synd[ii - jj]);
+        }
+        omega[ii] = v;
+    }
+
+    // Chien search for the roots of lambda, correcting each error as
+    // we find it.
+    unsigned found = 0;
+    for (size_t ii = 0; ii < size && found < len; ii++)
+    {
+        unsigned power = size - 1 - ii;
+        uint8_t x_inv = gf_exp[255 - power];
+        if (gf_poly_eval(lambda, len, x_inv) != 0)
+        {
+            continue;
+        }
+        // Formal derivative of lambda, evaluated at x_inv. Only the odd
+        // powers remain in characteristic 2.
+        uint8_t x_inv2 = gf_mul(x_inv, x_inv);
+        uint8_t x_inv2n = 1;
+        uint8_t denom = 0;
+        for (unsigned jj = 1; jj <= len; jj += 2)
+        {
+            denom ^= gf_mul(lambda[jj], x_inv2n);
+            x_inv2n = gf_mul(x_inv2n, x_inv2);
+        }
+        if (denom == 0)
+        {
+            return false;
+        }
+        uint8_t num = gf_mul(gf_exp[power], gf_poly_eval(omega, parity_bytes - 1, x_inv));
+        code[ii] ^= gf_div(num, denom);
+        found++;
+    }
+    return found == len;
+}
+
+size_t fec_encoded_size(const fec_t *fec, size_t size)
+{
+    switch (fec->type)
+    {
+    case FEC_TYPE_NIBBLE:
+        return size * 2;
+    case FEC_TYPE_REED_SOLOMON:
+        return size + fec->parity_bytes;
+    }
+    return 0;
+}
+
+size_t fec_decoded_size(const fec_t *fec, size_t size)
+{
+    switch (fec->type)
+    {
+    case FEC_TYPE_NIBBLE:
+        return size / 2;
+    case FEC_TYPE_REED_SOLOMON:
+        return size > fec->parity_bytes ? size - fec->parity_bytes : 0;
+    }
+    return 0;
+}
+
+// Transposes the bits of the encoded data, so the bits sent consecutively
+// come from different bytes. A burst of up to size bits then flips at most
+// one bit of each byte.
+static void fec_interleave(const uint8_t *data, uint8_t *output, size_t size, bool reverse)
+{
+    memset(output, 0, size);
+    for (size_t ii = 0; ii < size * 8; ii++)
+    {
+        size_t jj = (ii % 8) * size + ii / 8;
+        size_t src = reverse ? jj : ii;
+        size_t dst = reverse ? ii : jj;
+        if (data[src / 8] & (0x80 >> (src % 8)))
+        {
+            output[dst / 8] |= 0x80 >> (dst % 8);
+        }
+    }
+}
+
+static size_t fec_encode_code(const fec_t *fec, const void *data, size_t size, void *output)
+{
+    switch (fec->type)
+    {
+    case FEC_TYPE_NIBBLE:
+        return fec_nibble_encode(data, size, output);
+    case FEC_TYPE_REED_SOLOMON:
+        assert(fec->parity_bytes <= FEC_REED_SOLOMON_MAX_PARITY_BYTES);
+        assert(size + fec->parity_bytes <= FEC_REED_SOLOMON_MAX_ENCODED_SIZE);
+        return fec_reed_solomon_encode(data, size, output, fec->parity_bytes);
+    }
+    return 0;
+}
+
+static size_t fec_decode_code(const fec_t *fec, const void *data, size_t size, void *output,
+                              const uint8_t *erasures, size_t erasures_count)
+{
+    switch (fec->type)
+    {
+    case FEC_TYPE_NIBBLE:
+        return fec_nibble_decode(data, size, output);
+    case FEC_TYPE_REED_SOLOMON:
+    {
+        size_t total = fec_decoded_size(fec, size);
+        if (total == 0 || size > FEC_REED_SOLOMON_MAX_ENCODED_SIZE)
+        {
+            return 0;
+        }
+        uint8_t code[size];
+        memcpy(code, data, size);
+        bool ok = fec_reed_solomon_correct(code, size, fec->parity_bytes, erasures, erasures_count);
+        memcpy(output, code, total);
+        return ok ? total : 0;
+    }
+    }
+    return 0;
+}
+
+size_t fec_encode(const fec_t *fec, const void *data, size_t size, void *output, size_t output_size)
+{
+    size_t total = fec_encoded_size(fec, size);
+    if (output_size < total)
+    {
+        return 0;
+    }
+    if (fec->interleaved)
+    {
+        uint8_t code[total];
+        size_t code_size = fec_encode_code(fec, data, size, code);
+        fec_interleave(code, output, code_size, false);
+        return code_size;
+    }
+    return fec_encode_code(fec, data, size, output);
+}
+
+size_t fec_decode(const fec_t *fec, const void *data, size_t size, void *output, size_t output_size,
+                  const uint8_t *erasures, size_t erasures_count)
+{
+    size_t total = fec_decoded_size(fec, size);
+    if (output_size < total)
+    {
+        return 0;
+    }
+    if (fec->interleaved)
+    {
+        uint8_t code[size];
+        fec_interleave(data, code, size, true);
+        return fec_decode_code(fec, code, size, output, erasures, erasures_count);
+    }
+    return fec_decode_code(fec, data, size, output, erasures, erasures_count);
+}
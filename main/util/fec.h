@@ -1,9 +1,48 @@
 #pragma once
 
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
-#define FEC_ENCODED_SIZE(x) (2 * x)
-#define FEC_DECODED_SIZE(x) (x / 2)
+#define FEC_REED_SOLOMON_MAX_PARITY_BYTES 32
+// Codewords (data + parity) can't be longer than the GF(256) field size
+#define FEC_REED_SOLOMON_MAX_ENCODED_SIZE 255
 
-size_t fec_encode(const void *data, size_t size, void *output, size_t output_size);
-size_t fec_decode(const void *data, size_t size, void *output, size_t output_size);
\ No newline at end of file
+typedef enum
+{
+    // Maps each nibble to an 8 bit symbol, correcting isolated bit
+    // errors. Doubles the size of the data.
+    FEC_TYPE_NIBBLE = 1,
+    // Shortened Reed-Solomon code over GF(256). Appends parity_bytes to
+    // the data and corrects up to parity_bytes / 2 wrong bytes, or up to
+    // parity_bytes bytes when their positions are known (erasures).
+    FEC_TYPE_REED_SOLOMON,
+} fec_type_e;
+
+typedef struct fec_s
+{
+    fec_type_e type;
+    uint8_t parity_bytes; // Only used by FEC_TYPE_REED_SOLOMON
+    // Interleave the bits of the encoded data, so a burst of errors
+    // hits many symbols once rather than a few of them many times.
+    // Useful for FEC_TYPE_NIBBLE, which corrects a single bit per symbol.
+    bool interleaved;
+} fec_t;
+
+extern const fec_t *FEC_NIBBLE;
+
+size_t fec_encoded_size(const fec_t *fec, size_t size);
+size_t fec_decoded_size(const fec_t *fec, size_t size);
+
+// Returns the encoded size or 0 if output_size is too small.
+size_t fec_encode(const fec_t *fec, const void *data, size_t size, void *output, size_t output_size);
+// Returns the decoded size or 0 if output_size is too small or the errors
+// couldn't be corrected. erasures contains the indexes of the bytes in data
+// (after removing the interleaving) which are known to be unreliable, e.g.
+// because the demodulator flagged them. It's only used by
+// FEC_TYPE_REED_SOLOMON, pass NULL if there are no hints. Codes which
+// don't detect failures always fill the output, while for
+// FEC_TYPE_REED_SOLOMON the output contains the uncorrected data bytes
+// if decoding fails.
+size_t fec_decode(const fec_t *fec, const void *data, size_t size, void *output, size_t output_size,
+                  const uint8_t *erasures, size_t erasures_count);
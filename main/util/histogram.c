@@ -0,0 +1,39 @@
+#include <string.h>
+
+#include "util/macros.h"
+
+#include "histogram.h"
+
+void histogram_init(histogram_t *h)
+{
+    memset(h, 0, sizeof(*h));
+}
+
+void histogram_add(histogram_t *h, uint32_t value)
+{
+    unsigned bucket = value ? 32 - __builtin_clz(value) : 0;
+    h->buckets[MIN(bucket, HISTOGRAM_NUM_BUCKETS - 1)]++;
+    h->count++;
+    h->max = MAX(h->max, value);
+}
+
+uint32_t histogram_bucket_min(unsigned bucket)
+{
+    return bucket ? 1u << (bucket - 1) : 0;
+}
+
+uint32_t histogram_percentile(const histogram_t *h, unsigned pct)
+{
+    // Round up, so e.g. the 99th percentile of 10 values is the 10th
+    uint32_t target = ((uint64_t)h->count * pct + 99) / 100;
+    uint32_t seen = 0;
+    for (unsigned ii = 0; ii < HISTOGRAM_NUM_BUCKETS - 1; ii++)
+    {
+        seen += h->buckets[ii];
+        if (seen >= target)
+        {
+            return MIN(h->max, histogram_bucket_min(ii + 1) - 1);
+        }
+    }
+    return h->max;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdint.h>
+
+// Histogram with power of 2 buckets. Bucket 0 counts zeros and bucket
+// n > 0 counts the values in [2^(n-1), 2^n), except the last one which
+// also counts all the values too big for the rest.
+#define HISTOGRAM_NUM_BUCKETS 16
+
+typedef struct histogram_s
+{
+    uint32_t buckets[HISTOGRAM_NUM_BUCKETS];
+    uint32_t count;
+    uint32_t max;
+} histogram_t;
+
+void histogram_init(histogram_t *h);
+void histogram_add(histogram_t *h, uint32_t value);
+// Returns the smallest value that would be counted in the given bucket
+uint32_t histogram_bucket_min(unsigned bucket);
+// Returns an upper bound for the given percentile (0-100) of the added
+// values, rounded up to the end of its bucket. Returns 0 if empty.
+uint32_t histogram_percentile(const histogram_t *h, unsigned pct);
@@ -0,0 +1,57 @@
+#include <string.h>
+
+#include "util/macros.h"
+
+#include "profiler.h"
+
+#if defined(PROFILER_VIRTUAL_COUNTER)
+profiler_cycles_t profiler_virtual_cycles;
+uint32_t profiler_virtual_cycles_per_micro = 1;
+#endif
+
+uint32_t profiler_cycles_to_ns(uint64_t cycles)
+{
+    uint64_t ns = cycles * 1000 / MAX(1, profiler_cycles_per_micro());
+    return MIN(ns, UINT32_MAX);
+}
+
+void profiler_stats_init(profiler_stats_t *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    stats->min = UINT32_MAX;
+    histogram_init(&stats->histogram);
+}
+
+profiler_cycles_t profiler_stats_add_since(profiler_stats_t *stats, profiler_cycles_t start)
+{
+    profiler_cycles_t now = profiler_cycles_now();
+    // Unsigned arithmetic handles the wrap around
+    profiler_stats_add(stats, now - start);
+    return now;
+}
+
+void profiler_stats_add(profiler_stats_t *stats, profiler_cycles_t cycles)
+{
+    stats->count++;
+    stats->min = MIN(stats->min, cycles);
+    stats->max = MAX(stats->max, cycles);
+    stats->sum += cycles;
+    histogram_add(&stats->histogram, cycles >> PROFILER_HISTOGRAM_SHIFT);
+}
+
+bool profiler_stats_get_report(const profiler_stats_t *stats, profiler_report_t *report)
+{
+    if (stats->count == 0)
+    {
+        return false;
+    }
+    report->count = stats->count;
+    report->min = profiler_cycles_to_ns(stats->min);
+    report->avg = profiler_cycles_to_ns(stats->sum / stats->count);
+    report->max = profiler_cycles_to_ns(stats->max);
+    // The histogram percentile is the last value in its bucket,
+    // so include the cycles dropped by the shift.
+    uint64_t p99 = ((uint64_t)histogram_percentile(&stats->histogram, 99) + 1) << PROFILER_HISTOGRAM_SHIFT;
+    report->p99 = profiler_cycles_to_ns(MIN(p99 - 1, stats->max));
+    return true;
+}
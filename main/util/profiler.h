@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#if !defined(PROFILER_VIRTUAL_COUNTER)
+#include <hal/cycles.h>
+#endif
+
+#include "util/histogram.h"
+
+// Lightweight accounting of the CPU cycles spent in a section of
+// code, using the cycle counter of the CPU. Since the counter wraps
+// around in a few seconds, it's only suitable for short sections.
+// Host builds can define PROFILER_VIRTUAL_COUNTER to drive the
+// counter manually, see profiler_virtual_advance().
+
+// Cycles are shifted right by this before being added to the
+// histogram, so it covers a few ms before its last bucket.
+#define PROFILER_HISTOGRAM_SHIFT 6
+
+typedef uint32_t profiler_cycles_t;
+
+typedef struct profiler_stats_s
+{
+    uint32_t count;
+    profiler_cycles_t min;
+    profiler_cycles_t max;
+    uint64_t sum;
+    histogram_t histogram; // In units of 1 << PROFILER_HISTOGRAM_SHIFT cycles
+} profiler_stats_t;
+
+// All times in ns
+typedef struct profiler_report_s
+{
+    uint32_t count;
+    uint32_t min;
+    uint32_t avg;
+    uint32_t max;
+    uint32_t p99; // Rounded up to the end of its histogram bucket
+} profiler_report_t;
+
+#if defined(PROFILER_VIRTUAL_COUNTER)
+extern profiler_cycles_t profiler_virtual_cycles;
+extern uint32_t profiler_virtual_cycles_per_micro;
+
+inline void profiler_virtual_advance(profiler_cycles_t cycles) { profiler_virtual_cycles += cycles; }
+inline void profiler_cycles_init(void) {}
+inline profiler_cycles_t profiler_cycles_now(void) { return profiler_virtual_cycles; }
+inline uint32_t profiler_cycles_per_micro(void) { return profiler_virtual_cycles_per_micro; }
+#else
+inline void profiler_cycles_init(void) { hal_cycles_init(); }
+inline profiler_cycles_t profiler_cycles_now(void) { return hal_cycles_now(); }
+inline uint32_t profiler_cycles_per_micro(void) { return hal_cycles_per_micro(); }
+#endif
+
+uint32_t profiler_cycles_to_ns(uint64_t cycles);
+
+void profiler_stats_init(profiler_stats_t *stats);
+// Adds the cycles from start until now and returns now, so
+// consecutive sections can be chained without reading the counter
+// twice.
+profiler_cycles_t profiler_stats_add_since(profiler_stats_t *stats, profiler_cycles_t start);
+void profiler_stats_add(profiler_stats_t *stats, profiler_cycles_t cycles);
+// Returns false if no cycles have been added to stats
+bool profiler_stats_get_report(const profiler_stats_t *stats, profiler_report_t *report);
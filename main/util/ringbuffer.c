@@ -1,7 +1,39 @@
 #include <string.h>
 
+#include "util/macros.h"
+
 #include "ringbuffer.h"
 
+static void *ring_buffer_advance(const ring_buffer_t *rb, void *ptr, size_t n)
+{
+    char *p = (char *)ptr + n * rb->sz;
+    if (p >= (char *)rb->buffer_end)
+    {
+        p -= (char *)rb->buffer_end - (char *)rb->buffer;
+    }
+    return p;
+}
+
+// Splits the n elements starting at ptr into at most 2 contiguous spans
+static size_t ring_buffer_spans(const ring_buffer_t *rb, void *ptr, size_t n, ring_buffer_span_t *spans)
+{
+    if (n == 0)
+    {
+        return 0;
+    }
+    size_t until_end = ((char *)rb->buffer_end - (char *)ptr) / rb->sz;
+    spans[0].ptr = ptr;
+    if (n <= until_end)
+    {
+        spans[0].count = n;
+        return 1;
+    }
+    spans[0].count = until_end;
+    spans[1].ptr = rb->buffer;
+    spans[1].count = n - until_end;
+    return 2;
+}
+
 bool ring_buffer_really_push(ring_buffer_t *rb, const void *item, bool force)
 {
     if (rb->count == rb->capacity)
@@ -71,12 +103,79 @@ bool ring_buffer_discard(ring_buffer_t *rb)
 
 void ring_buffer_empty(ring_buffer_t *rb)
 {
-    while (ring_buffer_discard(rb))
-    {
-    }
+    rb->head = rb->buffer;
+    rb->tail = rb->buffer;
+    rb->count = 0;
 }
 
 size_t ring_buffer_count(const ring_buffer_t *rb)
 {
     return rb->count;
+}
+
+size_t ring_buffer_free(const ring_buffer_t *rb)
+{
+    return rb->capacity - rb->count;
+}
+
+bool ring_buffer_push_n(ring_buffer_t *rb, const void *items, size_t n)
+{
+    if (n > ring_buffer_free(rb))
+    {
+        return false;
+    }
+    ring_buffer_span_t spans[RING_BUFFER_MAX_SPANS];
+    size_t ns = ring_buffer_spans(rb, rb->head, n, spans);
+    const char *p = items;
+    for (size_t ii = 0; ii < ns; ii++)
+    {
+        size_t size = spans[ii].count * rb->sz;
+        memcpy(spans[ii].ptr, p, size);
+        p += size;
+    }
+    ring_buffer_commit(rb, n);
+    return true;
+}
+
+size_t ring_buffer_pop_n(ring_buffer_t *rb, void *items, size_t n)
+{
+    n = MIN(n, rb->count);
+    if (items != NULL)
+    {
+        ring_buffer_span_t spans[RING_BUFFER_MAX_SPANS];
+        size_t ns = ring_buffer_spans(rb, rb->tail, n, spans);
+        char *p = items;
+        for (size_t ii = 0; ii < ns; ii++)
+        {
+            size_t size = spans[ii].count * rb->sz;
+            memcpy(p, spans[ii].ptr, size);
+            p += size;
+        }
+    }
+    ring_buffer_consume(rb, n);
+    return n;
+}
+
+size_t ring_buffer_reserve(ring_buffer_t *rb, ring_buffer_span_t spans[RING_BUFFER_MAX_SPANS])
+{
+    return ring_buffer_spans(rb, rb->head, ring_buffer_free(rb), spans);
+}
+
+void ring_buffer_commit(ring_buffer_t *rb, size_t n)
+{
+    ASSERT(n <= ring_buffer_free(rb));
+    rb->head = ring_buffer_advance(rb, rb->head, n);
+    rb->count += n;
+}
+
+size_t ring_buffer_peek_span(ring_buffer_t *rb, ring_buffer_span_t spans[RING_BUFFER_MAX_SPANS])
+{
+    return ring_buffer_spans(rb, rb->tail, rb->count, spans);
+}
+
+void ring_buffer_consume(ring_buffer_t *rb, size_t n)
+{
+    n = MIN(n, rb->count);
+    rb->tail = ring_buffer_advance(rb, rb->tail, n);
+    rb->count -= n;
 }
\ No newline at end of file
@@ -38,6 +38,19 @@ typedef struct ring_buffer_s
     unsigned char buffer_ptr[];
 } ring_buffer_t;
 
+// Maximum number of spans returned by ring_buffer_reserve() and
+// ring_buffer_peek_span(). Since data might wrap around the end of
+// the backing storage, a region might be split in two.
+#define RING_BUFFER_MAX_SPANS 2
+
+// A contiguous region inside the ring buffer storage. Note that count
+// is expressed in elements, not in bytes.
+typedef struct ring_buffer_span_s
+{
+    void *ptr;
+    size_t count;
+} ring_buffer_span_t;
+
 bool ring_buffer_push(ring_buffer_t *rb, const void *item);
 bool ring_buffer_force_push(ring_buffer_t *rb, const void *item);
 bool ring_buffer_pop(ring_buffer_t *rb, void *item);
@@ -45,3 +58,23 @@ bool ring_buffer_peek(ring_buffer_t *rb, void *item);
 bool ring_buffer_discard(ring_buffer_t *rb);
 void ring_buffer_empty(ring_buffer_t *rb);
 size_t ring_buffer_count(const ring_buffer_t *rb);
+size_t ring_buffer_free(const ring_buffer_t *rb);
+
+// Bulk operations. ring_buffer_push_n() pushes either all the items or
+// none of them, while ring_buffer_pop_n() pops up to n items (items might
+// be NULL to discard them) and returns the number of items popped.
+bool ring_buffer_push_n(ring_buffer_t *rb, const void *items, size_t n);
+size_t ring_buffer_pop_n(ring_buffer_t *rb, void *items, size_t n);
+
+// Zero-copy writes. ring_buffer_reserve() fills spans with the free space
+// in the buffer and returns the number of spans used. Callers write directly
+// into them and then call ring_buffer_commit() with the number of elements
+// written, which must be <= the total count in the reserved spans.
+size_t ring_buffer_reserve(ring_buffer_t *rb, ring_buffer_span_t spans[RING_BUFFER_MAX_SPANS]);
+void ring_buffer_commit(ring_buffer_t *rb, size_t n);
+
+// Zero-copy reads. ring_buffer_peek_span() fills spans with the data stored
+// in the buffer (oldest first) and returns the number of spans used. Once the
+// data has been processed, callers remove it with ring_buffer_consume().
+size_t ring_buffer_peek_span(ring_buffer_t *rb, ring_buffer_span_t spans[RING_BUFFER_MAX_SPANS]);
+void ring_buffer_consume(ring_buffer_t *rb, size_t n);
@@ -0,0 +1,84 @@
+#include "siphash.h"
+
+#define ROTL64(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+
+static void siphash_round(uint64_t *v)
+{
+    v[0] += v[1];
+    v[1] = ROTL64(v[1], 13);
+    v[1] ^= v[0];
+    v[0] = ROTL64(v[0], 32);
+    v[2] += v[3];
+    v[3] = ROTL64(v[3], 16);
+    v[3] ^= v[2];
+    v[0] += v[3];
+    v[3] = ROTL64(v[3], 21);
+    v[3] ^= v[0];
+    v[2] += v[1];
+    v[1] = ROTL64(v[1], 17);
+    v[1] ^= v[2];
+    v[2] = ROTL64(v[2], 32);
+}
+
+static void siphash_compress(siphash_t *h, uint64_t m)
+{
+    h->v[3] ^= m;
+    siphash_round(h->v);
+    siphash_round(h->v);
+    h->v[0] ^= m;
+}
+
+void siphash_init(siphash_t *h, const siphash_key_t *key)
+{
+    h->v[0] = key->k0 ^ 0x736f6d6570736575ULL;
+    h->v[1] = key->k1 ^ 0x646f72616e646f6dULL;
+    h->v[2] = key->k0 ^ 0x6c7967656e657261ULL;
+    h->v[3] = key->k1 ^ 0x7465646279746573ULL;
+    h->tail = 0;
+    h->size = 0;
+}
+
+void siphash_update(siphash_t *h, const void *data, size_t size)
+{
+    const uint8_t *p = data;
+    const uint8_t *end = p + size;
+    // Complete the pending word first
+    while ((h->size & 7) && p < end)
+    {
+        h->tail |= ((uint64_t)*p++) << (8 * (h->size & 7));
+        if ((++h->size & 7) == 0)
+        {
+            siphash_compress(h, h->tail);
+            h->tail = 0;
+        }
+    }
+    for (; end - p >= 8; p += 8, h->size += 8)
+    {
+        uint64_t m = (uint64_t)p[0] | (uint64_t)p[1] << 8 | (uint64_t)p[2] << 16 | (uint64_t)p[3] << 24 |
+                     (uint64_t)p[4] << 32 | (uint64_t)p[5] << 40 | (uint64_t)p[6] << 48 | (uint64_t)p[7] << 56;
+        siphash_compress(h, m);
+    }
+    for (; p < end; p++, h->size++)
+    {
+        h->tail |= ((uint64_t)*p) << (8 * (h->size & 7));
+    }
+}
+
+uint64_t siphash_final(siphash_t *h)
+{
+    siphash_compress(h, h->tail | ((uint64_t)h->size) << 56);
+    h->v[2] ^= 0xff;
+    siphash_round(h->v);
+    siphash_round(h->v);
+    siphash_round(h->v);
+    siphash_round(h->v);
+    return h->v[0] ^ h->v[1] ^ h->v[2] ^ h->v[3];
+}
+
+uint64_t siphash(const siphash_key_t *key, const void *data, size_t size)
+{
+    siphash_t h;
+    siphash_init(&h, key);
+    siphash_update(&h, data, size);
+    return siphash_final(&h);
+}
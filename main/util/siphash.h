@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// SipHash-2-4, a fast keyed hash suitable as a MAC for short messages.
+
+typedef struct siphash_key_s
+{
+    uint64_t k0;
+    uint64_t k1;
+} siphash_key_t;
+
+typedef struct siphash_s
+{
+    uint64_t v[4];
+    uint64_t tail; // Pending bytes, up to 7
+    size_t size;   // Total bytes fed
+} siphash_t;
+
+void siphash_init(siphash_t *h, const siphash_key_t *key);
+void siphash_update(siphash_t *h, const void *data, size_t size);
+uint64_t siphash_final(siphash_t *h);
+uint64_t siphash(const siphash_key_t *key, const void *data, size_t size);
@@ -0,0 +1,145 @@
+#include <string.h>
+
+#include "util/macros.h"
+
+#include "spsc_queue.h"
+
+// Stored as the size of a message to indicate the rest of the
+// buffer is unused and the next message is at its start.
+#define SPSC_QUEUE_WRAP UINT32_MAX
+
+#define SPSC_QUEUE_LOAD_ACQUIRE(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define SPSC_QUEUE_LOAD_RELAXED(p) __atomic_load_n(p, __ATOMIC_RELAXED)
+#define SPSC_QUEUE_STORE_RELEASE(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define SPSC_QUEUE_STORE_RELAXED(p, v) __atomic_store_n(p, v, __ATOMIC_RELAXED)
+
+static uint32_t spsc_queue_message_size(size_t size)
+{
+    return ((size + 3) & ~3) + SPSC_QUEUE_MESSAGE_OVERHEAD;
+}
+
+static uint32_t *spsc_queue_header(const spsc_queue_t *q, uint32_t index)
+{
+    return (uint32_t *)&q->buffer[index & (q->size - 1)];
+}
+
+void spsc_queue_init(spsc_queue_t *q, void *buffer, size_t size)
+{
+    ASSERT(size >= SPSC_QUEUE_MESSAGE_OVERHEAD && (size & (size - 1)) == 0);
+    memset(q, 0, sizeof(*q));
+    q->buffer = buffer;
+    q->size = size;
+}
+
+void *spsc_queue_reserve(spsc_queue_t *q, size_t size)
+{
+    uint32_t message_size = spsc_queue_message_size(size);
+    uint32_t tail = SPSC_QUEUE_LOAD_ACQUIRE(&q->tail);
+    uint32_t free = q->size - (q->head - tail);
+    uint32_t until_end = q->size - (q->head & (q->size - 1));
+    // Skip the end of the buffer if the message doesn't fit
+    uint32_t skip = message_size > until_end ? until_end : 0;
+    if (message_size > q->size || skip + message_size > free)
+    {
+        SPSC_QUEUE_STORE_RELAXED(&q->dropped, q->dropped + 1);
+        return NULL;
+    }
+    if (skip > 0)
+    {
+        // Not visible to the consumer until the message is committed
+        *spsc_queue_header(q, q->head) = SPSC_QUEUE_WRAP;
+    }
+    uint32_t *header = spsc_queue_header(q, q->head + skip);
+    *header = size;
+    q->reserved = skip + message_size;
+    return header + 1;
+}
+
+void spsc_queue_commit(spsc_queue_t *q)
+{
+    if (q->reserved == 0)
+    {
+        return;
+    }
+    // Publishes the message and the skipped space, if any
+    SPSC_QUEUE_STORE_RELEASE(&q->head, q->head + q->reserved);
+    q->reserved = 0;
+    uint32_t pushed = q->pushed + 1;
+    SPSC_QUEUE_STORE_RELAXED(&q->pushed, pushed);
+    uint32_t depth = pushed - SPSC_QUEUE_LOAD_RELAXED(&q->popped);
+    if (depth > q->max_depth)
+    {
+        SPSC_QUEUE_STORE_RELAXED(&q->max_depth, depth);
+    }
+}
+
+bool spsc_queue_push(spsc_queue_t *q, const void *data, size_t size)
+{
+    void *p = spsc_queue_reserve(q, size);
+    if (!p)
+    {
+        return false;
+    }
+    memcpy(p, data, size);
+    spsc_queue_commit(q);
+    return true;
+}
+
+const void *spsc_queue_peek(spsc_queue_t *q, size_t *size)
+{
+    uint32_t head = SPSC_QUEUE_LOAD_ACQUIRE(&q->head);
+    if (q->tail == head)
+    {
+        return NULL;
+    }
+    uint32_t *header = spsc_queue_header(q, q->tail);
+    if (*header == SPSC_QUEUE_WRAP)
+    {
+        // The producer always stores a message after wrapping, so
+        // the queue can't be empty at the start of the buffer.
+        uint32_t tail = q->tail + (q->size - (q->tail & (q->size - 1)));
+        SPSC_QUEUE_STORE_RELEASE(&q->tail, tail);
+        header = spsc_queue_header(q, tail);
+    }
+    if (size)
+    {
+        *size = *header;
+    }
+    return header + 1;
+}
+
+void spsc_queue_consume(spsc_queue_t *q)
+{
+    if (!spsc_queue_peek(q, NULL))
+    {
+        return;
+    }
+    uint32_t message_size = spsc_queue_message_size(*spsc_queue_header(q, q->tail));
+    SPSC_QUEUE_STORE_RELEASE(&q->tail, q->tail + message_size);
+    SPSC_QUEUE_STORE_RELAXED(&q->popped, q->popped + 1);
+}
+
+int spsc_queue_pop(spsc_queue_t *q, void *buf, size_t buf_size)
+{
+    size_t size;
+    const void *p = spsc_queue_peek(q, &size);
+    if (!p)
+    {
+        return -1;
+    }
+    memcpy(buf, p, MIN(size, buf_size));
+    spsc_queue_consume(q);
+    return size;
+}
+
+void spsc_queue_get_stats(const spsc_queue_t *q, spsc_queue_stats_t *stats)
+{
+    // Read the consumer side first, so depth and used can't underflow
+    uint32_t popped = SPSC_QUEUE_LOAD_ACQUIRE(&q->popped);
+    uint32_t tail = SPSC_QUEUE_LOAD_ACQUIRE(&q->tail);
+    stats->pushed = SPSC_QUEUE_LOAD_ACQUIRE(&q->pushed);
+    stats->depth = stats->pushed - popped;
+    stats->used = SPSC_QUEUE_LOAD_ACQUIRE(&q->head) - tail;
+    stats->max_depth = SPSC_QUEUE_LOAD_RELAXED(&q->max_depth);
+    stats->dropped = SPSC_QUEUE_LOAD_RELAXED(&q->dropped);
+}
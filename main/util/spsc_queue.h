@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Lock-free queue of variable sized messages with a single producer and
+// a single consumer, which might run on different CPUs. Each side only
+// writes its own indexes, so neither of them ever blocks. If the queue
+// is used by more than one producer (or consumer), they must be
+// serialized by the caller.
+//
+// Messages are stored contiguously, prefixed by their size and aligned
+// to 4 bytes, so each one takes 4 bytes more than its size (rounded up
+// to 4). Messages which don't fit before the end of the buffer are
+// stored at its start instead.
+
+#define SPSC_QUEUE_MESSAGE_OVERHEAD 4
+
+// Buffer size needed to store count messages of up to size bytes each
+// (before rounding up to a power of 2).
+#define SPSC_QUEUE_BUFFER_SIZE(size, count) ((((size) + 3) / 4 * 4 + SPSC_QUEUE_MESSAGE_OVERHEAD) * ((count) + 1))
+
+typedef struct spsc_queue_stats_s
+{
+    uint32_t depth;     // Messages in the queue
+    uint32_t max_depth; // Maximum messages in the queue at once
+    uint32_t used;      // Bytes used in the buffer
+    uint32_t pushed;    // Messages ever pushed
+    uint32_t dropped;   // Messages dropped because the queue was full
+} spsc_queue_stats_t;
+
+typedef struct spsc_queue_s
+{
+    uint8_t *buffer;
+    uint32_t size; // Power of 2
+    // Written only by the producer. head is the free running index
+    // of the next byte to write.
+    uint32_t head;
+    uint32_t reserved; // Bytes taken by the reserved message, 0 if none
+    uint32_t pushed;
+    uint32_t dropped;
+    uint32_t max_depth;
+    // Written only by the consumer. tail is the free running index
+    // of the next byte to read.
+    uint32_t tail;
+    uint32_t popped;
+} spsc_queue_t;
+
+// size must be a power of 2 and buffer must be aligned to 4 bytes
+void spsc_queue_init(spsc_queue_t *q, void *buffer, size_t size);
+
+// Producer side. spsc_queue_reserve() returns a pointer to write a
+// message of the given size, which becomes visible to the consumer
+// when spsc_queue_commit() is called. If there's no space, it returns
+// NULL and the message is counted as dropped.
+void *spsc_queue_reserve(spsc_queue_t *q, size_t size);
+void spsc_queue_commit(spsc_queue_t *q);
+bool spsc_queue_push(spsc_queue_t *q, const void *data, size_t size);
+
+// Consumer side. spsc_queue_peek() returns the oldest message and its
+// size, or NULL if the queue is empty. It stays valid until it's
+// removed with spsc_queue_consume().
+const void *spsc_queue_peek(spsc_queue_t *q, size_t *size);
+void spsc_queue_consume(spsc_queue_t *q);
+// Copies up to buf_size bytes of the oldest message to buf and removes
+// it. Returns the size of the message or -1 if the queue is empty.
+int spsc_queue_pop(spsc_queue_t *q, void *buf, size_t buf_size);
+
+// Might be called from any side. Since the other side might be running,
+// the results are just a snapshot.
+void spsc_queue_get_stats(const spsc_queue_t *q, spsc_queue_stats_t *stats);
@@ -0,0 +1,100 @@
+#include <string.h>
+
+#include "wakeup.h"
+
+#define WAKEUP_MICROS_PER_TICK (portTICK_PERIOD_MS * 1000)
+
+static TaskHandle_t wakeup_task = NULL;
+static wakeup_stats_t wakeup_stats;
+
+void wakeup_init(void)
+{
+    wakeup_task = xTaskGetCurrentTaskHandle();
+    wakeup_reset_stats();
+}
+
+void wakeup_signal(void)
+{
+    if (wakeup_task)
+    {
+        xTaskNotifyGive(wakeup_task);
+    }
+}
+
+void IRAM_ATTR wakeup_signal_from_isr(void)
+{
+    if (wakeup_task)
+    {
+        BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+        vTaskNotifyGiveFromISR(wakeup_task, &xHigherPriorityTaskWoken);
+        portYIELD_FROM_ISR_IF(xHigherPriorityTaskWoken);
+    }
+}
+
+bool wakeup_wait_until(time_micros_t deadline)
+{
+    time_micros_t now = time_micros_now();
+    if (now < deadline)
+    {
+        // Waiting for N ticks returns after N-1 to N tick periods, so
+        // this never oversleeps.
+        time_ticks_t ticks = (deadline - now) / WAKEUP_MICROS_PER_TICK;
+        if (ticks > 0)
+        {
+            bool notified = ulTaskNotifyTake(pdTRUE, ticks) > 0;
+            time_micros_t end = time_micros_now();
+            wakeup_stats.blocked += end - now;
+            now = end;
+            if (notified)
+            {
+                wakeup_stats.events++;
+                return true;
+            }
+        }
+        time_micros_t spin_start = now;
+        while (now < deadline)
+        {
+            if (ulTaskNotifyTake(pdTRUE, 0) > 0)
+            {
+                wakeup_stats.spinning += now - spin_start;
+                wakeup_stats.events++;
+                return true;
+            }
+            now = time_micros_now();
+        }
+        wakeup_stats.spinning += now - spin_start;
+    }
+    // Consume any event signaled while the deadline expired, since the
+    // caller will process it now.
+    bool notified = ulTaskNotifyTake(pdTRUE, 0) > 0;
+    if (notified)
+    {
+        wakeup_stats.events++;
+    }
+    else
+    {
+        wakeup_stats.deadlines++;
+    }
+    return notified;
+}
+
+void wakeup_get_stats(wakeup_stats_t *stats)
+{
+    *stats = wakeup_stats;
+}
+
+void wakeup_reset_stats(void)
+{
+    memset(&wakeup_stats, 0, sizeof(wakeup_stats));
+    wakeup_stats.since = time_micros_now();
+}
+
+unsigned wakeup_idle_percentage(void)
+{
+    time_micros_t elapsed = time_micros_now() - wakeup_stats.since;
+    if (elapsed == 0)
+    {
+        return 0;
+    }
+    return (wakeup_stats.blocked * 100) / elapsed;
+}
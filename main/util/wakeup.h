@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include <os/os.h>
+
+#include "util/time.h"
+
+// Lets a task sleep until a deadline while still reacting to events
+// (e.g. radio or serial interrupts) as soon as they happen. Used by
+// the task running rc_update(), so it doesn't need to busy wait.
+// There's a single waiting task, set with wakeup_init().
+
+typedef struct wakeup_stats_s
+{
+    time_micros_t since;    // When the stats were reset
+    time_micros_t blocked;  // Time spent blocked, available for other tasks
+    time_micros_t spinning; // Time spent spinning until a deadline
+    unsigned events;        // Waits finished by an event
+    unsigned deadlines;     // Waits finished by reaching the deadline
+} wakeup_stats_t;
+
+// Must be called from the task that will call wakeup_wait_until()
+void wakeup_init(void);
+// Notify the waiting task that an event happened. Events signaled
+// while the task is not waiting make the next wait return immediately.
+void wakeup_signal(void);
+void wakeup_signal_from_isr(void);
+// Blocks until the given deadline or until an event is signaled.
+// Returns true iff the wait was finished by an event. Since the
+// scheduler has a resolution of one tick, the remaining time after
+// the last full tick is spent spinning, so the deadline is always
+// met with microsecond resolution.
+bool wakeup_wait_until(time_micros_t deadline);
+
+void wakeup_get_stats(wakeup_stats_t *stats);
+void wakeup_reset_stats(void);
+// Returns the percentage of time the waiting task was blocked since
+// the stats were reset.
+unsigned wakeup_idle_percentage(void);
@@ -0,0 +1,262 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "air/air_clock.h"
+
+// Model of the RX timing in input_air.c with the TX running 30ppm fast
+// and the RX 20ppm slow, scheduling jitter on the TX (optionally with
+// rare delay spikes), timestamp jitter on the RX and fades. It compares
+// three ways of predicting the next packet after each one received or
+// lost:
+//  - fixed: a cycle after the last event, with a 10% guard
+//  - anchor: whole cycles after the last packet received, 10% guard
+//  - clock: air_clock_next_at() and air_clock_guard()
+// and reports losses, the guard windows, how late losses are detected
+// and the time to reacquire after a fade. Senders which schedule each
+// packet relative to the previous send time ("walk") are modeled as well
+// as those which keep a fixed schedule ("anch"). Not a test, build it
+// with make test-tools. Pass the maximum spike delay in us and the
+// maximum fade length in packets to change their defaults.
+
+#define SIM_PACKETS 40000
+#define SIM_SEQ_COUNT 64
+#define SIM_MAX_LOST_JUMPING_FORWARD (SIM_SEQ_COUNT / 2)
+#define SIM_WAIT_FACTOR 0.10
+#define SIM_TX_PPM 30
+#define SIM_RX_PPM -20
+#define SIM_TX_MEAN_DELAY_US 15
+#define SIM_RX_TIMESTAMP_JITTER_US 20
+#define SIM_FADE_PROBABILITY 0.005
+#define SIM_LOSS_PROBABILITY 0.02
+
+typedef enum
+{
+    SIM_PREDICT_FIXED,
+    SIM_PREDICT_ANCHOR,
+    SIM_PREDICT_CLOCK,
+} sim_predict_e;
+
+typedef struct
+{
+    const char *name;
+    double cycle;
+    double air_time;
+    double preamble;
+} sim_mode_t;
+
+static const sim_mode_t modes[] = {
+    {"MODE_2", 16700, 7000, 10.25 * 128},
+    {"MODE_4", 52400, 24800, 10.25 * 1024},
+    {"MODE_5", 110300, 53800, 10.25 * 2048},
+};
+
+static double ends[SIM_PACKETS];
+static double guards[SIM_PACKETS];
+static double detect[SIM_PACKETS];
+static double detect_first[SIM_PACKETS];
+static double reacquire[SIM_PACKETS];
+static int max_fade = 12;
+static double max_spike = 400;
+
+static double rng_uniform(void)
+{
+    return (rand() + 0.5) / ((double)RAND_MAX + 1);
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+static double percentile(double *values, int count, double p)
+{
+    if (count == 0)
+    {
+        return 0;
+    }
+    qsort(values, count, sizeof(*values), compare_double);
+    return values[(int)(p / 100 * (count - 1))];
+}
+
+static void sim_run(const sim_mode_t *mode, sim_predict_e predict, bool tx_anchored, double spike_probability)
+{
+    air_clock_t clock;
+    double max_guard = mode->cycle * SIM_WAIT_FACTOR;
+    double tx_next = 1e6; // Next scheduled send, in TX time
+    double listen_from = -1e18;
+    double expected = 0;
+    double deadline = 1e18;
+    double fade_end = -1;
+    bool has_packet = false;
+    int last = 0;
+    int lost = 0;
+    int tx_seq = 0;
+    int freq = 0;
+    int fade = 0;
+    int received = 0;
+    int timing_lost = 0;
+    int guard_count = 0;
+    int detect_count = 0;
+    int detect_first_count = 0;
+    int reacquire_count = 0;
+
+    srand(1);
+    air_clock_init(&clock, mode->cycle);
+    for (int ii = 0; ii < SIM_PACKETS; ii++)
+    {
+        double delay = -SIM_TX_MEAN_DELAY_US * log(rng_uniform());
+        if (rng_uniform() < spike_probability)
+        {
+            delay += 100 + rng_uniform() * (max_spike - 100);
+        }
+        double send_at = tx_next + delay;
+        tx_next = tx_anchored && delay < 1000 ? tx_next + mode->cycle : send_at + mode->cycle;
+        // In RX time
+        double end = (send_at / (1 + SIM_TX_PPM * 1e-6) + mode->air_time) * (1 + SIM_RX_PPM * 1e-6);
+        double start = end - mode->air_time;
+        double rx_at = end + rng_uniform() * SIM_RX_TIMESTAMP_JITTER_US;
+        ends[ii] = end;
+
+        bool dropped = false;
+        if (fade > 0 || rng_uniform() < SIM_FADE_PROBABILITY)
+        {
+            fade = fade > 0 ? fade - 1 : rand() % max_fade;
+            dropped = true;
+            if (fade == 0)
+            {
+                fade_end = end;
+            }
+        }
+        else if (rng_uniform() < SIM_LOSS_PROBABILITY)
+        {
+            dropped = true;
+        }
+
+        // Deadlines which expire before this packet arrives
+        while (has_packet && deadline < rx_at)
+        {
+            double now = deadline + 1;
+            int missed = last + 1 + lost;
+            if (missed < SIM_PACKETS && missed <= ii)
+            {
+                detect[detect_count++] = deadline - ends[missed];
+                if (lost == 0)
+                {
+                    detect_first[detect_first_count++] = deadline - ends[missed];
+                }
+            }
+            lost++;
+            int next_freq = lost > SIM_MAX_LOST_JUMPING_FORWARD
+                                ? tx_seq + SIM_MAX_LOST_JUMPING_FORWARD - (lost - SIM_MAX_LOST_JUMPING_FORWARD) / 4
+                                : tx_seq + 1 + lost;
+            next_freq = ((next_freq % SIM_SEQ_COUNT) + SIM_SEQ_COUNT) % SIM_SEQ_COUNT;
+            if (next_freq != freq)
+            {
+                freq = next_freq;
+                listen_from = now;
+            }
+            double guard = max_guard;
+            if (predict == SIM_PREDICT_ANCHOR && lost < SIM_MAX_LOST_JUMPING_FORWARD)
+            {
+                expected = ends[last] + (lost + 1) * mode->cycle;
+            }
+            else if (predict == SIM_PREDICT_CLOCK && lost < SIM_MAX_LOST_JUMPING_FORWARD &&
+                     air_clock_has_reference(&clock))
+            {
+                expected = air_clock_next_at(&clock, lost + 1);
+                guard = fmin(air_clock_guard(&clock, lost + 1), max_guard);
+            }
+            else
+            {
+                expected = now + mode->cycle;
+            }
+            deadline = expected + guard;
+        }
+
+        // The RX must be listening on the right frequency before most of
+        // the preamble has gone by
+        bool ok = !dropped && freq == ii % SIM_SEQ_COUNT && listen_from <= start + mode->preamble / 2;
+        if (!dropped && !ok)
+        {
+            timing_lost++;
+        }
+        if (!ok)
+        {
+            continue;
+        }
+        received++;
+        if (fade_end >= 0)
+        {
+            reacquire[reacquire_count++] = rx_at - fade_end;
+            fade_end = -1;
+        }
+        if (has_packet && lost == 0)
+        {
+            guards[guard_count++] = deadline - expected;
+        }
+        has_packet = true;
+        lost = 0;
+        tx_seq = ii % SIM_SEQ_COUNT;
+        last = ii;
+        freq = (ii + 1) % SIM_SEQ_COUNT;
+        listen_from = rx_at;
+        if (predict == SIM_PREDICT_FIXED)
+        {
+            expected = rx_at + mode->cycle;
+            deadline = expected + max_guard;
+        }
+        else
+        {
+            air_clock_update(&clock, rx_at);
+            expected = air_clock_next_at(&clock, 1);
+            double guard = predict == SIM_PREDICT_CLOCK ? air_clock_guard(&clock, 1) : max_guard;
+            deadline = expected + fmin(guard, max_guard);
+        }
+    }
+
+    static const char *predict_names[] = {"fixed", "anchor", "clock"};
+    printf("%-6s %-4s %-6s spikes %3.1f%%: lost %5.2f%% (timing %5.2f%%) guard p50/p99 %5.0f/%5.0f us, "
+           "first loss detected p50 %+6.0f us, all p99 %+7.0f us, reacquire p50/p90 %7.1f/%7.1f ms",
+           mode->name, tx_anchored ? "anch" : "walk", predict_names[predict], spike_probability * 100,
+           (SIM_PACKETS - received) * 100.0 / SIM_PACKETS, timing_lost * 100.0 / SIM_PACKETS,
+           percentile(guards, guard_count, 50), percentile(guards, guard_count, 99),
+           percentile(detect_first, detect_first_count, 50), percentile(detect, detect_count, 99),
+           percentile(reacquire, reacquire_count, 50) / 1000, percentile(reacquire, reacquire_count, 90) / 1000);
+    if (predict == SIM_PREDICT_CLOCK)
+    {
+        double delay = tx_anchored ? 0 : SIM_TX_MEAN_DELAY_US + spike_probability * (100 + max_spike) / 2;
+        double ratio = (1 + SIM_RX_PPM * 1e-6) / (1 + SIM_TX_PPM * 1e-6);
+        double drift = (ratio * (mode->cycle + delay) - mode->cycle) / mode->cycle * 1e6;
+        printf(" drift %+.0f (true %+.0f) ppm", air_clock_drift_ppm(&clock), drift);
+    }
+    printf("\n");
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1)
+    {
+        max_spike = atof(argv[1]);
+    }
+    if (argc > 2)
+    {
+        max_fade = atoi(argv[2]);
+    }
+    for (unsigned mm = 0; mm < sizeof(modes) / sizeof(modes[0]); mm++)
+    {
+        for (int anchored = 0; anchored < 2; anchored++)
+        {
+            for (int spikes = 0; spikes < 2; spikes++)
+            {
+                for (sim_predict_e predict = SIM_PREDICT_FIXED; predict <= SIM_PREDICT_CLOCK; predict++)
+                {
+                    sim_run(&modes[mm], predict, anchored, spikes ? 0.01 : 0);
+                }
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,128 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "air/air_clock.h"
+
+#include "test.h"
+
+#define PERIOD 16700
+
+// Deterministic jitter in [-max, max]
+static int jitter(int max)
+{
+    return rand() % (2 * max + 1) - max;
+}
+
+static void test_unlocked(void)
+{
+    air_clock_t clock;
+    air_clock_init(&clock, PERIOD);
+    TEST_CHECK(!air_clock_has_reference(&clock));
+    TEST_CHECK(!air_clock_is_locked(&clock));
+    TEST_CHECK(air_clock_guard(&clock, 1) == TIME_MICROS_MAX);
+    TEST_CHECK(air_clock_drift_ppm(&clock) == 0);
+
+    // The first packet only sets the phase
+    TEST_CHECK(!air_clock_update(&clock, 1000000));
+    TEST_CHECK(air_clock_has_reference(&clock));
+    TEST_CHECK(air_clock_next_at(&clock, 1) == 1000000 + PERIOD);
+    TEST_CHECK(air_clock_guard(&clock, 1) == TIME_MICROS_MAX);
+}
+
+// The other end runs 50ppm fast relative to us and its packets arrive
+// with up to 10us of jitter, with some of them lost.
+static void test_drift(void)
+{
+    air_clock_t clock;
+    const double period = PERIOD * (1 - 50e-6);
+    int max_error = 0;
+    double drift_sum = 0;
+    int drift_count = 0;
+
+    srand(1);
+    air_clock_init(&clock, PERIOD);
+    for (int ii = 0; ii < 20000; ii++)
+    {
+        time_micros_t at = 1000000 + llround(ii * period) + jitter(10);
+        if (ii > 0 && ii % 7 == 0)
+        {
+            // Lost
+            continue;
+        }
+        if (air_clock_is_locked(&clock) && ii > 200)
+        {
+            unsigned cycles = ii % 7 == 1 ? 2 : 1;
+            int error = (int)(at - air_clock_next_at(&clock, cycles));
+            max_error = abs(error) > max_error ? abs(error) : max_error;
+            TEST_CHECK((time_micros_t)abs(error) < air_clock_guard(&clock, cycles));
+        }
+        TEST_CHECK(air_clock_update(&clock, at) == (ii > 0));
+        if (ii >= 1000)
+        {
+            drift_sum += air_clock_drift_ppm(&clock);
+            drift_count++;
+        }
+    }
+    TEST_CHECK(air_clock_is_locked(&clock));
+    // The period follows the jitter of the last few dozen packets, so
+    // only its average matches the drift.
+    TEST_CHECK(fabs(drift_sum / drift_count + 50) < 5);
+    TEST_CHECK(abs(air_clock_offset(&clock)) < 5);
+    TEST_CHECK(max_error < 30);
+    // Much tighter than the fixed 10% of the cycle, and growing for each
+    // lost packet
+    time_micros_t guard = air_clock_guard(&clock, 1);
+    TEST_CHECK(guard >= 500 && guard < 600);
+    TEST_CHECK(air_clock_guard(&clock, 2) >= 2 * guard && air_clock_guard(&clock, 2) <= 2 * guard + 1);
+    TEST_CHECK(air_clock_guard(&clock, 100) == PERIOD);
+}
+
+static void test_reset(void)
+{
+    air_clock_t clock;
+    air_clock_init(&clock, PERIOD);
+    for (int ii = 0; ii < 20; ii++)
+    {
+        air_clock_update(&clock, 1000000 + ii * PERIOD);
+    }
+    TEST_CHECK(air_clock_is_locked(&clock));
+    time_micros_t last = 1000000 + 19 * PERIOD;
+
+    // Out of phase, e.g. the sender restarted
+    TEST_CHECK(!air_clock_update(&clock, last + PERIOD + PERIOD / 2));
+    TEST_CHECK(!air_clock_is_locked(&clock));
+    last += PERIOD + PERIOD / 2;
+    TEST_CHECK(air_clock_next_at(&clock, 1) == last + PERIOD);
+
+    // Too many cycles since the last packet
+    TEST_CHECK(air_clock_update(&clock, last + PERIOD));
+    last += PERIOD;
+    TEST_CHECK(!air_clock_update(&clock, last + 40 * PERIOD));
+    last += 40 * PERIOD;
+
+    // Going back in time
+    TEST_CHECK(!air_clock_update(&clock, last - 10));
+}
+
+// Drifts beyond the limit are clamped
+static void test_max_drift(void)
+{
+    air_clock_t clock;
+    air_clock_init(&clock, PERIOD);
+    for (int ii = 0; ii < 1000; ii++)
+    {
+        air_clock_update(&clock, 1000000 + ii * (PERIOD + PERIOD / 10));
+    }
+    TEST_CHECK(air_clock_is_locked(&clock));
+    TEST_CHECK(fabsf(air_clock_drift_ppm(&clock) - 20000) < 1);
+}
+
+int main(void)
+{
+    test_unlocked();
+    test_drift();
+    test_reset();
+    test_max_drift();
+    return TEST_RESULT();
+}
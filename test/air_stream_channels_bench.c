@@ -0,0 +1,100 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "air/air_stream.h"
+
+// Air stream bytes per aux channel when sending N changed channels, packed
+// in a single frame vs one frame per channel. Switches are sent with a 2 bit
+// code and the rest with their full value. Bytes include the framing, with
+// COBS enabled. Not a test, build it with make test-tools.
+
+#define BENCH_SAMPLES 10000
+
+typedef enum
+{
+    BENCH_SWITCHES, // All min, center or max
+    BENCH_MIXED,    // Half of them
+    BENCH_FULL,     // None
+    BENCH_COUNT,
+} bench_values_e;
+
+static const char *bench_values_names[] = {"switches", "mixed", "full"};
+
+static void bench_telemetry(void *user, int telemetry_id, const void *data, size_t size, time_micros_t now)
+{
+}
+
+static void bench_cmd(void *user, air_cmd_e cmd, const void *data, size_t size, time_micros_t now)
+{
+}
+
+static unsigned bench_value(bench_values_e values)
+{
+    static const unsigned codes[] = {RC_CHANNEL_MIN_VALUE, RC_CHANNEL_CENTER_VALUE, RC_CHANNEL_MAX_VALUE};
+    if (values == BENCH_SWITCHES || (values == BENCH_MIXED && rand() % 2 == 0))
+    {
+        return codes[rand() % 3];
+    }
+    // Avoid the values that have a 2 bit code
+    return RC_CHANNEL_MIN_VALUE + 10 + rand() % (RC_CHANNEL_MAX_VALUE - RC_CHANNEL_MIN_VALUE - 20);
+}
+
+// Empties the queues
+static void bench_reset(air_stream_t *s)
+{
+    air_stream_init(s, NULL, bench_telemetry, bench_cmd, NULL, NULL);
+    air_stream_set_cobs(s, true);
+}
+
+int main(void)
+{
+    static air_stream_t s;
+    control_channel_t channels[RC_CHANNELS_NUM];
+    memset(channels, 0, sizeof(channels));
+    srand(1);
+
+    printf("Bytes per channel, packed vs single frames:\n");
+    printf("%8s", "channels");
+    for (int ii = 0; ii < BENCH_COUNT; ii++)
+    {
+        printf(" %18s", bench_values_names[ii]);
+    }
+    printf("\n");
+    for (unsigned count = 1; count <= RC_CHANNELS_NUM - 4; count++)
+    {
+        printf("%8u", count);
+        for (bench_values_e values = 0; values < BENCH_COUNT; values++)
+        {
+            size_t packed = 0;
+            size_t single = 0;
+            for (int ii = 0; ii < BENCH_SAMPLES; ii++)
+            {
+                uint32_t mask = 0;
+                while ((unsigned)__builtin_popcount(mask) < count)
+                {
+                    mask |= 1 << (4 + rand() % (RC_CHANNELS_NUM - 4));
+                }
+                for (int jj = 4; jj < RC_CHANNELS_NUM; jj++)
+                {
+                    channels[jj].value = bench_value(values);
+                }
+                bench_reset(&s);
+                packed += air_stream_feed_output_channels(&s, mask, channels);
+                for (int jj = 4; jj < RC_CHANNELS_NUM; jj++)
+                {
+                    if (mask & (1 << jj))
+                    {
+                        bench_reset(&s);
+                        single += air_stream_feed_output_channel(&s, jj, channels[jj].value);
+                    }
+                }
+            }
+            double total = (double)BENCH_SAMPLES * count;
+            printf("     %6.2f vs %5.2f", packed / total, single / total);
+        }
+        printf("\n");
+    }
+    return 0;
+}
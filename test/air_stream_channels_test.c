@@ -0,0 +1,232 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "air/air_stream.h"
+
+#include "util/macros.h"
+
+#include "air_stream_link.h"
+#include "test.h"
+
+// Aux channels through both ends of the air stream, fed the way
+// output_air.c does it: packed in a single frame when the other end
+// has AIR_CAP_STREAM_PACKED_CHANNELS, one channel per frame otherwise.
+
+#define CHANNELS_ROUNDS 200
+#define CHANNELS_DRAIN_CYCLES 20
+
+// MODE_1 with FEC_NIBBLE, see air_radio_sx127x.c
+static const air_packet_layout_t channels_layout = {.uplink_data_bytes = 4, .downlink_data_bytes = 7};
+#define CHANNELS_CYCLE_US 6670
+
+typedef struct
+{
+    air_stream_t tx_stream;
+    air_stream_t rx_stream;
+    air_stream_link_t link;
+    control_channel_t channels[RC_CHANNELS_NUM];
+    unsigned received[RC_CHANNELS_NUM];
+    unsigned received_count[RC_CHANNELS_NUM];
+} channels_pair_t;
+
+static void channels_received(void *user, unsigned chn, unsigned value, time_micros_t now)
+{
+    channels_pair_t *p = user;
+    if (chn < RC_CHANNELS_NUM)
+    {
+        p->received[chn] = value;
+        p->received_count[chn]++;
+    }
+}
+
+static void channels_telemetry(void *user, int telemetry_id, const void *data, size_t size, time_micros_t now)
+{
+}
+
+static void channels_cmd(void *user, air_cmd_e cmd, const void *data, size_t size, time_micros_t now)
+{
+}
+
+// Like output_air.c when the channels in mask are sent and then
+// the other end acknowledges them.
+static void channels_acked(channels_pair_t *p, uint32_t mask)
+{
+    for (int ii = 0; ii < RC_CHANNELS_NUM; ii++)
+    {
+        if (mask & (1 << ii))
+        {
+            data_state_sent(&p->channels[ii].data_state, 0, test_time_micros);
+            data_state_update_ack_received(&p->channels[ii].data_state, 0);
+        }
+    }
+}
+
+static void channels_init(channels_pair_t *p, uint64_t seed)
+{
+    memset(p, 0, sizeof(*p));
+    air_stream_init(&p->tx_stream, NULL, channels_telemetry, channels_cmd, NULL, p);
+    air_stream_init(&p->rx_stream, channels_received, channels_telemetry, channels_cmd, NULL, p);
+    air_stream_set_cobs(&p->tx_stream, true);
+    air_stream_set_cobs(&p->rx_stream, true);
+    air_stream_link_init(&p->link, &p->tx_stream, &p->rx_stream, &channels_layout, CHANNELS_CYCLE_US, seed);
+    for (int ii = 0; ii < RC_CHANNELS_NUM; ii++)
+    {
+        data_state_init(&p->channels[ii].data_state);
+    }
+    channels_acked(p, 0xffffffff);
+}
+
+// Switches use the 2 bit codes, the rest need the full value
+static unsigned channels_random_value(void)
+{
+    switch (rand() % 4)
+    {
+    case 0:
+        return RC_CHANNEL_MIN_VALUE;
+    case 1:
+        return RC_CHANNEL_CENTER_VALUE;
+    case 2:
+        return RC_CHANNEL_MAX_VALUE;
+    }
+    return RC_CHANNEL_MIN_VALUE + rand() % (RC_CHANNEL_MAX_VALUE - RC_CHANNEL_MIN_VALUE + 1);
+}
+
+// Value after going through the air, which has less resolution
+static unsigned channels_air_value(unsigned value)
+{
+    unsigned air_value = RC_CHANNEL_ENCODE_TO_BITS(value, AIR_CHANNEL_BITS);
+    return RC_CHANNEL_DECODE_FROM_BITS(air_value, AIR_CHANNEL_BITS);
+}
+
+// Changes the channels in mask to a random value, at a different
+// time for each so their scores differ.
+static void channels_change(channels_pair_t *p, uint32_t mask)
+{
+    for (int ii = 4; ii < RC_CHANNELS_NUM; ii++)
+    {
+        if (mask & (1 << ii))
+        {
+            p->channels[ii].value = channels_random_value();
+            test_time_micros += 1 + rand() % 1000;
+            data_state_update(&p->channels[ii].data_state, true, test_time_micros);
+        }
+    }
+}
+
+static uint32_t channels_random_mask(unsigned count)
+{
+    uint32_t mask = 0;
+    while ((unsigned)__builtin_popcount(mask) < count)
+    {
+        mask |= 1 << (4 + rand() % (RC_CHANNELS_NUM - 4));
+    }
+    return mask;
+}
+
+static void channels_drain(channels_pair_t *p)
+{
+    for (int ii = 0; ii < CHANNELS_DRAIN_CYCLES; ii++)
+    {
+        air_stream_link_cycle(&p->link);
+    }
+}
+
+// Checks that the channels in mask were received exactly once with the
+// right value and no other channel was.
+static void channels_check_received(channels_pair_t *p, uint32_t mask)
+{
+    for (int ii = 0; ii < RC_CHANNELS_NUM; ii++)
+    {
+        if (mask & (1 << ii))
+        {
+            TEST_CHECK(p->received_count[ii] == 1);
+            TEST_CHECK(p->received[ii] == channels_air_value(p->channels[ii].value));
+        }
+        else
+        {
+            TEST_CHECK(p->received_count[ii] == 0);
+        }
+    }
+    memset(p->received_count, 0, sizeof(p->received_count));
+}
+
+static void test_packed(void)
+{
+    static channels_pair_t p;
+    channels_init(&p, 1);
+    for (unsigned count = 1; count <= RC_CHANNELS_NUM - 4; count++)
+    {
+        for (int ii = 0; ii < CHANNELS_ROUNDS; ii++)
+        {
+            uint32_t mask = channels_random_mask(count);
+            channels_change(&p, mask);
+            uint32_t sent;
+            size_t n = air_stream_feed_output_unacked_channels(&p.tx_stream, p.channels, RC_CHANNELS_NUM, true, &sent, test_time_micros);
+            // All the unacked channels in a single frame
+            TEST_CHECK(n > 0);
+            TEST_CHECK(sent == mask);
+            channels_drain(&p);
+            channels_check_received(&p, mask);
+            channels_acked(&p, sent);
+        }
+    }
+    // Nothing to send
+    uint32_t sent = 0xffffffff;
+    TEST_CHECK(air_stream_feed_output_unacked_channels(&p.tx_stream, p.channels, RC_CHANNELS_NUM, true, &sent, test_time_micros) == 0);
+    TEST_CHECK(sent == 0);
+}
+
+// Without AIR_CAP_STREAM_PACKED_CHANNELS on the other end, channels go
+// one per frame, highest data_state_score() first, using the same frames
+// as air_stream_feed_output_channel().
+static void test_fallback(void)
+{
+    static channels_pair_t p;
+    static air_stream_t ref;
+    channels_init(&p, 2);
+    for (unsigned count = 1; count <= RC_CHANNELS_NUM - 4; count++)
+    {
+        for (int ii = 0; ii < CHANNELS_ROUNDS; ii++)
+        {
+            uint32_t mask = channels_random_mask(count);
+            channels_change(&p, mask);
+            uint32_t pending = mask;
+            while (pending)
+            {
+                // Feeding the frame advances test_time_micros
+                time_micros_t now = test_time_micros;
+                uint32_t max_score = 0;
+                for (int jj = 4; jj < RC_CHANNELS_NUM; jj++)
+                {
+                    if (pending & (1 << jj))
+                    {
+                        max_score = MAX(max_score, data_state_score(&p.channels[jj].data_state, now));
+                    }
+                }
+                uint32_t sent;
+                size_t n = air_stream_feed_output_unacked_channels(&p.tx_stream, p.channels, RC_CHANNELS_NUM, false, &sent, now);
+                TEST_CHECK(__builtin_popcount(sent) == 1);
+                TEST_CHECK((sent & pending) == sent);
+                unsigned chn = __builtin_ctz(sent);
+                TEST_CHECK(data_state_score(&p.channels[chn].data_state, now) == max_score);
+                air_stream_init(&ref, NULL, channels_telemetry, channels_cmd, NULL, NULL);
+                air_stream_set_cobs(&ref, true);
+                TEST_CHECK(n == air_stream_feed_output_channel(&ref, chn, p.channels[chn].value));
+                channels_drain(&p);
+                channels_check_received(&p, sent);
+                channels_acked(&p, sent);
+                pending &= ~sent;
+                test_time_micros += rand() % 1000;
+            }
+        }
+    }
+}
+
+int main(void)
+{
+    srand(1);
+    test_packed();
+    test_fallback();
+    return TEST_RESULT();
+}
@@ -0,0 +1,273 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "air/air_stream.h"
+
+#include "test.h"
+
+// COBS framing of variable sized commands: random payloads with runs of
+// the delimiter, the stuffing byte and bytes that look like block codes
+// must round trip, stay within the overhead bound and never contain a
+// delimiter. Truncated and corrupted frames must not keep the decoder
+// from picking up the next one.
+
+#define COBS_ROUNDS 2000
+#define COBS_PACKET_SIZE 7
+#define COBS_FRAME_MAX_SIZE (AIR_STREAM_MSP_QUEUE_CAPACITY)
+// Type byte of MSP frames, commands have 0x40 set. See air_stream.c.
+#define COBS_MSP_TYPE (0x40 | AIR_CMD_MSP)
+
+typedef struct
+{
+    air_stream_t tx_stream;
+    air_stream_t rx_stream;
+    unsigned seq : AIR_SEQ_BITS;
+    uint8_t received[MSP_MAX_PAYLOAD_SIZE];
+    size_t received_size;
+    unsigned received_count;
+} cobs_pair_t;
+
+static void cobs_channel(void *user, unsigned chn, unsigned value, time_micros_t now)
+{
+}
+
+static void cobs_telemetry(void *user, int telemetry_id, const void *data, size_t size, time_micros_t now)
+{
+}
+
+static void cobs_cmd(void *user, air_cmd_e cmd, const void *data, size_t size, time_micros_t now)
+{
+    cobs_pair_t *p = user;
+    TEST_CHECK(size <= sizeof(p->received));
+    if (cmd == AIR_CMD_MSP && size <= sizeof(p->received))
+    {
+        memcpy(p->received, data, size);
+        p->received_size = size;
+        p->received_count++;
+    }
+}
+
+static void cobs_init(cobs_pair_t *p, bool cobs)
+{
+    memset(p, 0, sizeof(*p));
+    air_stream_init(&p->tx_stream, NULL, cobs_telemetry, cobs_cmd, NULL, p);
+    air_stream_init(&p->rx_stream, cobs_channel, cobs_telemetry, cobs_cmd, NULL, p);
+    air_stream_set_cobs(&p->tx_stream, cobs);
+    air_stream_set_cobs(&p->rx_stream, cobs);
+}
+
+// Queues payload as an MSP command and returns the encoded frame
+static size_t cobs_encode(cobs_pair_t *p, const uint8_t *payload, size_t size, uint8_t *frame)
+{
+    size_t n = air_stream_feed_output_cmd(&p->tx_stream, AIR_CMD_MSP, payload, size);
+    TEST_CHECK(n > 0 && n <= COBS_FRAME_MAX_SIZE);
+    TEST_CHECK(air_stream_pop_output_n(&p->tx_stream, frame, n, test_time_micros) == n);
+    return n;
+}
+
+// Feeds data to the RX in packets, like the radio would
+static void cobs_feed(cobs_pair_t *p, const uint8_t *data, size_t size)
+{
+    for (size_t pos = 0; pos < size; pos += COBS_PACKET_SIZE)
+    {
+        size_t n = size - pos < COBS_PACKET_SIZE ? size - pos : COBS_PACKET_SIZE;
+        air_stream_feed_input(&p->rx_stream, ++p->seq, &data[pos], n, test_time_micros);
+    }
+}
+
+typedef enum
+{
+    COBS_PAYLOAD_RANDOM,
+    COBS_PAYLOAD_DELIMITERS, // Runs of AIR_DATA_START_STOP
+    COBS_PAYLOAD_STUFF,      // Runs of AIR_DATA_START_STOP and AIR_DATA_BYTE_STUFF
+    COBS_PAYLOAD_CODES,      // Bytes which are valid block codes once XOR'ed with the delimiter
+    COBS_PAYLOAD_NO_DELIMITERS,
+    COBS_PAYLOAD_COUNT,
+} cobs_payload_e;
+
+static uint8_t cobs_payload_byte(cobs_payload_e kind)
+{
+    static const uint8_t codes[] = {
+        AIR_DATA_START_STOP ^ 0x01,
+        AIR_DATA_START_STOP ^ 0x02,
+        AIR_DATA_START_STOP ^ 0xFE,
+        AIR_DATA_START_STOP ^ 0xFF,
+        AIR_DATA_START_STOP,
+    };
+    switch (kind)
+    {
+    case COBS_PAYLOAD_RANDOM:
+        return rand();
+    case COBS_PAYLOAD_DELIMITERS:
+        return rand() % 4 ? AIR_DATA_START_STOP : rand();
+    case COBS_PAYLOAD_STUFF:
+        return rand() % 2 ? AIR_DATA_START_STOP : AIR_DATA_BYTE_STUFF;
+    case COBS_PAYLOAD_CODES:
+        return codes[rand() % (sizeof(codes) / sizeof(codes[0]))];
+    default:
+        break;
+    }
+    uint8_t c = rand();
+    return c == AIR_DATA_START_STOP ? c + 1 : c;
+}
+
+static size_t cobs_random_payload(uint8_t *payload)
+{
+    // Favor the sizes around the 254 byte block boundary
+    static const size_t sizes[] = {0, 1, 2, 252, 253, 254, 255, 256, 507, 508, 509, MSP_MAX_PAYLOAD_SIZE};
+    size_t size = rand() % 2 ? sizes[rand() % (sizeof(sizes) / sizeof(sizes[0]))] : rand() % (MSP_MAX_PAYLOAD_SIZE + 1);
+    cobs_payload_e kind = rand() % COBS_PAYLOAD_COUNT;
+    for (size_t ii = 0; ii < size; ii++)
+    {
+        payload[ii] = cobs_payload_byte(kind);
+    }
+    return size;
+}
+
+static size_t cobs_uvarint_size(uint32_t v)
+{
+    size_t size = 1;
+    while (v >= 0x80)
+    {
+        v >>= 7;
+        size++;
+    }
+    return size;
+}
+
+// Delimiter and type byte, then the COBS encoded size and payload with
+// one code per 254 bytes, plus one more for the last block.
+static size_t cobs_max_frame_size(size_t size)
+{
+    size_t encoded = cobs_uvarint_size(size) + size;
+    return 1 + 1 + encoded + encoded / 254 + 1;
+}
+
+static void test_round_trip(void)
+{
+    static cobs_pair_t p;
+    static uint8_t payload[MSP_MAX_PAYLOAD_SIZE];
+    static uint8_t frame[COBS_FRAME_MAX_SIZE];
+    size_t max_overhead = 0;
+    cobs_init(&p, true);
+    for (int ii = 0; ii < COBS_ROUNDS; ii++)
+    {
+        size_t size = cobs_random_payload(payload);
+        size_t n = cobs_encode(&p, payload, size, frame);
+        TEST_CHECK(n <= cobs_max_frame_size(size));
+        TEST_CHECK(frame[0] == AIR_DATA_START_STOP);
+        TEST_CHECK(memchr(&frame[1], AIR_DATA_START_STOP, n - 1) == NULL);
+        if (n - size > max_overhead)
+        {
+            max_overhead = n - size;
+        }
+        cobs_feed(&p, frame, n);
+        TEST_CHECK(p.received_count == 1);
+        TEST_CHECK(p.received_size == size);
+        TEST_CHECK(memcmp(p.received, payload, size) == 0);
+        p.received_count = 0;
+    }
+    // The worst case is hit by a full payload without delimiters
+    memset(payload, 1, sizeof(payload));
+    size_t n = cobs_encode(&p, payload, sizeof(payload), frame);
+    TEST_CHECK(n == cobs_max_frame_size(sizeof(payload)));
+    TEST_CHECK(max_overhead <= n - sizeof(payload));
+    // Byte stuffing doubles a payload of delimiters
+    static cobs_pair_t stuffed;
+    cobs_init(&stuffed, false);
+    memset(payload, AIR_DATA_START_STOP, sizeof(payload));
+    size_t stuffed_size = cobs_encode(&stuffed, payload, sizeof(payload), frame);
+    n = cobs_encode(&p, payload, sizeof(payload), frame);
+    printf("%u byte payload of delimiters: %u bytes with COBS, %u with byte stuffing\n",
+           (unsigned)sizeof(payload), (unsigned)n, (unsigned)stuffed_size);
+    TEST_CHECK(n <= cobs_max_frame_size(sizeof(payload)));
+    TEST_CHECK(stuffed_size > 2 * sizeof(payload));
+}
+
+// A frame cut short and followed by the next one must be dropped, while
+// the next one gets through
+static void test_truncated(void)
+{
+    static cobs_pair_t p;
+    static uint8_t payload[MSP_MAX_PAYLOAD_SIZE];
+    static uint8_t next_payload[MSP_MAX_PAYLOAD_SIZE];
+    static uint8_t frame[COBS_FRAME_MAX_SIZE];
+    static uint8_t next_frame[COBS_FRAME_MAX_SIZE];
+    cobs_init(&p, true);
+    for (int ii = 0; ii < COBS_ROUNDS; ii++)
+    {
+        size_t size = cobs_random_payload(payload);
+        size_t n = cobs_encode(&p, payload, size, frame);
+        size_t next_size = cobs_random_payload(next_payload);
+        size_t next_n = cobs_encode(&p, next_payload, next_size, next_frame);
+        // Keep at least the delimiter, drop at least a byte
+        size_t cut = 1 + rand() % (n - 1);
+        cobs_feed(&p, frame, cut);
+        TEST_CHECK(p.received_count == 0);
+        cobs_feed(&p, next_frame, next_n);
+        TEST_CHECK(p.received_count == 1);
+        TEST_CHECK(p.received_size == next_size);
+        TEST_CHECK(memcmp(p.received, next_payload, next_size) == 0);
+        p.received_count = 0;
+    }
+}
+
+// Corrupted bytes can't be detected by the framing (packets have their
+// own CRC) and might even turn the frame into another command, but they
+// must not overflow the decoder or desynchronize it past the next
+// delimiter.
+static void test_corrupted(void)
+{
+    static cobs_pair_t p;
+    static uint8_t payload[MSP_MAX_PAYLOAD_SIZE];
+    static uint8_t next_payload[MSP_MAX_PAYLOAD_SIZE];
+    static uint8_t frame[COBS_FRAME_MAX_SIZE];
+    static uint8_t next_frame[COBS_FRAME_MAX_SIZE];
+    cobs_init(&p, true);
+    for (int ii = 0; ii < COBS_ROUNDS; ii++)
+    {
+        size_t size = cobs_random_payload(payload);
+        size_t n = cobs_encode(&p, payload, size, frame);
+        size_t next_size = cobs_random_payload(next_payload);
+        size_t next_n = cobs_encode(&p, next_payload, next_size, next_frame);
+        unsigned errors = 1 + rand() % 4;
+        for (unsigned jj = 0; jj < errors; jj++)
+        {
+            frame[1 + rand() % (n - 1)] = rand();
+        }
+        cobs_feed(&p, frame, n);
+        TEST_CHECK(p.received_count <= 1);
+        p.received_count = 0;
+        cobs_feed(&p, next_frame, next_n);
+        TEST_CHECK(p.received_count == 1);
+        TEST_CHECK(p.received_size == next_size);
+        TEST_CHECK(memcmp(p.received, next_payload, next_size) == 0);
+        p.received_count = 0;
+    }
+    // Plain garbage, without any delimiter
+    for (size_t ii = 0; ii < sizeof(frame); ii++)
+    {
+        frame[ii] = cobs_payload_byte(COBS_PAYLOAD_NO_DELIMITERS);
+    }
+    frame[0] = AIR_DATA_START_STOP;
+    frame[1] = COBS_MSP_TYPE;
+    cobs_feed(&p, frame, sizeof(frame));
+    p.received_count = 0;
+    size_t next_size = cobs_random_payload(next_payload);
+    size_t next_n = cobs_encode(&p, next_payload, next_size, next_frame);
+    cobs_feed(&p, next_frame, next_n);
+    TEST_CHECK(p.received_count == 1);
+    TEST_CHECK(p.received_size == next_size);
+    TEST_CHECK(memcmp(p.received, next_payload, next_size) == 0);
+}
+
+int main(void)
+{
+    srand(1);
+    test_round_trip();
+    test_truncated();
+    test_corrupted();
+    return TEST_RESULT();
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include "air/air.h"
+#include "air/air_stream.h"
+
+#include <hal/time.h>
+
+// Both ends of the air stream over a simulated link. Each cycle the TX
+// end sends an uplink packet and the RX end replies with a downlink one,
+// like output_air.c and input_air.c do. Packets are lost independently
+// with the given probabilities.
+
+typedef struct air_stream_link_s
+{
+    air_stream_t *tx; // Sends uplink, no channel callback
+    air_stream_t *rx; // Sends downlink
+    size_t uplink_size;
+    size_t downlink_size;
+    double uplink_loss;
+    double downlink_loss;
+    time_micros_t cycle;
+    unsigned tx_seq : AIR_SEQ_BITS;
+    unsigned rx_seq : AIR_SEQ_BITS;
+    uint64_t rng;
+    uint32_t cycles;
+    uint32_t uplink_lost;
+    uint32_t downlink_lost;
+} air_stream_link_t;
+
+static uint64_t air_stream_link_rand(air_stream_link_t *link)
+{
+    link->rng ^= link->rng << 13;
+    link->rng ^= link->rng >> 7;
+    link->rng ^= link->rng << 17;
+    return link->rng;
+}
+
+static double air_stream_link_uniform(air_stream_link_t *link)
+{
+    return (air_stream_link_rand(link) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static void air_stream_link_init(air_stream_link_t *link, air_stream_t *tx, air_stream_t *rx,
+                                 const air_packet_layout_t *layout, time_micros_t cycle, uint64_t seed)
+{
+    memset(link, 0, sizeof(*link));
+    link->tx = tx;
+    link->rx = rx;
+    link->uplink_size = layout->uplink_data_bytes;
+    link->downlink_size = layout->downlink_data_bytes;
+    link->cycle = cycle;
+    link->rng = seed | 1;
+}
+
+static void air_stream_link_packet(air_stream_link_t *link, air_stream_t *from, air_stream_t *to,
+                                   unsigned seq, size_t size, double loss, uint32_t *lost)
+{
+    uint8_t data[AIR_DOWNLINK_MAX_DATA_BYTES];
+    // Unused bytes are filled with delimiters, like the air packets
+    memset(data, AIR_DATA_START_STOP, size);
+    air_stream_pop_output_n(from, data, size, test_time_micros);
+    if (air_stream_link_uniform(link) < loss)
+    {
+        (*lost)++;
+        return;
+    }
+    air_stream_feed_input(to, seq, data, size, test_time_micros);
+}
+
+static void air_stream_link_cycle(air_stream_link_t *link)
+{
+    link->cycles++;
+    air_stream_link_packet(link, link->tx, link->rx, ++link->tx_seq, link->uplink_size,
+                           link->uplink_loss, &link->uplink_lost);
+    test_time_micros += link->cycle / 2;
+    air_stream_link_packet(link, link->rx, link->tx, ++link->rx_seq, link->downlink_size,
+                           link->downlink_loss, &link->downlink_lost);
+    test_time_micros += link->cycle - link->cycle / 2;
+}
@@ -0,0 +1,303 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "air/air_stream.h"
+
+#include "air_stream_link.h"
+#include "test.h"
+
+// MSP commands through both ends of the air stream with the reliable
+// sub-channel, over a link with uniform losses in both directions.
+// Commands carry their number and a pattern derived from it, so the
+// receiver can check they arrive in order, exactly once and intact.
+
+#define RELIABLE_CYCLES 20000
+#define RELIABLE_DRAIN_CYCLES 2000
+#define RELIABLE_MIN_CMD_SIZE 4
+#define RELIABLE_MAX_CMD_SIZE 103
+#define RELIABLE_RESTARTS 200
+
+// MODE_1 with FEC_NIBBLE, see air_radio_sx127x.c
+static const air_packet_layout_t reliable_layout = {.uplink_data_bytes = 4, .downlink_data_bytes = 7};
+#define RELIABLE_CYCLE_US 6670
+
+typedef struct
+{
+    // Sender
+    uint32_t next_id;
+    // Receiver
+    uint32_t expected_id; // Lowest ID that can be received next
+    uint32_t received;
+    uint32_t received_bytes;
+    uint32_t invalid;
+    uint32_t out_of_order;
+} reliable_end_t;
+
+static size_t reliable_cmd_size(uint32_t id)
+{
+    return RELIABLE_MIN_CMD_SIZE + (id * 2654435761u >> 16) % (RELIABLE_MAX_CMD_SIZE - RELIABLE_MIN_CMD_SIZE + 1);
+}
+
+static uint8_t reliable_cmd_byte(uint32_t id, size_t ii)
+{
+    // Include the framing bytes often
+    static const uint8_t special[] = {AIR_DATA_START_STOP, AIR_DATA_BYTE_STUFF, AIR_DATA_START_STOP ^ AIR_DATA_XOR};
+    uint32_t v = id * 31 + ii * 7;
+    return v % 5 == 0 ? special[v % 3] : v;
+}
+
+static void reliable_cmd(void *user, air_cmd_e cmd, const void *data, size_t size, time_micros_t now)
+{
+    reliable_end_t *end = user;
+    const uint8_t *p = data;
+    uint32_t id;
+    if (cmd != AIR_CMD_MSP || size < sizeof(id))
+    {
+        end->invalid++;
+        return;
+    }
+    memcpy(&id, p, sizeof(id));
+    bool valid = size == reliable_cmd_size(id);
+    for (size_t ii = sizeof(id); ii < size && valid; ii++)
+    {
+        valid = p[ii] == reliable_cmd_byte(id, ii);
+    }
+    if (!valid)
+    {
+        end->invalid++;
+        return;
+    }
+    if (id < end->expected_id)
+    {
+        end->out_of_order++;
+    }
+    end->expected_id = id + 1;
+    end->received++;
+    end->received_bytes += size;
+}
+
+static void reliable_channel(void *user, unsigned chn, unsigned value, time_micros_t now)
+{
+}
+
+static void reliable_telemetry(void *user, int telemetry_id, const void *data, size_t size, time_micros_t now)
+{
+}
+
+// Queues as many commands as the stream accepts
+static void reliable_feed(air_stream_t *s, reliable_end_t *end)
+{
+    uint8_t buf[RELIABLE_MAX_CMD_SIZE];
+    for (;;)
+    {
+        uint32_t id = end->next_id;
+        size_t size = reliable_cmd_size(id);
+        memcpy(buf, &id, sizeof(id));
+        for (size_t ii = sizeof(id); ii < size; ii++)
+        {
+            buf[ii] = reliable_cmd_byte(id, ii);
+        }
+        if (air_stream_feed_output_cmd(s, AIR_CMD_MSP, buf, size) == 0)
+        {
+            break;
+        }
+        end->next_id++;
+    }
+}
+
+typedef struct
+{
+    air_stream_t tx_stream;
+    air_stream_t rx_stream;
+    reliable_end_t tx;
+    reliable_end_t rx;
+    air_stream_link_t link;
+} reliable_pair_t;
+
+static void reliable_init_tx(reliable_pair_t *p, bool reliable)
+{
+    air_stream_init(&p->tx_stream, NULL, reliable_telemetry, reliable_cmd, NULL, &p->tx);
+    air_stream_set_cobs(&p->tx_stream, true);
+    air_stream_set_reliable(&p->tx_stream, reliable);
+}
+
+static void reliable_init_rx(reliable_pair_t *p, bool reliable)
+{
+    air_stream_init(&p->rx_stream, reliable_channel, reliable_telemetry, reliable_cmd, NULL, &p->rx);
+    air_stream_set_cobs(&p->rx_stream, true);
+    air_stream_set_reliable(&p->rx_stream, reliable);
+}
+
+static void reliable_init(reliable_pair_t *p, bool reliable, double loss, uint64_t seed)
+{
+    memset(p, 0, sizeof(*p));
+    srand(seed);
+    reliable_init_tx(p, reliable);
+    reliable_init_rx(p, reliable);
+    air_stream_link_init(&p->link, &p->tx_stream, &p->rx_stream, &reliable_layout, RELIABLE_CYCLE_US, seed);
+    p->link.uplink_loss = loss;
+    p->link.downlink_loss = loss;
+}
+
+static void reliable_cycle(reliable_pair_t *p, bool feed)
+{
+    if (feed)
+    {
+        reliable_feed(&p->tx_stream, &p->tx);
+        reliable_feed(&p->rx_stream, &p->rx);
+    }
+    air_stream_link_cycle(&p->link);
+}
+
+// Runs without feeding new commands and without losses, so everything
+// queued gets delivered.
+static void reliable_drain(reliable_pair_t *p)
+{
+    p->link.uplink_loss = 0;
+    p->link.downlink_loss = 0;
+    for (int ii = 0; ii < RELIABLE_DRAIN_CYCLES; ii++)
+    {
+        reliable_cycle(p, false);
+    }
+}
+
+static void test_loss(void)
+{
+    static const double losses[] = {0, 0.1, 0.2, 0.4};
+    printf("MSP goodput with %u+%u byte packets every %uus, unreliable vs reliable:\n",
+           reliable_layout.uplink_data_bytes, reliable_layout.downlink_data_bytes, RELIABLE_CYCLE_US);
+    for (unsigned ii = 0; ii < sizeof(losses) / sizeof(losses[0]); ii++)
+    {
+        double bps[2];
+        for (int reliable = 0; reliable < 2; reliable++)
+        {
+            static reliable_pair_t p;
+            reliable_init(&p, reliable, losses[ii], 1 + ii);
+            for (int cc = 0; cc < RELIABLE_CYCLES; cc++)
+            {
+                reliable_cycle(&p, true);
+            }
+            uint32_t bytes = p.rx.received_bytes + p.tx.received_bytes;
+            bps[reliable] = bytes * 1e6 / ((double)RELIABLE_CYCLES * RELIABLE_CYCLE_US);
+            // Lost commands are skipped, but nothing is reordered or corrupted
+            TEST_CHECK(p.tx.invalid == 0 && p.rx.invalid == 0);
+            TEST_CHECK(p.tx.out_of_order == 0 && p.rx.out_of_order == 0);
+            if (!reliable)
+            {
+                continue;
+            }
+            const air_stream_reliable_stats_t *stats = air_stream_get_reliable_stats(&p.tx_stream);
+            const air_stream_reliable_stats_t *downlink_stats = air_stream_get_reliable_stats(&p.rx_stream);
+            // The 4 bit sequence numbers wrapped many times. With 40% loss,
+            // few segments make it through the 4 byte uplink packets.
+            TEST_CHECK(downlink_stats->segments_sent - downlink_stats->retransmissions > 50 * AIR_STREAM_RELIABLE_SEQ_COUNT);
+            TEST_CHECK(losses[ii] > 0 || stats->retransmissions == 0);
+            TEST_CHECK(losses[ii] == 0 || stats->retransmissions > 0);
+            TEST_CHECK(stats->resets == 0);
+            reliable_drain(&p);
+            // Exactly once: every command, no gaps
+            TEST_CHECK(p.rx.received == p.tx.next_id && p.rx.expected_id == p.tx.next_id);
+            TEST_CHECK(p.tx.received == p.rx.next_id && p.tx.expected_id == p.rx.next_id);
+            TEST_CHECK(p.tx.invalid == 0 && p.rx.invalid == 0);
+            TEST_CHECK(p.tx.out_of_order == 0 && p.rx.out_of_order == 0);
+            TEST_CHECK(stats->bytes_acked == downlink_stats->bytes_received);
+            TEST_CHECK(downlink_stats->bytes_acked == stats->bytes_received);
+            printf("  loss %2.0f%%: %6.1f vs %6.1f bytes/s, %4.1f%% of segments retransmitted\n",
+                   losses[ii] * 100, bps[0], bps[1], stats->retransmissions * 100.0 / stats->segments_sent);
+        }
+        // Worth it as soon as there are losses
+        TEST_CHECK(losses[ii] == 0 || bps[1] > bps[0]);
+        TEST_CHECK(bps[1] > 0);
+    }
+}
+
+typedef enum
+{
+    RESTART_SENDER,              // With a new session
+    RESTART_SENDER_SAME_SESSION, // Picks the session the receiver has
+    RESTART_RECEIVER,
+} restart_e;
+
+// Restarts one end at a random point, then checks that everything sent
+// once the sender knows about the restart is delivered.
+static void test_restart(restart_e restart)
+{
+    for (int ii = 0; ii < RELIABLE_RESTARTS; ii++)
+    {
+        static reliable_pair_t p;
+        uint64_t seed = 100 + ii;
+        reliable_init(&p, true, 0.1, seed);
+        int restart_at = 10 + rand() % 500;
+        for (int cc = 0; cc < restart_at; cc++)
+        {
+            reliable_cycle(&p, true);
+        }
+        // Commands in flight are lost, the new ones must arrive. Since
+        // the restarted end is a new process, what it receives might
+        // repeat what the previous one got.
+        uint8_t session = p.tx_stream.reliable.tx_session;
+        uint32_t nonce = p.tx_stream.reliable.tx_nonce;
+        switch (restart)
+        {
+        case RESTART_SENDER:
+        case RESTART_SENDER_SAME_SESSION:
+        {
+            uint32_t next_id = p.tx.next_id;
+            srand(seed + 1000);
+            reliable_init_tx(&p, true);
+            memset(&p.tx, 0, sizeof(p.tx));
+            p.tx.next_id = next_id;
+            if (restart == RESTART_SENDER_SAME_SESSION)
+            {
+                p.tx_stream.reliable.tx_session = session;
+            }
+            TEST_CHECK(p.tx_stream.reliable.tx_nonce != nonce);
+            break;
+        }
+        case RESTART_RECEIVER:
+        {
+            uint32_t next_id = p.rx.next_id;
+            reliable_init_rx(&p, true);
+            memset(&p.rx, 0, sizeof(p.rx));
+            p.rx.next_id = next_id;
+            break;
+        }
+        }
+        uint32_t first_id = p.tx.next_id;
+        uint32_t received = p.rx.received;
+        const air_stream_reliable_stats_t *stats = air_stream_get_reliable_stats(&p.tx_stream);
+        uint32_t resets = stats->resets;
+        for (int cc = 0; cc < 1000; cc++)
+        {
+            reliable_cycle(&p, true);
+            if (stats->resets != resets)
+            {
+                // The sender drops what it had queued when it starts a
+                // new session, commands fed from now on must arrive.
+                resets = stats->resets;
+                first_id = p.tx.next_id;
+                received = p.rx.received;
+            }
+        }
+        reliable_drain(&p);
+        TEST_CHECK(p.rx.invalid == 0 && p.tx.invalid == 0);
+        TEST_CHECK(p.rx.out_of_order == 0 && p.tx.out_of_order == 0);
+        TEST_CHECK(p.rx.expected_id == p.tx.next_id);
+        // At least everything sent after the restart
+        TEST_CHECK(p.rx.received - received >= p.tx.next_id - first_id);
+        TEST_CHECK(p.tx.next_id - first_id > 10);
+        // Restarting the sender never needs a reset, the receiver
+        // sees the syn segments from the new one.
+        TEST_CHECK(restart == RESTART_RECEIVER || stats->resets <= 1);
+    }
+}
+
+int main(void)
+{
+    test_loss();
+    test_restart(RESTART_SENDER);
+    test_restart(RESTART_SENDER_SAME_SESSION);
+    test_restart(RESTART_RECEIVER);
+    return TEST_RESULT();
+}
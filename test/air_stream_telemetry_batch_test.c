@@ -0,0 +1,219 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "air/air_stream.h"
+
+#include "air_stream_link.h"
+#include "test.h"
+
+// Downlink telemetry through both ends of the air stream, fed the way
+// input_air.c does it: the values that changed batched in a single frame
+// when the other end has AIR_CAP_STREAM_TELEMETRY_BATCH and the downlink
+// LQ is at least AIR_STREAM_TELEMETRY_BATCH_MIN_LQ, one value per frame
+// otherwise. Reports how many value changes reach the TX per second.
+
+#define BATCH_CYCLES 30000
+#define BATCH_DRAIN_CYCLES 600
+
+// MODE_1 with FEC_NIBBLE, see air_radio_sx127x.c
+static const air_packet_layout_t batch_layout = {.uplink_data_bytes = 4, .downlink_data_bytes = 7};
+#define BATCH_CYCLE_US 6670
+
+// Chance of each value changing in a cycle, roughly what a flight
+// controller reports while flying.
+#define BATCH_FAST_CHANGE 0.5
+#define BATCH_SLOW_CHANGE 0.05
+
+typedef enum
+{
+    BATCH_NEVER,
+    BATCH_ALWAYS,
+    BATCH_LQ, // Like input_air.c
+    BATCH_MODE_COUNT,
+} batch_mode_e;
+
+typedef struct
+{
+    air_stream_t tx_stream;
+    air_stream_t rx_stream;
+    air_stream_link_t link;
+    batch_mode_e mode;
+    telemetry_t telemetry[TELEMETRY_DOWNLINK_COUNT];
+    telemetry_val_t received[TELEMETRY_DOWNLINK_COUNT];
+    unsigned received_count[TELEMETRY_DOWNLINK_COUNT];
+    unsigned updates;
+    unsigned invalid;
+} batch_pair_t;
+
+static bool batch_is_fast(int id)
+{
+    switch (id)
+    {
+    case TELEMETRY_ID_ALTITUDE:
+    case TELEMETRY_ID_VERTICAL_SPEED:
+    case TELEMETRY_ID_HEADING:
+    case TELEMETRY_ID_ATTITUDE_X:
+    case TELEMETRY_ID_ATTITUDE_Y:
+    case TELEMETRY_ID_ATTITUDE_Z:
+        return true;
+    }
+    return false;
+}
+
+static void batch_telemetry(void *user, int telemetry_id, const void *data, size_t size, time_micros_t now)
+{
+    batch_pair_t *p = user;
+    if (!TELEMETRY_IS_DOWNLINK(telemetry_id) || telemetry_id >= TELEMETRY_DOWNLINK_COUNT)
+    {
+        p->invalid++;
+        return;
+    }
+    size_t data_size = telemetry_get_data_size(telemetry_id);
+    if ((data_size > 0 && size != data_size) || size > sizeof(telemetry_val_t))
+    {
+        p->invalid++;
+        return;
+    }
+    telemetry_val_t *val = &p->received[TELEMETRY_DOWNLINK_GET_IDX(telemetry_id)];
+    if (p->received_count[telemetry_id] == 0 || memcmp(val, data, size) != 0)
+    {
+        p->updates++;
+    }
+    memcpy(val, data, size);
+    p->received_count[telemetry_id]++;
+}
+
+static void batch_channel(void *user, unsigned chn, unsigned value, time_micros_t now)
+{
+}
+
+static void batch_cmd(void *user, air_cmd_e cmd, const void *data, size_t size, time_micros_t now)
+{
+}
+
+static void batch_pull(void *user, air_stream_class_e cls, size_t offset, time_micros_t now)
+{
+    batch_pair_t *p = user;
+    if (cls != AIR_STREAM_CLASS_TELEMETRY)
+    {
+        return;
+    }
+    bool batch = p->mode == BATCH_ALWAYS;
+    if (p->mode == BATCH_LQ && p->link.cycles > 0)
+    {
+        // What the TX reports as TELEMETRY_ID_TX_LINK_QUALITY
+        unsigned lq = 100 - p->link.downlink_lost * 100 / p->link.cycles;
+        batch = lq >= AIR_STREAM_TELEMETRY_BATCH_MIN_LQ;
+    }
+    air_stream_feed_output_scored_downlink_telemetry(&p->rx_stream, p->telemetry, batch, now);
+}
+
+// Sets a fixed size value to the low bytes of v
+static void batch_set(batch_pair_t *p, int id, uint32_t v)
+{
+    telemetry_t *t = &p->telemetry[TELEMETRY_DOWNLINK_GET_IDX(id)];
+    size_t size = telemetry_get_data_size(id);
+    bool changed = memcmp(&t->val, &v, size) != 0;
+    memcpy(&t->val, &v, size);
+    data_state_update(&t->data_state, changed, test_time_micros);
+}
+
+static void batch_init(batch_pair_t *p, batch_mode_e mode, double loss, uint64_t seed)
+{
+    memset(p, 0, sizeof(*p));
+    // Values updated at time zero don't count as set
+    test_time_micros += BATCH_CYCLE_US;
+    air_stream_init(&p->tx_stream, NULL, batch_telemetry, batch_cmd, NULL, p);
+    air_stream_init(&p->rx_stream, batch_channel, batch_telemetry, batch_cmd, batch_pull, p);
+    air_stream_set_cobs(&p->tx_stream, true);
+    air_stream_set_cobs(&p->rx_stream, true);
+    air_stream_link_init(&p->link, &p->tx_stream, &p->rx_stream, &batch_layout, BATCH_CYCLE_US, seed);
+    p->link.downlink_loss = loss;
+    p->mode = mode;
+    for (int ii = 0; ii < TELEMETRY_DOWNLINK_COUNT; ii++)
+    {
+        int id = TELEMETRY_DOWNLINK_ID(ii);
+        data_state_init(&p->telemetry[ii].data_state);
+        if (telemetry_get_data_size(id) > 0)
+        {
+            batch_set(p, id, air_stream_link_rand(&p->link));
+        }
+    }
+    telemetry_set_str(&p->telemetry[TELEMETRY_ID_CRAFT_NAME], TELEMETRY_ID_CRAFT_NAME, "RAVEN", test_time_micros);
+    telemetry_set_str(&p->telemetry[TELEMETRY_ID_FLIGHT_MODE_NAME], TELEMETRY_ID_FLIGHT_MODE_NAME, "ACRO", test_time_micros);
+}
+
+static void batch_cycle(batch_pair_t *p, bool change)
+{
+    for (int ii = 0; change && ii < TELEMETRY_DOWNLINK_COUNT; ii++)
+    {
+        int id = TELEMETRY_DOWNLINK_ID(ii);
+        if (telemetry_get_data_size(id) == 0)
+        {
+            continue;
+        }
+        double chance = batch_is_fast(id) ? BATCH_FAST_CHANGE : BATCH_SLOW_CHANGE;
+        if (air_stream_link_uniform(&p->link) < chance)
+        {
+            batch_set(p, id, air_stream_link_rand(&p->link));
+        }
+    }
+    air_stream_link_cycle(&p->link);
+}
+
+// Checks that the TX ended up with the last value of each telemetry
+static void batch_check_received(batch_pair_t *p)
+{
+    for (int ii = 0; ii < TELEMETRY_DOWNLINK_COUNT; ii++)
+    {
+        int id = TELEMETRY_DOWNLINK_ID(ii);
+        size_t size = telemetry_get_data_size(id);
+        if (size == 0)
+        {
+            size = strlen(p->telemetry[ii].val.s) + 1;
+        }
+        TEST_CHECK(p->received_count[ii] > 0);
+        TEST_CHECK(memcmp(&p->received[ii], &p->telemetry[ii].val, size) == 0);
+    }
+}
+
+int main(void)
+{
+    static const double losses[] = {0, 0.02, 0.05, 0.1, 0.3};
+    printf("Downlink telemetry updates/s with %u byte packets every %uus, single vs always batched vs batched by LQ:\n",
+           batch_layout.downlink_data_bytes, BATCH_CYCLE_US);
+    for (unsigned ii = 0; ii < sizeof(losses) / sizeof(losses[0]); ii++)
+    {
+        double ups[BATCH_MODE_COUNT];
+        for (batch_mode_e mode = 0; mode < BATCH_MODE_COUNT; mode++)
+        {
+            static batch_pair_t p;
+            batch_init(&p, mode, losses[ii], 1 + ii);
+            for (int cc = 0; cc < BATCH_CYCLES; cc++)
+            {
+                batch_cycle(&p, true);
+            }
+            ups[mode] = p.updates * 1e6 / ((double)BATCH_CYCLES * BATCH_CYCLE_US);
+            TEST_CHECK(p.invalid == 0);
+            // Once the values stop changing, unchanged ones keep being
+            // resent, so the TX catches up even after losses.
+            p.link.downlink_loss = 0;
+            for (int cc = 0; cc < BATCH_DRAIN_CYCLES; cc++)
+            {
+                batch_cycle(&p, false);
+            }
+            TEST_CHECK(p.invalid == 0);
+            batch_check_received(&p);
+        }
+        printf("  loss %2.0f%%: %6.1f vs %6.1f vs %6.1f\n", losses[ii] * 100,
+               ups[BATCH_NEVER], ups[BATCH_ALWAYS], ups[BATCH_LQ]);
+        // Batching pays off on a clean link, and the LQ threshold keeps
+        // it from making things worse on a lossy one.
+        TEST_CHECK(losses[ii] > 0 || ups[BATCH_ALWAYS] > ups[BATCH_NEVER] * 1.1);
+        TEST_CHECK(ups[BATCH_LQ] >= ups[BATCH_NEVER] * 0.98);
+        TEST_CHECK(ups[BATCH_LQ] >= ups[BATCH_ALWAYS] * 0.98);
+    }
+    return TEST_RESULT();
+}
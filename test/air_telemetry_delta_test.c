@@ -0,0 +1,415 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "air/air_telemetry_delta.h"
+
+#include "test.h"
+
+// Round trips between an encoder and a decoder, checking that a value is
+// never decoded against a base the encoder didn't intend, no matter which
+// SETs and AIR_CMD_TELEMETRY_ACKs get lost, delayed or reordered.
+
+#define DELTA_PACKETS 200000
+#define DELTA_MAX_ACKS 256
+
+static const unsigned delta_idxs[] = {
+    TELEMETRY_ID_CRAFT_NAME,
+    TELEMETRY_ID_FLIGHT_MODE_NAME,
+    TELEMETRY_ID_BAT_VOLTAGE,
+    TELEMETRY_ID_CURRENT,
+    TELEMETRY_ID_CURRENT_DRAWN,
+    TELEMETRY_ID_ALTITUDE,
+    TELEMETRY_ID_HEADING,
+    TELEMETRY_ID_GPS_LAT,
+};
+
+#define DELTA_IDX_COUNT (sizeof(delta_idxs) / sizeof(delta_idxs[0]))
+
+static const char *delta_strings[] = {"ACRO", "ANGLE", "HORIZON", "AIR", "RTH", "!FS!", "RAVEN"};
+
+typedef struct
+{
+    air_cmd_telemetry_ack_t ack;
+    uint32_t deliver_at; // Packet in which the ACK reaches the encoder
+} delta_pending_ack_t;
+
+typedef struct
+{
+    air_telemetry_delta_t encoder;
+    air_telemetry_delta_t decoder;
+    telemetry_val_t values[TELEMETRY_DOWNLINK_COUNT];
+    delta_pending_ack_t acks[DELTA_MAX_ACKS];
+    unsigned ack_count;
+    uint32_t packet;
+    double value_loss;
+    double ack_loss;
+    unsigned max_ack_delay;
+    uint64_t rng;
+    // Stats
+    unsigned encoded;
+    unsigned decoded;
+    unsigned nacks;
+    unsigned mismatches;
+    unsigned invalid;
+    size_t encoded_bytes;
+    size_t raw_bytes;
+} delta_link_t;
+
+static uint32_t delta_rand(delta_link_t *l)
+{
+    l->rng ^= l->rng << 13;
+    l->rng ^= l->rng >> 7;
+    l->rng ^= l->rng << 17;
+    return l->rng >> 32;
+}
+
+static double delta_uniform(delta_link_t *l)
+{
+    return delta_rand(l) * (1.0 / 4294967296.0);
+}
+
+static size_t delta_value_size(unsigned idx, const telemetry_val_t *val)
+{
+    size_t size = telemetry_get_data_size(TELEMETRY_DOWNLINK_ID(idx));
+    return size > 0 ? size : strlen(val->s) + 1;
+}
+
+static void delta_init(delta_link_t *l, double value_loss, double ack_loss, unsigned max_ack_delay, uint64_t seed)
+{
+    memset(l, 0, sizeof(*l));
+    air_telemetry_delta_init(&l->encoder, false);
+    air_telemetry_delta_init(&l->decoder, false);
+    l->value_loss = value_loss;
+    l->ack_loss = ack_loss;
+    l->max_ack_delay = max_ack_delay;
+    l->rng = seed | 1;
+    strcpy(l->values[TELEMETRY_ID_CRAFT_NAME].s, "RAVEN");
+    strcpy(l->values[TELEMETRY_ID_FLIGHT_MODE_NAME].s, "ACRO");
+}
+
+// Random walk with occasional jumps, strings from a small dictionary
+static void delta_change(delta_link_t *l, unsigned idx)
+{
+    telemetry_val_t *val = &l->values[idx];
+    size_t size = telemetry_get_data_size(TELEMETRY_DOWNLINK_ID(idx));
+    if (size == 0)
+    {
+        strcpy(val->s, delta_strings[delta_rand(l) % (sizeof(delta_strings) / sizeof(delta_strings[0]))]);
+        return;
+    }
+    uint32_t step = delta_rand(l) % 16 == 0 ? delta_rand(l) : delta_rand(l) % 64 - 32;
+    if (size == sizeof(uint32_t))
+    {
+        val->u32 += step;
+    }
+    else
+    {
+        val->u16 += step;
+    }
+}
+
+static void delta_queue_ack(delta_link_t *l, const air_cmd_telemetry_ack_t *ack)
+{
+    if (delta_uniform(l) < l->ack_loss || l->ack_count == DELTA_MAX_ACKS)
+    {
+        return;
+    }
+    delta_pending_ack_t *p = &l->acks[l->ack_count++];
+    p->ack = *ack;
+    // Sent with the next packet in the other direction, then delayed
+    // by the queues. Different delays reorder them.
+    p->deliver_at = l->packet + 1 + (l->max_ack_delay ? delta_rand(l) % (l->max_ack_delay + 1) : 0);
+}
+
+static void delta_deliver_acks(delta_link_t *l)
+{
+    unsigned kept = 0;
+    for (unsigned ii = 0; ii < l->ack_count; ii++)
+    {
+        if (l->acks[ii].deliver_at <= l->packet)
+        {
+            air_telemetry_delta_handle_ack(&l->encoder, &l->acks[ii].ack);
+        }
+        else
+        {
+            l->acks[kept++] = l->acks[ii];
+        }
+    }
+    l->ack_count = kept;
+}
+
+// Sends the current value for idx, returns wether the decoder got it right
+static bool delta_send(delta_link_t *l, unsigned idx)
+{
+    const telemetry_val_t *val = &l->values[idx];
+    size_t size = delta_value_size(idx, val);
+    uint8_t buf[AIR_TELEMETRY_DELTA_MAX_SIZE];
+    size_t expected = air_telemetry_delta_encoded_size_for(&l->encoder, idx, val, l->packet);
+    size_t n = air_telemetry_delta_encode(&l->encoder, idx, val, buf, l->packet);
+    TEST_CHECK(n == expected);
+    l->raw_bytes += size;
+    if (n == 0)
+    {
+        // Sent as is
+        l->encoded_bytes += size;
+        return true;
+    }
+    l->encoded++;
+    l->encoded_bytes += n;
+    TEST_CHECK(air_telemetry_delta_encoded_size(&l->decoder, idx, buf, n) == (int)n);
+    if (delta_uniform(l) < l->value_loss)
+    {
+        return false;
+    }
+    telemetry_val_t decoded;
+    size_t decoded_size = 0;
+    air_cmd_telemetry_ack_t ack;
+    memset(&decoded, 0, sizeof(decoded));
+    switch (air_telemetry_delta_decode(&l->decoder, idx, buf, n, &decoded, &decoded_size, &ack))
+    {
+    case AIR_TELEMETRY_DELTA_DECODED_ACK:
+        delta_queue_ack(l, &ack);
+        // FALLTHROUGH
+    case AIR_TELEMETRY_DELTA_DECODED:
+        l->decoded++;
+        if (decoded_size != size || memcmp(&decoded, val, size) != 0)
+        {
+            l->mismatches++;
+            return false;
+        }
+        return true;
+    case AIR_TELEMETRY_DELTA_NACK:
+        l->nacks++;
+        delta_queue_ack(l, &ack);
+        return false;
+    case AIR_TELEMETRY_DELTA_INVALID:
+        l->invalid++;
+        break;
+    }
+    return false;
+}
+
+static void delta_step(delta_link_t *l)
+{
+    l->packet++;
+    delta_deliver_acks(l);
+    unsigned idx = delta_idxs[delta_rand(l) % DELTA_IDX_COUNT];
+    if (delta_rand(l) % 4 != 0)
+    {
+        delta_change(l, idx);
+    }
+    delta_send(l, idx);
+}
+
+static void delta_check(delta_link_t *l)
+{
+    TEST_CHECK(l->mismatches == 0);
+    TEST_CHECK(l->invalid == 0);
+}
+
+// A lost ACK leaves the SET pending, so the encoder keeps sending the
+// value as is and then retries the SET. The late ACK for the first SET
+// must not validate the slot for the retried one.
+static void test_lost_ack(void)
+{
+    static delta_link_t l;
+    delta_init(&l, 0, 1, 0, 1);
+    unsigned idx = TELEMETRY_ID_ALTITUDE;
+    l.values[idx].i32 = 100000;
+    uint8_t buf[AIR_TELEMETRY_DELTA_MAX_SIZE];
+    size_t set_size = air_telemetry_delta_encode(&l.encoder, idx, &l.values[idx], buf, l.packet);
+    TEST_CHECK(set_size == 1 + sizeof(int32_t));
+    telemetry_val_t decoded;
+    size_t decoded_size;
+    air_cmd_telemetry_ack_t first_ack;
+    TEST_CHECK(air_telemetry_delta_decode(&l.decoder, idx, buf, set_size, &decoded, &decoded_size, &first_ack) == AIR_TELEMETRY_DELTA_DECODED_ACK);
+    // ACK lost: no deltas against the pending slot, no new SET until the retry
+    for (int ii = 0; ii < 7; ii++)
+    {
+        l.packet++;
+        l.values[idx].i32++;
+        TEST_CHECK(air_telemetry_delta_encode(&l.encoder, idx, &l.values[idx], buf, l.packet) == 0);
+    }
+    // Retry, which the decoder misses
+    l.packet++;
+    l.values[idx].i32 = 200000;
+    size_t n = air_telemetry_delta_encode(&l.encoder, idx, &l.values[idx], buf, l.packet);
+    TEST_CHECK(n == 1 + sizeof(int32_t));
+    // The ACK for the first SET arrives late
+    air_telemetry_delta_handle_ack(&l.encoder, &first_ack);
+    l.packet++;
+    l.values[idx].i32++;
+    n = air_telemetry_delta_encode(&l.encoder, idx, &l.values[idx], buf, l.packet);
+    // Either sent as is or, if encoded, decoded right
+    if (n > 0)
+    {
+        air_cmd_telemetry_ack_t ack;
+        air_telemetry_delta_result_e r = air_telemetry_delta_decode(&l.decoder, idx, buf, n, &decoded, &decoded_size, &ack);
+        TEST_CHECK(r == AIR_TELEMETRY_DELTA_NACK || (r != AIR_TELEMETRY_DELTA_INVALID && decoded.i32 == l.values[idx].i32));
+    }
+}
+
+// ACKs for two SETs of the same index delivered in reverse order
+static void test_reordered_acks(void)
+{
+    static delta_link_t l;
+    delta_init(&l, 0, 0, 0, 2);
+    unsigned idx = TELEMETRY_ID_GPS_LAT;
+    uint8_t buf[AIR_TELEMETRY_DELTA_MAX_SIZE];
+    telemetry_val_t decoded;
+    size_t decoded_size;
+    air_cmd_telemetry_ack_t acks[2];
+    l.values[idx].i32 = 473977000;
+    size_t n = air_telemetry_delta_encode(&l.encoder, idx, &l.values[idx], buf, l.packet);
+    TEST_CHECK(air_telemetry_delta_decode(&l.decoder, idx, buf, n, &decoded, &decoded_size, &acks[0]) == AIR_TELEMETRY_DELTA_DECODED_ACK);
+    // First ACK delayed past the retry
+    l.packet += 8;
+    l.values[idx].i32 = -1225000;
+    n = air_telemetry_delta_encode(&l.encoder, idx, &l.values[idx], buf, l.packet);
+    TEST_CHECK(n == 1 + sizeof(int32_t));
+    TEST_CHECK(air_telemetry_delta_decode(&l.decoder, idx, buf, n, &decoded, &decoded_size, &acks[1]) == AIR_TELEMETRY_DELTA_DECODED_ACK);
+    air_telemetry_delta_handle_ack(&l.encoder, &acks[1]);
+    air_telemetry_delta_handle_ack(&l.encoder, &acks[0]);
+    // Values close to both bases must decode to the right one
+    const int32_t values[] = {473977005, -1224990, 473976990, -1225003};
+    for (unsigned ii = 0; ii < sizeof(values) / sizeof(values[0]); ii++)
+    {
+        l.packet++;
+        l.values[idx].i32 = values[ii];
+        n = air_telemetry_delta_encode(&l.encoder, idx, &l.values[idx], buf, l.packet);
+        if (n == 0)
+        {
+            continue;
+        }
+        air_cmd_telemetry_ack_t ack;
+        air_telemetry_delta_result_e r = air_telemetry_delta_decode(&l.decoder, idx, buf, n, &decoded, &decoded_size, &ack);
+        TEST_CHECK(r == AIR_TELEMETRY_DELTA_DECODED || r == AIR_TELEMETRY_DELTA_DECODED_ACK);
+        TEST_CHECK(decoded.i32 == values[ii]);
+    }
+}
+
+// An ACK delayed until every generation has been used by a retried SET
+// must not validate a newer SET that the decoder missed.
+static void test_stale_ack_after_wrap(void)
+{
+    static delta_link_t l;
+    delta_init(&l, 0, 0, 0, 4);
+    unsigned idx = TELEMETRY_ID_CURRENT_DRAWN;
+    uint8_t buf[AIR_TELEMETRY_DELTA_MAX_SIZE];
+    telemetry_val_t decoded;
+    size_t decoded_size;
+    air_cmd_telemetry_ack_t stale_ack;
+    l.values[idx].i32 = 1000;
+    size_t n = air_telemetry_delta_encode(&l.encoder, idx, &l.values[idx], buf, l.packet);
+    TEST_CHECK(air_telemetry_delta_decode(&l.decoder, idx, buf, n, &decoded, &decoded_size, &stale_ack) == AIR_TELEMETRY_DELTA_DECODED_ACK);
+    // All the retries are lost, as well as their ACKs. Once every other
+    // generation is waiting for an ACK, the encoder stops sending SETs.
+    unsigned sets = 0;
+    for (int ii = 0; ii < 32; ii++)
+    {
+        l.packet += 8;
+        l.values[idx].i32 += 100000;
+        n = air_telemetry_delta_encode(&l.encoder, idx, &l.values[idx], buf, l.packet);
+        if (n == 0)
+        {
+            break;
+        }
+        sets++;
+        // SETs have op zero
+        TEST_CHECK(buf[0] != ((stale_ack.slot << 4) | stale_ack.gen));
+    }
+    TEST_CHECK(sets == 15);
+    air_telemetry_delta_handle_ack(&l.encoder, &stale_ack);
+    unsigned deltas = 0;
+    for (int ii = 0; ii < 64; ii++)
+    {
+        l.packet++;
+        l.values[idx].i32 += 1;
+        n = air_telemetry_delta_encode(&l.encoder, idx, &l.values[idx], buf, l.packet);
+        if (n > 0)
+        {
+            air_cmd_telemetry_ack_t ack;
+            air_telemetry_delta_result_e r = air_telemetry_delta_decode(&l.decoder, idx, buf, n, &decoded, &decoded_size, &ack);
+            TEST_CHECK(r == AIR_TELEMETRY_DELTA_DECODED || r == AIR_TELEMETRY_DELTA_DECODED_ACK);
+            TEST_CHECK(decoded.i32 == l.values[idx].i32);
+            if (r == AIR_TELEMETRY_DELTA_DECODED_ACK)
+            {
+                air_telemetry_delta_handle_ack(&l.encoder, &ack);
+            }
+            else
+            {
+                deltas++;
+            }
+        }
+    }
+    // Back to deltas
+    TEST_CHECK(deltas > 0);
+}
+
+// The decoder restarts and loses its slots, the encoder gets NACKs for
+// the stale ones and goes back to SETs.
+static void test_decoder_restart(void)
+{
+    static delta_link_t l;
+    delta_init(&l, 0.1, 0.1, 4, 3);
+    for (int ii = 0; ii < DELTA_PACKETS / 4; ii++)
+    {
+        delta_step(&l);
+    }
+    unsigned encoded = l.encoded;
+    air_telemetry_delta_init(&l.decoder, false);
+    l.nacks = 0;
+    for (int ii = 0; ii < DELTA_PACKETS / 4; ii++)
+    {
+        delta_step(&l);
+    }
+    delta_check(&l);
+    TEST_CHECK(l.nacks > 0);
+    // Still delta coding after recovering
+    TEST_CHECK(l.encoded - encoded > DELTA_PACKETS / 16);
+}
+
+static void test_random(void)
+{
+    static const struct
+    {
+        double value_loss;
+        double ack_loss;
+        unsigned max_ack_delay;
+    } cases[] = {
+        {0, 0, 0},
+        {0.1, 0, 0},
+        {0, 0.3, 0},
+        {0.1, 0.1, 8},
+        {0.3, 0.3, 16},
+        // ACKs delayed for long enough to see the generations wrap
+        {0.05, 0.05, 64},
+    };
+    for (unsigned ii = 0; ii < sizeof(cases) / sizeof(cases[0]); ii++)
+    {
+        static delta_link_t l;
+        delta_init(&l, cases[ii].value_loss, cases[ii].ack_loss, cases[ii].max_ack_delay, 10 + ii);
+        for (int jj = 0; jj < DELTA_PACKETS; jj++)
+        {
+            delta_step(&l);
+        }
+        delta_check(&l);
+        printf("  value loss %2.0f%%, ack loss %2.0f%%, ack delay <= %2u: %5.1f%% of raw size, %u nacks\n",
+               cases[ii].value_loss * 100, cases[ii].ack_loss * 100, cases[ii].max_ack_delay,
+               l.encoded_bytes * 100.0 / l.raw_bytes, l.nacks);
+        TEST_CHECK(l.encoded_bytes < l.raw_bytes);
+        TEST_CHECK(cases[ii].value_loss > 0 || l.nacks == 0);
+    }
+}
+
+int main(void)
+{
+    srand(1);
+    test_lost_ack();
+    test_reordered_acks();
+    test_stale_ack_after_wrap();
+    test_decoder_restart();
+    test_random();
+    return TEST_RESULT();
+}
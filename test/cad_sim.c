@@ -0,0 +1,331 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Event model of the RX timing in input_air.c with and without early loss
+// detection using CAD. It follows input_air_update() and
+// input_air_prepare_next_receive(): the deadline is the expected end of
+// the packet plus CYCLE_TIME_WAIT_FACTOR of the cycle, after a timeout
+// the next packet is expected a cycle later, and after
+// MAX_LOST_PACKETS_JUMPING_FORWARD lost packets the RX scans backwards.
+// The link fades for a few packets at random, and CAD has a fixed rate
+// of false negatives and false positives. Not a test, build it with
+// make test-tools.
+
+#define SIM_SEQ_COUNT 64
+#define SIM_WAIT_FACTOR 0.10
+#define SIM_MAX_LOST_JUMPING_FORWARD (SIM_SEQ_COUNT / 2)
+#define SIM_MAX_LOST_USING_CAD SIM_MAX_LOST_JUMPING_FORWARD
+#define SIM_CAD_AUDIT_INTERVAL 16
+#define SIM_PREAMBLE_SYMBOLS 10.25
+#define SIM_RESPONSE_PROCESSING_US 1500
+
+#define SIM_SLOTS 40000
+#define SIM_SEEDS 5
+#define SIM_FADE_PROBABILITY 0.01
+#define SIM_LOSS_PROBABILITY 0.02
+#define SIM_CAD_FALSE_NEGATIVES 0.03
+#define SIM_CAD_FALSE_POSITIVES 0.01
+#define SIM_JITTER_US 200
+
+typedef struct
+{
+    const char *name;
+    double cycle;
+    double uplink;
+    double downlink;
+    double symbol;
+} sim_mode_t;
+
+typedef struct
+{
+    double lost;
+    double detect_p50;
+    double detect_p99;
+    double reacquire_p50;
+    double reacquire_p90;
+    unsigned hits;
+    unsigned misses;
+    unsigned false_negatives;
+    unsigned audits;
+    unsigned audited_false_negatives;
+} sim_result_t;
+
+typedef struct
+{
+    const sim_mode_t *mode;
+    bool cad;
+    double ends[SIM_SLOTS];
+    bool faded[SIM_SLOTS];
+    unsigned tx_seq;
+    unsigned lost;
+    unsigned freq;
+    double listen_from;
+} sim_t;
+
+static uint64_t rng_state;
+
+static double rng_uniform(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return (rng_state >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+// In ms
+static double percentile(double *values, size_t count, unsigned p)
+{
+    if (count == 0)
+    {
+        return 0;
+    }
+    qsort(values, count, sizeof(*values), compare_double);
+    size_t idx = count * p / 100;
+    return values[idx < count ? idx : count - 1] / 1000;
+}
+
+static bool sim_using_cad(const sim_t *sim)
+{
+    return sim->cad && sim->lost < SIM_MAX_LOST_USING_CAD;
+}
+
+static void sim_prepare(sim_t *sim, double now)
+{
+    unsigned freq;
+    if (sim->lost > SIM_MAX_LOST_JUMPING_FORWARD)
+    {
+        freq = (sim->tx_seq + SIM_MAX_LOST_JUMPING_FORWARD - (sim->lost - SIM_MAX_LOST_JUMPING_FORWARD) / 4) % SIM_SEQ_COUNT;
+    }
+    else
+    {
+        freq = (sim->tx_seq + 1 + sim->lost) % SIM_SEQ_COUNT;
+    }
+    if (freq != sim->freq)
+    {
+        sim->freq = freq;
+        sim->listen_from = now;
+    }
+}
+
+// Returns the first packet on the current frequency starting in
+// [start, end) or -1 if there's none.
+static int sim_first_packet(const sim_t *sim, double start, double end)
+{
+    int k = start / sim->mode->cycle;
+    for (k = k < 1 ? 1 : k; k < SIM_SLOTS && sim->ends[k] - sim->mode->uplink < end; k++)
+    {
+        if (sim->ends[k] - sim->mode->uplink >= start && k % SIM_SEQ_COUNT == sim->freq)
+        {
+            return k;
+        }
+    }
+    return -1;
+}
+
+static void sim_run(const sim_mode_t *mode, bool cad, unsigned seed, int max_fade, sim_result_t *result)
+{
+    static sim_t sim;
+    static double detect[SIM_SLOTS];
+    static double reacquire[SIM_SLOTS];
+    static double fade_ends[SIM_SLOTS];
+    size_t detect_count = 0;
+    size_t reacquire_count = 0;
+    size_t fade_count = 0;
+    size_t next_fade = 0;
+
+    rng_state = 88172645463325252ull + seed * 0x9e3779b97f4a7c15ull;
+    sim.mode = mode;
+    sim.cad = cad;
+    for (int k = 0; k < SIM_SLOTS; k++)
+    {
+        sim.ends[k] = k * mode->cycle + (rng_uniform() * 2 - 1) * SIM_JITTER_US;
+    }
+    int fade_until = -1;
+    for (int k = 0; k < SIM_SLOTS; k++)
+    {
+        if (fade_until < k && rng_uniform() < SIM_FADE_PROBABILITY)
+        {
+            fade_until = k + 1 + (int)(rng_uniform() * max_fade);
+            if (fade_until + 1 < SIM_SLOTS)
+            {
+                // When the first packet after the fade starts
+                fade_ends[fade_count++] = sim.ends[fade_until + 1] - mode->uplink;
+            }
+        }
+        sim.faded[k] = k <= fade_until || rng_uniform() < SIM_LOSS_PROBABILITY;
+    }
+
+    double preamble = SIM_PREAMBLE_SYMBOLS * mode->symbol;
+    double cad_offset = mode->uplink - mode->symbol;
+    double cad_time = 2 * mode->symbol;
+    unsigned lost_packets = 0;
+    unsigned misses_until_audit = SIM_CAD_AUDIT_INTERVAL;
+    *result = (sim_result_t){0};
+    sim.tx_seq = 0;
+    sim.lost = 0;
+    sim.freq = 1;
+    sim.listen_from = 0;
+    double expected = sim.ends[1];
+    double deadline = expected + mode->cycle * SIM_WAIT_FACTOR;
+
+    while (expected < sim.ends[SIM_SLOTS - 1] - 2 * mode->cycle)
+    {
+        int got = -1;
+        if (sim_using_cad(&sim))
+        {
+            double cad_at = expected - cad_offset;
+            // CAD interrupts any RX in progress, but a packet whose
+            // preamble it sees is still received after restarting RX, as
+            // long as there are a few preamble symbols left to lock.
+            int k = sim_first_packet(&sim, cad_at + cad_time + 4 * mode->symbol - preamble, cad_at + 1);
+            bool sees = k >= 0 && !sim.faded[k];
+            bool detected = sees ? rng_uniform() >= SIM_CAD_FALSE_NEGATIVES : rng_uniform() < SIM_CAD_FALSE_POSITIVES;
+            if (detected)
+            {
+                result->hits++;
+                if (sees)
+                {
+                    got = k;
+                }
+                else if (k < 0)
+                {
+                    // False positive, listen until the deadline
+                    k = sim_first_packet(&sim, sim.listen_from, deadline);
+                    got = k >= 0 && !sim.faded[k] ? k : -1;
+                }
+            }
+            else
+            {
+                result->misses++;
+                result->false_negatives += sees;
+                if (--misses_until_audit == 0)
+                {
+                    // Keep listening until the deadline to measure
+                    // false negatives
+                    misses_until_audit = SIM_CAD_AUDIT_INTERVAL;
+                    result->audits++;
+                    result->audited_false_negatives += sees;
+                    got = sees ? k : -1;
+                }
+                else
+                {
+                    double now = cad_at + cad_time;
+                    lost_packets++;
+                    sim.lost++;
+                    detect[detect_count++] = now - expected;
+                    expected += mode->cycle;
+                    deadline = expected + mode->cycle * SIM_WAIT_FACTOR;
+                    sim_prepare(&sim, now);
+                    continue;
+                }
+            }
+        }
+        else
+        {
+            int k = sim_first_packet(&sim, sim.listen_from, deadline);
+            if (k < 0)
+            {
+                // A header seen before the deadline extends it once
+                int next = sim_first_packet(&sim, sim.listen_from, deadline + mode->cycle * SIM_WAIT_FACTOR);
+                if (next >= 0 && sim.ends[next] - mode->uplink + preamble < deadline)
+                {
+                    k = next;
+                }
+            }
+            got = k >= 0 && !sim.faded[k] ? k : -1;
+        }
+        if (got >= 0)
+        {
+            double now = sim.ends[got];
+            for (; next_fade < fade_count && fade_ends[next_fade] <= now; next_fade++)
+            {
+                if (now - mode->uplink >= fade_ends[next_fade])
+                {
+                    reacquire[reacquire_count++] = now - fade_ends[next_fade];
+                }
+            }
+            sim.tx_seq = got % SIM_SEQ_COUNT;
+            sim.lost = 0;
+            expected = now + mode->cycle;
+            deadline = expected + mode->cycle * SIM_WAIT_FACTOR;
+            // Send the response, then hop
+            sim_prepare(&sim, now + mode->downlink + SIM_RESPONSE_PROCESSING_US);
+            continue;
+        }
+        // Timeout. After a CAD loss the RX keeps the TX timing.
+        double now = deadline;
+        bool anchored = sim_using_cad(&sim);
+        lost_packets++;
+        sim.lost++;
+        detect[detect_count++] = now - expected;
+        expected = (anchored ? expected : now) + mode->cycle;
+        deadline = expected + mode->cycle * SIM_WAIT_FACTOR;
+        sim_prepare(&sim, now);
+    }
+    result->lost = 100.0 * lost_packets / SIM_SLOTS;
+    result->detect_p50 = percentile(detect, detect_count, 50);
+    result->detect_p99 = percentile(detect, detect_count, 99);
+    result->reacquire_p50 = percentile(reacquire, reacquire_count, 50);
+    result->reacquire_p90 = percentile(reacquire, reacquire_count, 90);
+}
+
+int main(void)
+{
+    // Fixed cycle times and the LoRa time on air of the uplink and
+    // downlink packets in each mode, from sx127x_lora_time_on_air().
+    static const sim_mode_t modes[] = {
+        {"MODE_4 SF9 ", 66000, 24832, 24832, 1024},
+        {"MODE_5 SF10", 115000, 53760, 53760, 2048},
+    };
+    static const int max_fades[] = {12, 40};
+
+    for (unsigned ff = 0; ff < sizeof(max_fades) / sizeof(max_fades[0]); ff++)
+    {
+        printf("fades of 1-%d packets, %.0f%% fade start chance per packet, %.0f%% random loss, "
+               "CAD %.0f%% false negatives, %.0f%% false positives\n",
+               max_fades[ff], SIM_FADE_PROBABILITY * 100, SIM_LOSS_PROBABILITY * 100,
+               SIM_CAD_FALSE_NEGATIVES * 100, SIM_CAD_FALSE_POSITIVES * 100);
+        for (unsigned mm = 0; mm < sizeof(modes) / sizeof(modes[0]); mm++)
+        {
+            for (int cad = 0; cad < 2; cad++)
+            {
+                sim_result_t sum = {0};
+                for (unsigned seed = 0; seed < SIM_SEEDS; seed++)
+                {
+                    sim_result_t r;
+                    sim_run(&modes[mm], cad, seed, max_fades[ff], &r);
+                    sum.lost += r.lost;
+                    sum.detect_p50 += r.detect_p50;
+                    sum.detect_p99 += r.detect_p99;
+                    sum.reacquire_p50 += r.reacquire_p50;
+                    sum.reacquire_p90 += r.reacquire_p90;
+                    sum.hits += r.hits;
+                    sum.misses += r.misses;
+                    sum.false_negatives += r.false_negatives;
+                    sum.audits += r.audits;
+                    sum.audited_false_negatives += r.audited_false_negatives;
+                }
+                printf("  %s %-4s lost %5.2f%% | detect p50 %6.1f p99 %6.1f ms | reacquire p50 %6.1f p90 %7.1f ms",
+                       modes[mm].name, cad ? "CAD" : "base", sum.lost / SIM_SEEDS, sum.detect_p50 / SIM_SEEDS,
+                       sum.detect_p99 / SIM_SEEDS, sum.reacquire_p50 / SIM_SEEDS, sum.reacquire_p90 / SIM_SEEDS);
+                if (cad)
+                {
+                    printf(" | CAD hits %u misses %u audits %u audited FN %u (true FN %u)",
+                           sum.hits / SIM_SEEDS, sum.misses / SIM_SEEDS, sum.audits / SIM_SEEDS,
+                           sum.audited_false_negatives / SIM_SEEDS, sum.false_negatives / SIM_SEEDS);
+                }
+                printf("\n");
+            }
+        }
+    }
+    return 0;
+}
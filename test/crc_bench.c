@@ -0,0 +1,91 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "util/crc.h"
+
+// Time per byte of crc8_dvb_s2_bytes() for the sizes it sees: bind and
+// air packets, CRSF frames and MSP v2 frames. The implementation is
+// picked at build time, so there's one binary per variant like with
+// crc_test. Cycles are TSC ticks and only available on x86. Not a test,
+// build it with make test-tools.
+
+#define BENCH_BYTES (1 << 20)
+#define BENCH_REPEATS 20
+
+#if defined(USE_CRC8_DVB_S2_BITWISE)
+#define BENCH_VARIANT "bitwise"
+#elif defined(USE_CRC8_DVB_S2_SLICING_BY_4)
+#define BENCH_VARIANT "slicing-by-4"
+#else
+#define BENCH_VARIANT "table"
+#endif
+
+static uint64_t rng_state = 88172645463325252ull;
+
+static uint64_t rng_next(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint64_t now_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+int main(void)
+{
+    static const size_t sizes[] = {6, 14, 26, 64, 256};
+    static uint8_t data[256 + 3];
+    for (size_t ii = 0; ii < sizeof(data); ii++)
+    {
+        data[ii] = rng_next();
+    }
+
+    printf("%s, best of %d:\n", BENCH_VARIANT, BENCH_REPEATS);
+    printf("%6s %10s %12s\n", "bytes", "ns/byte", "cycles/byte");
+    volatile uint8_t sink = 0;
+    for (size_t ss = 0; ss < sizeof(sizes) / sizeof(sizes[0]); ss++)
+    {
+        size_t iterations = BENCH_BYTES / sizes[ss];
+        uint64_t best_ns = UINT64_MAX, best_cycles = UINT64_MAX;
+        for (int rr = 0; rr < BENCH_REPEATS; rr++)
+        {
+            uint64_t start = now_ns();
+            uint64_t start_cycles = now_cycles();
+            for (size_t ii = 0; ii < iterations; ii++)
+            {
+                // Vary the alignment, the air packets aren't aligned
+                uint8_t crc = crc8_dvb_s2_bytes(&data[ii & 3], sizes[ss]);
+                data[0] ^= crc;
+                sink = crc;
+            }
+            uint64_t cycles = now_cycles() - start_cycles;
+            uint64_t t = now_ns() - start;
+            best_ns = t < best_ns ? t : best_ns;
+            best_cycles = cycles < best_cycles ? cycles : best_cycles;
+        }
+        double total = (double)iterations * sizes[ss];
+        printf("%6u %10.2f %12.2f\n", (unsigned)sizes[ss], best_ns / total, best_cycles / total);
+    }
+    (void)sink;
+    return 0;
+}
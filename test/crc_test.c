@@ -0,0 +1,96 @@
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "util/crc.h"
+
+#include "test.h"
+
+// Built once per CRC8 implementation (see test/Makefile). All of them
+// are checked against this plain bitwise one.
+static uint8_t crc8_dvb_s2_ref(uint8_t crc, uint8_t data)
+{
+    crc ^= data;
+    for (int ii = 0; ii < 8; ii++)
+    {
+        crc = (crc & 0x80) ? (crc << 1) ^ 0xD5 : crc << 1;
+    }
+    return crc;
+}
+
+static uint8_t crc8_dvb_s2_ref_bytes_from(uint8_t crc, const uint8_t *data, size_t size)
+{
+    for (size_t ii = 0; ii < size; ii++)
+    {
+        crc = crc8_dvb_s2_ref(crc, data[ii]);
+    }
+    return crc;
+}
+
+int main(void)
+{
+    uint8_t buf[300];
+
+    // Every (crc, byte) pair
+    for (int crc = 0; crc < 256; crc++)
+    {
+        for (int data = 0; data < 256; data++)
+        {
+            TEST_CHECK(crc8_dvb_s2(crc, data) == crc8_dvb_s2_ref(crc, data));
+        }
+    }
+
+    // Every initial CRC with every value at each position of a 4 byte
+    // block, for lengths which end in every part of the block.
+    int errors = 0;
+    for (int crc = 0; crc < 256; crc++)
+    {
+        for (int pos = 0; pos < 4; pos++)
+        {
+            for (int value = 0; value < 256; value++)
+            {
+                for (int ii = 0; ii < 8; ii++)
+                {
+                    buf[ii] = crc * 7 + ii * 13;
+                }
+                buf[pos] = value;
+                for (int size = 0; size <= 8; size++)
+                {
+                    if (crc8_dvb_s2_bytes_from(crc, buf, size) != crc8_dvb_s2_ref_bytes_from(crc, buf, size))
+                    {
+                        errors++;
+                    }
+                }
+            }
+        }
+    }
+    TEST_CHECK(errors == 0);
+
+    // Random buffers with unaligned starts
+    srand(1);
+    for (int it = 0; it < 100000; it++)
+    {
+        size_t size = rand() % sizeof(buf);
+        uint8_t crc = rand();
+        for (size_t ii = 0; ii < size; ii++)
+        {
+            buf[ii] = rand();
+        }
+        size_t offset = rand() % 4;
+        if (offset > size)
+        {
+            offset = 0;
+        }
+        uint8_t expected = crc8_dvb_s2_ref_bytes_from(crc, buf + offset, size - offset);
+        if (crc8_dvb_s2_bytes_from(crc, buf + offset, size - offset) != expected)
+        {
+            errors++;
+        }
+        if (crc == 0 && crc8_dvb_s2_bytes(buf + offset, size - offset) != expected)
+        {
+            errors++;
+        }
+    }
+    TEST_CHECK(errors == 0);
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,128 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "util/fec.h"
+
+// Time per packet for encoding and decoding, and packet success rate on a
+// binary symmetric channel, for the FSK air packet sizes. Not a test,
+// build it with make test-tools.
+
+#define BENCH_ITERATIONS 1000
+#define BENCH_REPEATS 20
+#define CHANNEL_PACKETS 200000
+
+static uint64_t rng_state = 88172645463325252ull;
+
+static uint64_t rng_next(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static double rng_uniform(void)
+{
+    return (rng_next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+int main(void)
+{
+    static const fec_t rs = {.type = FEC_TYPE_REED_SOLOMON, .parity_bytes = 8};
+    const fec_t *fecs[] = {FEC_NIBBLE, &rs};
+    const char *names[] = {"nibble", "rs(8)"};
+    static const size_t sizes[] = {16, 28};
+    static const double bers[] = {1e-4, 3e-4, 1e-3, 2e-3, 5e-3, 1e-2, 2e-2, 3e-2};
+
+    printf("ns per packet (best of %d):\n", BENCH_REPEATS);
+    for (int ff = 0; ff < 2; ff++)
+    {
+        for (int ss = 0; ss < 2; ss++)
+        {
+            uint8_t data[64], encoded[128], corrupted[128], decoded[64];
+            for (int ii = 0; ii < 64; ii++)
+            {
+                data[ii] = rng_next();
+            }
+            size_t encoded_size = fec_encode(fecs[ff], data, sizes[ss], encoded, sizeof(encoded));
+            memcpy(corrupted, encoded, encoded_size);
+            corrupted[1] ^= 0x55;
+            corrupted[5] ^= 0x01;
+            corrupted[9] ^= 0x80;
+            corrupted[encoded_size - 1] ^= 0x03;
+            uint64_t best_encode = UINT64_MAX, best_decode = UINT64_MAX, best_decode_errors = UINT64_MAX;
+            for (int rr = 0; rr < BENCH_REPEATS; rr++)
+            {
+                uint64_t start = now_ns();
+                for (int ii = 0; ii < BENCH_ITERATIONS; ii++)
+                {
+                    data[0] = ii;
+                    fec_encode(fecs[ff], data, sizes[ss], encoded, sizeof(encoded));
+                }
+                uint64_t t = now_ns() - start;
+                best_encode = t < best_encode ? t : best_encode;
+                start = now_ns();
+                for (int ii = 0; ii < BENCH_ITERATIONS; ii++)
+                {
+                    fec_decode(fecs[ff], encoded, encoded_size, decoded, sizeof(decoded), NULL, 0);
+                }
+                t = now_ns() - start;
+                best_decode = t < best_decode ? t : best_decode;
+                start = now_ns();
+                for (int ii = 0; ii < BENCH_ITERATIONS; ii++)
+                {
+                    fec_decode(fecs[ff], corrupted, encoded_size, decoded, sizeof(decoded), NULL, 0);
+                }
+                t = now_ns() - start;
+                best_decode_errors = t < best_decode_errors ? t : best_decode_errors;
+            }
+            printf("  %-7s %2zuB -> %2zuB: encode %6.1f, decode %6.1f, decode with 4 byte errors %6.1f\n",
+                   names[ff], sizes[ss], encoded_size, (double)best_encode / BENCH_ITERATIONS,
+                   (double)best_decode / BENCH_ITERATIONS, (double)best_decode_errors / BENCH_ITERATIONS);
+        }
+    }
+
+    printf("\npacket success rate on a binary symmetric channel (%d packets per point):\n", CHANNEL_PACKETS);
+    printf("     BER  nibble16    rs16  nibble28    rs28\n");
+    for (size_t bb = 0; bb < sizeof(bers) / sizeof(bers[0]); bb++)
+    {
+        printf("  %6.4f", bers[bb]);
+        for (int ss = 0; ss < 2; ss++)
+        {
+            for (int ff = 0; ff < 2; ff++)
+            {
+                int ok = 0;
+                for (int nn = 0; nn < CHANNEL_PACKETS; nn++)
+                {
+                    uint8_t data[64], encoded[128], decoded[64];
+                    for (size_t ii = 0; ii < sizes[ss]; ii++)
+                    {
+                        data[ii] = rng_next();
+                    }
+                    size_t encoded_size = fec_encode(fecs[ff], data, sizes[ss], encoded, sizeof(encoded));
+                    for (size_t ii = 0; ii < encoded_size * 8; ii++)
+                    {
+                        if (rng_uniform() < bers[bb])
+                        {
+                            encoded[ii / 8] ^= 1 << (ii % 8);
+                        }
+                    }
+                    fec_decode(fecs[ff], encoded, encoded_size, decoded, sizeof(decoded), NULL, 0);
+                    ok += memcmp(decoded, data, sizes[ss]) == 0;
+                }
+                printf("  %7.4f", (double)ok / CHANNEL_PACKETS);
+            }
+        }
+        printf("\n");
+    }
+    return 0;
+}
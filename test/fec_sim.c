@@ -0,0 +1,96 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "util/fec.h"
+
+// Packet loss of the FSK FEC schemes on a Gilbert-Elliott burst channel:
+// a two state Markov chain which spends 1% of the bits in a bad state
+// with a high BER. Not a test, build it with make test-tools.
+
+#define SIM_PACKETS 200000
+#define SIM_BAD_STATE_FRACTION 0.01
+#define SIM_GOOD_BER 1e-5
+#define SIM_BAD_BER 0.3
+
+static uint64_t rng_state = 88172645463325252ull;
+static bool channel_bad;
+static double channel_p_good_to_bad;
+static double channel_p_bad_to_good;
+
+static uint64_t rng_next(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static double rng_uniform(void)
+{
+    return (rng_next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static void channel_set_mean_burst(double bits)
+{
+    channel_p_bad_to_good = 1 / bits;
+    channel_p_good_to_bad = channel_p_bad_to_good * SIM_BAD_STATE_FRACTION / (1 - SIM_BAD_STATE_FRACTION);
+    channel_bad = false;
+}
+
+static void channel_transmit(uint8_t *data, size_t size)
+{
+    for (size_t ii = 0; ii < size * 8; ii++)
+    {
+        if (channel_bad)
+        {
+            channel_bad = rng_uniform() >= channel_p_bad_to_good;
+        }
+        else
+        {
+            channel_bad = rng_uniform() < channel_p_good_to_bad;
+        }
+        if (rng_uniform() < (channel_bad ? SIM_BAD_BER : SIM_GOOD_BER))
+        {
+            data[ii / 8] ^= 0x80 >> (ii % 8);
+        }
+    }
+}
+
+int main(void)
+{
+    static const fec_t nibble_interleaved = {.type = FEC_TYPE_NIBBLE, .interleaved = true};
+    static const fec_t rs = {.type = FEC_TYPE_REED_SOLOMON, .parity_bytes = 8};
+    const fec_t *fecs[] = {FEC_NIBBLE, &nibble_interleaved, &rs};
+
+    printf("packet loss, %d packets per point, bad state BER %.1f, good state BER %.0e\n",
+           SIM_PACKETS, SIM_BAD_BER, SIM_GOOD_BER);
+    for (size_t size = 16; size <= 28; size += 12)
+    {
+        printf("%zu byte packets   nibble  nibble+il    rs(8)\n", size);
+        for (double burst = 8; burst <= 64; burst *= 2)
+        {
+            channel_set_mean_burst(burst);
+            printf("  burst %2.0f bits", burst);
+            for (int ff = 0; ff < 3; ff++)
+            {
+                int lost = 0;
+                for (int nn = 0; nn < SIM_PACKETS; nn++)
+                {
+                    uint8_t data[32], encoded[64], decoded[32];
+                    for (size_t ii = 0; ii < size; ii++)
+                    {
+                        data[ii] = rng_next();
+                    }
+                    size_t encoded_size = fec_encode(fecs[ff], data, size, encoded, sizeof(encoded));
+                    channel_transmit(encoded, encoded_size);
+                    fec_decode(fecs[ff], encoded, encoded_size, decoded, sizeof(decoded), NULL, 0);
+                    lost += memcmp(decoded, data, size) != 0;
+                }
+                printf("   %7.4f", (double)lost / SIM_PACKETS);
+            }
+            printf("\n");
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,177 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util/fec.h"
+
+#include "test.h"
+
+static void fill_random(uint8_t *buf, size_t size)
+{
+    for (size_t ii = 0; ii < size; ii++)
+    {
+        buf[ii] = rand();
+    }
+}
+
+// Fills positions with count distinct random indexes below max
+static void random_positions(uint8_t *positions, size_t count, size_t max)
+{
+    for (size_t ii = 0; ii < count; ii++)
+    {
+        bool repeated;
+        do
+        {
+            positions[ii] = rand() % max;
+            repeated = false;
+            for (size_t jj = 0; jj < ii; jj++)
+            {
+                repeated |= positions[jj] == positions[ii];
+            }
+        } while (repeated);
+    }
+}
+
+static void test_nibble(void)
+{
+    uint8_t data[64];
+    uint8_t encoded[128];
+    uint8_t decoded[64];
+
+    TEST_CHECK(fec_encoded_size(FEC_NIBBLE, 16) == 32);
+    TEST_CHECK(fec_decoded_size(FEC_NIBBLE, 32) == 16);
+
+    // Every byte value, with every single bit error in each of its symbols
+    for (int value = 0; value < 256; value++)
+    {
+        data[0] = value;
+        TEST_CHECK(fec_encode(FEC_NIBBLE, data, 1, encoded, sizeof(encoded)) == 2);
+        for (int bit = -1; bit < 16; bit++)
+        {
+            uint8_t corrupted[2] = {encoded[0], encoded[1]};
+            if (bit >= 0)
+            {
+                corrupted[bit / 8] ^= 1 << (bit % 8);
+            }
+            TEST_CHECK(fec_decode(FEC_NIBBLE, corrupted, 2, decoded, sizeof(decoded), NULL, 0) == 1);
+            TEST_CHECK(decoded[0] == value);
+        }
+    }
+
+    // Output too small
+    TEST_CHECK(fec_encode(FEC_NIBBLE, data, 16, encoded, 31) == 0);
+    TEST_CHECK(fec_decode(FEC_NIBBLE, encoded, 32, decoded, 15, NULL, 0) == 0);
+}
+
+static void test_reed_solomon(void)
+{
+    uint8_t data[FEC_REED_SOLOMON_MAX_ENCODED_SIZE];
+    uint8_t encoded[FEC_REED_SOLOMON_MAX_ENCODED_SIZE];
+    uint8_t decoded[FEC_REED_SOLOMON_MAX_ENCODED_SIZE];
+    uint8_t positions[FEC_REED_SOLOMON_MAX_PARITY_BYTES];
+    static const uint8_t parity_bytes[] = {2, 4, 8, 16, FEC_REED_SOLOMON_MAX_PARITY_BYTES};
+
+    srand(1);
+    for (size_t pp = 0; pp < sizeof(parity_bytes) / sizeof(parity_bytes[0]); pp++)
+    {
+        fec_t fec = {.type = FEC_TYPE_REED_SOLOMON, .parity_bytes = parity_bytes[pp]};
+        for (int it = 0; it < 2000; it++)
+        {
+            size_t size = 1 + rand() % (FEC_REED_SOLOMON_MAX_ENCODED_SIZE - fec.parity_bytes);
+            size_t encoded_size = fec_encoded_size(&fec, size);
+            TEST_CHECK(encoded_size == size + fec.parity_bytes);
+            TEST_CHECK(fec_decoded_size(&fec, encoded_size) == size);
+            fill_random(data, size);
+            TEST_CHECK(fec_encode(&fec, data, size, encoded, sizeof(encoded)) == encoded_size);
+            // The code is systematic
+            TEST_CHECK(memcmp(encoded, data, size) == 0);
+
+            // Up to parity_bytes / 2 errors at unknown positions, or up
+            // to parity_bytes erasures, or any mix with
+            // 2 * errors + erasures <= parity_bytes.
+            size_t erasures = rand() % (fec.parity_bytes + 1);
+            size_t errors = (fec.parity_bytes - erasures) / 2;
+            random_positions(positions, erasures + errors, encoded_size);
+            for (size_t ii = 0; ii < erasures + errors; ii++)
+            {
+                // Erased bytes might also be right
+                encoded[positions[ii]] ^= ii < erasures ? rand() : 1 + rand() % 255;
+            }
+            memset(decoded, 0, sizeof(decoded));
+            TEST_CHECK(fec_decode(&fec, encoded, encoded_size, decoded, sizeof(decoded), positions, erasures) == size);
+            TEST_CHECK(memcmp(decoded, data, size) == 0);
+        }
+    }
+
+    // Too many errors are detected. With 8 parity bytes the chance of
+    // miscorrecting 5 random errors is well below 1 in 1000.
+    fec_t fec = {.type = FEC_TYPE_REED_SOLOMON, .parity_bytes = 8};
+    int failed = 0;
+    for (int it = 0; it < 1000; it++)
+    {
+        fill_random(data, 16);
+        fec_encode(&fec, data, 16, encoded, sizeof(encoded));
+        random_positions(positions, 5, 24);
+        for (int ii = 0; ii < 5; ii++)
+        {
+            encoded[positions[ii]] ^= 1 + rand() % 255;
+        }
+        failed += fec_decode(&fec, encoded, 24, decoded, sizeof(decoded), NULL, 0) == 0;
+    }
+    TEST_CHECK(failed >= 999);
+
+    // Output too small
+    TEST_CHECK(fec_encode(&fec, data, 16, encoded, 23) == 0);
+    TEST_CHECK(fec_decode(&fec, encoded, 24, decoded, 15, NULL, 0) == 0);
+}
+
+// A burst of up to encoded size bits flips at most one bit of each
+// symbol once interleaved, which the nibble code always corrects.
+static void test_interleaved(void)
+{
+    static const fec_t nibble = {.type = FEC_TYPE_NIBBLE, .interleaved = true};
+    static const fec_t rs = {.type = FEC_TYPE_REED_SOLOMON, .parity_bytes = 8, .interleaved = true};
+    uint8_t data[28];
+    uint8_t encoded[64];
+    uint8_t corrupted[64];
+    uint8_t decoded[28];
+    uint8_t plain[64];
+
+    for (size_t size = 1; size <= sizeof(data); size++)
+    {
+        fill_random(data, size);
+        size_t encoded_size = fec_encode(&nibble, data, size, encoded, sizeof(encoded));
+        TEST_CHECK(encoded_size == size * 2);
+        // Same bits as the plain code, in a different order
+        int bits = 0;
+        fec_encode(FEC_NIBBLE, data, size, plain, sizeof(plain));
+        for (size_t ii = 0; ii < encoded_size; ii++)
+        {
+            bits += __builtin_popcount(encoded[ii]) - __builtin_popcount(plain[ii]);
+        }
+        TEST_CHECK(bits == 0);
+        for (size_t start = 0; start < encoded_size * 8; start++)
+        {
+            memcpy(corrupted, encoded, encoded_size);
+            for (size_t ii = start; ii < start + encoded_size && ii < encoded_size * 8; ii++)
+            {
+                corrupted[ii / 8] ^= 0x80 >> (ii % 8);
+            }
+            TEST_CHECK(fec_decode(&nibble, corrupted, encoded_size, decoded, sizeof(decoded), NULL, 0) == size);
+            TEST_CHECK(memcmp(decoded, data, size) == 0);
+        }
+
+        encoded_size = fec_encode(&rs, data, size, encoded, sizeof(encoded));
+        TEST_CHECK(encoded_size == size + rs.parity_bytes);
+        TEST_CHECK(fec_decode(&rs, encoded, encoded_size, decoded, sizeof(decoded), NULL, 0) == size);
+        TEST_CHECK(memcmp(decoded, data, size) == 0);
+    }
+}
+
+int main(void)
+{
+    test_nibble();
+    test_reed_solomon();
+    test_interleaved();
+    return TEST_RESULT();
+}
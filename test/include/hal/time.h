@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stdint.h>
+
+// Virtual clock for the host tests, set by the tests themselves. Every
+// read advances it by 1us, so busy waits in the code under test end.
+extern uint64_t test_time_micros;
+
+static inline uint64_t hal_time_micros_now(void)
+{
+    return test_time_micros++;
+}
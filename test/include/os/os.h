@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdint.h>
+
+// Just enough of the FreeRTOS API for the host tests to build code which
+// doesn't really need a scheduler. Tasks are never started and the tick
+// count is derived from hal_time_micros_now(). There's a single task
+// taking notifications, see test/stubs.c.
+
+#include <hal/time.h>
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+typedef void *TaskHandle_t;
+
+#define pdFALSE 0
+#define pdTRUE 1
+#define portMAX_DELAY ((TickType_t)UINT32_MAX)
+#define portTICK_PERIOD_MS 1
+#define configMINIMAL_STACK_SIZE 1024
+#define configMAX_PRIORITIES 25
+
+#define IRAM_ATTR
+#define portYIELD_FROM_ISR_IF(x) ((void)(x))
+
+#define CREATE_TASK(handler, name, stack, params, prio, task, core) ((void)(handler))
+
+static inline TickType_t xTaskGetTickCount(void)
+{
+    return hal_time_micros_now() / 1000;
+}
+
+static inline void vTaskDelay(TickType_t ticks)
+{
+    test_time_micros += (uint64_t)ticks * portTICK_PERIOD_MS * 1000;
+}
+
+// Time at which an ISR notifies the task, UINT64_MAX if none. Blocking
+// in ulTaskNotifyTake() moves the clock to it.
+extern uint64_t test_notify_at;
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+void xTaskNotifyGive(TaskHandle_t task);
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken);
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks);
@@ -0,0 +1,12 @@
+#pragma once
+
+// The host tests don't build for any target. Features are enabled
+// per test in test/Makefile.
+
+#include <string.h>
+
+// glibc only has strlcpy() since 2.38, the libcs of the targets always
+// had it. See test/stubs.c.
+#if defined(__GLIBC__) && !__GLIBC_PREREQ(2, 38)
+size_t strlcpy(char *dst, const char *src, size_t size);
+#endif
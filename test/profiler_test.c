@@ -0,0 +1,125 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rc/rc_profiler.h"
+#include "util/profiler.h"
+
+#include "test.h"
+
+// Built with PROFILER_VIRTUAL_COUNTER, so the cycle counter only moves
+// when profiler_virtual_advance() is called.
+
+static int compare_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void test_stats(void)
+{
+    profiler_stats_t stats;
+    profiler_report_t report;
+
+    profiler_virtual_cycles_per_micro = 240;
+    profiler_stats_init(&stats);
+    TEST_CHECK(!profiler_stats_get_report(&stats, &report));
+
+    // 99 samples of 1000 cycles and one of 100000
+    for (int ii = 0; ii < 99; ii++)
+    {
+        profiler_stats_add(&stats, 1000);
+    }
+    profiler_stats_add(&stats, 100000);
+    TEST_CHECK(profiler_stats_get_report(&stats, &report));
+    TEST_CHECK(report.count == 100);
+    TEST_CHECK(report.min == 1000 * 1000 / 240);
+    TEST_CHECK(report.avg == (99 * 1000 + 100000) / 100 * 1000 / 240);
+    TEST_CHECK(report.max == 100000 * 1000 / 240);
+    TEST_CHECK(report.p99 >= report.min && report.p99 < 2 * report.min + 300);
+
+    // p99 never exceeds max
+    profiler_stats_init(&stats);
+    profiler_stats_add(&stats, 70);
+    profiler_stats_get_report(&stats, &report);
+    TEST_CHECK(report.p99 == report.max && report.min == report.max);
+
+    // Random samples: p99 is rounded up to the end of its bucket, so it's
+    // at least the exact value and less than twice it.
+    static uint32_t samples[10000];
+    uint64_t sum = 0;
+    profiler_stats_init(&stats);
+    srand(1);
+    for (int ii = 0; ii < 10000; ii++)
+    {
+        samples[ii] = 200 + rand() % 50000;
+        profiler_stats_add(&stats, samples[ii]);
+        sum += samples[ii];
+    }
+    qsort(samples, 10000, sizeof(samples[0]), compare_u32);
+    profiler_stats_get_report(&stats, &report);
+    uint32_t exact = samples[9899] * 1000 / 240;
+    TEST_CHECK(report.p99 >= exact && report.p99 <= 2 * exact + (1 << PROFILER_HISTOGRAM_SHIFT) * 1000 / 240);
+    TEST_CHECK(report.avg == (uint32_t)(sum / 10000 * 1000 / 240));
+
+    // Across the counter wrapping around
+    profiler_stats_init(&stats);
+    profiler_virtual_cycles = UINT32_MAX - 10;
+    profiler_cycles_t start = profiler_cycles_now();
+    profiler_virtual_advance(240);
+    TEST_CHECK(profiler_stats_add_since(&stats, start) == profiler_cycles_now());
+    TEST_CHECK(profiler_stats_get_report(&stats, &report) && report.max == 1000);
+}
+
+static void test_rc_profiler(void)
+{
+    rc_profiler_t profiler;
+    profiler_report_t report;
+
+    rc_profiler_init(&profiler);
+    rc_profiler_set_input(&profiler, RC_PROFILER_SLOT_INPUT_CRSF);
+    rc_profiler_set_output(&profiler, RC_PROFILER_SLOT_OUTPUT_AIR);
+    for (int ii = 0; ii < 10; ii++)
+    {
+        profiler_virtual_cycles = UINT32_MAX - 120 + ii;
+        rc_profiler_begin(&profiler);
+        profiler_virtual_advance(10);
+        rc_profiler_end_phase(&profiler, RC_PROFILER_SLOT_RECONFIGURE);
+        profiler_virtual_advance(100 * (ii + 1));
+        rc_profiler_end_phase(&profiler, RC_PROFILER_SLOT_INPUT);
+        // Not accounted to any phase, but to the whole update
+        profiler_virtual_advance(50);
+        rc_profiler_begin_phase(&profiler);
+        profiler_virtual_advance(200);
+        rc_profiler_end_phase(&profiler, RC_PROFILER_SLOT_OUTPUT);
+        rc_profiler_end(&profiler);
+    }
+    // 1 cycle = 1ns
+    profiler_virtual_cycles_per_micro = 1000;
+    TEST_CHECK(rc_profiler_get_report(&profiler, RC_PROFILER_SLOT_INPUT, &report));
+    TEST_CHECK(report.min == 100 && report.max == 1000 && report.avg == 550);
+    TEST_CHECK(rc_profiler_get_report(&profiler, RC_PROFILER_SLOT_INPUT_CRSF, &report));
+    TEST_CHECK(report.count == 10 && report.avg == 550);
+    TEST_CHECK(rc_profiler_get_report(&profiler, RC_PROFILER_SLOT_OUTPUT_AIR, &report));
+    TEST_CHECK(report.min == 200 && report.max == 200);
+    TEST_CHECK(rc_profiler_get_report(&profiler, RC_PROFILER_SLOT_UPDATE, &report));
+    TEST_CHECK(report.min == 360 && report.max == 1260 && report.avg == 810);
+    TEST_CHECK(rc_profiler_get_report(&profiler, RC_PROFILER_SLOT_RECONFIGURE, &report));
+    TEST_CHECK(report.avg == 10);
+    TEST_CHECK(!rc_profiler_get_report(&profiler, RC_PROFILER_SLOT_INPUT_SBUS, &report));
+    TEST_CHECK(!rc_profiler_get_report(&profiler, RC_PROFILER_SLOT_RSSI, &report));
+    TEST_CHECK(!rc_profiler_get_report(&profiler, RC_PROFILER_SLOT_COUNT, &report));
+    for (int ii = 0; ii < RC_PROFILER_SLOT_COUNT; ii++)
+    {
+        const char *name = rc_profiler_slot_name(ii);
+        TEST_CHECK(name && strlen(name) <= RC_PROFILER_SLOT_NAME_MAX_LENGTH);
+    }
+}
+
+int main(void)
+{
+    test_stats();
+    test_rc_profiler();
+    return TEST_RESULT();
+}
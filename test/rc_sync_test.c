@@ -0,0 +1,171 @@
+#include <math.h>
+#include <stdlib.h>
+
+#include "rc/rc_sync.h"
+
+#include "test.h"
+
+// Synthetic input frames and output packets, with the input clock
+// drifting relative to the output and both of them jittering.
+
+#define SYNC_SIM_DURATION_US 60000000
+#define SYNC_SIM_SETTLE_US 10000000
+#define SYNC_SIM_MAX_LAGS 20000
+// OpenTX aims for the frame to arrive this long before the packet
+#define SYNC_SIM_OPENTX_TARGET_LAG_US 800
+#define SYNC_SIM_OPENTX_SYNC_INTERVAL_US 200000
+
+typedef enum
+{
+    SYNC_SIM_INPUT_FIXED,  // Sends frames at its own interval
+    SYNC_SIM_INPUT_OPENTX, // Follows the timing from rc_sync_get_input_timing()
+} sync_sim_input_e;
+
+typedef struct
+{
+    int p50;
+    int p99;
+    unsigned nudges;
+    int max_nudge;
+    unsigned histogram_p99;
+} sync_sim_result_t;
+
+static int compare_int(const void *a, const void *b)
+{
+    return *(const int *)a - *(const int *)b;
+}
+
+static double jitter(double max)
+{
+    return (rand() / (double)RAND_MAX * 2 - 1) * max;
+}
+
+static void sync_sim_run(double input_interval, double drift_ppm, time_micros_t output_interval,
+                         sync_sim_input_e input, bool nudge, sync_sim_result_t *result)
+{
+    static int lags[SYNC_SIM_MAX_LAGS];
+    unsigned lag_count = 0;
+    rc_sync_t sync;
+    double input_at = 1000;
+    double output_at = 2000;
+    double input_scale = 1 + drift_ppm * 1e-6;
+    double next_sync = 0;
+
+    srand(1);
+    rc_sync_reset_input(&sync);
+    rc_sync_reset_output(&sync);
+    result->nudges = 0;
+    result->max_nudge = 0;
+    while (input_at < SYNC_SIM_DURATION_US || output_at < SYNC_SIM_DURATION_US)
+    {
+        if (input_at < output_at)
+        {
+            rc_sync_input_frame(&sync, input_at + jitter(20));
+            if (input == SYNC_SIM_INPUT_OPENTX && input_at >= next_sync)
+            {
+                float interval;
+                int32_t lag;
+                next_sync = input_at + SYNC_SIM_OPENTX_SYNC_INTERVAL_US;
+                if (rc_sync_get_input_timing(&sync, 4000, input_at, &interval, &lag))
+                {
+                    // Adopt the interval and move half way to the target lag
+                    double error = lag - SYNC_SIM_OPENTX_TARGET_LAG_US;
+                    if (error > interval / 2)
+                    {
+                        error -= interval;
+                    }
+                    input_interval = interval;
+                    input_at += error / 2;
+                }
+            }
+            input_at += input_interval * input_scale;
+            continue;
+        }
+        time_micros_t now = output_at;
+        int moved = rc_sync_output_packet(&sync, now, output_interval);
+        if (sync.lag >= 0 && now > SYNC_SIM_SETTLE_US && lag_count < SYNC_SIM_MAX_LAGS)
+        {
+            lags[lag_count++] = sync.lag;
+        }
+        if (moved != 0)
+        {
+            result->nudges++;
+            result->max_nudge = abs(moved) > result->max_nudge ? abs(moved) : result->max_nudge;
+        }
+        output_at = now + output_interval + (nudge ? moved : 0) + fabs(jitter(50));
+    }
+    qsort(lags, lag_count, sizeof(lags[0]), compare_int);
+    result->p50 = lags[lag_count / 2];
+    result->p99 = lags[lag_count * 99 / 100];
+    result->histogram_p99 = histogram_percentile(&sync.latency, 99);
+}
+
+static void test_input_timing(void)
+{
+    rc_sync_t sync;
+    float interval;
+    int32_t lag;
+
+    rc_sync_reset_input(&sync);
+    rc_sync_reset_output(&sync);
+    // Not sending yet
+    TEST_CHECK(!rc_sync_get_input_timing(&sync, 4000, 0, &interval, &lag));
+
+    for (int ii = 0; ii < 100; ii++)
+    {
+        rc_sync_input_frame(&sync, 1000 + ii * 4000);
+        if (ii % 2 == 1)
+        {
+            rc_sync_output_packet(&sync, 1300 + ii * 4000, 8000);
+        }
+    }
+    TEST_CHECK(rc_sync_get_input_timing(&sync, 4000, 400000, &interval, &lag));
+    // Half of the output interval, since it's >= the minimum
+    TEST_CHECK(fabsf(interval - 4000) < 1);
+    TEST_CHECK(lag == 300);
+    TEST_CHECK(rc_sync_get_input_timing(&sync, 6000, 400000, &interval, &lag));
+    TEST_CHECK(fabsf(interval - 8000) < 1);
+    // The output doesn't move while the input follows it
+    TEST_CHECK(rc_sync_output_packet(&sync, 402300, 8000) == 0);
+
+    // Stale input
+    TEST_CHECK(rc_sync_output_packet(&sync, 500000, 8000) == 0);
+    TEST_CHECK(sync.lag == -1);
+}
+
+static void test_latency(void)
+{
+    sync_sim_result_t before;
+    sync_sim_result_t after;
+
+    // CRSF at 4ms into 6.67ms and 8ms air cycles. Without sync the lag
+    // covers the whole frame interval.
+    sync_sim_run(4000, 30, 6667, SYNC_SIM_INPUT_FIXED, false, &before);
+    sync_sim_run(4000, 30, 6667, SYNC_SIM_INPUT_OPENTX, false, &after);
+    TEST_CHECK(before.p99 > 3500);
+    TEST_CHECK(after.p50 < 1000 && after.p99 < 1200);
+    TEST_CHECK(after.histogram_p99 < 1100);
+    sync_sim_run(4000, 30, 8000, SYNC_SIM_INPUT_OPENTX, false, &after);
+    TEST_CHECK(after.p50 < 1000 && after.p99 < 1200);
+
+    // Inputs without sync at compatible intervals, the output moves
+    // towards them in small steps
+    sync_sim_run(5000, 40, 10000, SYNC_SIM_INPUT_FIXED, false, &before);
+    sync_sim_run(5000, 40, 10000, SYNC_SIM_INPUT_FIXED, true, &after);
+    TEST_CHECK(before.p50 > 2000);
+    TEST_CHECK(after.p50 < 700 && after.p99 < 800);
+    TEST_CHECK(after.max_nudge <= 50);
+    sync_sim_run(20000, -60, 20000, SYNC_SIM_INPUT_FIXED, true, &after);
+    TEST_CHECK(after.p50 < 700 && after.p99 < 800);
+
+    // Incompatible intervals are left alone
+    sync_sim_run(7000, 40, 10000, SYNC_SIM_INPUT_FIXED, true, &after);
+    TEST_CHECK(after.nudges == 0);
+}
+
+int main(void)
+{
+    test_input_timing();
+    test_latency();
+    return TEST_RESULT();
+}
@@ -0,0 +1,292 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rc/rc_trace.h"
+#include "util/macros.h"
+
+#include "test.h"
+
+// Packets from seq 0 to seq 15, like in the simulation below
+#define TRACE_SEQ_COUNT 16
+
+static void set_values(uint16_t *values, uint16_t value)
+{
+    for (int ii = 0; ii < RC_TRACE_CHANNELS; ii++)
+    {
+        values[ii] = value + ii;
+    }
+}
+
+static void test_sampling(void)
+{
+    rc_trace_t tx;
+    rc_trace_t rx;
+    uint16_t values[RC_TRACE_CHANNELS];
+    rc_trace_entry_t entries[RC_TRACE_RING_SIZE];
+
+    rc_trace_init(&tx);
+    rc_trace_init(&rx);
+    set_values(values, 100);
+    // Changes without a previous input change aren't traced on the TX
+    rc_trace_air_tx(&tx, RC_TRACE_SAMPLE_SEQ, AIR_MODE_1, values, 1000);
+    TEST_CHECK(tx.count == 0);
+
+    // Only packets with RC_TRACE_SAMPLE_SEQ are traced
+    values[2] = 200;
+    rc_trace_channel_changed(&tx, 2, 1500);
+    rc_trace_air_tx(&tx, RC_TRACE_SAMPLE_SEQ + 1, AIR_MODE_1, values, 2000);
+    TEST_CHECK(tx.count == 0);
+    values[2] = 201;
+    rc_trace_channel_changed(&tx, 2, 2500);
+    rc_trace_channel_changed(&tx, 2, 2700);
+    rc_trace_air_tx(&tx, RC_TRACE_SAMPLE_SEQ, AIR_MODE_1, values, 3000);
+    TEST_CHECK(tx.count == 1);
+    TEST_CHECK(rc_trace_get_entries(&tx, entries, ARRAY_COUNT(entries)) == 1);
+    TEST_CHECK(entries[0].channel == 2);
+    TEST_CHECK(entries[0].value == 201);
+    TEST_CHECK(entries[0].mode == AIR_MODE_1);
+    // Timed from the last change before the packet
+    TEST_CHECK(entries[0].at[RC_TRACE_STAGE_INPUT] == 2700);
+    TEST_CHECK(entries[0].at[RC_TRACE_STAGE_AIR_TX] == 3000);
+    TEST_CHECK(entries[0].at[RC_TRACE_STAGE_AIR_RX] == 0);
+    // Nothing changed since the last packet
+    rc_trace_air_tx(&tx, RC_TRACE_SAMPLE_SEQ, AIR_MODE_1, values, 4000);
+    TEST_CHECK(tx.count == 1);
+
+    // The RX traces received changes and completes them on output
+    set_values(values, 100);
+    rc_trace_air_rx(&rx, RC_TRACE_SAMPLE_SEQ, AIR_MODE_1, values, 1000);
+    rc_trace_output(&rx, 1200);
+    values[2] = 201;
+    rc_trace_air_rx(&rx, RC_TRACE_SAMPLE_SEQ, AIR_MODE_1, values, 5000);
+    TEST_CHECK(rc_trace_get_entries(&rx, entries, ARRAY_COUNT(entries)) == 2);
+    TEST_CHECK(entries[1].at[RC_TRACE_STAGE_OUTPUT] == 0);
+    rc_trace_output(&rx, 5300);
+    // Only the first output after the packet counts
+    rc_trace_output(&rx, 5600);
+    TEST_CHECK(rc_trace_get_entries(&rx, entries, ARRAY_COUNT(entries)) == 2);
+    TEST_CHECK(entries[0].channel == 0 && entries[0].at[RC_TRACE_STAGE_OUTPUT] == 1200);
+    TEST_CHECK(entries[1].channel == 2 && entries[1].at[RC_TRACE_STAGE_OUTPUT] == 5300);
+
+    rc_trace_entry_t merged[RC_TRACE_RING_SIZE];
+    TEST_CHECK(rc_trace_merge(&tx, &rx, 0, merged, ARRAY_COUNT(merged)) == 1);
+    TEST_CHECK(merged[0].at[RC_TRACE_STAGE_INPUT] == 2700);
+    TEST_CHECK(merged[0].at[RC_TRACE_STAGE_AIR_TX] == 3000);
+    TEST_CHECK(merged[0].at[RC_TRACE_STAGE_AIR_RX] == 5000);
+    TEST_CHECK(merged[0].at[RC_TRACE_STAGE_OUTPUT] == 5300);
+    // Outside of the match window
+    TEST_CHECK(rc_trace_merge(&tx, &rx, -200000, merged, ARRAY_COUNT(merged)) == 0);
+}
+
+static void test_ring(void)
+{
+    rc_trace_t rx;
+    uint16_t values[RC_TRACE_CHANNELS];
+    rc_trace_entry_t entries[RC_TRACE_RING_SIZE];
+    rc_trace_stats_t stats;
+
+    rc_trace_init(&rx);
+    TEST_CHECK(!rc_trace_stats(&rx, AIR_MODE_2, RC_TRACE_STAGE_AIR_RX, RC_TRACE_STAGE_OUTPUT, &stats));
+    for (unsigned ii = 0; ii < RC_TRACE_RING_SIZE + 10; ii++)
+    {
+        set_values(values, ii + 1);
+        rc_trace_air_rx(&rx, RC_TRACE_SAMPLE_SEQ, AIR_MODE_2, values, 1000 + ii * 1000);
+        // The last entry is left pending
+        if (ii < RC_TRACE_RING_SIZE + 9)
+        {
+            rc_trace_output(&rx, 1000 + ii * 1000 + ii);
+        }
+    }
+    TEST_CHECK(rx.count == RC_TRACE_RING_SIZE);
+    TEST_CHECK(rc_trace_get_entries(&rx, entries, 4) == 4);
+    TEST_CHECK(rc_trace_get_entries(&rx, entries, ARRAY_COUNT(entries)) == RC_TRACE_RING_SIZE);
+    // Oldest entries were overwritten and the rest come in order
+    for (unsigned ii = 0; ii < RC_TRACE_RING_SIZE; ii++)
+    {
+        TEST_CHECK(entries[ii].value == ii + 11);
+    }
+    // Latencies 10 to 40, the pending one doesn't count
+    TEST_CHECK(rc_trace_stats(&rx, AIR_MODE_2, RC_TRACE_STAGE_AIR_RX, RC_TRACE_STAGE_OUTPUT, &stats));
+    TEST_CHECK(stats.count == RC_TRACE_RING_SIZE - 1);
+    TEST_CHECK(stats.p50 == 25);
+    TEST_CHECK(stats.p99 == 39);
+    TEST_CHECK(stats.max == 40);
+    TEST_CHECK(!rc_trace_stats(&rx, AIR_MODE_1, RC_TRACE_STAGE_AIR_RX, RC_TRACE_STAGE_OUTPUT, &stats));
+    TEST_CHECK(!rc_trace_stats(&rx, AIR_MODE_2, RC_TRACE_STAGE_INPUT, RC_TRACE_STAGE_OUTPUT, &stats));
+
+}
+
+// Both ends of the link back to back: a CRSF input with the sticks moving
+// continuously, packets lost at random and the RX output either sent
+// right away or limited to 50Hz like MSP. Ends are drained periodically,
+// like the debug commands do.
+
+#define TRACE_SIM_DURATION_US 120000000
+#define TRACE_SIM_CRSF_INTERVAL_US 4000
+#define TRACE_SIM_RX_DELAY_US 60
+#define TRACE_SIM_MAX_ENTRIES 4096
+
+typedef struct
+{
+    unsigned traced; // On the TX
+    unsigned matched;
+    uint32_t at_min[RC_TRACE_STAGE_COUNT];
+    uint32_t at_max[RC_TRACE_STAGE_COUNT];
+    rc_trace_stats_t total;
+} trace_sim_result_t;
+
+static const unsigned trace_sim_cycle_us[] = {0, 6670, 16700, 30700, 52400, 110300};
+static const unsigned trace_sim_toa_us[] = {0, 2400, 6900, 13600, 24300, 53000};
+
+static rc_trace_entry_t trace_sim_entries[TRACE_SIM_MAX_ENTRIES];
+
+static double rng_uniform(void)
+{
+    return rand() / (double)RAND_MAX;
+}
+
+static void trace_sim_collect(rc_trace_t *tx, rc_trace_t *rx, int32_t rx_offset, trace_sim_result_t *result)
+{
+    rc_trace_entry_t merged[RC_TRACE_RING_SIZE];
+    unsigned count = rc_trace_merge(tx, rx, rx_offset, merged, ARRAY_COUNT(merged));
+    for (unsigned ii = 0; ii < count && result->matched < TRACE_SIM_MAX_ENTRIES; ii++)
+    {
+        const rc_trace_entry_t *entry = &merged[ii];
+        for (int ss = 1; ss < RC_TRACE_STAGE_COUNT; ss++)
+        {
+            uint32_t value = entry->at[ss] - entry->at[ss - 1];
+            result->at_min[ss] = result->matched == 0 ? value : MIN(result->at_min[ss], value);
+            result->at_max[ss] = result->matched == 0 ? value : MAX(result->at_max[ss], value);
+        }
+        trace_sim_entries[result->matched++] = *entry;
+    }
+    result->traced += tx->count;
+    rc_trace_init(tx);
+    rc_trace_init(rx);
+}
+
+static void trace_sim_run(air_mode_e mode, unsigned output_interval, int32_t rx_offset, double loss, trace_sim_result_t *result)
+{
+    rc_trace_t tx;
+    rc_trace_t rx;
+    uint16_t channels[RC_TRACE_CHANNELS];
+    unsigned seq = 0;
+    double input_at = 1000;
+    double packet_at = 2500;
+    double output_at = -1;
+    double last_output_at = -1e9;
+    // Cross the 32 bit wrap of the entries
+    uint64_t base = 0xFFFF0000ull;
+
+    srand(mode * 7 + output_interval);
+    memset(result, 0, sizeof(*result));
+    rc_trace_init(&tx);
+    rc_trace_init(&rx);
+    set_values(channels, 992);
+    for (;;)
+    {
+        double next_output = output_at >= 0 ? fmax(output_at, last_output_at + output_interval) : INFINITY;
+        double now = fmin(fmin(input_at, packet_at), next_output);
+        if (now > TRACE_SIM_DURATION_US)
+        {
+            break;
+        }
+        if (now == input_at)
+        {
+            for (int ii = 0; ii < RC_TRACE_CHANNELS; ii++)
+            {
+                uint16_t value = 992 + 800 * sin(now / 1e6 * (0.7 + ii * 0.3));
+                if (value != channels[ii])
+                {
+                    channels[ii] = value;
+                    rc_trace_channel_changed(&tx, ii, base + now);
+                }
+            }
+            input_at += TRACE_SIM_CRSF_INTERVAL_US;
+        }
+        else if (now == packet_at)
+        {
+            // 10 bits per channel over the air
+            uint16_t air_values[RC_TRACE_CHANNELS];
+            for (int ii = 0; ii < RC_TRACE_CHANNELS; ii++)
+            {
+                air_values[ii] = ((channels[ii] - 172) * 1023) / (1811 - 172);
+            }
+            rc_trace_air_tx(&tx, seq, mode, air_values, base + now);
+            if (rng_uniform() >= loss)
+            {
+                double rx_at = now + trace_sim_toa_us[mode] + TRACE_SIM_RX_DELAY_US;
+                rc_trace_air_rx(&rx, seq, mode, air_values, base + rx_offset + rx_at);
+                // Processing before the channels reach the output
+                output_at = rx_at + 150 + rng_uniform() * 100;
+            }
+            seq = (seq + 1) % TRACE_SEQ_COUNT;
+            packet_at += trace_sim_cycle_us[mode] + rng_uniform() * 50;
+            if (tx.count >= RC_TRACE_RING_SIZE / 2 && seq == TRACE_SEQ_COUNT / 2)
+            {
+                trace_sim_collect(&tx, &rx, rx_offset, result);
+            }
+        }
+        else
+        {
+            rc_trace_output(&rx, base + rx_offset + now);
+            last_output_at = now;
+            output_at = -1;
+        }
+    }
+    trace_sim_collect(&tx, &rx, rx_offset, result);
+    rc_trace_entries_stats(trace_sim_entries, MIN(result->matched, RC_TRACE_RING_SIZE), mode,
+                           RC_TRACE_STAGE_INPUT, RC_TRACE_STAGE_OUTPUT, &result->total);
+}
+
+static void test_latency(void)
+{
+    trace_sim_result_t result;
+    trace_sim_result_t offset_result;
+
+    for (air_mode_e mode = AIR_MODE_1; mode <= AIR_MODE_5; mode++)
+    {
+        unsigned cycle = trace_sim_cycle_us[mode];
+        trace_sim_run(mode, 0, 0, 0.05, &result);
+        // One traced change every TRACE_SEQ_COUNT packets, the ~5% lost
+        // ones can't be matched
+        unsigned expected = TRACE_SIM_DURATION_US / (cycle * TRACE_SEQ_COUNT);
+        TEST_CHECK(result.traced > expected * 95 / 100 && result.traced <= expected + 1);
+        TEST_CHECK(result.matched <= result.traced && result.matched > result.traced * 85 / 100);
+        // Changes are at most one input interval old, unless the stick
+        // stopped at the end of its travel
+        TEST_CHECK(result.at_min[RC_TRACE_STAGE_AIR_TX] < TRACE_SIM_CRSF_INTERVAL_US);
+        TEST_CHECK(result.at_max[RC_TRACE_STAGE_AIR_TX] < 5 * cycle);
+        TEST_CHECK(result.at_min[RC_TRACE_STAGE_AIR_RX] == trace_sim_toa_us[mode] + TRACE_SIM_RX_DELAY_US);
+        TEST_CHECK(result.at_max[RC_TRACE_STAGE_AIR_RX] == trace_sim_toa_us[mode] + TRACE_SIM_RX_DELAY_US);
+        TEST_CHECK(result.at_min[RC_TRACE_STAGE_OUTPUT] >= 150 && result.at_max[RC_TRACE_STAGE_OUTPUT] <= 250);
+        TEST_CHECK(result.total.p50 > trace_sim_toa_us[mode] && result.total.p99 <= result.total.max);
+
+        // Limiting the output rate only delays the faster modes
+        trace_sim_run(mode, 20000, 0, 0.05, &result);
+        TEST_CHECK(result.at_min[RC_TRACE_STAGE_OUTPUT] >= 150);
+        TEST_CHECK(result.at_max[RC_TRACE_STAGE_OUTPUT] <= 20000);
+        if (cycle > 20000)
+        {
+            TEST_CHECK(result.at_max[RC_TRACE_STAGE_OUTPUT] <= 250);
+        }
+    }
+
+    // The RX clock offset doesn't change anything, even across the wrap
+    static const int32_t offsets[] = {123456789, -98765};
+    trace_sim_run(AIR_MODE_2, 0, 0, 0.05, &result);
+    for (unsigned ii = 0; ii < ARRAY_COUNT(offsets); ii++)
+    {
+        trace_sim_run(AIR_MODE_2, 0, offsets[ii], 0.05, &offset_result);
+        TEST_CHECK(memcmp(&result, &offset_result, sizeof(result)) == 0);
+    }
+}
+
+int main(void)
+{
+    test_sampling();
+    test_ring();
+    test_latency();
+    return TEST_RESULT();
+}
@@ -0,0 +1,120 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "util/ringbuffer.h"
+
+// Throughput of moving bytes through a ring buffer with the per byte API
+// versus the bulk and span APIs, in chunks of the sizes used by the air
+// stream and MSP. Not a test, build it with make test-tools.
+
+#define BENCH_CAPACITY 1024
+#define BENCH_BYTES (16 * 1024 * 1024)
+#define BENCH_REPEATS 5
+
+typedef RING_BUFFER_DECLARE(rb, uint8_t, BENCH_CAPACITY) bench_ring_buffer_t;
+
+typedef enum
+{
+    BENCH_BYTEWISE,
+    BENCH_BULK,
+    BENCH_SPANS,
+} bench_mode_e;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint32_t bench_run(bench_mode_e mode, size_t chunk)
+{
+    static bench_ring_buffer_t b;
+    ring_buffer_t *rb = &b.rb;
+    ring_buffer_span_t spans[RING_BUFFER_MAX_SPANS];
+    uint8_t in[512];
+    uint8_t out[512];
+    uint32_t sum = 0;
+
+    for (size_t ii = 0; ii < sizeof(in); ii++)
+    {
+        in[ii] = ii;
+    }
+    RING_BUFFER_INIT(rb, uint8_t, BENCH_CAPACITY);
+    // Start unaligned, so chunks wrap around
+    ring_buffer_push_n(rb, in, 3);
+    for (size_t done = 0; done < BENCH_BYTES; done += chunk)
+    {
+        switch (mode)
+        {
+        case BENCH_BYTEWISE:
+            for (size_t ii = 0; ii < chunk; ii++)
+            {
+                ring_buffer_push(rb, &in[ii]);
+            }
+            for (size_t ii = 0; ii < chunk; ii++)
+            {
+                ring_buffer_pop(rb, &out[ii]);
+            }
+            break;
+        case BENCH_BULK:
+            ring_buffer_push_n(rb, in, chunk);
+            ring_buffer_pop_n(rb, out, chunk);
+            break;
+        case BENCH_SPANS:
+        {
+            size_t ns = ring_buffer_reserve(rb, spans);
+            size_t n = 0;
+            for (size_t ss = 0; ss < ns && n < chunk; ss++)
+            {
+                size_t c = spans[ss].count < chunk - n ? spans[ss].count : chunk - n;
+                memcpy(spans[ss].ptr, in + n, c);
+                n += c;
+            }
+            ring_buffer_commit(rb, n);
+            ns = ring_buffer_peek_span(rb, spans);
+            n = 0;
+            for (size_t ss = 0; ss < ns && n < chunk; ss++)
+            {
+                size_t c = spans[ss].count < chunk - n ? spans[ss].count : chunk - n;
+                memcpy(out + n, spans[ss].ptr, c);
+                n += c;
+            }
+            ring_buffer_consume(rb, n);
+            break;
+        }
+        }
+        sum += out[chunk - 1];
+    }
+    return sum;
+}
+
+int main(void)
+{
+    static const char *names[] = {"bytewise", "bulk", "spans"};
+    static const size_t chunks[] = {1, 8, 32, 128, 512};
+    uint32_t sum = 0;
+
+    printf("MB/s through a %d byte buffer (best of %d):\n", BENCH_CAPACITY, BENCH_REPEATS);
+    for (size_t cc = 0; cc < sizeof(chunks) / sizeof(chunks[0]); cc++)
+    {
+        printf("chunk %3zu:", chunks[cc]);
+        for (bench_mode_e mode = BENCH_BYTEWISE; mode <= BENCH_SPANS; mode++)
+        {
+            uint64_t best = UINT64_MAX;
+            for (int rr = 0; rr < BENCH_REPEATS; rr++)
+            {
+                uint64_t start = now_ns();
+                sum += bench_run(mode, chunks[cc]);
+                uint64_t t = now_ns() - start;
+                best = t < best ? t : best;
+            }
+            printf(" %s %7.1f", names[mode], BENCH_BYTES * 1e3 / best);
+        }
+        printf("\n");
+    }
+    // Keep the copies from being optimized out
+    return sum == 0xffffffff;
+}
@@ -0,0 +1,240 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util/ringbuffer.h"
+
+#include "test.h"
+
+#define RB_CAPACITY 10
+
+typedef RING_BUFFER_DECLARE(rb, uint16_t, RB_CAPACITY) test_ring_buffer_t;
+
+static size_t spans_count(const ring_buffer_span_t *spans, size_t n)
+{
+    size_t count = 0;
+    for (size_t ii = 0; ii < n; ii++)
+    {
+        count += spans[ii].count;
+    }
+    return count;
+}
+
+static void test_single(void)
+{
+    test_ring_buffer_t b;
+    ring_buffer_t *rb = &b.rb;
+    uint16_t v;
+
+    RING_BUFFER_INIT(rb, uint16_t, RB_CAPACITY);
+    TEST_CHECK(!ring_buffer_pop(rb, &v));
+    for (uint16_t ii = 0; ii < RB_CAPACITY; ii++)
+    {
+        TEST_CHECK(ring_buffer_push(rb, &ii));
+    }
+    v = 100;
+    TEST_CHECK(!ring_buffer_push(rb, &v));
+    // Drops the oldest one
+    TEST_CHECK(ring_buffer_force_push(rb, &v));
+    TEST_CHECK(ring_buffer_count(rb) == RB_CAPACITY);
+    TEST_CHECK(ring_buffer_peek(rb, &v) && v == 1);
+    for (uint16_t ii = 1; ii < RB_CAPACITY; ii++)
+    {
+        TEST_CHECK(ring_buffer_pop(rb, &v) && v == ii);
+    }
+    TEST_CHECK(ring_buffer_pop(rb, &v) && v == 100);
+    TEST_CHECK(!ring_buffer_discard(rb));
+    ring_buffer_push(rb, &v);
+    ring_buffer_empty(rb);
+    TEST_CHECK(ring_buffer_count(rb) == 0 && ring_buffer_free(rb) == RB_CAPACITY);
+}
+
+static void test_bulk_wrap(void)
+{
+    test_ring_buffer_t b;
+    ring_buffer_t *rb = &b.rb;
+    uint16_t in[RB_CAPACITY + 1];
+    uint16_t out[RB_CAPACITY + 1];
+
+    for (int ii = 0; ii < RB_CAPACITY + 1; ii++)
+    {
+        in[ii] = 1000 + ii;
+    }
+    RING_BUFFER_INIT(rb, uint16_t, RB_CAPACITY);
+    // All or nothing
+    TEST_CHECK(!ring_buffer_push_n(rb, in, RB_CAPACITY + 1));
+    TEST_CHECK(ring_buffer_count(rb) == 0);
+    // Every start position, so every split of the data around the end
+    for (int start = 0; start < RB_CAPACITY; start++)
+    {
+        for (int n = 0; n <= RB_CAPACITY; n++)
+        {
+            ring_buffer_empty(rb);
+            TEST_CHECK(ring_buffer_push_n(rb, in, start));
+            TEST_CHECK(ring_buffer_pop_n(rb, NULL, start) == (size_t)start);
+            TEST_CHECK(ring_buffer_push_n(rb, in, n));
+            TEST_CHECK(ring_buffer_push_n(rb, in, RB_CAPACITY - n) && ring_buffer_free(rb) == 0);
+            TEST_CHECK(!ring_buffer_push_n(rb, in, 1));
+            memset(out, 0, sizeof(out));
+            TEST_CHECK(ring_buffer_pop_n(rb, out, n) == (size_t)n);
+            TEST_CHECK(memcmp(out, in, n * sizeof(in[0])) == 0);
+            // Asking for more than there is pops what's left
+            TEST_CHECK(ring_buffer_pop_n(rb, out, RB_CAPACITY + 1) == (size_t)(RB_CAPACITY - n));
+            TEST_CHECK(memcmp(out, in, (RB_CAPACITY - n) * sizeof(in[0])) == 0);
+            TEST_CHECK(ring_buffer_count(rb) == 0);
+        }
+    }
+}
+
+static void test_spans(void)
+{
+    test_ring_buffer_t b;
+    ring_buffer_t *rb = &b.rb;
+    ring_buffer_span_t spans[RING_BUFFER_MAX_SPANS];
+    uint16_t v;
+
+    RING_BUFFER_INIT(rb, uint16_t, RB_CAPACITY);
+    TEST_CHECK(ring_buffer_peek_span(rb, spans) == 0);
+    TEST_CHECK(ring_buffer_reserve(rb, spans) == 1);
+    TEST_CHECK(spans[0].ptr == rb->buffer && spans[0].count == RB_CAPACITY);
+
+    // Move head and tail to 7, free space wraps around the end
+    for (uint16_t ii = 0; ii < 7; ii++)
+    {
+        ring_buffer_push(rb, &ii);
+        ring_buffer_pop(rb, NULL);
+    }
+    TEST_CHECK(ring_buffer_reserve(rb, spans) == 2);
+    TEST_CHECK(spans[0].ptr == (uint16_t *)rb->buffer + 7 && spans[0].count == 3);
+    TEST_CHECK(spans[1].ptr == rb->buffer && spans[1].count == 7);
+    // Write 5 elements across the wrap point, commit 4
+    for (size_t ss = 0, n = 0; ss < 2; ss++)
+    {
+        for (size_t ii = 0; ii < spans[ss].count && n < 5; ii++, n++)
+        {
+            ((uint16_t *)spans[ss].ptr)[ii] = 200 + n;
+        }
+    }
+    ring_buffer_commit(rb, 4);
+    TEST_CHECK(ring_buffer_count(rb) == 4);
+
+    TEST_CHECK(ring_buffer_peek_span(rb, spans) == 2);
+    TEST_CHECK(spans[0].count == 3 && spans[1].count == 1);
+    TEST_CHECK(((uint16_t *)spans[0].ptr)[0] == 200 && ((uint16_t *)spans[1].ptr)[0] == 203);
+    // Reserving again only returns the free space, which no longer wraps
+    TEST_CHECK(ring_buffer_reserve(rb, spans) == 1);
+    TEST_CHECK(spans[0].ptr == (uint16_t *)rb->buffer + 1 && spans[0].count == RB_CAPACITY - 4);
+
+    // Consume within the first span, then across the wrap point
+    ring_buffer_consume(rb, 2);
+    TEST_CHECK(ring_buffer_peek_span(rb, spans) == 2);
+    TEST_CHECK(spans[0].count == 1 && spans[1].count == 1);
+    ring_buffer_consume(rb, 1);
+    TEST_CHECK(ring_buffer_peek(rb, &v) && v == 203);
+    TEST_CHECK(ring_buffer_peek_span(rb, spans) == 1 && spans[0].count == 1);
+    // Consuming past what was peeked stops at the data in the buffer
+    ring_buffer_consume(rb, 5);
+    TEST_CHECK(ring_buffer_count(rb) == 0);
+    TEST_CHECK(ring_buffer_peek_span(rb, spans) == 0);
+    v = 300;
+    TEST_CHECK(ring_buffer_push(rb, &v));
+    TEST_CHECK(ring_buffer_pop(rb, &v) && v == 300);
+
+    // Full buffer, nothing to reserve
+    while (ring_buffer_push(rb, &v))
+    {
+    }
+    TEST_CHECK(ring_buffer_reserve(rb, spans) == 0);
+    TEST_CHECK(spans_count(spans, ring_buffer_peek_span(rb, spans)) == RB_CAPACITY);
+}
+
+// Random operations against a simple model
+static void test_random(void)
+{
+    test_ring_buffer_t b;
+    ring_buffer_t *rb = &b.rb;
+    ring_buffer_span_t spans[RING_BUFFER_MAX_SPANS];
+    uint16_t model[RB_CAPACITY];
+    size_t model_count = 0;
+    uint16_t next = 0;
+    uint16_t buf[RB_CAPACITY + 2];
+
+    srand(1);
+    RING_BUFFER_INIT(rb, uint16_t, RB_CAPACITY);
+    for (int ii = 0; ii < 100000; ii++)
+    {
+        size_t n = rand() % (RB_CAPACITY + 2);
+        switch (rand() % 4)
+        {
+        case 0:
+            for (size_t jj = 0; jj < n; jj++)
+            {
+                buf[jj] = next + jj;
+            }
+            if (ring_buffer_push_n(rb, buf, n))
+            {
+                TEST_CHECK(model_count + n <= RB_CAPACITY);
+                for (size_t jj = 0; jj < n; jj++)
+                {
+                    model[model_count++] = next++;
+                }
+            }
+            else
+            {
+                TEST_CHECK(model_count + n > RB_CAPACITY);
+            }
+            break;
+        case 1:
+        {
+            size_t popped = ring_buffer_pop_n(rb, buf, n);
+            TEST_CHECK(popped == (n < model_count ? n : model_count));
+            TEST_CHECK(memcmp(buf, model, popped * sizeof(buf[0])) == 0);
+            memmove(model, model + popped, (model_count - popped) * sizeof(model[0]));
+            model_count -= popped;
+            break;
+        }
+        case 2:
+        {
+            size_t ns = ring_buffer_reserve(rb, spans);
+            TEST_CHECK(spans_count(spans, ns) == RB_CAPACITY - model_count);
+            size_t written = 0;
+            for (size_t ss = 0; ss < ns; ss++)
+            {
+                for (size_t jj = 0; jj < spans[ss].count && written < n; jj++, written++)
+                {
+                    ((uint16_t *)spans[ss].ptr)[jj] = next;
+                    model[model_count++] = next++;
+                }
+            }
+            ring_buffer_commit(rb, written);
+            break;
+        }
+        case 3:
+        {
+            size_t ns = ring_buffer_peek_span(rb, spans);
+            TEST_CHECK(spans_count(spans, ns) == model_count);
+            size_t pos = 0;
+            for (size_t ss = 0; ss < ns; ss++)
+            {
+                TEST_CHECK(memcmp(spans[ss].ptr, model + pos, spans[ss].count * sizeof(model[0])) == 0);
+                pos += spans[ss].count;
+            }
+            ring_buffer_consume(rb, n);
+            n = n < model_count ? n : model_count;
+            memmove(model, model + n, (model_count - n) * sizeof(model[0]));
+            model_count -= n;
+            break;
+        }
+        }
+        TEST_CHECK(ring_buffer_count(rb) == model_count);
+    }
+}
+
+int main(void)
+{
+    test_single();
+    test_bulk_wrap();
+    test_spans();
+    test_random();
+    return TEST_RESULT();
+}
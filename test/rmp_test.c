@@ -0,0 +1,217 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "config/config.h"
+#include "platform/system.h"
+#include "rmp/rmp.h"
+
+#include "test.h"
+
+// Pairing keys cached in the RMP peers: lookups for known peers must be
+// served from the cache, the cache must be reloaded when the pairings
+// change and peers must lose RMP_PEER_FLAG_CAN_AUTHENTICATE when their
+// pairing is removed. Two RMP instances talk through the RC transport
+// and share the config stub below, so each one verifies the signatures
+// of the other.
+
+#define RMP_TEST_PORT 0x50
+
+typedef struct
+{
+    air_pairing_t pairings[4];
+    unsigned pairings_count;
+    uint32_t generation;
+    unsigned lookups;
+} rmp_test_config_t;
+
+static rmp_test_config_t test_config;
+
+bool config_get_pairing(air_pairing_t *pairing, const air_addr_t *addr)
+{
+    test_config.lookups++;
+    for (unsigned ii = 0; ii < test_config.pairings_count; ii++)
+    {
+        if (air_addr_equals(&test_config.pairings[ii].addr, addr))
+        {
+            *pairing = test_config.pairings[ii];
+            return true;
+        }
+    }
+    return false;
+}
+
+uint32_t config_get_pairing_generation(void)
+{
+    return test_config.generation;
+}
+
+bool config_supports_air_band(air_band_e band)
+{
+    return true;
+}
+
+bool system_has_flag(system_flag_e flag)
+{
+    return false;
+}
+
+// Both ends of a pairing use the same key
+static void test_config_set_key(const air_addr_t *a, const air_addr_t *b, air_key_t key)
+{
+    test_config.pairings[0] = (air_pairing_t){.addr = *a, .key = key};
+    test_config.pairings[1] = (air_pairing_t){.addr = *b, .key = key};
+    test_config.pairings_count = 2;
+    test_config.generation++;
+}
+
+static void test_config_remove_keys(void)
+{
+    test_config.pairings_count = 0;
+    test_config.generation++;
+}
+
+typedef struct
+{
+    rmp_t rmp;
+    unsigned received;
+    unsigned authenticated;
+} rmp_test_node_t;
+
+static bool rmp_test_send(rmp_t *rmp, rmp_msg_t *msg, void *user_data)
+{
+    rmp_test_node_t *other = user_data;
+    rmp_process_message(&other->rmp, msg, RMP_TRANSPORT_RC);
+    return true;
+}
+
+static void rmp_test_handler(rmp_t *rmp, rmp_req_t *req, void *user_data)
+{
+    rmp_test_node_t *node = user_data;
+    node->received++;
+    if (req->is_authenticated)
+    {
+        node->authenticated++;
+    }
+}
+
+static const air_addr_t addr_a = {.addr = {0x10, 0x20, 0x30, 0x40, 0x50, 0x01}};
+static const air_addr_t addr_b = {.addr = {0x10, 0x20, 0x30, 0x40, 0x50, 0x02}};
+
+static void rmp_test_init(rmp_test_node_t *a, rmp_test_node_t *b)
+{
+    air_addr_t addr;
+    memset(&test_config, 0, sizeof(test_config));
+    memset(a, 0, sizeof(*a));
+    memset(b, 0, sizeof(*b));
+    addr = addr_a;
+    rmp_init(&a->rmp, &addr);
+    addr = addr_b;
+    rmp_init(&b->rmp, &addr);
+    rmp_set_transport(&a->rmp, RMP_TRANSPORT_RC, rmp_test_send, b);
+    rmp_set_transport(&b->rmp, RMP_TRANSPORT_RC, rmp_test_send, a);
+    TEST_CHECK(rmp_open_port(&a->rmp, RMP_TEST_PORT, rmp_test_handler, a) != NULL);
+    TEST_CHECK(rmp_open_port(&b->rmp, RMP_TEST_PORT, rmp_test_handler, b) != NULL);
+}
+
+static rmp_peer_flag_e rmp_test_peer_flags(rmp_test_node_t *node, const air_addr_t *addr)
+{
+    for (int ii = 0; ii < RMP_MAX_PEERS; ii++)
+    {
+        if (air_addr_equals(&node->rmp.internal.peers[ii].addr, addr))
+        {
+            return node->rmp.internal.peers[ii].flags;
+        }
+    }
+    return 0;
+}
+
+static void test_cache_hit(void)
+{
+    static rmp_test_node_t a, b;
+    unsigned hits, misses, reloads;
+    rmp_test_init(&a, &b);
+    test_config_set_key(&addr_a, &addr_b, 0x12345678);
+
+    // Unknown peer, the key comes from the config
+    uint8_t payload = 1;
+    TEST_CHECK(rmp_send(&a.rmp, NULL, &addr_b, RMP_TEST_PORT, &payload, sizeof(payload)));
+    rmp_get_key_cache_stats(&a.rmp, &hits, &misses, &reloads);
+    TEST_CHECK(hits == 0);
+    TEST_CHECK(misses == 1);
+    // b added a as a peer when verifying the signature
+    TEST_CHECK(b.received == 1 && b.authenticated == 1);
+    TEST_CHECK(rmp_can_authenticate_peer(&b.rmp, &addr_a));
+
+    // Once b replies, a knows it as a peer and doesn't check the config anymore
+    TEST_CHECK(rmp_send(&b.rmp, NULL, &addr_a, RMP_TEST_PORT, &payload, sizeof(payload)));
+    TEST_CHECK(a.received == 1 && a.authenticated == 1);
+    unsigned lookups = test_config.lookups;
+    for (int ii = 0; ii < 10; ii++)
+    {
+        TEST_CHECK(rmp_send(&a.rmp, NULL, &addr_b, RMP_TEST_PORT, &payload, sizeof(payload)));
+    }
+    TEST_CHECK(test_config.lookups == lookups);
+    TEST_CHECK(b.received == 11 && b.authenticated == 11);
+    rmp_get_key_cache_stats(&a.rmp, &hits, &misses, &reloads);
+    TEST_CHECK(hits == 1 + 10); // Verifying the reply, then sending
+    TEST_CHECK(misses == 1);
+}
+
+static void test_reload(void)
+{
+    static rmp_test_node_t a, b;
+    unsigned hits, misses, reloads, reloads_before;
+    uint8_t payload = 2;
+    rmp_test_init(&a, &b);
+    test_config_set_key(&addr_a, &addr_b, 0x12345678);
+    TEST_CHECK(rmp_send(&a.rmp, NULL, &addr_b, RMP_TEST_PORT, &payload, sizeof(payload)));
+    TEST_CHECK(rmp_send(&b.rmp, NULL, &addr_a, RMP_TEST_PORT, &payload, sizeof(payload)));
+    rmp_get_key_cache_stats(&a.rmp, NULL, NULL, &reloads_before);
+
+    // Pairing again changes the key, which must be reloaded from the
+    // config before signing.
+    test_config_set_key(&addr_a, &addr_b, 0x87654321);
+    unsigned lookups = test_config.lookups;
+    TEST_CHECK(rmp_send(&a.rmp, NULL, &addr_b, RMP_TEST_PORT, &payload, sizeof(payload)));
+    TEST_CHECK(test_config.lookups > lookups);
+    rmp_get_key_cache_stats(&a.rmp, &hits, &misses, &reloads);
+    TEST_CHECK(reloads == reloads_before + 1);
+    TEST_CHECK(b.received == 2 && b.authenticated == 2);
+
+    // No changes, no reloads
+    lookups = test_config.lookups;
+    TEST_CHECK(rmp_send(&a.rmp, NULL, &addr_b, RMP_TEST_PORT, &payload, sizeof(payload)));
+    TEST_CHECK(test_config.lookups == lookups);
+    rmp_get_key_cache_stats(&a.rmp, NULL, NULL, &reloads);
+    TEST_CHECK(reloads == reloads_before + 1);
+    TEST_CHECK(b.received == 3 && b.authenticated == 3);
+}
+
+static void test_pairing_removed(void)
+{
+    static rmp_test_node_t a, b;
+    uint8_t payload = 3;
+    rmp_test_init(&a, &b);
+    test_config_set_key(&addr_a, &addr_b, 0x12345678);
+    TEST_CHECK(rmp_send(&a.rmp, NULL, &addr_b, RMP_TEST_PORT, &payload, sizeof(payload)));
+    TEST_CHECK(rmp_send(&b.rmp, NULL, &addr_a, RMP_TEST_PORT, &payload, sizeof(payload)));
+    TEST_CHECK(rmp_can_authenticate_peer(&a.rmp, &addr_b));
+    TEST_CHECK(rmp_can_authenticate_peer(&b.rmp, &addr_a));
+    TEST_CHECK(rmp_test_peer_flags(&a, &addr_b) & RMP_PEER_FLAG_CAN_AUTHENTICATE);
+
+    test_config_remove_keys();
+    TEST_CHECK(!rmp_can_authenticate_peer(&a.rmp, &addr_b));
+    TEST_CHECK(!(rmp_test_peer_flags(&a, &addr_b) & RMP_PEER_FLAG_CAN_AUTHENTICATE));
+    TEST_CHECK(!rmp_can_authenticate_peer(&b.rmp, &addr_a));
+    // Messages are sent unsigned now
+    TEST_CHECK(rmp_send(&a.rmp, NULL, &addr_b, RMP_TEST_PORT, &payload, sizeof(payload)));
+    TEST_CHECK(b.received == 2 && b.authenticated == 1);
+}
+
+int main(void)
+{
+    test_cache_hit();
+    test_reload();
+    test_pairing_removed();
+    return TEST_RESULT();
+}
@@ -0,0 +1,217 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "util/spsc_queue.h"
+
+#include "test.h"
+
+#define STRESS_MESSAGES 200000
+#define STRESS_PRODUCERS 3
+
+static uint32_t msg_size(uint32_t seq)
+{
+    return 4 + (seq * 2654435761u >> 24) % 300;
+}
+
+static uint8_t msg_byte(uint32_t seq, uint32_t ii)
+{
+    return seq * 31 + ii * 7;
+}
+
+static void test_single_thread(void)
+{
+    static uint32_t buf[64 / 4];
+    spsc_queue_t q;
+    spsc_queue_stats_t stats;
+    uint8_t m[64] = {0};
+
+    spsc_queue_init(&q, buf, sizeof(buf));
+    TEST_CHECK(spsc_queue_pop(&q, m, sizeof(m)) == -1);
+    // Each message takes its size rounded up to 4 plus a 4 byte header
+    TEST_CHECK(spsc_queue_push(&q, m, 20));
+    TEST_CHECK(spsc_queue_push(&q, m, 20));
+    // Full: 16 bytes left
+    TEST_CHECK(!spsc_queue_push(&q, m, 20));
+    TEST_CHECK(spsc_queue_pop(&q, m, sizeof(m)) == 20);
+    // 16 bytes free at the end and 24 at the start, so it wraps
+    TEST_CHECK(spsc_queue_push(&q, m, 17));
+    TEST_CHECK(!spsc_queue_push(&q, m, 1));
+    // Oversized, never fits
+    TEST_CHECK(!spsc_queue_push(&q, m, 61));
+    TEST_CHECK(spsc_queue_pop(&q, m, sizeof(m)) == 20);
+    TEST_CHECK(spsc_queue_pop(&q, m, sizeof(m)) == 17);
+    TEST_CHECK(spsc_queue_pop(&q, m, sizeof(m)) == -1);
+    TEST_CHECK(spsc_queue_push(&q, m, 0));
+    TEST_CHECK(spsc_queue_pop(&q, m, 0) == 0);
+    // A message as big as the whole buffer only fits when it starts
+    // at its beginning.
+    TEST_CHECK(!spsc_queue_push(&q, m, 60));
+
+    spsc_queue_get_stats(&q, &stats);
+    TEST_CHECK(stats.pushed == 4);
+    TEST_CHECK(stats.dropped == 4);
+    TEST_CHECK(stats.max_depth == 2);
+    TEST_CHECK(stats.depth == 0);
+    TEST_CHECK(stats.used == 0);
+
+    spsc_queue_init(&q, buf, sizeof(buf));
+    TEST_CHECK(spsc_queue_push(&q, m, 60));
+    TEST_CHECK(spsc_queue_pop(&q, m, sizeof(m)) == 60);
+}
+
+static void test_order_and_wrap(void)
+{
+    static uint32_t buf[256 / 4];
+    spsc_queue_t q;
+    uint8_t m[64];
+    uint32_t next_push = 0;
+    uint32_t next_pop = 0;
+
+    spsc_queue_init(&q, buf, sizeof(buf));
+    // Odd sizes, so the messages end at every possible offset and the
+    // buffer wraps many times
+    for (int ii = 0; ii < 10000; ii++)
+    {
+        while (1)
+        {
+            uint32_t size = 4 + next_push % 37;
+            uint8_t *p = spsc_queue_reserve(&q, size);
+            if (!p)
+            {
+                break;
+            }
+            TEST_CHECK(((uintptr_t)p & 3) == 0);
+            memcpy(p, &next_push, 4);
+            memset(p + 4, next_push, size - 4);
+            spsc_queue_commit(&q);
+            next_push++;
+        }
+        // Leave some messages in the queue
+        for (int jj = 0; jj < 1 + ii % 3; jj++)
+        {
+            int size = spsc_queue_pop(&q, m, sizeof(m));
+            uint32_t seq;
+            memcpy(&seq, m, 4);
+            TEST_CHECK(size == (int)(4 + next_pop % 37));
+            TEST_CHECK(seq == next_pop);
+            TEST_CHECK(size < 5 || m[size - 1] == (uint8_t)next_pop);
+            next_pop++;
+        }
+    }
+    TEST_CHECK(next_pop > 1000);
+}
+
+typedef struct
+{
+    spsc_queue_t q;
+    uint32_t buf[2048 / 4];
+    uint32_t id;
+} stress_queue_t;
+
+static stress_queue_t stress_queues[STRESS_PRODUCERS];
+
+static void *stress_producer(void *arg)
+{
+    stress_queue_t *sq = arg;
+    uint8_t m[512];
+    for (uint32_t seq = 0; seq < STRESS_MESSAGES; seq++)
+    {
+        uint32_t size = msg_size(seq);
+        memcpy(m, &seq, 4);
+        for (uint32_t ii = 4; ii < size; ii++)
+        {
+            m[ii] = msg_byte(seq + sq->id, ii);
+        }
+        if (seq & 1)
+        {
+            while (!spsc_queue_push(&sq->q, m, size))
+            {
+                sched_yield();
+            }
+        }
+        else
+        {
+            void *p;
+            while (!(p = spsc_queue_reserve(&sq->q, size)))
+            {
+                sched_yield();
+            }
+            memcpy(p, m, size);
+            spsc_queue_commit(&sq->q);
+        }
+    }
+    return NULL;
+}
+
+// Several producers with a queue each and a single consumer draining
+// all of them, like the queues to the RC task.
+static void test_stress(void)
+{
+    pthread_t threads[STRESS_PRODUCERS];
+    uint32_t next[STRESS_PRODUCERS] = {0};
+    uint32_t done = 0;
+    int errors = 0;
+
+    for (int ii = 0; ii < STRESS_PRODUCERS; ii++)
+    {
+        stress_queues[ii].id = ii;
+        spsc_queue_init(&stress_queues[ii].q, stress_queues[ii].buf, sizeof(stress_queues[ii].buf));
+        pthread_create(&threads[ii], NULL, stress_producer, &stress_queues[ii]);
+    }
+    while (done < STRESS_PRODUCERS && errors == 0)
+    {
+        bool idle = true;
+        for (int ii = 0; ii < STRESS_PRODUCERS; ii++)
+        {
+            stress_queue_t *sq = &stress_queues[ii];
+            const uint8_t *p;
+            size_t size;
+            while (next[ii] < STRESS_MESSAGES && (p = spsc_queue_peek(&sq->q, &size)))
+            {
+                uint32_t seq;
+                memcpy(&seq, p, 4);
+                if (seq != next[ii] || size != msg_size(seq) || ((uintptr_t)p & 3) != 0)
+                {
+                    errors++;
+                }
+                for (uint32_t jj = 4; jj < size; jj++)
+                {
+                    if (p[jj] != msg_byte(seq + sq->id, jj))
+                    {
+                        errors++;
+                        break;
+                    }
+                }
+                spsc_queue_consume(&sq->q);
+                if (++next[ii] == STRESS_MESSAGES)
+                {
+                    done++;
+                }
+                idle = false;
+            }
+        }
+        if (idle)
+        {
+            sched_yield();
+        }
+    }
+    for (int ii = 0; ii < STRESS_PRODUCERS; ii++)
+    {
+        pthread_join(threads[ii], NULL);
+        spsc_queue_stats_t stats;
+        spsc_queue_get_stats(&stress_queues[ii].q, &stats);
+        TEST_CHECK(stats.pushed == STRESS_MESSAGES);
+        TEST_CHECK(stats.depth == 0);
+    }
+    TEST_CHECK(errors == 0);
+}
+
+int main(void)
+{
+    test_single_thread();
+    test_order_and_wrap();
+    test_stress();
+    return TEST_RESULT();
+}
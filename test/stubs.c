@@ -0,0 +1,145 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <hal/gpio.h>
+#include <hal/log.h>
+#include <hal/rand.h>
+#include <hal/spi.h>
+#include <hal/time.h>
+
+#include <os/os.h>
+
+uint64_t test_time_micros;
+uint64_t test_notify_at = UINT64_MAX;
+static uint32_t test_notifications;
+
+static void test_notify_if_due(void)
+{
+    if (test_notify_at <= test_time_micros)
+    {
+        test_notify_at = UINT64_MAX;
+        test_notifications++;
+    }
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    return &test_notifications;
+}
+
+void xTaskNotifyGive(TaskHandle_t task)
+{
+    test_notifications++;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken)
+{
+    test_notifications++;
+}
+
+// Blocking for N ticks wakes up at the Nth tick interrupt, or earlier if
+// the task is notified in the meantime.
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks)
+{
+    test_notify_if_due();
+    if (test_notifications == 0 && ticks > 0)
+    {
+        uint64_t wake = (test_time_micros / 1000 + ticks) * 1000;
+        test_time_micros = test_notify_at < wake ? test_notify_at : wake;
+        test_notify_if_due();
+    }
+    uint32_t value = test_notifications;
+    if (value > 0)
+    {
+        test_notifications = clear ? 0 : value - 1;
+    }
+    return value;
+}
+
+// Logs are only printed when TEST_LOG is set in the environment
+void log_printf(int level, const char *tag, const char *format, ...)
+{
+    if (getenv("TEST_LOG"))
+    {
+        va_list ap;
+        va_start(ap, format);
+        printf("[%s] ", tag);
+        vprintf(format, ap);
+        printf("\n");
+        va_end(ap);
+    }
+}
+
+void log_print_buffer_hex(int level, const char *tag, const void *buffer, size_t size)
+{
+}
+
+// Peripherals do nothing and read as zero
+
+hal_err_t hal_gpio_setup(hal_gpio_t gpio, hal_gpio_dir_t dir, hal_gpio_pull_t pull)
+{
+    return HAL_ERR_NONE;
+}
+
+hal_err_t hal_gpio_set_level(hal_gpio_t gpio, uint32_t level)
+{
+    return HAL_ERR_NONE;
+}
+
+int hal_gpio_set_isr(hal_gpio_t gpio, hal_gpio_intr_t intr, hal_gpio_isr_t isr, void *data)
+{
+    return HAL_ERR_NONE;
+}
+
+hal_err_t hal_spi_bus_init(hal_spi_bus_t bus, hal_gpio_t miso, hal_gpio_t mosi, hal_gpio_t sck)
+{
+    return HAL_ERR_NONE;
+}
+
+hal_err_t hal_spi_bus_add_device(hal_spi_bus_t bus, const hal_spi_device_config_t *cfg, hal_spi_device_handle_t *dev)
+{
+    return HAL_ERR_NONE;
+}
+
+// Tests can provide their own device on the bus
+__attribute__((weak)) hal_err_t hal_spi_device_transmit(const hal_spi_device_handle_t *dev, uint16_t cmd, uint32_t addr,
+                                                        const void *tx, size_t tx_size, void *rx, size_t rx_size)
+{
+    if (rx)
+    {
+        memset(rx, 0, rx_size ? rx_size : tx_size);
+    }
+    return HAL_ERR_NONE;
+}
+
+hal_err_t hal_spi_device_transmit_u8(const hal_spi_device_handle_t *dev, uint16_t cmd, uint32_t addr, uint8_t c, uint8_t *out)
+{
+    return hal_spi_device_transmit(dev, cmd, addr, &c, 1, out, 0);
+}
+
+// Overridden when the test links util/wakeup.c
+__attribute__((weak)) void wakeup_signal(void)
+{
+}
+
+#if defined(__GLIBC__) && !__GLIBC_PREREQ(2, 38)
+size_t strlcpy(char *dst, const char *src, size_t size)
+{
+    size_t len = strlen(src);
+    if (size > 0)
+    {
+        size_t n = len < size - 1 ? len : size - 1;
+        memcpy(dst, src, n);
+        dst[n] = '\0';
+    }
+    return len;
+}
+#endif
+
+// Deterministic, tests pick the sequence with srand()
+uint32_t hal_rand_u32(void)
+{
+    return rand();
+}
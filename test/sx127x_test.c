@@ -0,0 +1,460 @@
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <hal/time.h>
+
+#include "io/sx127x.h"
+#include "util/histogram.h"
+#include "util/macros.h"
+
+#include "test.h"
+
+#define SX127X_FXOSC 32000000
+#define SX127X_FSK_FREQ_STEP 61.03515625
+
+// Registers of a fake chip on the SPI bus. 0x0d-0x3f are banked
+// between FSK and LoRa, selected by bit 7 of RegOpMode.
+static uint8_t chip_regs[256];
+static uint8_t chip_banked_regs[2][256];
+
+static uint8_t *chip_reg(uint8_t addr)
+{
+    if (addr >= 0x0d && addr <= 0x3f)
+    {
+        return &chip_banked_regs[chip_regs[0x01] >> 7][addr];
+    }
+    return &chip_regs[addr];
+}
+
+static void chip_reset(void)
+{
+    memset(chip_regs, 0, sizeof(chip_regs));
+    memset(chip_banked_regs, 0, sizeof(chip_banked_regs));
+    chip_regs[0x01] = 0x01; // RegOpMode: standby
+    chip_regs[0x42] = 0x12; // RegVersion
+}
+
+// SPI traffic, each transaction sends the address byte and then the data
+static unsigned spi_transactions;
+static unsigned spi_bytes;
+
+hal_err_t hal_spi_device_transmit(const hal_spi_device_handle_t *dev, uint16_t cmd, uint32_t addr,
+                                  const void *tx, size_t tx_size, void *rx, size_t rx_size)
+{
+    spi_transactions++;
+    spi_bytes += 1 + tx_size;
+    const uint8_t *input = tx;
+    uint8_t *output = rx;
+    for (size_t ii = 0; ii < tx_size; ii++)
+    {
+        // Address 0 is the FIFO, which doesn't auto increment
+        uint8_t reg = addr == 0 ? 0 : addr + ii;
+        if (cmd)
+        {
+            *chip_reg(reg) = input[ii];
+        }
+        else if (output)
+        {
+            // RegIrqFlags1 in FSK mode only reports ModeReady
+            output[ii] = reg == 0x3e && !(chip_regs[0x01] & 0x80) ? 0x80 : *chip_reg(reg);
+        }
+    }
+    return HAL_ERR_NONE;
+}
+
+// sx127x_prepare_frequency() must give the same register values as the
+// conversions sx127x_set_frequency() used to do on every hop.
+static void test_prepare_frequency(void)
+{
+    unsigned long mismatches = 0;
+
+    // Every frequency the chips can tune to, against the FSK and the
+    // LoRa conversions
+    for (unsigned long freq = 137000000; freq <= 1020000000; freq++)
+    {
+        sx127x_freq_t f;
+        sx127x_prepare_frequency(&f, freq, 0);
+        uint32_t fsk = (uint32_t)(freq / SX127X_FSK_FREQ_STEP);
+        uint32_t lora = ((uint64_t)freq << 19) / SX127X_FXOSC;
+        if (f.freq != freq || f.frf != fsk || f.frf != lora || f.ppm_correction != 0)
+        {
+            mismatches++;
+        }
+    }
+    TEST_CHECK(mismatches == 0);
+
+    // Frequency errors, including the ppm correction
+    srand(1);
+    for (int ii = 0; ii < 10000000; ii++)
+    {
+        unsigned long freq = 137000000 + (unsigned long)rand() % 883000000;
+        int error = rand() % 200001 - 100000;
+        sx127x_freq_t f;
+        sx127x_prepare_frequency(&f, freq, error);
+        unsigned long corrected = freq - error;
+        int8_t ppm = CONSTRAIN_TO_I8(lrintf(0.95f * (error / ((float)corrected / 1000000))));
+        if (f.freq != corrected || f.frf != ((uint64_t)corrected << 19) / SX127X_FXOSC || f.ppm_correction != ppm)
+        {
+            mismatches++;
+        }
+    }
+    TEST_CHECK(mismatches == 0);
+}
+
+// Reference times from the LoRa modem formula in the SX1276 datasheet
+// (section 4.1.1.7), the one used by the Semtech LoRa calculator, with
+// LowDataRateOptimize off since the driver never enables it.
+static const struct
+{
+    int sf;
+    sx127x_lora_signal_bw_e bw;
+    sx127x_lora_coding_rate_e coding_rate;
+    long preamble_length;
+    sx127x_lora_header_e header;
+    bool crc;
+    size_t size;
+    time_micros_t us;
+} lora_time_on_air[] = {
+    {6, SX127X_LORA_SIGNAL_BW_500, SX127X_LORA_CODING_RATE_4_5, 6, SX127X_LORA_HEADER_IMPLICIT, false, 1, 2336},
+    {7, SX127X_LORA_SIGNAL_BW_500, SX127X_LORA_CODING_RATE_4_5, 6, SX127X_LORA_HEADER_IMPLICIT, false, 0, 4672},
+    {7, SX127X_LORA_SIGNAL_BW_500, SX127X_LORA_CODING_RATE_4_6, 6, SX127X_LORA_HEADER_IMPLICIT, false, 6, 6208},
+    {7, SX127X_LORA_SIGNAL_BW_500, SX127X_LORA_CODING_RATE_4_6, 6, SX127X_LORA_HEADER_IMPLICIT, false, 9, 7744},
+    {7, SX127X_LORA_SIGNAL_BW_500, SX127X_LORA_CODING_RATE_4_6, 6, SX127X_LORA_HEADER_IMPLICIT, false, 32, 18496},
+    {7, SX127X_LORA_SIGNAL_BW_250, SX127X_LORA_CODING_RATE_4_5, 8, SX127X_LORA_HEADER_EXPLICIT, true, 10, 20608},
+    {8, SX127X_LORA_SIGNAL_BW_500, SX127X_LORA_CODING_RATE_4_6, 6, SX127X_LORA_HEADER_IMPLICIT, false, 7, 12416},
+    {8, SX127X_LORA_SIGNAL_BW_500, SX127X_LORA_CODING_RATE_4_6, 6, SX127X_LORA_HEADER_IMPLICIT, false, 11, 15488},
+    {8, SX127X_LORA_SIGNAL_BW_250, SX127X_LORA_CODING_RATE_4_7, 12, SX127X_LORA_HEADER_EXPLICIT, true, 4, 39168},
+    {9, SX127X_LORA_SIGNAL_BW_500, SX127X_LORA_CODING_RATE_4_6, 6, SX127X_LORA_HEADER_IMPLICIT, false, 8, 24832},
+    {9, SX127X_LORA_SIGNAL_BW_250, SX127X_LORA_CODING_RATE_4_5, 8, SX127X_LORA_HEADER_EXPLICIT, true, 51, 164352},
+    {10, SX127X_LORA_SIGNAL_BW_500, SX127X_LORA_CODING_RATE_4_8, 6, SX127X_LORA_HEADER_IMPLICIT, false, 9, 53760},
+    {12, SX127X_LORA_SIGNAL_BW_250, SX127X_LORA_CODING_RATE_4_5, 8, SX127X_LORA_HEADER_EXPLICIT, true, 20, 659456},
+    {12, SX127X_LORA_SIGNAL_BW_250, SX127X_LORA_CODING_RATE_4_8, 6, SX127X_LORA_HEADER_IMPLICIT, false, 8, 430080},
+};
+
+// FSK packets are the preamble, 4 sync word bytes and the FEC encoded
+// payload, which the chip sends Manchester encoded.
+static const struct
+{
+    unsigned long bps;
+    unsigned preamble_length;
+    bool reed_solomon;
+    size_t size;
+    time_micros_t us;
+} fsk_time_on_air[] = {
+    {200000, 5, false, 16, 2920},
+    {200000, 5, false, 28, 4840},
+    {200000, 5, true, 16, 2280},
+    {200000, 5, true, 28, 3240},
+    {50000, 3, false, 10, 7520},
+    {4800, 5, true, 40, 175000},
+};
+
+static void test_time_on_air(void)
+{
+    static const fec_t reed_solomon = {.type = FEC_TYPE_REED_SOLOMON, .parity_bytes = 8};
+
+    for (unsigned ii = 0; ii < ARRAY_COUNT(lora_time_on_air); ii++)
+    {
+        time_micros_t us = sx127x_lora_time_on_air(lora_time_on_air[ii].sf, lora_time_on_air[ii].bw,
+                                                   lora_time_on_air[ii].coding_rate, lora_time_on_air[ii].preamble_length,
+                                                   lora_time_on_air[ii].header, lora_time_on_air[ii].crc,
+                                                   lora_time_on_air[ii].size);
+        TEST_CHECK(us == lora_time_on_air[ii].us);
+    }
+    for (unsigned ii = 0; ii < ARRAY_COUNT(fsk_time_on_air); ii++)
+    {
+        const fec_t *fec = fsk_time_on_air[ii].reed_solomon ? &reed_solomon : FEC_NIBBLE;
+        time_micros_t us = sx127x_fsk_time_on_air(fsk_time_on_air[ii].bps, fsk_time_on_air[ii].preamble_length,
+                                                  fec, fsk_time_on_air[ii].size);
+        TEST_CHECK(us == fsk_time_on_air[ii].us);
+    }
+}
+
+static sx127x_t sx127x = {
+    .output_type = SX127X_OUTPUT_PA_BOOST,
+    .txen = HAL_GPIO_NONE,
+    .rxen = HAL_GPIO_NONE,
+};
+// Same sequences as air_radio_set_mode() for AIR_MODE_1 and the LoRa modes
+static void apply_fsk_mode(sx127x_t *s)
+{
+    sx127x_sleep(s);
+    sx127x_set_op_mode(s, SX127X_OP_MODE_FSK);
+    sx127x_set_fsk_fdev(s, 125000);
+    sx127x_set_fsk_bitrate(s, 200000);
+    sx127x_set_fsk_rx_bandwidth(s, 250000);
+    sx127x_set_fsk_rx_afc_bandwidth(s, 250000);
+    sx127x_set_fsk_preamble_length(s, 5);
+}
+
+static void apply_lora_mode(sx127x_t *s, int sf)
+{
+    sx127x_sleep(s);
+    sx127x_set_op_mode(s, SX127X_OP_MODE_LORA);
+    sx127x_set_lora_signal_bw(s, SX127X_LORA_SIGNAL_BW_500);
+    sx127x_set_lora_header_mode(s, SX127X_LORA_HEADER_IMPLICIT);
+    sx127x_set_lora_crc(s, false);
+    sx127x_set_lora_preamble_length(s, 6);
+    sx127x_set_lora_spreading_factor(s, sf);
+    sx127x_set_lora_coding_rate(s, SX127X_LORA_CODING_RATE_4_6);
+}
+
+// A TX side cycle like output_air.c: hop, send the uplink packet, then
+// switch to RX and read the downlink one.
+static void hop_tx_rx(sx127x_t *s, const sx127x_freq_t *hop)
+{
+    uint8_t buf[32] = {0};
+    sx127x_set_prepared_frequency(s, hop);
+    sx127x_send(s, buf, 10);
+    sx127x_sleep(s);
+    sx127x_set_payload_size(s, 13);
+    sx127x_enable_continous_rx(s);
+    sx127x_read(s, buf, 13);
+}
+
+// Every register in the shadow copy, once flushed, must match the chip
+static bool regs_match_chip(sx127x_t *s)
+{
+    for (int ii = 0; ii < SX127X_NUM_REGS; ii++)
+    {
+        bool valid = s->state.regs.valid[ii / 8] & (1 << (ii % 8));
+        bool dirty = s->state.regs.dirty[ii / 8] & (1 << (ii % 8));
+        if (valid && !dirty && s->state.regs.values[ii] != *chip_reg(ii))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool modem_regs_valid(sx127x_t *s)
+{
+    for (int ii = 0x0d; ii <= 0x3f; ii++)
+    {
+        if (s->state.regs.valid[ii / 8] & (1 << (ii % 8)))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void spi_traffic_start(void)
+{
+    spi_transactions = 0;
+    spi_bytes = 0;
+}
+
+// Assumes a 9 MHz clock and about 2us of overhead per transaction
+static void spi_traffic_print(const char *name)
+{
+    unsigned us = (spi_bytes * 8 + 8) / 9 + 2 * spi_transactions;
+    printf("  %-28s %3u txn / %3u bytes / %3u us\n", name, spi_transactions, spi_bytes, us);
+}
+
+// SPI transactions and bytes for the usual sequences. Registers are
+// only written when they change, and the ones banked per modem are
+// forgotten on FSK/LoRa switches.
+static void test_spi_traffic(void)
+{
+    static sx127x_t s = {
+        .output_type = SX127X_OUTPUT_PA_BOOST,
+        .txen = HAL_GPIO_NONE,
+        .rxen = HAL_GPIO_NONE,
+    };
+    sx127x_freq_t hops[2];
+    sx127x_prepare_frequency(&hops[0], 868100000, 0);
+    sx127x_prepare_frequency(&hops[1], 869300000, 0);
+
+    chip_reset();
+    sx127x_init(&s);
+    printf("SPI traffic:\n");
+
+    apply_lora_mode(&s, 7);
+    hop_tx_rx(&s, &hops[0]);
+    TEST_CHECK(regs_match_chip(&s));
+    sx127x_sleep(&s);
+    spi_traffic_start();
+    apply_lora_mode(&s, 7);
+    spi_traffic_print("mode re-applied (LoRa SF7)");
+    TEST_CHECK(spi_transactions == 0);
+
+    spi_traffic_start();
+    apply_lora_mode(&s, 8);
+    spi_traffic_print("mode switch SF7 -> SF8");
+    TEST_CHECK(spi_transactions == 1);
+    TEST_CHECK(regs_match_chip(&s));
+
+    spi_traffic_start();
+    hop_tx_rx(&s, &hops[1]);
+    spi_traffic_print("LoRa hop + TX + RX");
+    TEST_CHECK(regs_match_chip(&s));
+
+    // The LoRa values of the banked registers must not be reused in FSK
+    TEST_CHECK(modem_regs_valid(&s));
+    sx127x_sleep(&s);
+    sx127x_set_op_mode(&s, SX127X_OP_MODE_FSK);
+    TEST_CHECK(regs_match_chip(&s));
+    sx127x_set_op_mode(&s, SX127X_OP_MODE_LORA);
+    TEST_CHECK(regs_match_chip(&s));
+
+    spi_traffic_start();
+    apply_fsk_mode(&s);
+    spi_traffic_print("mode switch LoRa -> FSK");
+    TEST_CHECK(regs_match_chip(&s));
+
+    spi_traffic_start();
+    apply_fsk_mode(&s);
+    spi_traffic_print("mode re-applied (FSK)");
+    TEST_CHECK(spi_transactions == 0);
+
+    spi_traffic_start();
+    hop_tx_rx(&s, &hops[0]);
+    spi_traffic_print("FSK hop + TX + RX");
+    TEST_CHECK(regs_match_chip(&s));
+
+    spi_traffic_start();
+    apply_lora_mode(&s, 7);
+    spi_traffic_print("mode switch FSK -> LoRa");
+    TEST_CHECK(regs_match_chip(&s));
+}
+
+static int rx_callbacks;
+static int tx_callbacks;
+
+static void count_callbacks(air_radio_t *radio, air_radio_callback_reason_e reason, void *data)
+{
+    if (reason == AIR_RADIO_CALLBACK_REASON_RX_DONE)
+    {
+        rx_callbacks++;
+    }
+    else
+    {
+        tx_callbacks++;
+    }
+}
+
+// Events injected with sx127x_queue_event(), like the DIO0 ISR does
+static void test_events(void)
+{
+    chip_reset();
+    sx127x_init(&sx127x);
+    sx127x_set_op_mode(&sx127x, SX127X_OP_MODE_LORA);
+    sx127x_set_callback(&sx127x, count_callbacks, NULL);
+    sx127x_enable_continous_rx(&sx127x);
+
+    // Known ISR to handler latencies. Packets are timestamped when the
+    // event is queued, not when it's processed.
+    static const unsigned latencies[] = {0, 1, 3, 40, 40, 100, 250, 1000, 70000};
+    for (unsigned ii = 0; ii < ARRAY_COUNT(latencies); ii++)
+    {
+        time_micros_t at = 1000000 + ii * 100000;
+        test_time_micros = at;
+        sx127x_queue_event(&sx127x, at);
+        test_time_micros += latencies[ii];
+        sx127x_process_events(&sx127x);
+        TEST_CHECK(sx127x_is_rx_done(&sx127x));
+        TEST_CHECK(sx127x_rx_done_at(&sx127x) == at);
+    }
+    const histogram_t *latency = sx127x_event_latency(&sx127x);
+    TEST_CHECK(latency->count == ARRAY_COUNT(latencies));
+    TEST_CHECK(rx_callbacks == ARRAY_COUNT(latencies) && tx_callbacks == 0);
+    TEST_CHECK(latency->buckets[0] == 1 && latency->buckets[1] == 1 && latency->buckets[2] == 1);
+    TEST_CHECK(latency->buckets[6] == 2 && latency->buckets[7] == 1 && latency->buckets[8] == 1);
+    TEST_CHECK(latency->buckets[10] == 1 && latency->buckets[15] == 1);
+    TEST_CHECK(latency->max == 70000);
+    TEST_CHECK(histogram_percentile(latency, 50) == 63);
+
+    // The ring holds SX127X_EVENT_RING_SIZE - 1 events, the rest are dropped
+    for (int ii = 0; ii < 20; ii++)
+    {
+        sx127x_queue_event(&sx127x, test_time_micros);
+    }
+    TEST_CHECK(sx127x_dropped_events(&sx127x) == 20 - (SX127X_EVENT_RING_SIZE - 1));
+    sx127x_process_events(&sx127x);
+    TEST_CHECK(rx_callbacks == ARRAY_COUNT(latencies) + SX127X_EVENT_RING_SIZE - 1);
+
+    // Events keep the trigger they were queued with, even if it changes
+    // before they're processed
+    uint8_t buf[4] = {0};
+    sx127x_send(&sx127x, buf, sizeof(buf));
+    time_micros_t sent_at = test_time_micros + 500;
+    sx127x_queue_event(&sx127x, sent_at);
+    sx127x_enable_continous_rx(&sx127x);
+    sx127x_process_events(&sx127x);
+    TEST_CHECK(tx_callbacks == 1 && sx127x_tx_done_at(&sx127x) == sent_at);
+}
+
+#define EVENTS_STRESS_COUNT 200000
+
+static volatile int events_producer_done;
+
+static void *events_producer(void *arg)
+{
+    for (time_micros_t at = 1; at <= EVENTS_STRESS_COUNT;)
+    {
+        unsigned dropped = sx127x_dropped_events(&sx127x);
+        sx127x_queue_event(&sx127x, at);
+        if (sx127x_dropped_events(&sx127x) == dropped)
+        {
+            at++;
+        }
+        else
+        {
+            sched_yield();
+        }
+    }
+    __atomic_store_n(&events_producer_done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static time_micros_t events_expected;
+static int events_out_of_order;
+
+static void check_event_order(air_radio_t *radio, air_radio_callback_reason_e reason, void *data)
+{
+    if (sx127x_rx_done_at(&sx127x) != events_expected)
+    {
+        events_out_of_order++;
+    }
+    events_expected = sx127x_rx_done_at(&sx127x) + 1;
+}
+
+// The ISR and the callback task on different threads: every event must
+// be processed once and in order.
+static void test_events_concurrent(void)
+{
+    pthread_t producer;
+
+    sx127x_enable_continous_rx(&sx127x);
+    sx127x_set_callback(&sx127x, check_event_order, NULL);
+    events_expected = 1;
+    pthread_create(&producer, NULL, events_producer, NULL);
+    while (1)
+    {
+        int done = __atomic_load_n(&events_producer_done, __ATOMIC_ACQUIRE);
+        sx127x_process_events(&sx127x);
+        if (done && events_expected == EVENTS_STRESS_COUNT + 1)
+        {
+            break;
+        }
+        sched_yield();
+    }
+    pthread_join(producer, NULL);
+    TEST_CHECK(events_out_of_order == 0);
+}
+
+int main(void)
+{
+    test_prepare_frequency();
+    test_time_on_air();
+    test_spi_traffic();
+    test_events();
+    test_events_concurrent();
+    return TEST_RESULT();
+}
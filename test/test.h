@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdio.h>
+
+// Minimal helpers for the host tests. Each test is a standalone program
+// which returns non-zero if any check failed.
+
+static int test_failures;
+
+#define TEST_CHECK(x)                                                     \
+    do                                                                    \
+    {                                                                     \
+        if (!(x))                                                         \
+        {                                                                 \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #x); \
+            test_failures++;                                              \
+        }                                                                 \
+    } while (0)
+
+#define TEST_RESULT()                                                \
+    ({                                                               \
+        printf("%s: %s\n", __FILE__, test_failures ? "FAIL" : "OK"); \
+        test_failures != 0;                                          \
+    })
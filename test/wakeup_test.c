@@ -0,0 +1,119 @@
+#include <stdint.h>
+
+#include <os/os.h>
+
+#include "util/wakeup.h"
+
+#include "test.h"
+
+// The clock only moves when it's read or when the task blocks, so
+// every wait can be checked to the microsecond.
+
+static void test_deadlines(void)
+{
+    wakeup_stats_t stats;
+
+    test_time_micros = 100;
+    wakeup_init();
+
+    // Blocks for the whole ticks and spins for the rest
+    TEST_CHECK(!wakeup_wait_until(5600));
+    TEST_CHECK(test_time_micros >= 5600 && test_time_micros <= 5602);
+    wakeup_get_stats(&stats);
+    TEST_CHECK(stats.deadlines == 1 && stats.events == 0);
+    TEST_CHECK(stats.blocked >= 4800 && stats.blocked <= 4900);
+    TEST_CHECK(stats.spinning >= 590 && stats.spinning <= 600);
+
+    // Less than a tick away, only spins
+    TEST_CHECK(!wakeup_wait_until(test_time_micros + 700));
+    wakeup_get_stats(&stats);
+    TEST_CHECK(stats.deadlines == 2 && stats.blocked <= 4900);
+
+    // Already expired
+    uint64_t now = test_time_micros;
+    TEST_CHECK(!wakeup_wait_until(now - 10));
+    TEST_CHECK(test_time_micros <= now + 2);
+
+    TEST_CHECK(wakeup_idle_percentage() >= 70);
+}
+
+static void test_events(void)
+{
+    wakeup_stats_t stats;
+
+    test_time_micros = 1000000;
+    wakeup_init();
+
+    // An event while blocked ends the wait when it happens
+    test_notify_at = 1002345;
+    TEST_CHECK(wakeup_wait_until(1010000));
+    TEST_CHECK(test_time_micros >= 1002345 && test_time_micros <= 1002347);
+
+    // An event while spinning
+    uint64_t event_at = test_time_micros + 300;
+    test_notify_at = event_at;
+    TEST_CHECK(wakeup_wait_until(event_at + 200));
+    TEST_CHECK(test_time_micros >= event_at && test_time_micros <= event_at + 2);
+
+    // Signaled before waiting, returns right away
+    uint64_t now = test_time_micros;
+    wakeup_signal();
+    TEST_CHECK(wakeup_wait_until(now + 10000));
+    TEST_CHECK(test_time_micros <= now + 2);
+
+    // Signaled with the deadline expired
+    wakeup_signal();
+    TEST_CHECK(wakeup_wait_until(0));
+    TEST_CHECK(!wakeup_wait_until(0));
+
+    wakeup_get_stats(&stats);
+    TEST_CHECK(stats.events == 4 && stats.deadlines == 1);
+}
+
+// The air output sends a packet every cycle while serial frames wake the
+// task up in between. Packets must go out at the same time as with a
+// busy loop polling the deadline.
+static void test_packet_timing(void)
+{
+    const uint64_t cycle = 6666;
+    const uint64_t frame_interval = 4000;
+    uint64_t next_packet = 10000;
+    uint64_t next_frame = 10500;
+    uint64_t max_late = 0;
+    unsigned packets = 0;
+
+    test_time_micros = 0;
+    test_notify_at = next_frame;
+    wakeup_init();
+    while (packets < 1000)
+    {
+        bool event = wakeup_wait_until(next_packet);
+        uint64_t now = hal_time_micros_now();
+        if (event)
+        {
+            // Serial frame, schedule the next one
+            next_frame += frame_interval;
+            test_notify_at = next_frame;
+        }
+        if (now >= next_packet)
+        {
+            max_late = now - next_packet > max_late ? now - next_packet : max_late;
+            next_packet += cycle;
+            packets++;
+        }
+        // Time taken by rc_update()
+        test_time_micros += 20;
+    }
+    // The only delay is reading the clock, plus one rc_update() if a
+    // frame arrives right before the packet is due
+    TEST_CHECK(max_late <= 25);
+    TEST_CHECK(wakeup_idle_percentage() >= 80);
+}
+
+int main(void)
+{
+    test_deadlines();
+    test_events();
+    test_packet_timing();
+    return TEST_RESULT();
+}